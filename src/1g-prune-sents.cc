@@ -19,6 +19,8 @@ int main(int argc, char* argv[]) {
       ('s', "stop-list=STRING", "arg", "", "Text file containing subwords that should not be removed")
       ('t', "temp-vocabs=INT", "arg", "0", "Write out intermediate vocabularies for #V mod INT == 0")
       ('f', "forward-backward", "", "", "Use Forward-backward segmentation instead of Viterbi")
+      ('b', "stream-buffer=INT", "arg", "0", "Stream the corpus from the file on each pass with a buffer of INT megabytes, DEFAULT: 0 (read all to memory)")
+      ('j', "threads=INT", "arg", "1", "Number of threads, DEFAULT: 1")
       ('8', "utf-8", "", "", "Utf-8 character encoding in use");
     config.default_parse(argc, argv);
     if (config.arguments.size() != 3) config.print_help(stderr, 1);
@@ -34,6 +36,8 @@ int main(int argc, char* argv[]) {
     unsigned int temp_vocab_interval = config["temp-vocabs"].get_int();
     bool enable_forward_backward = config["forward-backward"].specified;
     bool utf8_encoding = config["utf-8"].specified;
+    int num_threads = config["threads"].get_int();
+    unsigned int stream_buffer = config["stream-buffer"].get_int();
 
     set<string> stoplist;
     if (config["stop-list"].specified) {
@@ -58,12 +62,15 @@ int main(int argc, char* argv[]) {
         cerr << "parameters, write temp vocabularies: NO" << endl;
     cerr << "parameters, use forward-backward: " << enable_forward_backward << endl;
     cerr << "parameters, utf-8 encoding: " << utf8_encoding << endl;
+    cerr << "parameters, threads: " << num_threads << endl;
+    cerr << "parameters, corpus stream buffer (MB): " << stream_buffer << endl;
 
     int maxlen;
     set<string> short_factors;
     map<string, flt_type> vocab;
-    map<string, flt_type> freqs;
     vector<string> sents;
+    vector<flt_type> sent_counts;
+    Corpus *corpus = NULL;
 
     cerr << "Reading vocabulary " << vocab_fname << endl;
     int retval = Unigrams::read_vocab(vocab_fname, vocab, maxlen, utf8_encoding);
@@ -75,22 +82,37 @@ int main(int argc, char* argv[]) {
     cerr << "\t" << "maximum string length: " << maxlen << endl;
     find_short_factors(vocab, short_factors, min_removal_length, utf8_encoding);
 
-    cerr << "Reading training corpus " << corpus_fname << endl;
-    retval = Unigrams::read_sents(corpus_fname, sents);
-    if (retval < 0) {
-        cerr << "something went wrong reading training corpus" << endl;
-        exit(EXIT_FAILURE);
+    if (stream_buffer > 0) {
+        // Half of the buffer for the chunk being segmented, half for the one being read
+        cerr << "Streaming training corpus " << corpus_fname << endl;
+        corpus = new StreamingCorpus(corpus_fname, (unsigned long int)stream_buffer*1024*1024/2);
+    }
+    else {
+        cerr << "Reading training corpus " << corpus_fname << endl;
+        retval = Unigrams::read_sents(corpus_fname, sents, sent_counts);
+        if (retval < 0) {
+            cerr << "something went wrong reading training corpus" << endl;
+            exit(EXIT_FAILURE);
+        }
+        cerr << "\t" << "number of sentences in corpus: " << retval << endl;
+        cerr << "\t" << "number of distinct sentences: " << sents.size() << endl;
+        corpus = new MemoryCorpus(sents, sent_counts);
     }
-    cerr << "\t" << "number of sentences in corpus: " << sents.size() << endl;
 
     Unigrams ug;
-    if (enable_forward_backward)
+    if (enable_forward_backward) {
         ug.set_segmentation_method(forward_backward);
-    else
+        ug.set_ranking_method(forward_backward);
+    }
+    else {
         ug.set_segmentation_method(viterbi);
+        ug.set_ranking_method(viterbi);
+    }
     ug.set_utf8(utf8_encoding);
+    ug.set_threads(num_threads);
 
-    flt_type cost = ug.resegment_sents(sents, vocab, freqs);
+    UnigramModel model(vocab, utf8_encoding);
+    flt_type cost = ug.resegment_sents(*corpus, model.vocab, model.counts);
     cerr << "Initial likelihood: " << cost << endl;
 
     cerr << endl << "Removing factors by likelihood based pruning" << endl;
@@ -99,55 +121,63 @@ int main(int argc, char* argv[]) {
 
         cerr << "iteration " << itern << endl;
         cerr << "collecting candidate factors" << endl;
+        model.get_vocab(vocab);
         set<string> candidates;
         ug.init_candidates(vocab, candidates, n_candidates_per_iter, stoplist, min_removal_length);
 
         cerr << "ranking candidate factors (" << candidates.size() << ")" << endl;
         vector<pair<string, flt_type> > removal_scores;
-        cost = ug.rank_candidates(sents, vocab, candidates, freqs, removal_scores);
+        cost = ug.rank_candidates(*corpus, model, candidates, removal_scores);
 
         cerr << "initial likelihood before removing factors: " << cost << endl;
 
         // Remove factors one by one
         unsigned int n_removals = 0;
+        unsigned int n_counted = model.counted_size();
         for (unsigned int i=0; i<removal_scores.size(); i++) {
 
             if (removal_scores[i].first.length() == 1) continue;
             // Score most probably went to zero already
-            if (vocab.find(removal_scores[i].first) == vocab.end()) continue;
-            if (freqs.find(removal_scores[i].first) == freqs.end()) continue;
+            int factor = model.vocab.factor_index(removal_scores[i].first);
+            if (factor < 0) continue;
+            if (model.counts[factor] == MIN_FLOAT) continue;
 
-            vocab.erase(removal_scores[i].first);
-            freqs.erase(removal_scores[i].first);
+            model.remove(factor);
+            n_counted--;
             n_removals++;
 
-            if (temp_vocab_interval > 0 && freqs.size() % temp_vocab_interval == 0) {
-                vocab = freqs;
-                Unigrams::freqs_to_logprobs(vocab);
+            if (temp_vocab_interval > 0 && n_counted % temp_vocab_interval == 0) {
+                model.update_costs();
+                model.get_vocab(vocab);
                 ostringstream vocabfname;
                 vocabfname << "iteration_" << itern << "_" << vocab.size() << ".vocab";
                 Unigrams::write_vocab(vocabfname.str(), vocab);
             }
 
             if (n_removals >= removals_per_iter) break;
-            if (vocab.size() <= target_vocab_size) break;
+            if (model.size() <= target_vocab_size) break;
         }
 
-        cost = ug.iterate(sents, vocab, 1);
-        assert_factors(vocab, short_factors, short_factor_min_lp);
+        cost = ug.iterate(*corpus, model, 1);
+        model.assert_factors(short_factors, short_factor_min_lp);
 
         cerr << "factors removed in this iteration: " << n_removals << endl;
-        cerr << "current vocabulary size: " << vocab.size() << endl;
+        cerr << "current vocabulary size: " << model.size() << endl;
         cerr << "likelihood after the removals: " << cost << endl;
 
+        // Drop the removed factors from the letter tree
+        if (model.needs_compacting()) model.compact();
+
         itern++;
 
-        if (vocab.size() <= target_vocab_size) {
+        if (model.size() <= target_vocab_size) {
             cerr << "stopping by min_vocab_size." << endl;
             break;
         }
     }
 
+    model.get_vocab(vocab);
     Unigrams::write_vocab(out_vocab_fname, vocab);
+    delete corpus;
     exit(EXIT_SUCCESS);
 }
@@ -20,6 +20,8 @@ int main(int argc, char* argv[]) {
       ('s', "stop-list=STRING", "arg", "", "Text file containing subwords that should not be removed")
       ('t', "temp-vocabs=INT", "arg", "0", "Write out intermediate vocabularies for #V mod INT == 0")
       ('f', "forward-backward", "", "", "Use Forward-backward segmentation instead of Viterbi")
+      ('p', "prefix", "", "", "Continue the segmentation of each word from the prefix shared with the previous word")
+      ('j', "threads=INT", "arg", "1", "Number of threads, DEFAULT: 1")
       ('8', "utf-8", "", "", "Utf-8 character encoding in use");
     config.default_parse(argc, argv);
     if (config.arguments.size() != 3) config.print_help(stderr, 1);
@@ -34,7 +36,9 @@ int main(int argc, char* argv[]) {
     unsigned int target_vocab_size = config["vocab-size"].get_int();
     unsigned int temp_vocab_interval = config["temp-vocabs"].get_int();
     bool enable_forward_backward = config["forward-backward"].specified;
+    bool enable_prefix = config["prefix"].specified;
     bool utf8_encoding = config["utf-8"].specified;
+    int num_threads = config["threads"].get_int();
 
     set<string> stoplist;
     if (config["stop-list"].specified) {
@@ -58,12 +62,13 @@ int main(int argc, char* argv[]) {
     else
         cerr << "parameters, write temp vocabularies: NO" << endl;
     cerr << "parameters, use forward-backward: " << enable_forward_backward << endl;
+    cerr << "parameters, continue from shared prefix: " << enable_prefix << endl;
     cerr << "parameters, utf-8 encoding: " << utf8_encoding << endl;
+    cerr << "parameters, threads: " << num_threads << endl;
 
     int maxlen, word_maxlen;
     set<string> short_subwords;
     map<string, flt_type> vocab;
-    map<string, flt_type> freqs;
     map<string, flt_type> words;
 
     cerr << "Reading vocabulary " << vocab_fname << endl;
@@ -92,13 +97,21 @@ int main(int argc, char* argv[]) {
     cerr << "\t" << "maximum word length: " << word_maxlen << endl;
 
     Unigrams ug;
-    if (enable_forward_backward)
-        ug.set_segmentation_method(forward_backward);
-    else
-        ug.set_segmentation_method(viterbi);
+    if (enable_forward_backward) {
+        if (enable_prefix) ug.set_segmentation_method(forward_backward_incremental);
+        else ug.set_segmentation_method(forward_backward);
+        ug.set_ranking_method(forward_backward);
+    }
+    else {
+        if (enable_prefix) ug.set_segmentation_method(viterbi_incremental);
+        else ug.set_segmentation_method(viterbi);
+        ug.set_ranking_method(viterbi);
+    }
     ug.set_utf8(utf8_encoding);
+    ug.set_threads(num_threads);
 
-    flt_type cost = ug.resegment_words(words, vocab, freqs);
+    UnigramModel model(vocab, utf8_encoding);
+    flt_type cost = ug.resegment_words(words, model.vocab, model.counts);
     cerr << endl << "Initial likelihood: " << cost << endl;
 
     cerr << endl << "Removing subwords by likelihood based pruning" << endl;
@@ -107,6 +120,7 @@ int main(int argc, char* argv[]) {
 
         cerr << "iteration " << itern << endl;
         cerr << "collecting candidate subwords" << endl;
+        model.get_vocab(vocab);
         set<string> candidates;
         ug.init_candidates_by_usage(words, vocab, candidates, n_candidates_per_iter/3, stoplist, min_removal_length);
         ug.init_candidates_by_random(vocab, candidates, (n_candidates_per_iter-candidates.size())/4, stoplist, min_removal_length);
@@ -114,50 +128,56 @@ int main(int argc, char* argv[]) {
 
         cerr << "ranking candidate subwords (" << candidates.size() << ")" << endl;
         vector<pair<string, flt_type> > removal_scores;
-        cost = ug.rank_candidates(words, vocab, candidates, freqs, removal_scores);
+        cost = ug.rank_candidates(words, model, candidates, removal_scores);
 
         cerr << "initial likelihood before removing subwords: " << cost << endl;
 
         // Remove subwords one by one
         unsigned int n_removals = 0;
+        unsigned int n_counted = model.counted_size();
         for (unsigned int i=0; i<removal_scores.size(); i++) {
 
             if (removal_scores[i].first.length() == 1) continue;
             // Score most probably went to zero already
-            if (vocab.find(removal_scores[i].first) == vocab.end()) continue;
-            if (freqs.find(removal_scores[i].first) == freqs.end()) continue;
+            int factor = model.vocab.factor_index(removal_scores[i].first);
+            if (factor < 0) continue;
+            if (model.counts[factor] == MIN_FLOAT) continue;
 
-            vocab.erase(removal_scores[i].first);
-            freqs.erase(removal_scores[i].first);
+            model.remove(factor);
+            n_counted--;
             n_removals++;
 
-            if (temp_vocab_interval > 0 && freqs.size() % temp_vocab_interval == 0) {
-                vocab = freqs;
-                Unigrams::freqs_to_logprobs(vocab);
+            if (temp_vocab_interval > 0 && n_counted % temp_vocab_interval == 0) {
+                model.update_costs();
+                model.get_vocab(vocab);
                 ostringstream vocabfname;
                 vocabfname << "iteration_" << itern << "_" << vocab.size() << ".vocab";
                 Unigrams::write_vocab(vocabfname.str(), vocab);
             }
 
             if (n_removals >= removals_per_iter) break;
-            if (vocab.size() <= target_vocab_size) break;
+            if (model.size() <= target_vocab_size) break;
         }
 
-        cost = ug.iterate(words, vocab, 1);
-        assert_factors(vocab, stoplist, subword_min_lp);
+        cost = ug.iterate(words, model, 1);
+        model.assert_factors(stoplist, subword_min_lp);
 
         cerr << "subwords removed in this iteration: " << n_removals << endl;
-        cerr << "current vocabulary size: " << vocab.size() << endl;
+        cerr << "current vocabulary size: " << model.size() << endl;
         cerr << "likelihood after the removals: " << cost << endl;
 
+        // Drop the removed factors from the letter tree
+        if (model.needs_compacting()) model.compact();
+
         itern++;
 
-        if (vocab.size() <= target_vocab_size) {
+        if (model.size() <= target_vocab_size) {
             cerr << "stopping by min_vocab_size." << endl;
             break;
         }
     }
 
+    model.get_vocab(vocab);
     Unigrams::write_vocab(out_vocab_fname, vocab);
     exit(EXIT_SUCCESS);
 }
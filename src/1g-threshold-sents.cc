@@ -17,6 +17,8 @@ int main(int argc, char* argv[]) {
       ('v', "vocab-size=INT", "arg must", "", "Target vocabulary size")
       ('s', "stop-list=STRING", "arg", "", "Text file containing subwords that should not be removed")
       ('f', "forward-backward", "", "", "Use Forward-backward segmentation instead of Viterbi")
+      ('b', "stream-buffer=INT", "arg", "0", "Stream the corpus from the file on each pass with a buffer of INT megabytes, DEFAULT: 0 (read all to memory)")
+      ('j', "threads=INT", "arg", "1", "Number of threads, DEFAULT: 1")
       ('8', "utf-8", "", "", "Utf-8 character encoding in use");
     config.default_parse(argc, argv);
     if (config.arguments.size() != 3) config.print_help(stderr, 1);
@@ -30,6 +32,8 @@ int main(int argc, char* argv[]) {
     unsigned int target_vocab_size = config["vocab-size"].get_int();
     bool enable_forward_backward = config["forward-backward"].specified;
     bool utf8_encoding = config["utf-8"].specified;
+    int num_threads = config["threads"].get_int();
+    unsigned int stream_buffer = config["stream-buffer"].get_int();
 
     set<string> stoplist;
     if (config["stop-list"].specified) {
@@ -49,12 +53,15 @@ int main(int argc, char* argv[]) {
     cerr << "parameters, target vocab size: " << target_vocab_size << endl;
     cerr << "parameters, use forward-backward: " << enable_forward_backward << endl;
     cerr << "parameters, utf-8 encoding: " << utf8_encoding << endl;
+    cerr << "parameters, threads: " << num_threads << endl;
+    cerr << "parameters, corpus stream buffer (MB): " << stream_buffer << endl;
 
     int maxlen;
     set<string> short_factors;
     map<string, flt_type> vocab;
-    map<string, flt_type> freqs;
     vector<string> sents;
+    vector<flt_type> sent_counts;
+    Corpus *corpus = NULL;
 
     cerr << "Reading vocabulary " << vocab_fname << endl;
     int retval = Unigrams::read_vocab(vocab_fname, vocab, maxlen, utf8_encoding);
@@ -66,13 +73,22 @@ int main(int argc, char* argv[]) {
     cerr << "\t" << "maximum string length: " << maxlen << endl;
     find_short_factors(vocab, short_factors, min_removal_length, utf8_encoding);
 
-    cerr << "Reading training corpus " << corpus_fname << endl;
-    retval = Unigrams::read_sents(corpus_fname, sents);
-    if (retval < 0) {
-        cerr << "something went wrong reading training corpus" << endl;
-        exit(EXIT_FAILURE);
+    if (stream_buffer > 0) {
+        // Half of the buffer for the chunk being segmented, half for the one being read
+        cerr << "Streaming training corpus " << corpus_fname << endl;
+        corpus = new StreamingCorpus(corpus_fname, (unsigned long int)stream_buffer*1024*1024/2);
+    }
+    else {
+        cerr << "Reading training corpus " << corpus_fname << endl;
+        retval = Unigrams::read_sents(corpus_fname, sents, sent_counts);
+        if (retval < 0) {
+            cerr << "something went wrong reading training corpus" << endl;
+            exit(EXIT_FAILURE);
+        }
+        cerr << "\t" << "number of sentences in corpus: " << retval << endl;
+        cerr << "\t" << "number of distinct sentences: " << sents.size() << endl;
+        corpus = new MemoryCorpus(sents, sent_counts);
     }
-    cerr << "\t" << "number of sentences in corpus: " << sents.size() << endl;
 
     Unigrams ug;
     if (enable_forward_backward)
@@ -80,23 +96,26 @@ int main(int argc, char* argv[]) {
     else
         ug.set_segmentation_method(viterbi);
     ug.set_utf8(utf8_encoding);
+    ug.set_threads(num_threads);
 
     cerr << endl << "Initial threshold" << endl;
-    flt_type cost = ug.resegment_sents(sents, vocab, freqs);
+    UnigramModel model(vocab, utf8_encoding);
+    flt_type cost = ug.resegment_sents(*corpus, model.vocab, model.counts);
     cerr << "likelihood: " << cost << endl;
 
     flt_type threshold_value = 0.0;
-    while (vocab.size() > target_vocab_size) {
+    while (model.size() > target_vocab_size) {
         threshold_value += threshold_increment;
-        ug.cutoff(freqs, threshold_value, stoplist, min_removal_length);
-        cerr << "\tthreshold: " << threshold_value << "\t" << "vocabulary size: " << freqs.size() << endl;
-        vocab = freqs;
-        Unigrams::freqs_to_logprobs(vocab);
-        assert_factors(vocab, short_factors, short_factor_min_lp);
-        cost = ug.resegment_sents(sents, vocab, freqs);
+        ug.cutoff(model, threshold_value, stoplist, min_removal_length);
+        cerr << "\tthreshold: " << threshold_value << "\t" << "vocabulary size: " << model.counted_size() << endl;
+        model.update_costs();
+        model.assert_factors(short_factors, short_factor_min_lp);
+        cost = ug.resegment_sents(*corpus, model.vocab, model.counts);
         cerr << "likelihood: " << cost << endl;
     }
 
+    model.get_vocab(vocab);
     Unigrams::write_vocab(out_vocab_fname, vocab);
+    delete corpus;
     exit(EXIT_SUCCESS);
 }
@@ -18,6 +18,8 @@ int main(int argc, char* argv[]) {
       ('v', "vocab-size=INT", "arg must", "", "Target vocabulary size")
       ('s', "stop-list=STRING", "arg", "", "Text file containing subwords that should not be removed")
       ('f', "forward-backward", "", "", "Use Forward-backward segmentation instead of Viterbi")
+      ('p', "prefix", "", "", "Continue the segmentation of each word from the prefix shared with the previous word")
+      ('j', "threads=INT", "arg", "1", "Number of threads, DEFAULT: 1")
       ('8', "utf-8", "", "", "Utf-8 character encoding in use");
     config.default_parse(argc, argv);
     if (config.arguments.size() != 3) config.print_help(stderr, 1);
@@ -30,7 +32,9 @@ int main(int argc, char* argv[]) {
     unsigned int min_removal_length = config["min-length"].get_int();
     unsigned int target_vocab_size = config["vocab-size"].get_int();
     bool enable_forward_backward = config["forward-backward"].specified;
+    bool enable_prefix = config["prefix"].specified;
     bool utf8_encoding = config["utf-8"].specified;
+    int num_threads = config["threads"].get_int();
 
     set<string> stoplist;
     if (config["stop-list"].specified) {
@@ -49,12 +53,13 @@ int main(int argc, char* argv[]) {
         cerr << "parameters, stoplist with " << stoplist.size() << " subwords" << endl;
     cerr << "parameters, target vocab size: " << target_vocab_size << endl;
     cerr << "parameters, use forward-backward: " << enable_forward_backward << endl;
+    cerr << "parameters, continue from shared prefix: " << enable_prefix << endl;
     cerr << "parameters, utf-8 encoding: " << utf8_encoding << endl;
+    cerr << "parameters, threads: " << num_threads << endl;
 
     int maxlen, word_maxlen;
     set<string> short_subwords;
     map<string, flt_type> vocab;
-    map<string, flt_type> freqs;
     map<string, flt_type> words;
 
     cerr << "Reading vocabulary " << vocab_fname << endl;
@@ -83,27 +88,33 @@ int main(int argc, char* argv[]) {
     cerr << "\t" << "maximum word length: " << word_maxlen << endl;
 
     Unigrams ug;
-    if (enable_forward_backward)
+    if (enable_forward_backward && enable_prefix)
+        ug.set_segmentation_method(forward_backward_incremental);
+    else if (enable_forward_backward)
         ug.set_segmentation_method(forward_backward);
+    else if (enable_prefix)
+        ug.set_segmentation_method(viterbi_incremental);
     else
         ug.set_segmentation_method(viterbi);
     ug.set_utf8(utf8_encoding);
+    ug.set_threads(num_threads);
 
-    flt_type cost = ug.resegment_words(words, vocab, freqs);
+    UnigramModel model(vocab, utf8_encoding);
+    flt_type cost = ug.resegment_words(words, model.vocab, model.counts);
     cerr << endl << "Initial likelihood: " << cost << endl;
 
     flt_type threshold_value = 0.0;
-    while (target_vocab_size > 0 && vocab.size() > target_vocab_size) {
+    while (target_vocab_size > 0 && model.size() > target_vocab_size) {
         threshold_value += threshold_increment;
-        ug.cutoff(freqs, threshold_value, stoplist, min_removal_length);
-        cerr << "\tthreshold: " << threshold_value << "\t" << "vocabulary size: " << freqs.size() << endl;
-        vocab = freqs;
-        Unigrams::freqs_to_logprobs(vocab);
-        assert_factors(vocab, stoplist, subword_min_lp);
-        cost = ug.resegment_words(words, vocab, freqs);
+        ug.cutoff(model, threshold_value, stoplist, min_removal_length);
+        cerr << "\tthreshold: " << threshold_value << "\t" << "vocabulary size: " << model.counted_size() << endl;
+        model.update_costs();
+        model.assert_factors(stoplist, subword_min_lp);
+        cost = ug.resegment_words(words, model.vocab, model.counts);
         cerr << "likelihood: " << cost << endl;
     }
 
+    model.get_vocab(vocab);
     Unigrams::write_vocab(out_vocab_fname, vocab);
     exit(EXIT_SUCCESS);
 }
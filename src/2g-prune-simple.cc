@@ -46,7 +46,6 @@ int main(int argc, char* argv[]) {
     map<string, flt_type> all_chars;
     map<string, flt_type> freqs;
     map<string, flt_type> words;
-    MultiStringFactorGraph msfg(start_end_symbol);
     transitions_t transitions;
     transitions_t trans_stats;
     map<string, flt_type> unigram_stats;
@@ -74,31 +73,43 @@ int main(int argc, char* argv[]) {
     cerr << "\t" << "wordlist size: " << words.size() << endl;
     cerr << "\t" << "maximum word length: " << word_maxlen << endl;
 
-    cerr << "Reading msfg " << msfg_fname << endl;
-    msfg.read(msfg_fname);
+    FrozenMultiStringFactorGraph msfg(start_end_symbol);
+    if (FrozenMultiStringFactorGraph::is_image(msfg_fname)) {
+        cerr << "Mapping msfg image " << msfg_fname << endl;
+        if (msfg.open_image(msfg_fname) < 0) {
+            cerr << "something went wrong mapping msfg image" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    else {
+        cerr << "Reading msfg " << msfg_fname << endl;
+        MultiStringFactorGraph *read_msfg = new MultiStringFactorGraph(start_end_symbol);
+        read_msfg->read(msfg_fname);
+        msfg.build(*read_msfg);
+        delete read_msfg;
+    }
 
-    if (transitions.size() < msfg.factor_node_map.size()) {
+    if (transitions.size() < msfg.factor_count()) {
         vector<string> to_remove;
-        cerr << "Pruning " << msfg.factor_node_map.size()-transitions.size() << " unused transitions from msfg." << endl;
-        for (auto it = msfg.factor_node_map.begin(); it != msfg.factor_node_map.end(); ++it)
-            if (transitions.find(it->first) == transitions.end())
-                to_remove.push_back(it->first);
+        cerr << "Pruning " << msfg.factor_count()-transitions.size() << " unused transitions from msfg." << endl;
+        for (unsigned int i=0; i<msfg.factor_strings.size(); i++)
+            if (!msfg.factor_removed[i] && transitions.find(msfg.factor_strings[i]) == transitions.end())
+                to_remove.push_back(msfg.factor_strings[i]);
         for (auto it = to_remove.begin(); it != to_remove.end(); ++it)
             msfg.remove_arcs(*it);
     }
 
-    assign_scores(transitions, msfg);
-
     std::cerr << std::setprecision(15);
     int iteration = 1;
     while (true) {
 
         cerr << "Iteration " << iteration << endl;
 
+        // The costs are copied to the arcs, also after normalizing in remove_transitions
+        assign_scores(transitions, msfg);
         flt_type lp = Bigrams::collect_trans_stats(words, msfg, trans_stats, unigram_stats, enable_fb);
         transitions.swap(trans_stats);
         Bigrams::freqs_to_logprobs(transitions);
-        assign_scores(transitions, msfg);
         trans_stats.clear();
 
         cerr << "\tbigram likelihood: " << lp << endl;
@@ -59,7 +59,6 @@ int main(int argc, char* argv[]) {
     map<string, flt_type> all_chars;
     map<string, flt_type> freqs;
     map<string, flt_type> words;
-    MultiStringFactorGraph msfg(start_end_symbol);
     transitions_t transitions;
     transitions_t trans_stats;
     map<string, flt_type> unigram_stats;
@@ -87,8 +86,21 @@ int main(int argc, char* argv[]) {
     cerr << "\t" << "wordlist size: " << words.size() << endl;
     cerr << "\t" << "maximum word length: " << word_maxlen << endl;
 
-    cerr << "Reading msfg " << msfg_fname << endl;
-    msfg.read(msfg_fname);
+    FrozenMultiStringFactorGraph msfg(start_end_symbol);
+    if (FrozenMultiStringFactorGraph::is_image(msfg_fname)) {
+        cerr << "Mapping msfg image " << msfg_fname << endl;
+        if (msfg.open_image(msfg_fname) < 0) {
+            cerr << "something went wrong mapping msfg image" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    else {
+        cerr << "Reading msfg " << msfg_fname << endl;
+        MultiStringFactorGraph *read_msfg = new MultiStringFactorGraph(start_end_symbol);
+        read_msfg->read(msfg_fname);
+        msfg.build(*read_msfg);
+        delete read_msfg;
+    }
     msfg.prune_unused(transitions);
 
     std::cerr << std::setprecision(15);
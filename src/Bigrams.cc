@@ -29,6 +29,26 @@ Bigrams::iterate(const map<string, flt_type> &words,
 }
 
 
+flt_type
+Bigrams::iterate(const map<string, flt_type> &words,
+                 FrozenMultiStringFactorGraph &msfg,
+                 transitions_t &transitions,
+                 bool forward_backward,
+                 unsigned int iterations)
+{
+    flt_type lp=0.0;
+    for (unsigned int i=0; i<iterations; i++) {
+        map<string, flt_type> unigram_stats;
+        transitions_t trans_stats;
+        assign_scores(transitions, msfg);
+        lp = collect_trans_stats(words, msfg, trans_stats, unigram_stats, forward_backward);
+        transitions.swap(trans_stats);
+        Bigrams::freqs_to_logprobs(transitions);
+    }
+    return lp;
+}
+
+
 flt_type
 Bigrams::iterate_kn(const map<string, flt_type> &words,
                     MultiStringFactorGraph &msfg,
@@ -49,6 +69,26 @@ Bigrams::iterate_kn(const map<string, flt_type> &words,
 }
 
 
+flt_type
+Bigrams::iterate_kn(const map<string, flt_type> &words,
+                    FrozenMultiStringFactorGraph &msfg,
+                    transitions_t &transitions,
+                    bool forward_backward,
+                    flt_type D,
+                    unsigned int iterations)
+{
+    flt_type lp=0.0;
+    for (unsigned int i=0; i<iterations; i++) {
+        map<string, flt_type> unigram_stats;
+        transitions_t trans_stats;
+        assign_scores(transitions, msfg);
+        lp = collect_trans_stats(words, msfg, trans_stats, unigram_stats, forward_backward);
+        kn_smooth(trans_stats, transitions, D);
+    }
+    return lp;
+}
+
+
 void
 Bigrams::update_trans_stats(const transitions_t &collected_stats,
                             flt_type weight,
@@ -109,7 +149,7 @@ Bigrams::collect_trans_stats(const map<string, flt_type> &words,
 
     flt_type total_lp = 0.0;
     if (fb) {
-        vector<flt_type> fw(msfg.nodes.size(), MIN_FLOAT);
+        vector<score_type> fw(msfg.nodes.size(), MIN_SCORE);
         fw[0] = 0.0;
         forward(msfg, fw);
         transitions_t word_stats;
@@ -127,6 +167,41 @@ Bigrams::collect_trans_stats(const map<string, flt_type> &words,
 }
 
 
+// The statistics are collected by the factor indices and converted to strings at the end
+flt_type
+Bigrams::collect_trans_stats(const map<string, flt_type> &words,
+                             FrozenMultiStringFactorGraph &msfg,
+                             transitions_t &trans_stats,
+                             map<string, flt_type> &unigram_stats,
+                             bool fb)
+{
+    trans_stats.clear();
+    unigram_stats.clear();
+
+    flt_type total_lp = 0.0;
+    bigram_stats_t stats;
+    if (fb) {
+        vector<score_type> fw(msfg.node_count(), MIN_SCORE);
+        fw[0] = 0.0;
+        forward(msfg, fw);
+        FrozenMSFGWorkspace ws(msfg);
+        for (auto it = msfg.string_end_nodes.begin(); it != msfg.string_end_nodes.end(); ++it)
+            total_lp += words.at(it->first) * backward(msfg, it->first, fw, stats, ws, words.at(it->first));
+        transitions_t word_stats;
+        msfg.get_transitions(stats, word_stats);
+        update_trans_stats(word_stats, 1.0, trans_stats, unigram_stats);
+    }
+    else {
+        total_lp = viterbi(msfg, words, stats);
+        finalize_viterbi_stats(msfg, stats);
+        msfg.get_transitions(stats, trans_stats);
+        get_unigram_stats(trans_stats, unigram_stats);
+    }
+
+    return total_lp;
+}
+
+
 void
 Bigrams::get_unigram_stats(const transitions_t &trans_stats,
                            map<string, flt_type> &unigram_stats)
@@ -153,6 +228,20 @@ Bigrams::finalize_viterbi_stats(const MultiStringFactorGraph &msfg,
 }
 
 
+void
+Bigrams::finalize_viterbi_stats(const FrozenMultiStringFactorGraph &msfg,
+                                bigram_stats_t &stats)
+{
+    for (unsigned int arc=0; arc<msfg.arc_count(); arc++) {
+        if (msfg.arc_removed[arc]) continue;
+        unsigned long long key = FrozenMultiStringFactorGraph::bigram_key(msfg.node_factors[msfg.arc_sources[arc]],
+                                                                         msfg.node_factors[msfg.arc_targets[arc]]);
+        if (stats.find(key) == stats.end())
+            stats[key] = exp(FLOOR_LP);
+    }
+}
+
+
 void
 Bigrams::freqs_to_logprobs(transitions_t &trans_stats,
                            flt_type min_lp)
@@ -472,6 +561,23 @@ Bigrams::get_backpointers(const MultiStringFactorGraph &msfg,
 }
 
 
+void
+Bigrams::get_backpointers(const FrozenMultiStringFactorGraph &msfg,
+                          map<string, set<string> > &backpointers,
+                          unsigned int minlen)
+{
+    backpointers.clear();
+    for (auto it = msfg.string_end_nodes.begin(); it != msfg.string_end_nodes.end(); ++it) {
+        set<string> factors;
+        msfg.collect_factors(it->first, factors);
+        for (auto fit = factors.begin(); fit != factors.end(); ++fit) {
+            if ((*fit).length() < minlen) continue;
+            backpointers[*fit].insert(it->first);
+        }
+    }
+}
+
+
 int
 Bigrams::init_candidates_freq(unsigned int n_candidates,
                               const map<string, flt_type> &unigram_stats,
@@ -554,6 +660,41 @@ Bigrams::rank_candidate_subwords(const map<string, flt_type> &words,
 }
 
 
+void
+Bigrams::rank_candidate_subwords(const map<string, flt_type> &words,
+                                 FrozenMultiStringFactorGraph &msfg,
+                                 const map<string, flt_type> &unigram_stats,
+                                 transitions_t &transitions,
+                                 map<string, flt_type> &candidates,
+                                 bool forward_backward,
+                                 bool normalize_by_bigram_count)
+{
+    map<string, set<string> > backpointers;
+    Bigrams::get_backpointers(msfg, backpointers, 1);
+    transitions_t reverse;
+    Bigrams::reverse_transitions(transitions, reverse);
+    FrozenMSFGWorkspace ws(msfg);
+
+    for (auto it = candidates.begin(); it != candidates.end(); ++it) {
+        transitions_t changes;
+        set<string> words_to_resegment = backpointers.at(it->first);
+        flt_type orig_score = likelihood(words, words_to_resegment, msfg, ws, forward_backward);
+        flt_type context_score = Bigrams::disable_string(reverse, it->first,
+                                                         unigram_stats, transitions, changes);
+        update_scores(transitions, changes, msfg);
+        flt_type hypo_score = likelihood(words, words_to_resegment, msfg, ws, forward_backward);
+        it->second = hypo_score-orig_score + context_score;
+        Bigrams::restore_string(transitions, changes);
+        update_scores(transitions, changes, msfg);
+        if (normalize_by_bigram_count) {
+            int num_bigrams = transitions.at(it->first).size() + reverse.at(it->first).size();
+            if (it->second < 0) it->second /= num_bigrams;
+            else it->second *= num_bigrams;
+        }
+    }
+}
+
+
 void
 Bigrams::kn_smooth(const transitions_t &counts,
                    transitions_t &kn,
@@ -7,6 +7,7 @@
 #include "defs.hh"
 #include "FactorGraph.hh"
 #include "MSFG.hh"
+#include "FrozenMSFG.hh"
 
 
 class Bigrams {
@@ -20,6 +21,12 @@ static flt_type iterate(const std::map<std::string, flt_type> &words,
                         bool forward_backward=false,
                         unsigned int iterations=1);
 
+static flt_type iterate(const std::map<std::string, flt_type> &words,
+                        FrozenMultiStringFactorGraph &msfg,
+                        transitions_t &transitions,
+                        bool forward_backward=false,
+                        unsigned int iterations=1);
+
 static flt_type iterate_kn(const std::map<std::string, flt_type> &words,
                            MultiStringFactorGraph &msfg,
                            transitions_t &transitions,
@@ -27,6 +34,13 @@ static flt_type iterate_kn(const std::map<std::string, flt_type> &words,
                            flt_type D=0.1,
                            unsigned int iterations=1);
 
+static flt_type iterate_kn(const std::map<std::string, flt_type> &words,
+                           FrozenMultiStringFactorGraph &msfg,
+                           transitions_t &transitions,
+                           bool forward_backward=false,
+                           flt_type D=0.1,
+                           unsigned int iterations=1);
+
 static void update_trans_stats(const transitions_t &collected_stats,
                                flt_type weight,
                                transitions_t &trans_stats,
@@ -49,12 +63,21 @@ static flt_type collect_trans_stats(const std::map<std::string, flt_type> &words
                                     std::map<std::string, flt_type> &unigram_stats,
                                     bool fb=true);
 
+static flt_type collect_trans_stats(const std::map<std::string, flt_type> &words,
+                                    FrozenMultiStringFactorGraph &msfg,
+                                    transitions_t &trans_stats,
+                                    std::map<std::string, flt_type> &unigram_stats,
+                                    bool fb=true);
+
 static void get_unigram_stats(const transitions_t &trans_stats,
                               std::map<std::string, flt_type> &unigram_stats);
 
 static void finalize_viterbi_stats(const MultiStringFactorGraph &msfg,
                                    transitions_t &trans_stats);
 
+static void finalize_viterbi_stats(const FrozenMultiStringFactorGraph &msfg,
+                                   bigram_stats_t &trans_stats);
+
 static void freqs_to_logprobs(transitions_t &trans_stats,
                               flt_type min_lp = FLOOR_LP);
 
@@ -115,6 +138,10 @@ static void get_backpointers(const MultiStringFactorGraph &msfg,
                              std::map<std::string, std::set<std::string> > &backpointers,
                              unsigned int minlen=2);
 
+static void get_backpointers(const FrozenMultiStringFactorGraph &msfg,
+                             std::map<std::string, std::set<std::string> > &backpointers,
+                             unsigned int minlen=2);
+
 static void remove_transitions(std::vector<std::string> &to_remove,
                                transitions_t &transitions);
 
@@ -137,6 +164,15 @@ static void rank_candidate_subwords(const std::map<std::string, flt_type> &words
                                     bool forward_backward=true,
                                     bool normalize_by_bigram_count=false);
 
+// The arc costs of the changed bigrams are updated in the graph for each candidate
+static void rank_candidate_subwords(const std::map<std::string, flt_type> &words,
+                                    FrozenMultiStringFactorGraph &msfg,
+                                    const std::map<std::string, flt_type> &unigram_stats,
+                                    transitions_t &transitions,
+                                    std::map<std::string, flt_type> &candidates,
+                                    bool forward_backward=true,
+                                    bool normalize_by_bigram_count=false);
+
 static void kn_smooth(const transitions_t &counts,
                       transitions_t &kn,
                       double D=0.1,
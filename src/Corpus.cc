@@ -0,0 +1,84 @@
+#include "Corpus.hh"
+
+using namespace std;
+
+
+bool
+MemoryCorpus::next_batch(vector<const string*> &batch,
+                         vector<flt_type> &counts,
+                         unsigned int max_sents)
+{
+    batch.clear();
+    counts.clear();
+    if (next_sent >= sents.size()) return false;
+    for (; next_sent < sents.size() && batch.size() < max_sents; next_sent++) {
+        batch.push_back(&sents[next_sent]);
+        counts.push_back(this->counts != nullptr ? (*this->counts)[next_sent] : 1.0);
+    }
+    return true;
+}
+
+
+StreamingCorpus::StreamingCorpus(const string &fname,
+                                 unsigned long int chunk_size)
+    : fname(fname), chunk_size(chunk_size), next_sent(0)
+{
+}
+
+
+StreamingCorpus::~StreamingCorpus()
+{
+    if (reader.joinable()) reader.join();
+}
+
+
+void
+StreamingCorpus::rewind()
+{
+    if (reader.joinable()) reader.join();
+    input.reset(new SimpleFileInput(fname));
+    chunk.clear();
+    next_sent = 0;
+    reader = thread(&StreamingCorpus::read_chunk, this);
+}
+
+
+bool
+StreamingCorpus::next_batch(vector<const string*> &batch,
+                            vector<flt_type> &counts,
+                            unsigned int max_sents)
+{
+    batch.clear();
+    counts.clear();
+
+    // Takes the chunk read meanwhile and starts reading the one after it,
+    // an empty chunk ends the pass
+    if (next_sent >= chunk.size()) {
+        if (!reader.joinable()) return false;
+        reader.join();
+        chunk.swap(next_chunk);
+        next_sent = 0;
+        if (chunk.size() == 0) return false;
+        reader = thread(&StreamingCorpus::read_chunk, this);
+    }
+
+    for (; next_sent < chunk.size() && batch.size() < max_sents; next_sent++) {
+        batch.push_back(&chunk[next_sent]);
+        counts.push_back(1.0);
+    }
+    return true;
+}
+
+
+void
+StreamingCorpus::read_chunk()
+{
+    next_chunk.clear();
+    unsigned long int bytes = 0;
+    string line;
+    while (bytes < chunk_size && input->getline(line)) {
+        trim(line, '\n');
+        bytes += sizeof(string) + line.length();
+        next_chunk.push_back(line);
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef CORPUS_HH
+#define CORPUS_HH
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "defs.hh"
+#include "io.hh"
+
+/** Sentences of a training corpus, read in batches on each pass.
+ * The sentences are either all kept in memory or streamed from the file
+ * on each pass, so that only a bounded part of the corpus is in memory.
+ * Each sentence has a count, identical sentences may be kept as one. */
+
+class Corpus {
+public:
+
+    virtual ~Corpus() { }
+
+    /** Starts a new pass from the first sentence, called before each pass */
+    virtual void rewind() = 0;
+
+    /** Gets the next sentences of the pass
+     * \param batch = pointers to the sentences, valid until the next call
+     * \param counts = count of each sentence in the batch
+     * \param max_sents = maximum number of sentences in the batch
+     * \return false if the pass is finished
+     */
+    virtual bool next_batch(std::vector<const std::string*> &batch,
+                            std::vector<flt_type> &counts,
+                            unsigned int max_sents) = 0;
+};
+
+
+/** Corpus of sentences read to memory, the sentences are not copied. */
+
+class MemoryCorpus : public Corpus {
+public:
+
+    /** Each sentence counted once */
+    MemoryCorpus(const std::vector<std::string> &sents)
+        : sents(sents), counts(nullptr), next_sent(0) { }
+    /** Distinct sentences with the counts */
+    MemoryCorpus(const std::vector<std::string> &sents, const std::vector<flt_type> &counts)
+        : sents(sents), counts(&counts), next_sent(0) { }
+
+    void rewind() { next_sent = 0; }
+
+    bool next_batch(std::vector<const std::string*> &batch,
+                    std::vector<flt_type> &counts,
+                    unsigned int max_sents);
+
+private:
+    const std::vector<std::string> &sents; //!< Sentences of the corpus
+    const std::vector<flt_type> *counts; //!< Counts of the sentences, nullptr if all are 1
+    unsigned int next_sent; //!< Index of the next sentence in the pass
+};
+
+
+/** Corpus streamed from a plain or gzip compressed file on each pass.
+ * The file is read in chunks of sentences, a reader thread decompresses
+ * and splits the next chunk while the sentences of the current chunk are
+ * segmented. At most two chunks are in memory at a time. */
+
+class StreamingCorpus : public Corpus {
+public:
+
+    /** \param fname = the corpus file, one sentence per line, .gz for gzip
+     * \param chunk_size = maximum size of one chunk in bytes
+     */
+    StreamingCorpus(const std::string &fname, unsigned long int chunk_size);
+    ~StreamingCorpus();
+    StreamingCorpus(const StreamingCorpus&) = delete;
+    StreamingCorpus& operator=(const StreamingCorpus&) = delete;
+
+    /** Opens the file again and starts reading the first chunk */
+    void rewind();
+
+    bool next_batch(std::vector<const std::string*> &batch,
+                    std::vector<flt_type> &counts,
+                    unsigned int max_sents);
+
+private:
+
+    /** Reads the next chunk, run in the reader thread */
+    void read_chunk();
+
+    std::string fname; //!< The corpus file
+    unsigned long int chunk_size; //!< Maximum size of a chunk in bytes
+    std::unique_ptr<SimpleFileInput> input; //!< The file of the current pass
+    std::vector<std::string> chunk; //!< Sentences being segmented
+    std::vector<std::string> next_chunk; //!< Sentences being read by the reader thread
+    unsigned int next_sent; //!< Index of the next sentence in the chunk
+    std::thread reader; //!< Thread reading the next chunk, joinable while reading
+};
+
+
+#endif /* CORPUS_HH */
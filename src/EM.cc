@@ -43,7 +43,7 @@ flt_type viterbi(const map<string, flt_type> &vocab,
 
     // Look up the best path
     int target = search.size()-1;
-    if (search[target].cost == MIN_FLOAT) return MIN_FLOAT;
+    if (search[target].cost == MIN_SCORE) return MIN_FLOAT;
 
     int source = search[target].source;
     while (true) {
@@ -68,36 +68,957 @@ flt_type viterbi(const StringSet &vocab,
     if (text.length() == 0) return MIN_FLOAT;
     vector<Token> search(text.length());
 
-    vector<unsigned int> char_positions;
-    get_character_positions(text, char_positions, utf8);
+    // All factors in the text, the factors ending before the start
+    // of a factor come first so the source tokens are final
+    vector<StringSet::Match> matches;
+    vocab.scan(text, matches);
+
+    for (auto match = matches.cbegin(); match != matches.cend(); ++match) {
+
+        flt_type cost = match->cost;
+        if (match->start>0) cost += search[match->start-1].cost;
+
+        if (cost > search[match->end-1].cost) {
+            search[match->end-1].cost = cost;
+            search[match->end-1].source = match->start-1;
+        }
+    }
+
+    // Look up the best path
+    int target = search.size()-1;
+    if (search[target].cost == MIN_SCORE) return MIN_FLOAT;
+
+    int source = search[target].source;
+    while (true) {
+        best_path.push_back(text.substr(source+1, target-source));
+        if (source == -1) break;
+        target = source;
+        source = search[target].source;
+    }
+
+    if (reverse) std::reverse(best_path.begin(), best_path.end());
+    return search.back().cost;
+}
+
+
+flt_type viterbi(const StringSet &vocab,
+                 const string &text,
+                 map<string, flt_type> &stats,
+                 bool utf8)
+{
+    stats.clear();
+    vector<string> best_path;
+    flt_type lp = viterbi(vocab, text, best_path, false, utf8);
+    for (auto it = best_path.begin(); it != best_path.end(); ++it)
+        stats[*it] += 1.0;
+    return lp;
+}
+
+
+flt_type viterbi(const StringSet &vocab,
+                 const string &text,
+                 vector<int> &best_path,
+                 bool reverse,
+                 bool utf8,
+                 const FactorMask *mask)
+{
+    best_path.clear();
+    if (text.length() == 0) return MIN_FLOAT;
+    vector<Token> search(text.length());
+
+    // All factors in the text, the factors ending before the start
+    // of a factor come first so the source tokens are final
+    vector<StringSet::Match> matches;
+    vocab.scan(text, matches, mask);
+
+    for (auto match = matches.cbegin(); match != matches.cend(); ++match) {
+
+        flt_type cost = match->cost;
+        if (match->start>0) cost += search[match->start-1].cost;
+
+        if (cost > search[match->end-1].cost) {
+            search[match->end-1].cost = cost;
+            search[match->end-1].source = match->start-1;
+            search[match->end-1].factor = match->factor;
+        }
+    }
+
+    // Look up the best path
+    int target = search.size()-1;
+    if (search[target].cost == MIN_SCORE) return MIN_FLOAT;
+
+    while (target != -1) {
+        best_path.push_back(search[target].factor);
+        target = search[target].source;
+    }
+
+    if (reverse) std::reverse(best_path.begin(), best_path.end());
+    return search.back().cost;
+}
+
+
+bool factor_index_sort(pair<int, flt_type> i, pair<int, flt_type> j) { return (i.first < j.first); }
+
+// Sorts the statistics by the factor index and sums the values of each factor
+// Values of one factor are summed in the original order
+static void merge_stats(factor_stats_t &stats)
+{
+    if (stats.size() == 0) return;
+    stable_sort(stats.begin(), stats.end(), factor_index_sort);
+    unsigned int last = 0;
+    for (unsigned int i=1; i<stats.size(); i++) {
+        if (stats[i].first == stats[last].first)
+            stats[last].second += stats[i].second;
+        else
+            stats[++last] = stats[i];
+    }
+    stats.resize(last+1);
+}
+
+
+// Same as above without allocating memory once the buffers have grown,
+// sorting by the factor and the original position keeps the summing order
+static void merge_stats(factor_stats_t &stats,
+                        vector<pair<int, int> > &order,
+                        factor_stats_t &buffer)
+{
+    if (stats.size() == 0) return;
+    order.clear();
+    for (unsigned int i=0; i<stats.size(); i++)
+        order.push_back(make_pair(stats[i].first, i));
+    sort(order.begin(), order.end());
+    buffer.assign(stats.begin(), stats.end());
+    unsigned int last = 0;
+    stats[0] = buffer[order[0].second];
+    for (unsigned int i=1; i<order.size(); i++) {
+        const pair<int, flt_type> &stat = buffer[order[i].second];
+        if (stat.first == stats[last].first)
+            stats[last].second += stat.second;
+        else
+            stats[++last] = stat;
+    }
+    stats.resize(last+1);
+}
+
+
+flt_type viterbi(const StringSet &vocab,
+                 const string &text,
+                 factor_stats_t &stats,
+                 bool utf8)
+{
+    stats.clear();
+    vector<int> best_path;
+    flt_type lp = viterbi(vocab, text, best_path, false, utf8);
+    for (auto it = best_path.begin(); it != best_path.end(); ++it)
+        stats.push_back(make_pair(*it, 1.0));
+    merge_stats(stats);
+    return lp;
+}
+
+
+flt_type viterbi(const StringSet &vocab,
+                 const string &text,
+                 factor_stats_t &stats,
+                 const FactorMask &mask,
+                 bool utf8)
+{
+    SegmentationWorkspace ws;
+    return viterbi(vocab, text, stats, mask, ws, utf8);
+}
+
+
+// Best token ending in each position from the matches starting from the given one,
+// the tokens ending before the first match are final
+static void viterbi(const vector<StringSet::Match> &matches,
+                    unsigned int first,
+                    vector<Token> &search)
+{
+    for (auto match = matches.cbegin()+first; match != matches.cend(); ++match) {
+
+        flt_type cost = match->cost;
+        if (match->start>0) cost += search[match->start-1].cost;
+
+        if (cost > search[match->end-1].cost) {
+            search[match->end-1].cost = cost;
+            search[match->end-1].source = match->start-1;
+            search[match->end-1].factor = match->factor;
+        }
+    }
+}
+
+
+// Collects the factors of the best path from the tokens of the workspace
+static flt_type best_path_stats(int len,
+                                factor_stats_t &stats,
+                                SegmentationWorkspace &ws)
+{
+    const vector<Token> &search = ws.tokens;
+    int target = len-1;
+    if (search[target].cost == MIN_SCORE) return MIN_FLOAT;
+
+    while (target != -1) {
+        stats.push_back(make_pair(search[target].factor, 1.0));
+        target = search[target].source;
+    }
+
+    merge_stats(stats, ws.stats_order, ws.stats_buffer);
+    return search[len-1].cost;
+}
+
+
+flt_type viterbi(const StringSet &vocab,
+                 const string &text,
+                 factor_stats_t &stats,
+                 const FactorMask &mask,
+                 SegmentationWorkspace &ws,
+                 bool utf8)
+{
+    stats.clear();
+    ws.text.clear();
+    int len = text.length();
+    if (len == 0) return MIN_FLOAT;
+    ws.tokens.assign(len, Token());
+
+    vocab.scan(text, ws.matches, &mask);
+    viterbi(ws.matches, 0, ws.tokens);
+    return best_path_stats(len, stats, ws);
+}
+
+
+// Length of the common prefix of two strings
+static unsigned int common_prefix_length(const string &text1, const string &text2)
+{
+    unsigned int len = min(text1.length(), text2.length());
+    unsigned int i = 0;
+    while (i < len && text1[i] == text2[i]) i++;
+    return i;
+}
+
+
+flt_type viterbi_incremental(const StringSet &vocab,
+                             const string &text,
+                             factor_stats_t &stats,
+                             const FactorMask &mask,
+                             SegmentationWorkspace &ws,
+                             bool utf8)
+{
+    stats.clear();
+    int len = text.length();
+    if (len == 0) return MIN_FLOAT;
+
+    // The best tokens ending before the continued position are final
+    unsigned int prefix = common_prefix_length(text, ws.text);
+    unsigned int start = vocab.scan(text, prefix, ws.matches, ws.scan_states, &mask);
+    ws.text = text;
+    ws.tokens.resize(len);
+    fill(ws.tokens.begin()+start, ws.tokens.end(), Token());
+
+    viterbi(ws.matches, ws.scan_states[start].num_matches, ws.tokens);
+    return best_path_stats(len, stats, ws);
+}
+
+
+// Log-sum of the costs of the tokens ending in one position,
+// the costs are gathered to the buffer and summed in one call
+static flt_type sum_token_costs(const vector<Token> &tokens, vector<score_type> &costs)
+{
+    costs.clear();
+    for (auto tok = tokens.cbegin(); tok != tokens.cend(); ++tok)
+        costs.push_back(tok->cost);
+    return sum_log_domain_probs(&costs[0], costs.size());
+}
+
+
+// Forward pass over the factors found in the text from the given match,
+// the tokens and the forward scores ending before the first match are final
+static void forward(const vector<StringSet::Match> &matches,
+                    unsigned int first,
+                    int len,
+                    vector<vector<Token> > &search,
+                    vector<score_type> &fw,
+                    vector<score_type> &costs)
+{
+    // The matches come by the end position, the forward score of a position
+    // is summed when the first factor ending after it is reached, so only
+    // the end of the last match before the first one may be left unsummed
+    int summed = 0;
+    if (first > 0) summed = matches[first-1].end-1;
+    for (auto match = matches.cbegin()+first; match != matches.cend(); ++match) {
+
+        int end = match->end;
+        for (; summed<end-1; summed++) {
+            if (search[summed].size() == 0) continue;
+            fw[summed] = sum_token_costs(search[summed], costs);
+        }
+
+        int i = match->start;
+        if (i>0 && search[i-1].size() == 0) continue;
+
+        flt_type cost = match->cost;
+        if (i>0) cost += fw[i-1];
+
+        Token tok(i-1, cost, match->factor);
+        search[end-1].push_back(tok);
+    }
+
+    if (search[len-1].size() == 0) return;
+
+    fw[len-1] = sum_token_costs(search[len-1], costs);
+}
+
+
+void forward(const StringSet &vocab,
+             const string &text,
+             vector<vector<Token> > &search,
+             vector<score_type> &fw,
+             bool utf8,
+             const FactorMask *mask)
+{
+    vector<StringSet::Match> matches;
+    vector<score_type> costs;
+    vocab.scan(text, matches, mask);
+    forward(matches, 0, text.length(), search, fw, costs);
+}
+
+
+// Backward scores gathered over the tokens starting after each position,
+// the tokens are indexed by their source in the order of the end position from
+// the last, so the scores are summed in the same order as along the tokens
+static void backward_scores(int len,
+                            const vector<vector<Token> > &search,
+                            const vector<score_type> &fw,
+                            vector<score_type> &bw,
+                            SegmentationWorkspace &ws)
+{
+    ws.source_offsets.assign(len+1, 0);
+    for (int i=len-1; i>=0; i--)
+        for (auto tok = search[i].cbegin(); tok != search[i].cend(); ++tok)
+            if (tok->source >= 0) ws.source_offsets[tok->source+1]++;
+    for (int j=0; j<len; j++) ws.source_offsets[j+1] += ws.source_offsets[j];
+
+    // Filling moves the offset of each position to the start of the next one
+    ws.source_tokens.resize(ws.source_offsets[len]);
+    for (int i=len-1; i>=0; i--)
+        for (unsigned int t=0; t<search[i].size(); t++)
+            if (search[i][t].source >= 0)
+                ws.source_tokens[ws.source_offsets[search[i][t].source]++] = make_pair(i, t);
+
+    for (int j=len-2; j>=0; j--) {
+        ws.costs.clear();
+        for (int k = j>0 ? ws.source_offsets[j-1] : 0; k<ws.source_offsets[j]; k++) {
+            int i = ws.source_tokens[k].first;
+            if (bw[i] == SMALL_LP || fw[i] == SMALL_LP) continue;
+            ws.costs.push_back((flt_type)search[i][ws.source_tokens[k].second].cost - fw[i] + bw[i]);
+        }
+        if (ws.costs.size() > 0) bw[j] = sum_log_domain_probs(&ws.costs[0], ws.costs.size());
+    }
+}
+
+
+// Backward pass collecting the statistics by the factor string
+static void backward(const string &text,
+                     const vector<vector<Token> > &search,
+                     const vector<score_type> &fw,
+                     vector<score_type> &bw,
+                     map<string, flt_type> &stats)
+{
+    int len = text.length();
+    if (search[len-1].size() == 0) return;
+
+    SegmentationWorkspace ws;
+    backward_scores(len, search, fw, bw, ws);
+
+    for (int i=len-1; i>=0; i--) {
+        if (bw[i] == SMALL_LP || fw[i] == SMALL_LP) continue;
+        for (auto tok = search[i].cbegin(); tok != search[i].cend(); ++tok)
+            stats[text.substr(tok->source+1, i-tok->source)] += exp((flt_type)tok->cost - fw[i] + bw[i]);
+    }
+}
+
+
+void backward(const StringSet &vocab,
+              const string &text,
+              const vector<vector<Token> > &search,
+              const vector<score_type> &fw,
+              vector<score_type> &bw,
+              map<string, flt_type> &stats)
+{
+    backward(text, search, fw, bw, stats);
+}
+
+
+// Backward pass collecting the unmerged statistics of each token
+static void backward(int len,
+                     const vector<vector<Token> > &search,
+                     const vector<score_type> &fw,
+                     vector<score_type> &bw,
+                     factor_stats_t &stats,
+                     SegmentationWorkspace &ws)
+{
+    if (search[len-1].size() == 0) return;
+
+    backward_scores(len, search, fw, bw, ws);
+
+    for (int i=len-1; i>=0; i--) {
+        if (bw[i] == SMALL_LP || fw[i] == SMALL_LP) continue;
+        for (auto tok = search[i].cbegin(); tok != search[i].cend(); ++tok)
+            stats.push_back(make_pair(tok->factor, exp((flt_type)tok->cost - fw[i] + bw[i])));
+    }
+}
+
+
+void backward(const StringSet &vocab,
+              const string &text,
+              const vector<vector<Token> > &search,
+              const vector<score_type> &fw,
+              vector<score_type> &bw,
+              factor_stats_t &stats)
+{
+    SegmentationWorkspace ws;
+    backward(text.length(), search, fw, bw, stats, ws);
+    merge_stats(stats);
+}
+
+
+flt_type forward_backward(const StringSet &vocab,
+                          const string &text,
+                          map<string, flt_type> &stats,
+                          bool utf8)
+{
+    int len = text.length();
+    if (len == 0) return MIN_FLOAT;
+
+    stats.clear();
+    vector<vector<Token> > search(len);
+    vector<score_type> fw(len, SMALL_LP); fw[0] = 0.0;
+    vector<score_type> bw(len, SMALL_LP); bw.back() = 0.0;
+
+    forward(vocab, text, search, fw, utf8);
+    backward(vocab, text, search, fw, bw, stats);
+
+    if (search[len-1].size() == 0) return MIN_FLOAT;
+    return fw.back();
+}
+
+
+flt_type forward_backward(const StringSet &vocab,
+                          const string &text,
+                          map<string, flt_type> &stats,
+                          vector<score_type> &bw,
+                          bool utf8)
+{
+    int len = text.length();
+    if (len == 0) return MIN_FLOAT;
+
+    stats.clear();
+    vector<vector<Token> > search(len);
+    vector<score_type> fw(len, SMALL_LP); fw[0] = 0.0;
+    bw.resize(len, SMALL_LP); bw.back() = 0.0;
+
+    forward(vocab, text, search, fw, utf8);
+    backward(vocab, text, search, fw, bw, stats);
+
+    if (search[len-1].size() == 0) return MIN_FLOAT;
+    return fw.back();
+}
+
+
+flt_type forward_backward(const StringSet &vocab,
+                          const string &text,
+                          factor_stats_t &stats,
+                          bool utf8)
+{
+    int len = text.length();
+    if (len == 0) return MIN_FLOAT;
+
+    stats.clear();
+    vector<vector<Token> > search(len);
+    vector<score_type> fw(len, SMALL_LP); fw[0] = 0.0;
+    vector<score_type> bw(len, SMALL_LP); bw.back() = 0.0;
+
+    forward(vocab, text, search, fw, utf8);
+    backward(vocab, text, search, fw, bw, stats);
+
+    if (search[len-1].size() == 0) return MIN_FLOAT;
+    return fw.back();
+}
+
+
+flt_type forward_backward(const StringSet &vocab,
+                          const string &text,
+                          factor_stats_t &stats,
+                          vector<score_type> &bw,
+                          bool utf8)
+{
+    int len = text.length();
+    if (len == 0) return MIN_FLOAT;
+
+    stats.clear();
+    vector<vector<Token> > search(len);
+    vector<score_type> fw(len, SMALL_LP); fw[0] = 0.0;
+    bw.resize(len, SMALL_LP); bw.back() = 0.0;
+
+    forward(vocab, text, search, fw, utf8);
+    backward(vocab, text, search, fw, bw, stats);
+
+    if (search[len-1].size() == 0) return MIN_FLOAT;
+    return fw.back();
+}
+
+
+flt_type forward_backward(const StringSet &vocab,
+                          const string &text,
+                          factor_stats_t &stats,
+                          const FactorMask &mask,
+                          bool utf8)
+{
+    SegmentationWorkspace ws;
+    return forward_backward(vocab, text, stats, mask, ws, utf8);
+}
+
+
+flt_type forward_backward(const StringSet &vocab,
+                          const string &text,
+                          factor_stats_t &stats,
+                          const FactorMask &mask,
+                          SegmentationWorkspace &ws,
+                          bool utf8)
+{
+    int len = text.length();
+    if (len == 0) return MIN_FLOAT;
+
+    // The token lists keep their capacity, only the ones in use are cleared
+    stats.clear();
+    ws.text.clear();
+    if ((int)ws.search.size() < len) ws.search.resize(len);
+    for (int i=0; i<len; i++) ws.search[i].clear();
+    ws.fw.assign(len, SMALL_LP); ws.fw[0] = 0.0;
+    ws.bw.assign(len, SMALL_LP); ws.bw[len-1] = 0.0;
+
+    vocab.scan(text, ws.matches, &mask);
+    forward(ws.matches, 0, len, ws.search, ws.fw, ws.costs);
+    backward(len, ws.search, ws.fw, ws.bw, stats, ws);
+    merge_stats(stats, ws.stats_order, ws.stats_buffer);
+
+    if (ws.search[len-1].size() == 0) return MIN_FLOAT;
+    return ws.fw[len-1];
+}
+
+
+flt_type forward_backward_incremental(const StringSet &vocab,
+                                      const string &text,
+                                      factor_stats_t &stats,
+                                      const FactorMask &mask,
+                                      SegmentationWorkspace &ws,
+                                      bool utf8)
+{
+    int len = text.length();
+    if (len == 0) return MIN_FLOAT;
+
+    // The tokens and the forward scores ending before the continued position are kept
+    stats.clear();
+    unsigned int prefix = common_prefix_length(text, ws.text);
+    unsigned int start = vocab.scan(text, prefix, ws.matches, ws.scan_states, &mask);
+    ws.text = text;
+    if ((int)ws.search.size() < len) ws.search.resize(len);
+    for (int i=start; i<len; i++) ws.search[i].clear();
+    ws.fw.resize(len);
+    fill(ws.fw.begin()+start, ws.fw.end(), SMALL_LP);
+    if (start == 0) ws.fw[0] = 0.0;
+    ws.bw.assign(len, SMALL_LP); ws.bw[len-1] = 0.0;
+
+    forward(ws.matches, ws.scan_states[start].num_matches, len, ws.search, ws.fw, ws.costs);
+    backward(len, ws.search, ws.fw, ws.bw, stats, ws);
+    merge_stats(stats, ws.stats_order, ws.stats_buffer);
+
+    if (ws.search[len-1].size() == 0) return MIN_FLOAT;
+    return ws.fw[len-1];
+}
+
+
+// Counts the matches of the factors in the statistics
+static void count_factor_matches(const factor_stats_t &stats,
+                                 SegmentationWorkspace &ws)
+{
+    ws.factor_matches.assign(stats.size(), 0);
+    ws.factor_match.assign(stats.size(), -1);
+    for (unsigned int m=0; m<ws.matches.size(); m++) {
+        auto stat = lower_bound(stats.cbegin(), stats.cend(),
+                                make_pair(ws.matches[m].factor, 0.0), factor_index_sort);
+        if (stat == stats.cend() || stat->first != ws.matches[m].factor) continue;
+        ws.factor_matches[stat-stats.cbegin()]++;
+        ws.factor_match[stat-stats.cbegin()] = m;
+    }
+}
+
+
+static unsigned int count_distinct(vector<int> &factors)
+{
+    sort(factors.begin(), factors.end());
+    return unique(factors.begin(), factors.end()) - factors.begin();
+}
+
+
+// Number of distinct factors on the paths through the text without the removed match
+static unsigned int count_live_factors(int len,
+                                       int removed,
+                                       SegmentationWorkspace &ws)
+{
+    const vector<StringSet::Match> &matches = ws.matches;
+    vector<char> &reached = ws.prefix_reached;
+    reached.assign(len+1, 0); reached[0] = 1;
+    for (int m=0; m<(int)matches.size(); m++)
+        if (m != removed && reached[matches[m].start]) reached[matches[m].end] = 1;
+
+    vector<char> &reaching = ws.suffix_reached;
+    reaching.assign(len+1, 0); reaching[len] = 1;
+    for (int m=matches.size()-1; m>=0; m--)
+        if (m != removed && reaching[matches[m].end]) reaching[matches[m].start] = 1;
+
+    ws.factors.clear();
+    for (int m=0; m<(int)matches.size(); m++)
+        if (m != removed && reached[matches[m].start] && reaching[matches[m].end])
+            ws.factors.push_back(matches[m].factor);
+    return count_distinct(ws.factors);
+}
+
+
+flt_type viterbi(const StringSet &vocab,
+                 const string &text,
+                 factor_stats_t &stats,
+                 const vector<bool> &candidates,
+                 vector<FactorRemoval> &removals,
+                 FactorMask &mask,
+                 SegmentationWorkspace &ws,
+                 bool utf8)
+{
+    removals.clear();
+    flt_type lp = viterbi(vocab, text, stats, mask, ws, utf8);
+    if (stats.size() == 0) return lp;
+
+    // Best scores from each position to the end of the text
+    int len = text.length();
+    const vector<StringSet::Match> &matches = ws.matches;
+    ws.suffix.assign(len+1, MIN_SCORE); ws.suffix[len] = 0.0;
+    ws.suffix_match.assign(len+1, -1);
+    for (int m=matches.size()-1; m>=0; m--) {
+        const StringSet::Match &match = matches[m];
+        if (ws.suffix[match.end] == MIN_SCORE) continue;
+        flt_type cost = match.cost + ws.suffix[match.end];
+        if (cost > ws.suffix[match.start]) {
+            ws.suffix[match.start] = cost;
+            ws.suffix_match[match.start] = m;
+        }
+    }
+    count_factor_matches(stats, ws);
+
+    for (unsigned int i=0; i<stats.size(); i++) {
+
+        if (!candidates[stats[i].first]) continue;
+
+        FactorRemoval removal;
+        removal.factor = stats[i].first;
+        removal.ll = MIN_FLOAT;
+        removal.num_tokens = 0;
+        if (ws.factor_matches[i] > 1) {
+            removals.push_back(removal);
+            continue;
+        }
+
+        // Each path without the removed match has exactly one match
+        // covering the start position of the removed match
+        int removed = ws.factor_match[i];
+        int pos = matches[removed].start;
+        int best_match = -1;
+        for (int m=0; m<(int)matches.size(); m++) {
+            const StringSet::Match &match = matches[m];
+            if (m == removed || (int)match.start > pos || (int)match.end <= pos) continue;
+            if (match.start > 0 && ws.tokens[match.start-1].cost == MIN_SCORE) continue;
+            if (ws.suffix[match.end] == MIN_SCORE) continue;
+            flt_type cost = match.cost + ws.suffix[match.end];
+            if (match.start > 0) cost += ws.tokens[match.start-1].cost;
+            if (cost > removal.ll) {
+                removal.ll = cost;
+                best_match = m;
+            }
+        }
+
+        if (best_match != -1) {
+            ws.factors.clear();
+            ws.factors.push_back(matches[best_match].factor);
+            for (int target=matches[best_match].start-1; target != -1; target = ws.tokens[target].source)
+                ws.factors.push_back(ws.tokens[target].factor);
+            for (int p=matches[best_match].end; p<len; p = matches[ws.suffix_match[p]].end)
+                ws.factors.push_back(matches[ws.suffix_match[p]].factor);
+            removal.num_tokens = count_distinct(ws.factors);
+        }
+        removals.push_back(removal);
+    }
+
+    // Factors with several matches are removed by segmenting again
+    for (unsigned int i=0, r=0; i<stats.size(); i++) {
+        if (!candidates[stats[i].first]) continue;
+        if (ws.factor_matches[i] > 1) {
+            mask.disable(stats[i].first);
+            removals[r].ll = viterbi(vocab, text, ws.removal_stats, mask, ws, utf8);
+            removals[r].num_tokens = ws.removal_stats.size();
+            mask.enable(stats[i].first);
+        }
+        r++;
+    }
+
+    return lp;
+}
+
+
+flt_type forward_backward(const StringSet &vocab,
+                          const string &text,
+                          factor_stats_t &stats,
+                          const vector<bool> &candidates,
+                          vector<FactorRemoval> &removals,
+                          FactorMask &mask,
+                          SegmentationWorkspace &ws,
+                          bool utf8)
+{
+    removals.clear();
+    flt_type lp = forward_backward(vocab, text, stats, mask, ws, utf8);
+    if (stats.size() == 0) return lp;
+
+    // Summed scores from each position to the end of the text
+    int len = text.length();
+    const vector<StringSet::Match> &matches = ws.matches;
+    ws.suffix.assign(len+1, MIN_SCORE); ws.suffix[len] = 0.0;
+    for (int m=matches.size()-1; m>=0; m--) {
+        const StringSet::Match &match = matches[m];
+        if (ws.suffix[match.end] == MIN_SCORE) continue;
+        flt_type cost = match.cost + ws.suffix[match.end];
+        if (ws.suffix[match.start] == MIN_SCORE) ws.suffix[match.start] = cost;
+        else ws.suffix[match.start] = add_log_domain_probs(ws.suffix[match.start], cost);
+    }
+    count_factor_matches(stats, ws);
+
+    for (unsigned int i=0; i<stats.size(); i++) {
+
+        if (!candidates[stats[i].first]) continue;
+
+        FactorRemoval removal;
+        removal.factor = stats[i].first;
+        removal.ll = MIN_FLOAT;
+        removal.num_tokens = 0;
+        if (ws.factor_matches[i] > 1) {
+            removals.push_back(removal);
+            continue;
+        }
+
+        // The paths without the removed match are divided by the match
+        // covering the start position of the removed match
+        int removed = ws.factor_match[i];
+        int pos = matches[removed].start;
+        ws.costs.clear();
+        for (int m=0; m<(int)matches.size(); m++) {
+            const StringSet::Match &match = matches[m];
+            if (m == removed || (int)match.start > pos || (int)match.end <= pos) continue;
+            if (match.start > 0 && ws.search[match.start-1].size() == 0) continue;
+            if (ws.suffix[match.end] == MIN_SCORE) continue;
+            flt_type cost = match.cost + ws.suffix[match.end];
+            if (match.start > 0) cost += ws.fw[match.start-1];
+            ws.costs.push_back(cost);
+        }
+
+        if (ws.costs.size() > 0) {
+            removal.ll = sum_log_domain_probs(&ws.costs[0], ws.costs.size());
+            removal.num_tokens = count_live_factors(len, removed, ws);
+        }
+        removals.push_back(removal);
+    }
+
+    // Factors with several matches are removed by segmenting again
+    for (unsigned int i=0, r=0; i<stats.size(); i++) {
+        if (!candidates[stats[i].first]) continue;
+        if (ws.factor_matches[i] > 1) {
+            mask.disable(stats[i].first);
+            removals[r].ll = forward_backward(vocab, text, ws.removal_stats, mask, ws, utf8);
+            removals[r].num_tokens = ws.removal_stats.size();
+            mask.enable(stats[i].first);
+        }
+        r++;
+    }
+
+    return lp;
+}
+
+
+flt_type forward_backward(const map<string, flt_type> &vocab,
+                          const string &text,
+                          map<string, flt_type> &stats,
+                          bool utf8)
+{
+    StringSet stringset_vocab(vocab, utf8);
+    return forward_backward(stringset_vocab, text, stats, utf8);
+}
+
+
+flt_type viterbi(const StringSet &vocab,
+                 const string &text,
+                 transitions_t &stats,
+                 const string &start_end_symbol)
+{
+    stats.clear();
+    vector<string> best_path;
+    flt_type lp = viterbi(vocab, text, best_path, true);
+    if (best_path.size() == 0) return MIN_FLOAT;
+    best_path.insert(best_path.begin(), start_end_symbol);
+    best_path.push_back(start_end_symbol);
+    for (unsigned int i=1; i<best_path.size(); i++)
+        stats[best_path[i-1]][best_path[i]] += 1.0;
+    return lp;
+}
+
+
+// Segmentation policies for the kernels going through the start positions,
+// reached tells if the tokens ending before the position are continued
+// and add adds a factor from the start to the end position
+class ViterbiSearch {
+public:
+    ViterbiSearch(vector<Token> &tokens) : tokens(tokens) { }
+
+    inline bool reached(int pos) { return true; }
+
+    inline void add(int start, int end, int factor, flt_type cost)
+    {
+        if (start>0) cost += tokens[start-1].cost;
+
+        if (cost > tokens[end-1].cost) {
+            tokens[end-1].cost = cost;
+            tokens[end-1].source = start-1;
+            tokens[end-1].factor = factor;
+        }
+    }
+
+    vector<Token> &tokens; //!< Best token ending in each position
+};
 
-    for (unsigned int i=0; i<char_positions.size(); i++) {
+
+class ForwardSearch {
+public:
+    ForwardSearch(vector<vector<Token> > &search, vector<score_type> &fw)
+        : search(search), fw(fw) { }
+
+    // The tokens ending before the position are final when the position is reached
+    inline bool reached(int pos)
+    {
+        if (pos>0 && search[pos-1].size() == 0) return false;
+        if (pos>0) fw[pos-1] = sum_token_costs(search[pos-1], costs);
+        return true;
+    }
+
+    inline void add(int start, int end, int factor, flt_type cost)
+    {
+        if (start>0) cost += fw[start-1];
+
+        Token tok(start-1, cost, factor);
+        search[end-1].push_back(tok);
+    }
+
+    void finish(int len)
+    {
+        if (search[len-1].size() == 0) return;
+        fw[len-1] = sum_token_costs(search[len-1], costs);
+    }
+
+    vector<vector<Token> > &search; //!< All tokens ending in each position
+    vector<score_type> &fw; //!< Forward scores
+    vector<score_type> costs; //!< Token costs of one position for summing
+};
+
+
+// Adds the factors starting from each letter, one arc at a time
+template <class Search, class Letters>
+static void search_factors(const FrozenStringSet &vocab,
+                           const string &text,
+                           Search &search)
+{
+    for (unsigned int i=0; i<text.length(); i=Letters::next(text, i)) {
+
+        if (!search.reached(i)) continue;
+
+        // Letter added outside the tree
+        if (vocab.added_letter_count() > 0) {
+            unsigned int end = min(Letters::next(text, i), (unsigned int)text.length());
+            int factor = vocab.added_letter(text, i, end);
+            if (factor >= 0) search.add(i, end, factor, vocab.factor_cost(factor));
+        }
 
         // Iterate all factors starting from this position
-        unsigned int start_pos = char_positions[i];
-        const StringSet::Node *node = &vocab.root_node;
-        for (unsigned int j=start_pos; j<text.length(); j++) {
+        int node = FrozenStringSet::root_node;
+        for (unsigned int j=i; j<text.length(); j++) {
 
-            StringSet::Arc *arc = vocab.find_arc(text[j], node);
-            if (arc == nullptr) break;
-            node = arc->target_node;
+            node = vocab.find_arc(text[j], node);
+            if (node < 0) break;
 
             // Factor associated with this node
-            if (arc->factor.length() > 0) {
-                flt_type cost = arc->cost;
-                if (start_pos>0) cost += search[start_pos-1].cost;
+            int factor = vocab.factor_id(node);
+            if (factor >= 0) search.add(i, j+1, factor, vocab.cost(node));
+        }
+    }
+}
 
-                if (cost > search[j].cost) {
-                    search[j].cost = cost;
-                    search[j].source = start_pos-1;
-                }
-            }
+
+// Adds the factors starting from each letter, one edge at a time
+template <class Search, class Letters>
+static void search_factors(const RadixStringSet &vocab,
+                           const string &text,
+                           Search &search)
+{
+    for (unsigned int i=0; i<text.length(); i=Letters::next(text, i)) {
+
+        if (!search.reached(i)) continue;
+
+        // Iterate all factors starting from this position, one edge at a time
+        int node = RadixStringSet::root_node;
+        unsigned int j = i;
+        while (j<text.length()) {
+
+            node = vocab.find_edge(text, j, node);
+            if (node < 0) break;
+            j += vocab.label_length(node);
+
+            // Factor associated with this node
+            int factor = vocab.factor_id(node);
+            if (factor >= 0) search.add(i, j, factor, vocab.costs[factor]);
         }
     }
+}
+
+
+// The encoding is chosen once for the text, the letters are
+// not decoded to a vector of positions in the one-byte mode
+template <class Search, class Vocabulary>
+static void search_factors(const Vocabulary &vocab,
+                           const string &text,
+                           Search &search,
+                           bool utf8)
+{
+    if (utf8) search_factors<Search, Utf8Letters>(vocab, text, search);
+    else search_factors<Search, OneByteLetters>(vocab, text, search);
+}
+
+
+flt_type viterbi(const FrozenStringSet &vocab,
+                 const string &text,
+                 vector<string> &best_path,
+                 bool reverse,
+                 bool utf8)
+{
+    best_path.clear();
+    if (text.length() == 0) return MIN_FLOAT;
+    vector<Token> search(text.length());
+    ViterbiSearch vit(search);
+    search_factors(vocab, text, vit, utf8);
 
     // Look up the best path
     int target = search.size()-1;
-    if (search[target].cost == MIN_FLOAT) return MIN_FLOAT;
+    if (search[target].cost == MIN_SCORE) return MIN_FLOAT;
 
     int source = search[target].source;
     while (true) {
@@ -112,7 +1033,7 @@ flt_type viterbi(const StringSet &vocab,
 }
 
 
-flt_type viterbi(const StringSet &vocab,
+flt_type viterbi(const FrozenStringSet &vocab,
                  const string &text,
                  map<string, flt_type> &stats,
                  bool utf8)
@@ -126,106 +1047,321 @@ flt_type viterbi(const StringSet &vocab,
 }
 
 
-void forward(const StringSet &vocab,
+flt_type viterbi(const FrozenStringSet &vocab,
+                 const string &text,
+                 transitions_t &stats,
+                 const string &start_end_symbol)
+{
+    stats.clear();
+    vector<string> best_path;
+    flt_type lp = viterbi(vocab, text, best_path, true);
+    if (best_path.size() == 0) return MIN_FLOAT;
+    best_path.insert(best_path.begin(), start_end_symbol);
+    best_path.push_back(start_end_symbol);
+    for (unsigned int i=1; i<best_path.size(); i++)
+        stats[best_path[i-1]][best_path[i]] += 1.0;
+    return lp;
+}
+
+
+void
+StreamingViterbi::reset()
+{
+    text.clear();
+    tokens.assign(1, Token(-1, 0.0));
+    next_start = 0;
+}
+
+
+void
+StreamingViterbi::add(const FrozenStringSet &vocab,
+                      const string &part,
+                      vector<string> &factors)
+{
+    text.append(part);
+    tokens.resize(text.length()+1);
+
+    // Factors from the starts before the limit all end within the text
+    unsigned int max_len = max(vocab.max_factor_length, 1);
+    if (text.length() < max_len) return;
+    unsigned int limit = text.length()-max_len+1;
+    if (utf8) expand<Utf8Letters>(vocab, limit);
+    else expand<OneByteLetters>(vocab, limit);
+
+    // Every path to the end goes through one of these final positions
+    frontier.clear();
+    unsigned int first = limit > max_len ? limit-max_len+1 : 0;
+    for (unsigned int pos=first; pos<=limit; pos++)
+        if (tokens[pos].cost != MIN_SCORE) frontier.push_back(pos);
+    if (frontier.size() == 0) return;
+    commit(factors);
+}
+
+
+template <class Letters>
+void
+StreamingViterbi::expand(const FrozenStringSet &vocab,
+                         unsigned int limit)
+{
+    for (; next_start<limit; next_start=Letters::next(text, next_start)) {
+
+        score_type start_cost = tokens[next_start].cost;
+        if (start_cost == MIN_SCORE) continue;
+
+        if (vocab.added_letter_count() > 0) {
+            unsigned int end = min(Letters::next(text, next_start), (unsigned int)text.length());
+            int factor = vocab.added_letter(text, next_start, end);
+            if (factor >= 0) {
+                flt_type cost = vocab.factor_cost(factor) + start_cost;
+                Token &tok = tokens[end];
+                if (cost > tok.cost) {
+                    tok.cost = cost;
+                    tok.source = next_start;
+                    tok.factor = factor;
+                }
+            }
+        }
+
+        int node = FrozenStringSet::root_node;
+        for (unsigned int j=next_start; j<text.length(); j++) {
+
+            node = vocab.find_arc(text[j], node);
+            if (node < 0) break;
+
+            int factor = vocab.factor_id(node);
+            if (factor < 0) continue;
+            flt_type cost = vocab.cost(node) + start_cost;
+            Token &tok = tokens[j+1];
+            if (cost > tok.cost) {
+                tok.cost = cost;
+                tok.source = next_start;
+                tok.factor = factor;
+            }
+        }
+    }
+}
+
+
+void
+StreamingViterbi::commit(vector<string> &factors)
+{
+    // Follow the paths back from the frontier until they meet
+    while (true) {
+        auto first = min_element(frontier.begin(), frontier.end());
+        auto last = max_element(frontier.begin(), frontier.end());
+        if (*first == *last) break;
+        *last = tokens[*last].source;
+    }
+
+    unsigned int pos = frontier[0];
+    if (pos == 0) return;
+    backtrace(pos, factors);
+
+    // Drop the committed text, the tokens before pos are not used anymore
+    text.erase(0, pos);
+    tokens.erase(tokens.begin(), tokens.begin()+pos);
+    for (auto it = tokens.begin(); it != tokens.end(); ++it)
+        it->source = it->source >= (int)pos ? it->source-pos : -1;
+    next_start -= pos;
+}
+
+
+void
+StreamingViterbi::backtrace(unsigned int end,
+                            vector<string> &factors)
+{
+    path.clear();
+    unsigned int target = end;
+    while (target > 0) {
+        unsigned int source = tokens[target].source;
+        path.push_back(text.substr(source, target-source));
+        target = source;
+    }
+    factors.insert(factors.end(), path.rbegin(), path.rend());
+}
+
+
+flt_type
+StreamingViterbi::finish(const FrozenStringSet &vocab,
+                         vector<string> &factors)
+{
+    if (utf8) expand<Utf8Letters>(vocab, text.length());
+    else expand<OneByteLetters>(vocab, text.length());
+
+    flt_type lp = MIN_FLOAT;
+    if (text.length() > 0 && tokens.back().cost != MIN_SCORE) {
+        backtrace(text.length(), factors);
+        lp = tokens.back().cost;
+    }
+    reset();
+    return lp;
+}
+
+
+void forward(const FrozenStringSet &vocab,
              const string &text,
              vector<vector<Token> > &search,
-             vector<flt_type> &fw,
+             vector<score_type> &fw,
              bool utf8)
+{
+    ForwardSearch fws(search, fw);
+    search_factors(vocab, text, fws, utf8);
+    fws.finish(text.length());
+}
+
+
+void backward(const FrozenStringSet &vocab,
+              const string &text,
+              const vector<vector<Token> > &search,
+              const vector<score_type> &fw,
+              vector<score_type> &bw,
+              map<string, flt_type> &stats)
+{
+    backward(text, search, fw, bw, stats);
+}
+
+
+flt_type forward_backward(const FrozenStringSet &vocab,
+                          const string &text,
+                          map<string, flt_type> &stats,
+                          bool utf8)
 {
     int len = text.length();
+    if (len == 0) return MIN_FLOAT;
 
-    vector<unsigned int> char_positions;
-    get_character_positions(text, char_positions, utf8);
+    stats.clear();
+    vector<vector<Token> > search(len);
+    vector<score_type> fw(len, SMALL_LP); fw[0] = 0.0;
+    vector<score_type> bw(len, SMALL_LP); bw.back() = 0.0;
 
-    for (unsigned int cpi=0; cpi<char_positions.size(); cpi++) {
+    forward(vocab, text, search, fw, utf8);
+    backward(vocab, text, search, fw, bw, stats);
 
-        int i = char_positions[cpi];
-        if (i>0 && search[i-1].size() == 0) continue;
+    if (search[len-1].size() == 0) return MIN_FLOAT;
+    return fw.back();
+}
 
-        if (i>0) {
-            fw[i-1] = search[i-1][0].cost;
-            for (unsigned int t=1; t<search[i-1].size(); t++)
-                fw[i-1] = add_log_domain_probs(fw[i-1], search[i-1][t].cost);
-        }
 
-        // Iterate all factors starting from this position
-        const StringSet::Node *node = &vocab.root_node;
-        for (unsigned int j=i; j<text.length(); j++) {
+flt_type forward_backward(const FrozenStringSet &vocab,
+                          const string &text,
+                          map<string, flt_type> &stats,
+                          vector<score_type> &bw,
+                          bool utf8)
+{
+    int len = text.length();
+    if (len == 0) return MIN_FLOAT;
 
-            StringSet::Arc *arc = vocab.find_arc(text[j], node);
+    stats.clear();
+    vector<vector<Token> > search(len);
+    vector<score_type> fw(len, SMALL_LP); fw[0] = 0.0;
+    bw.resize(len, SMALL_LP); bw.back() = 0.0;
 
-            if (arc == nullptr) break;
-            node = arc->target_node;
+    forward(vocab, text, search, fw, utf8);
+    backward(vocab, text, search, fw, bw, stats);
 
-            // Factor associated with this node
-            if (arc->factor.length() > 0) {
-                flt_type cost = arc->cost;
-                if (i>0) cost += fw[i-1];
+    if (search[len-1].size() == 0) return MIN_FLOAT;
+    return fw.back();
+}
 
-                Token tok(i-1, cost);
-                search[j].push_back(tok);
-            }
-        }
+
+flt_type viterbi(const RadixStringSet &vocab,
+                 const string &text,
+                 vector<string> &best_path,
+                 bool reverse,
+                 bool utf8)
+{
+    best_path.clear();
+    if (text.length() == 0) return MIN_FLOAT;
+    vector<Token> search(text.length());
+    ViterbiSearch vit(search);
+    search_factors(vocab, text, vit, utf8);
+
+    // Look up the best path
+    int target = search.size()-1;
+    if (search[target].cost == MIN_SCORE) return MIN_FLOAT;
+
+    int source = search[target].source;
+    while (true) {
+        best_path.push_back(text.substr(source+1, target-source));
+        if (source == -1) break;
+        target = source;
+        source = search[target].source;
     }
 
-    if (search[len-1].size() == 0) return;
+    if (reverse) std::reverse(best_path.begin(), best_path.end());
+    return search.back().cost;
+}
+
+
+flt_type viterbi(const RadixStringSet &vocab,
+                 const string &text,
+                 vector<int> &best_path,
+                 bool reverse,
+                 bool utf8)
+{
+    best_path.clear();
+    if (text.length() == 0) return MIN_FLOAT;
+    vector<Token> search(text.length());
+    ViterbiSearch vit(search);
+    search_factors(vocab, text, vit, utf8);
+
+    // Look up the best path
+    int target = search.size()-1;
+    if (search[target].cost == MIN_SCORE) return MIN_FLOAT;
+
+    while (target != -1) {
+        best_path.push_back(search[target].factor);
+        target = search[target].source;
+    }
 
-    fw[len-1] = search[len-1][0].cost;
-    for (unsigned int j=1; j<search[len-1].size(); j++)
-        fw[len-1] = add_log_domain_probs(fw[len-1], search[len-1][j].cost);
+    if (reverse) std::reverse(best_path.begin(), best_path.end());
+    return search.back().cost;
 }
 
 
-void backward(const StringSet &vocab,
-              const string &text,
-              const vector<vector<Token> > &search,
-              const vector<flt_type> &fw,
-              vector<flt_type> &bw,
-              map<string, flt_type> &stats)
+flt_type viterbi(const RadixStringSet &vocab,
+                 const string &text,
+                 factor_stats_t &stats,
+                 bool utf8)
 {
-    int len = text.length();
-    if (search[len-1].size() == 0) return;
-
-    // Backward
-    for (int i=len-1; i>=0; i--) {
-        for (auto tok = search[i].cbegin(); tok != search[i].cend(); ++tok) {
-            flt_type normalized = tok->cost - fw[i] + bw[i];
-            if (bw[i] != SMALL_LP && fw[i] != SMALL_LP) {
-                stats[text.substr(tok->source+1, i-tok->source)] += exp(normalized);
-                if (tok->source == -1) continue;
-                if (bw[tok->source] != SMALL_LP) bw[tok->source] = add_log_domain_probs(bw[tok->source], normalized);
-                else bw[tok->source] = normalized;
-            }
-        }
-    }
+    stats.clear();
+    vector<int> best_path;
+    flt_type lp = viterbi(vocab, text, best_path, false, utf8);
+    for (auto it = best_path.begin(); it != best_path.end(); ++it)
+        stats.push_back(make_pair(*it, 1.0));
+    merge_stats(stats);
+    return lp;
 }
 
 
-flt_type forward_backward(const StringSet &vocab,
-                          const string &text,
-                          map<string, flt_type> &stats,
-                          bool utf8)
+void forward(const RadixStringSet &vocab,
+             const string &text,
+             vector<vector<Token> > &search,
+             vector<score_type> &fw,
+             bool utf8)
 {
-    int len = text.length();
-    if (len == 0) return MIN_FLOAT;
-
-    stats.clear();
-    vector<vector<Token> > search(len);
-    vector<flt_type> fw(len, SMALL_LP); fw[0] = 0.0;
-    vector<flt_type> bw(len, SMALL_LP); bw.back() = 0.0;
+    ForwardSearch fws(search, fw);
+    search_factors(vocab, text, fws, utf8);
+    fws.finish(text.length());
+}
 
-    forward(vocab, text, search, fw, utf8);
-    backward(vocab, text, search, fw, bw, stats);
 
-    if (search[len-1].size() == 0) return MIN_FLOAT;
-    return fw.back();
+void backward(const RadixStringSet &vocab,
+              const string &text,
+              const vector<vector<Token> > &search,
+              const vector<score_type> &fw,
+              vector<score_type> &bw,
+              factor_stats_t &stats)
+{
+    SegmentationWorkspace ws;
+    backward(text.length(), search, fw, bw, stats, ws);
+    merge_stats(stats);
 }
 
 
-flt_type forward_backward(const StringSet &vocab,
+flt_type forward_backward(const RadixStringSet &vocab,
                           const string &text,
-                          map<string, flt_type> &stats,
-                          vector<flt_type> &bw,
+                          factor_stats_t &stats,
                           bool utf8)
 {
     int len = text.length();
@@ -233,8 +1369,8 @@ flt_type forward_backward(const StringSet &vocab,
 
     stats.clear();
     vector<vector<Token> > search(len);
-    vector<flt_type> fw(len, SMALL_LP); fw[0] = 0.0;
-    bw.resize(len, SMALL_LP); bw.back() = 0.0;
+    vector<score_type> fw(len, SMALL_LP); fw[0] = 0.0;
+    vector<score_type> bw(len, SMALL_LP); bw.back() = 0.0;
 
     forward(vocab, text, search, fw, utf8);
     backward(vocab, text, search, fw, bw, stats);
@@ -244,33 +1380,6 @@ flt_type forward_backward(const StringSet &vocab,
 }
 
 
-flt_type forward_backward(const map<string, flt_type> &vocab,
-                          const string &text,
-                          map<string, flt_type> &stats,
-                          bool utf8)
-{
-    StringSet stringset_vocab(vocab);
-    return forward_backward(stringset_vocab, text, stats, utf8);
-}
-
-
-flt_type viterbi(const StringSet &vocab,
-                 const string &text,
-                 transitions_t &stats,
-                 const string &start_end_symbol)
-{
-    stats.clear();
-    vector<string> best_path;
-    flt_type lp = viterbi(vocab, text, best_path, true);
-    if (best_path.size() == 0) return MIN_FLOAT;
-    best_path.insert(best_path.begin(), start_end_symbol);
-    best_path.push_back(start_end_symbol);
-    for (unsigned int i=1; i<best_path.size(); i++)
-        stats[best_path[i-1]][best_path[i]] += 1.0;
-    return lp;
-}
-
-
 flt_type viterbi(const transitions_t &transitions,
                  FactorGraph &text,
                  vector<string> &best_path,
@@ -337,52 +1446,70 @@ flt_type viterbi(const transitions_t &transitions,
 }
 
 
+// The scores over the incoming arcs of a node are summed in one call,
+// in the order of the source node as when adding them along the arcs
 void forward(const transitions_t &transitions,
              FactorGraph &text,
-             vector<flt_type> &fw)
+             vector<score_type> &fw)
 {
-    for (unsigned int i=0; i<text.nodes.size(); i++) {
-
-        if (fw[i] == MIN_FLOAT) continue;
+    vector<flt_type> costs;
+    for (unsigned int i=1; i<text.nodes.size(); i++) {
 
         FactorGraph::Node &node = text.nodes[i];
-        for (auto arc = node.outgoing.begin(); arc != node.outgoing.end(); ++arc) {
+        string target_node_str = text.get_factor(node);
 
-            int tgt_node = (**arc).target_node;
+        costs.clear();
+        for (auto arc = node.incoming.begin(); arc != node.incoming.end(); ++arc) {
+
+            int src_node = (**arc).source_node;
+            if (fw[src_node] == MIN_SCORE) continue;
             try {
-                (**arc).cost = transitions.at(text.get_factor(node)).at(text.get_factor(tgt_node));
+                (**arc).cost = transitions.at(text.get_factor(src_node)).at(target_node_str);
             }
             catch (std::out_of_range &oor) {
                 (**arc).cost = SMALL_LP;
             }
-
-            flt_type cost = fw[i] + (**arc).cost;
-            if (fw[tgt_node] == MIN_FLOAT) fw[tgt_node] = cost;
-            else fw[tgt_node] = add_log_domain_probs(fw[tgt_node], cost);
+            costs.push_back(fw[src_node] + (**arc).cost);
         }
+        if (costs.size() > 0) fw[i] = sum_log_domain_probs(&costs[0], costs.size());
     }
 }
 
 
+// The backward scores are summed over the outgoing arcs of a node in one call,
+// from the last target as when adding them along the incoming arcs
 void backward(const FactorGraph &text,
-              const vector<flt_type> &fw,
-              vector<flt_type> &bw,
+              const vector<score_type> &fw,
+              vector<score_type> &bw,
               transitions_t &stats)
 {
+    vector<flt_type> costs;
+    for (int i=text.nodes.size()-2; i>=0; i--) {
+
+        if (fw[i] == MIN_SCORE) continue;
+
+        const FactorGraph::Node &node = text.nodes[i];
+        costs.clear();
+        for (auto arc = node.outgoing.rbegin(); arc != node.outgoing.rend(); ++arc) {
+            int tgt_node = (**arc).target_node;
+            if (bw[tgt_node] == MIN_SCORE) continue;
+            costs.push_back((**arc).cost + fw[i] - fw[tgt_node] + bw[tgt_node]);
+        }
+        if (costs.size() > 0) bw[i] = sum_log_domain_probs(&costs[0], costs.size());
+    }
+
     for (int i=text.nodes.size()-1; i>0; i--) {
 
-        if (bw[i] == MIN_FLOAT) continue;
+        if (bw[i] == MIN_SCORE) continue;
 
         const FactorGraph::Node &node = text.nodes[i];
         string target_node_str = text.get_factor(node);
 
         for (auto arc = node.incoming.begin(); arc != node.incoming.end(); ++arc) {
             int src_node = (**arc).source_node;
-            if (fw[src_node] == MIN_FLOAT) continue;
+            if (fw[src_node] == MIN_SCORE) continue;
             flt_type curr_cost = (**arc).cost + fw[src_node] - fw[i] + bw[i];
             stats[text.get_factor(src_node)][target_node_str] += exp(curr_cost);
-            if (bw[src_node] == MIN_FLOAT) bw[src_node] = curr_cost;
-            else bw[src_node] = add_log_domain_probs(bw[src_node], curr_cost);
         }
     }
 }
@@ -394,8 +1521,8 @@ flt_type forward_backward(const transitions_t &transitions,
 {
     if (text.nodes.size() == 0) return MIN_FLOAT;
 
-    vector<flt_type> fw(text.nodes.size(), MIN_FLOAT);
-    vector<flt_type> bw(text.nodes.size(), MIN_FLOAT);
+    vector<score_type> fw(text.nodes.size(), MIN_SCORE);
+    vector<score_type> bw(text.nodes.size(), MIN_SCORE);
     fw[0] = 0.0; bw[text.nodes.size()-1] = 0.0;
 
     forward(transitions, text, fw);
@@ -408,13 +1535,13 @@ flt_type forward_backward(const transitions_t &transitions,
 flt_type forward_backward(const transitions_t &transitions,
                           FactorGraph &text,
                           transitions_t &stats,
-                          vector<flt_type> &post_scores)
+                          vector<score_type> &post_scores)
 {
     if (text.nodes.size() == 0) return MIN_FLOAT;
     stats.clear();
 
-    vector<flt_type> fw(text.nodes.size(), MIN_FLOAT);
-    vector<flt_type> bw(text.nodes.size(), MIN_FLOAT);
+    vector<score_type> fw(text.nodes.size(), MIN_SCORE);
+    vector<score_type> bw(text.nodes.size(), MIN_SCORE);
     fw[0] = 0.0; bw[text.nodes.size()-1] = 0.0;
 
     forward(transitions, text, fw);
@@ -440,128 +1567,347 @@ flt_type forward_backward(const transitions_t &transitions,
     if (text.nodes.size() == 0) return MIN_FLOAT;
     stats.clear();
 
-    vector<flt_type> fw(text.nodes.size(), MIN_FLOAT);
-    vector<flt_type> bw(text.nodes.size(), MIN_FLOAT);
-    fw[0] = 0.0; bw[text.nodes.size()-1] = 0.0;
+    vector<score_type> fw(text.nodes.size(), MIN_SCORE);
+    vector<score_type> bw(text.nodes.size(), MIN_SCORE);
+    fw[0] = 0.0; bw[text.nodes.size()-1] = 0.0;
+
+    string source_node_str, target_node_str;
+
+    // Forward
+    for (unsigned int i=0; i<text.nodes.size(); i++) {
+
+        if (fw[i] == MIN_SCORE) continue;
+
+        FactorGraph::Node &node = text.nodes[i];
+        source_node_str = text.get_factor(node);
+        if (source_node_str == block) continue;
+
+        for (auto arc = node.outgoing.begin(); arc != node.outgoing.end(); ++arc) {
+
+            int tgt_node = (**arc).target_node;
+            target_node_str = text.get_factor(tgt_node);
+            if (target_node_str == block) continue;
+            try {
+                (**arc).cost = transitions.at(source_node_str).at(target_node_str);
+            }
+            catch (std::out_of_range &oor) {
+                (**arc).cost = SMALL_LP;
+            }
+
+            flt_type cost = fw[i] + (**arc).cost;
+            if (fw[tgt_node] == MIN_SCORE) fw[tgt_node] = cost;
+            else fw[tgt_node] = add_log_domain_probs(fw[tgt_node], cost);
+        }
+    }
+
+    backward(text, fw, bw, stats);
+
+    return fw.back();
+}
+
+
+flt_type forward_backward(const map<string, flt_type> &vocab,
+                          FactorGraph &text,
+                          transitions_t &stats)
+{
+    if (text.nodes.size() == 0) return MIN_FLOAT;
+    stats.clear();
+
+    vector<score_type> fw(text.nodes.size(), MIN_SCORE);
+    vector<score_type> bw(text.nodes.size(), MIN_SCORE);
+    fw[0] = 0.0; bw[text.nodes.size()-1] = 0.0;
+
+    // Forward
+    for (unsigned int i=0; i<text.nodes.size(); i++) {
+
+        if (fw[i] == MIN_SCORE) continue;
+
+        FactorGraph::Node &node = text.nodes[i];
+        for (auto arc = node.outgoing.begin(); arc != node.outgoing.end(); ++arc) {
+            int tgt_node = (**arc).target_node;
+            (**arc).cost = vocab.at(text.get_factor(tgt_node));
+            flt_type cost = fw[i] + (**arc).cost;
+            if (fw[tgt_node] == MIN_SCORE) fw[tgt_node] = cost;
+            else fw[tgt_node] = add_log_domain_probs(fw[tgt_node], cost);
+        }
+    }
+
+    backward(text, fw, bw, stats);
+
+    return fw.back();
+}
+
+
+flt_type posterior_decode(const transitions_t &transitions,
+                          FactorGraph &text,
+                          vector<string> &path,
+                          bool reverse)
+{
+    if (text.nodes.size() == 0) return MIN_FLOAT;
+    path.clear();
+
+    transitions_t stats;
+    vector<score_type> fw(text.nodes.size(), MIN_SCORE);
+    vector<score_type> bw(text.nodes.size(), MIN_SCORE);
+    fw[0] = 0.0; bw[text.nodes.size()-1] = 0.0;
+
+    forward(transitions, text, fw);
+    backward(text, fw, bw, stats);
+
+    // Initialize node scores
+    vector<flt_type> costs(text.nodes.size(), MIN_FLOAT);
+    vector<int> source_nodes(text.nodes.size());
+    costs[0] = 0.0; source_nodes[0] = -1;
+
+    // Traverse paths
+    for (unsigned int i=0; i<text.nodes.size(); i++) {
+
+        FactorGraph::Node &node = text.nodes[i];
+        for (auto arc = node.outgoing.begin(); arc != node.outgoing.end(); ++arc) {
+
+            int tgt_node = (**arc).target_node;
+            flt_type curr_cost = costs[tgt_node];
+            flt_type new_cost = costs[i] + bw[tgt_node];
+            if (new_cost > curr_cost) {
+                costs[tgt_node] = new_cost;
+                source_nodes[tgt_node] = i;
+            }
+        }
+    }
+
+    // Find best path
+    int node = text.nodes.size()-1;
+    path.push_back(text.get_factor(node));
+    while (true) {
+        node = source_nodes[node];
+        if (node == -1) break;
+        path.push_back(text.get_factor(node));
+    }
+    if (reverse) std::reverse(path.begin(), path.end());
+
+    return costs.back();
+}
+
+
+flt_type viterbi(const TransitionTable &transitions,
+                 FlatFactorGraph &text,
+                 vector<string> &best_path,
+                 bool reverse)
+{
+    if (text.nodes.size() == 0) return MIN_FLOAT;
+    best_path.clear();
+
+    // Initialize node scores
+    vector<flt_type> costs(text.nodes.size(), MIN_FLOAT);
+    vector<int> source_nodes(text.nodes.size());
+    costs[0] = 0.0; source_nodes[0] = -1;
+
+    // Traverse paths
+    for (unsigned int i=0; i<text.nodes.size(); i++) {
+
+        for (unsigned int arc=text.outgoing_offsets[i]; arc<text.outgoing_offsets[i+1]; arc++) {
+
+            int tgt_node = text.arc_targets[arc];
+            text.arc_costs[arc] = transitions.cost(text.nodes[i].factor, text.nodes[tgt_node].factor);
+
+            flt_type curr_cost = costs[tgt_node];
+            flt_type new_cost = costs[i] + text.arc_costs[arc];
+            if (new_cost > curr_cost) {
+                costs[tgt_node] = new_cost;
+                source_nodes[tgt_node] = i;
+            }
+        }
+    }
+
+    // Find best path
+    int node = text.nodes.size()-1;
+    best_path.push_back(text.get_factor(node));
+    while (true) {
+        node = source_nodes[node];
+        if (node == -1) break;
+        best_path.push_back(text.get_factor(node));
+    }
+    if (reverse) std::reverse(best_path.begin(), best_path.end());
+
+    return costs.back();
+}
+
+
+flt_type viterbi(const TransitionTable &transitions,
+                 FlatFactorGraph &text,
+                 transitions_t &stats,
+                 flt_type multiplier)
+{
+    vector<string> best_path;
+    flt_type lp = viterbi(transitions, text, best_path, true);
+    if (best_path.size() < 2) return MIN_FLOAT;
+    for (unsigned int i=1; i<best_path.size(); i++)
+        stats[best_path[i-1]][best_path[i]] += multiplier;
+    return lp;
+}
+
+
+// The scores over the incoming arcs of a node are summed in one call,
+// in the order of the source node as when adding them along the arcs
+void forward(const TransitionTable &transitions,
+             FlatFactorGraph &text,
+             vector<score_type> &fw)
+{
+    vector<flt_type> costs;
+    for (unsigned int i=1; i<text.nodes.size(); i++) {
+
+        costs.clear();
+        for (unsigned int in=text.incoming_offsets[i]; in<text.incoming_offsets[i+1]; in++) {
+            unsigned int arc = text.incoming_arcs[in];
+            int src_node = text.arc_sources[arc];
+            text.arc_costs[arc] = transitions.cost(text.nodes[src_node].factor, text.nodes[i].factor);
+            if (fw[src_node] != MIN_SCORE) costs.push_back(fw[src_node] + text.arc_costs[arc]);
+        }
+        if (costs.size() > 0) fw[i] = sum_log_domain_probs(&costs[0], costs.size());
+    }
+}
+
+
+// Adds the arc posteriors to the statistics by the factor pair of the arc,
+// in the order of the backward pass, arcs with a negative posterior were not visited
+static void add_arc_stats(const FlatFactorGraph &text,
+                          const vector<flt_type> &arc_posts,
+                          transitions_t &stats)
+{
+    // Sorted by the factor pair and the order of the pass
+    vector<pair<unsigned long long, unsigned int> > pairs;
+    for (int i=text.nodes.size()-1; i>0; i--) {
+        for (unsigned int in=text.incoming_offsets[i]; in<text.incoming_offsets[i+1]; in++) {
+            unsigned int arc = text.incoming_arcs[in];
+            if (arc_posts[arc] < 0.0) continue;
+            unsigned long long key = FrozenMultiStringFactorGraph::bigram_key(text.nodes[text.arc_sources[arc]].factor,
+                                                                             text.nodes[i].factor);
+            pairs.push_back(make_pair(key, in));
+        }
+    }
+    sort(pairs.begin(), pairs.end(),
+         [](const pair<unsigned long long, unsigned int> &a, const pair<unsigned long long, unsigned int> &b)
+         { return a.first < b.first || (a.first == b.first && a.second > b.second); });
 
     string source_node_str, target_node_str;
+    for (unsigned int i=0; i<pairs.size(); ) {
+        unsigned int arc = text.incoming_arcs[pairs[i].second];
+        flt_type sum = arc_posts[arc];
+        unsigned int j = i+1;
+        for (; j<pairs.size() && pairs[j].first == pairs[i].first; j++)
+            sum += arc_posts[text.incoming_arcs[pairs[j].second]];
+        text.get_factor(text.arc_sources[arc], source_node_str);
+        text.get_factor(text.arc_targets[arc], target_node_str);
+        stats[source_node_str][target_node_str] += sum;
+        i = j;
+    }
+}
 
-    // Forward
-    for (unsigned int i=0; i<text.nodes.size(); i++) {
-
-        if (fw[i] == MIN_FLOAT) continue;
 
-        FactorGraph::Node &node = text.nodes[i];
-        source_node_str = text.get_factor(node);
-        if (source_node_str == block) continue;
+// The backward scores are summed over the outgoing arcs of a node in one call,
+// from the last target as when adding them along the incoming arcs
+// The posteriors are collected per arc and converted to strings once per factor pair
+void backward(const FlatFactorGraph &text,
+              const vector<score_type> &fw,
+              vector<score_type> &bw,
+              transitions_t &stats)
+{
+    vector<flt_type> arc_posts(text.num_arcs(), -1.0);
+    vector<flt_type> costs;
 
-        for (auto arc = node.outgoing.begin(); arc != node.outgoing.end(); ++arc) {
+    for (int i=text.nodes.size()-2; i>=0; i--) {
 
-            int tgt_node = (**arc).target_node;
-            target_node_str = text.get_factor(tgt_node);
-            if (target_node_str == block) continue;
-            try {
-                (**arc).cost = transitions.at(source_node_str).at(target_node_str);
-            }
-            catch (std::out_of_range &oor) {
-                (**arc).cost = SMALL_LP;
-            }
+        if (fw[i] == MIN_SCORE) continue;
 
-            flt_type cost = fw[i] + (**arc).cost;
-            if (fw[tgt_node] == MIN_FLOAT) fw[tgt_node] = cost;
-            else fw[tgt_node] = add_log_domain_probs(fw[tgt_node], cost);
+        costs.clear();
+        for (unsigned int arc=text.outgoing_offsets[i+1]; arc-- > text.outgoing_offsets[i]; ) {
+            int tgt_node = text.arc_targets[arc];
+            if (bw[tgt_node] == MIN_SCORE) continue;
+            flt_type curr_cost = text.arc_costs[arc] + fw[i] - fw[tgt_node] + bw[tgt_node];
+            arc_posts[arc] = exp(curr_cost);
+            costs.push_back(curr_cost);
         }
+        if (costs.size() > 0) bw[i] = sum_log_domain_probs(&costs[0], costs.size());
     }
 
-    backward(text, fw, bw, stats);
-
-    return fw.back();
+    add_arc_stats(text, arc_posts, stats);
 }
 
 
-flt_type forward_backward(const map<string, flt_type> &vocab,
-                          FactorGraph &text,
+flt_type forward_backward(const TransitionTable &transitions,
+                          FlatFactorGraph &text,
                           transitions_t &stats)
 {
     if (text.nodes.size() == 0) return MIN_FLOAT;
-    stats.clear();
 
-    vector<flt_type> fw(text.nodes.size(), MIN_FLOAT);
-    vector<flt_type> bw(text.nodes.size(), MIN_FLOAT);
+    vector<score_type> fw(text.nodes.size(), MIN_SCORE);
+    vector<score_type> bw(text.nodes.size(), MIN_SCORE);
     fw[0] = 0.0; bw[text.nodes.size()-1] = 0.0;
 
-    // Forward
-    for (unsigned int i=0; i<text.nodes.size(); i++) {
-
-        if (fw[i] == MIN_FLOAT) continue;
-
-        FactorGraph::Node &node = text.nodes[i];
-        for (auto arc = node.outgoing.begin(); arc != node.outgoing.end(); ++arc) {
-            int tgt_node = (**arc).target_node;
-            (**arc).cost = vocab.at(text.get_factor(tgt_node));
-            flt_type cost = fw[i] + (**arc).cost;
-            if (fw[tgt_node] == MIN_FLOAT) fw[tgt_node] = cost;
-            else fw[tgt_node] = add_log_domain_probs(fw[tgt_node], cost);
-        }
-    }
-
+    forward(transitions, text, fw);
     backward(text, fw, bw, stats);
 
     return fw.back();
 }
 
 
-flt_type posterior_decode(const transitions_t &transitions,
-                          FactorGraph &text,
-                          vector<string> &path,
-                          bool reverse)
+flt_type forward_backward(const TransitionTable &transitions,
+                          FlatFactorGraph &text,
+                          transitions_t &stats,
+                          vector<score_type> &post_scores)
 {
     if (text.nodes.size() == 0) return MIN_FLOAT;
-    path.clear();
+    stats.clear();
 
-    transitions_t stats;
-    vector<flt_type> fw(text.nodes.size(), MIN_FLOAT);
-    vector<flt_type> bw(text.nodes.size(), MIN_FLOAT);
+    vector<score_type> fw(text.nodes.size(), MIN_SCORE);
+    vector<score_type> bw(text.nodes.size(), MIN_SCORE);
     fw[0] = 0.0; bw[text.nodes.size()-1] = 0.0;
 
     forward(transitions, text, fw);
     backward(text, fw, bw, stats);
 
-    // Initialize node scores
-    vector<flt_type> costs(text.nodes.size(), MIN_FLOAT);
-    vector<int> source_nodes(text.nodes.size());
-    costs[0] = 0.0; source_nodes[0] = -1;
+    post_scores.clear();
+    post_scores.resize(text.text.size());
+    for (unsigned int i=1; i<text.nodes.size()-1; i++) {
+        int idx = int(text.nodes[i].start_pos) + int(text.nodes[i].len) - 1;
+        if (post_scores[idx] == 0.0) post_scores[idx] = bw[i];
+        else post_scores[idx] = add_log_domain_probs(post_scores[idx], bw[i]);
+    }
 
-    // Traverse paths
-    for (unsigned int i=0; i<text.nodes.size(); i++) {
+    return fw.back();
+}
 
-        FactorGraph::Node &node = text.nodes[i];
-        for (auto arc = node.outgoing.begin(); arc != node.outgoing.end(); ++arc) {
 
-            int tgt_node = (**arc).target_node;
-            flt_type curr_cost = costs[tgt_node];
-            flt_type new_cost = costs[i] + bw[tgt_node];
-            if (new_cost > curr_cost) {
-                costs[tgt_node] = new_cost;
-                source_nodes[tgt_node] = i;
-            }
+flt_type forward_backward(const FrozenStringSet &vocab,
+                          FlatFactorGraph &text,
+                          transitions_t &stats)
+{
+    if (text.nodes.size() == 0) return MIN_FLOAT;
+    stats.clear();
+
+    vector<score_type> fw(text.nodes.size(), MIN_SCORE);
+    vector<score_type> bw(text.nodes.size(), MIN_SCORE);
+    fw[0] = 0.0; bw[text.nodes.size()-1] = 0.0;
+
+    // Forward
+    vector<flt_type> costs;
+    for (unsigned int i=1; i<text.nodes.size(); i++) {
+
+        costs.clear();
+        for (unsigned int in=text.incoming_offsets[i]; in<text.incoming_offsets[i+1]; in++) {
+            unsigned int arc = text.incoming_arcs[in];
+            int src_node = text.arc_sources[arc];
+            text.arc_costs[arc] = vocab.factor_cost(text.nodes[i].factor);
+            if (fw[src_node] != MIN_SCORE) costs.push_back(fw[src_node] + text.arc_costs[arc]);
         }
+        if (costs.size() > 0) fw[i] = sum_log_domain_probs(&costs[0], costs.size());
     }
 
-    // Find best path
-    int node = text.nodes.size()-1;
-    path.push_back(text.get_factor(node));
-    while (true) {
-        node = source_nodes[node];
-        if (node == -1) break;
-        path.push_back(text.get_factor(node));
-    }
-    if (reverse) std::reverse(path.begin(), path.end());
+    backward(text, fw, bw, stats);
 
-    return costs.back();
+    return fw.back();
 }
 
-
 void
 assign_scores(transitions_t &transitions,
               MultiStringFactorGraph &msfg)
@@ -627,17 +1973,17 @@ assign_scores(map<string, flt_type> &vocab,
 
 void
 forward(const MultiStringFactorGraph &msfg,
-        vector<flt_type> &fw)
+        vector<score_type> &fw)
 {
     for (unsigned int i=0; i<msfg.nodes.size(); i++) {
 
-        if (fw[i] == MIN_FLOAT) continue;
+        if (fw[i] == MIN_SCORE) continue;
 
         const MultiStringFactorGraph::Node &node = msfg.nodes[i];
         for (auto arc = node.outgoing.begin(); arc != node.outgoing.end(); ++arc) {
             int tgt_node = (**arc).target_node;
             flt_type cost = fw[i] + *(**arc).cost;
-            if (fw[tgt_node] == MIN_FLOAT) fw[tgt_node] = cost;
+            if (fw[tgt_node] == MIN_SCORE) fw[tgt_node] = cost;
             else fw[tgt_node] = add_log_domain_probs(fw[tgt_node], cost);
         }
     }
@@ -647,7 +1993,7 @@ forward(const MultiStringFactorGraph &msfg,
 flt_type
 forward(const string &text,
         const MultiStringFactorGraph &msfg,
-        map<msfg_node_idx_t, flt_type> &fw)
+        map<msfg_node_idx_t, score_type> &fw)
 {
     map<msfg_node_idx_t, vector<MultiStringFactorGraph::Arc*> > arcs;
     msfg.collect_arcs(text, arcs);
@@ -676,14 +2022,14 @@ forward(const map<string, flt_type> &words,
     flt_type total_lp = 0.0;
 
     if (full_forward_pass) {
-        vector<flt_type> fw;
+        vector<score_type> fw;
         forward(msfg, fw);
         for (auto wit = words_to_fb.cbegin(); wit != words_to_fb.cend(); ++wit)
             total_lp += words.at(*wit) * fw.at(msfg.string_end_nodes.at(*wit));
     }
     else {
         for (auto wit = words_to_fb.cbegin(); wit != words_to_fb.cend(); ++wit) {
-            map<msfg_node_idx_t, flt_type> fw;
+            map<msfg_node_idx_t, score_type> fw;
             total_lp += words.at(*wit) * forward(*wit, msfg, fw);
         }
     }
@@ -696,7 +2042,7 @@ flt_type
 likelihood_fb(const string &text,
               const MultiStringFactorGraph &msfg)
 {
-    map<msfg_node_idx_t, flt_type> fw;
+    map<msfg_node_idx_t, score_type> fw;
     int text_end_node = msfg.string_end_nodes.at(text);
     set<int> nodes_to_process; nodes_to_process.insert(text_end_node);
     fw[text_end_node] = 0.0;
@@ -726,7 +2072,7 @@ flt_type
 likelihood_viterbi(const string &text,
                    const MultiStringFactorGraph &msfg)
 {
-    map<msfg_node_idx_t, flt_type> fw;
+    map<msfg_node_idx_t, score_type> fw;
     int text_end_node = msfg.string_end_nodes.at(text);
     set<int> nodes_to_process; nodes_to_process.insert(text_end_node);
     fw[text_end_node] = 0.0;
@@ -741,7 +2087,7 @@ likelihood_viterbi(const string &text,
             int src_node = (**arc).source_node;
             flt_type cost = fw[i] + *(**arc).cost;
             if (fw.find(src_node) == fw.end()) fw[src_node] = cost;
-            else fw[src_node] = max(fw[src_node], cost);
+            else fw[src_node] = max(fw[src_node], (score_type)cost);
             nodes_to_process.insert(src_node);
         }
 
@@ -773,13 +2119,13 @@ likelihood(const map<string, flt_type> &words,
 flt_type
 backward(const MultiStringFactorGraph &msfg,
          const string &text,
-         const vector<flt_type> &fw,
+         const vector<score_type> &fw,
          transitions_t &stats,
          flt_type text_weight)
 {
 
     int text_end_node = msfg.string_end_nodes.at(text);
-    map<int, flt_type> bw; bw[text_end_node] = 0.0;
+    map<int, score_type> bw; bw[text_end_node] = 0.0;
     set<int> nodes_to_process; nodes_to_process.insert(text_end_node);
 
     while(nodes_to_process.size() > 0) {
@@ -790,7 +2136,7 @@ backward(const MultiStringFactorGraph &msfg,
 
         for (auto arc = node.incoming.begin(); arc != node.incoming.end(); ++arc) {
             int src_node = (**arc).source_node;
-            if (fw[src_node] == MIN_FLOAT) continue;
+            if (fw[src_node] == MIN_SCORE) continue;
             flt_type curr_cost = *(**arc).cost + fw[src_node] - fw[i] + bw[i];
             stats[msfg.nodes.at(src_node).factor][node.factor] += text_weight * exp(curr_cost);
             if (bw.find(src_node) == bw.end()) {
@@ -810,13 +2156,13 @@ backward(const MultiStringFactorGraph &msfg,
 flt_type
 backward(const MultiStringFactorGraph &msfg,
          const string &text,
-         const map<msfg_node_idx_t, flt_type> &fw,
+         const map<msfg_node_idx_t, score_type> &fw,
          transitions_t &stats,
          flt_type text_weight)
 {
 
     int text_end_node = msfg.string_end_nodes.at(text);
-    map<int, flt_type> bw; bw[text_end_node] = 0.0;
+    map<int, score_type> bw; bw[text_end_node] = 0.0;
     set<int> nodes_to_process; nodes_to_process.insert(text_end_node);
 
     while(nodes_to_process.size() > 0) {
@@ -850,7 +2196,7 @@ forward_backward(const MultiStringFactorGraph &msfg,
 {
     if (msfg.nodes.size() == 0) return MIN_FLOAT;
 
-    vector<flt_type> fw(msfg.nodes.size(), MIN_FLOAT);
+    vector<score_type> fw(msfg.nodes.size(), MIN_SCORE);
     fw[0] = 0.0;
 
     forward(msfg, fw);
@@ -871,7 +2217,7 @@ forward_backward(const MultiStringFactorGraph &msfg,
 {
     if (msfg.nodes.size() == 0) return MIN_FLOAT;
 
-    map<msfg_node_idx_t, flt_type> fw;
+    map<msfg_node_idx_t, score_type> fw;
     fw[0] = 0.0;
 
     forward(text, msfg, fw);
@@ -886,7 +2232,7 @@ viterbi(const MultiStringFactorGraph &msfg,
         const string &text,
         vector<string> &best_path)
 {
-    map<msfg_node_idx_t, flt_type> scores;
+    map<msfg_node_idx_t, score_type> scores;
     map<msfg_node_idx_t, msfg_node_idx_t> sources;
     unsigned int text_end_node = msfg.string_end_nodes.at(text);
     set<unsigned int> nodes_to_process; nodes_to_process.insert(text_end_node);
@@ -944,12 +2290,12 @@ flt_type viterbi(const MultiStringFactorGraph &msfg,
 {
     if (msfg.nodes.size() == 0) return MIN_FLOAT;
 
-    vector<flt_type> fw(msfg.nodes.size(), MIN_FLOAT);
+    vector<score_type> fw(msfg.nodes.size(), MIN_SCORE);
     vector<int> source_nodes(msfg.nodes.size(), -1);
     fw[0] = 0.0;
 
     for (unsigned int i=0; i<msfg.nodes.size(); i++) {
-        if (fw[i] == MIN_FLOAT) continue;
+        if (fw[i] == MIN_SCORE) continue;
         const MultiStringFactorGraph::Node &node = msfg.nodes[i];
         for (auto arc = node.outgoing.begin(); arc != node.outgoing.end(); ++arc) {
             int tgt_node = (**arc).target_node;
@@ -976,3 +2322,356 @@ flt_type viterbi(const MultiStringFactorGraph &msfg,
 
     return total_lp;
 }
+
+
+// Targets of one source factor by the factor index
+static bool factor_below(const pair<int, flt_type> &target, int factor)
+{
+    return target.first < factor;
+}
+
+
+// Sets the costs of the outgoing arcs of the nodes of the source factor
+// to the bigram costs, the targets are sorted by the factor index
+static void score_factor_arcs(FrozenMultiStringFactorGraph &msfg,
+                              int factor,
+                              const vector<pair<int, flt_type> > &targets,
+                              vector<bool> *scored)
+{
+    for (unsigned int i=msfg.factor_node_offsets[factor]; i<msfg.factor_node_offsets[factor+1]; i++) {
+        msfg_node_idx_t node = msfg.factor_nodes[i];
+        for (unsigned int arc=msfg.outgoing_offsets[node]; arc<msfg.outgoing_offsets[node+1]; arc++) {
+            if (msfg.arc_removed[arc]) continue;
+            int target = msfg.node_factors[msfg.arc_targets[arc]];
+            auto tgtit = lower_bound(targets.begin(), targets.end(), target, factor_below);
+            if (tgtit != targets.end() && tgtit->first == target) {
+                msfg.arc_costs[arc] = tgtit->second;
+                if (scored != nullptr) (*scored)[arc] = true;
+            }
+        }
+    }
+}
+
+
+void
+assign_scores(transitions_t &transitions,
+              FrozenMultiStringFactorGraph &msfg)
+{
+    msfg.arc_costs.assign(msfg.arc_count(), MIN_FLOAT);
+    vector<bool> scored(msfg.arc_count(), false);
+
+    vector<pair<int, flt_type> > targets;
+    for (auto it = transitions.begin(); it != transitions.end(); ++it) {
+        int factor = msfg.factor_index(it->first);
+        if (factor < 0 || msfg.factor_removed[factor]) continue;
+
+        // Sorted by the index as the factors are sorted in the graph
+        targets.clear();
+        for (auto tgtit = it->second.begin(); tgtit != it->second.end(); ++tgtit) {
+            int target = msfg.factor_index(tgtit->first);
+            if (target >= 0) targets.push_back(make_pair(target, tgtit->second));
+        }
+        score_factor_arcs(msfg, factor, targets, &scored);
+    }
+
+    for (unsigned int arc=0; arc<msfg.arc_count(); arc++)
+        if (!scored[arc]) msfg.arc_removed[arc] = true;
+
+    for (unsigned int i=0; i<msfg.factor_strings.size(); i++)
+        if (!msfg.factor_removed[i] && transitions.find(msfg.factor_strings[i]) == transitions.end())
+            msfg.remove_arcs(msfg.factor_strings[i]);
+}
+
+
+void
+update_scores(const transitions_t &transitions,
+              const transitions_t &changes,
+              FrozenMultiStringFactorGraph &msfg)
+{
+    vector<pair<int, flt_type> > targets;
+    for (auto it = changes.begin(); it != changes.end(); ++it) {
+        int factor = msfg.factor_index(it->first);
+        auto srcit = transitions.find(it->first);
+        if (factor < 0 || msfg.factor_removed[factor] || srcit == transitions.end()) continue;
+
+        targets.clear();
+        for (auto chit = it->second.begin(); chit != it->second.end(); ++chit) {
+            int target = msfg.factor_index(chit->first);
+            auto tgtit = srcit->second.find(chit->first);
+            if (target >= 0 && tgtit != srcit->second.end())
+                targets.push_back(make_pair(target, tgtit->second));
+        }
+        score_factor_arcs(msfg, factor, targets, nullptr);
+    }
+}
+
+
+void
+assign_scores(map<string, flt_type> &vocab,
+              FrozenMultiStringFactorGraph &msfg)
+{
+    msfg.arc_costs.assign(msfg.arc_count(), MIN_FLOAT);
+    vector<bool> scored(msfg.arc_count(), false);
+
+    for (unsigned int factor=0; factor<msfg.factor_strings.size(); factor++) {
+        if (msfg.factor_removed[factor]) continue;
+        auto vocabit = vocab.find(msfg.factor_strings[factor]);
+        if (vocabit == vocab.end()) continue;
+        for (unsigned int i=msfg.factor_node_offsets[factor]; i<msfg.factor_node_offsets[factor+1]; i++) {
+            msfg_node_idx_t node = msfg.factor_nodes[i];
+            for (unsigned int j=msfg.incoming_offsets[node]; j<msfg.incoming_offsets[node+1]; j++) {
+                unsigned int arc = msfg.incoming_arcs[j];
+                if (msfg.arc_removed[arc]) continue;
+                msfg.arc_costs[arc] = vocabit->second;
+                scored[arc] = true;
+            }
+        }
+    }
+
+    for (unsigned int arc=0; arc<msfg.arc_count(); arc++)
+        if (!scored[arc]) msfg.arc_removed[arc] = true;
+
+    for (unsigned int i=0; i<msfg.factor_strings.size(); i++)
+        if (!msfg.factor_removed[i] && vocab.find(msfg.factor_strings[i]) == vocab.end())
+            msfg.remove_arcs(msfg.factor_strings[i]);
+}
+
+
+// The scores over the incoming arcs of a node are summed in one call,
+// in the order of the source node as when adding them along the arcs
+void
+forward(const FrozenMultiStringFactorGraph &msfg,
+        vector<score_type> &fw)
+{
+    vector<flt_type> costs;
+    for (unsigned int i=0; i<msfg.node_count(); i++) {
+
+        costs.clear();
+        for (unsigned int j=msfg.incoming_offsets[i]; j<msfg.incoming_offsets[i+1]; j++) {
+            unsigned int arc = msfg.incoming_arcs[j];
+            if (msfg.arc_removed[arc]) continue;
+            msfg_node_idx_t src_node = msfg.arc_sources[arc];
+            if (fw[src_node] != MIN_SCORE) costs.push_back(fw[src_node] + msfg.arc_costs[arc]);
+        }
+        if (costs.size() > 0) fw[i] = sum_log_domain_probs(&costs[0], costs.size());
+    }
+}
+
+
+// The nodes of one string are processed from the end node backwards,
+// a node is final when it is the last one in the queue
+static inline void queue_node(FrozenMSFGWorkspace &ws,
+                              msfg_node_idx_t node)
+{
+    ws.queued[node] = 1;
+    ws.queue.push_back(node);
+    push_heap(ws.queue.begin(), ws.queue.end());
+}
+
+
+static inline msfg_node_idx_t next_node(FrozenMSFGWorkspace &ws)
+{
+    pop_heap(ws.queue.begin(), ws.queue.end());
+    msfg_node_idx_t node = ws.queue.back();
+    ws.queue.pop_back();
+    return node;
+}
+
+
+// Clears the entry of a processed node for the next pass
+static inline void clear_node(FrozenMSFGWorkspace &ws,
+                              msfg_node_idx_t node)
+{
+    ws.scores[node] = MIN_SCORE;
+    ws.queued[node] = 0;
+}
+
+
+flt_type
+likelihood_fb(const string &text,
+              const FrozenMultiStringFactorGraph &msfg,
+              FrozenMSFGWorkspace &ws)
+{
+    flt_type lp = MIN_FLOAT;
+    msfg_node_idx_t text_end_node = msfg.string_end_nodes.at(text);
+    ws.scores[text_end_node] = 0.0;
+    queue_node(ws, text_end_node);
+
+    while (ws.queue.size() > 0) {
+
+        msfg_node_idx_t i = next_node(ws);
+
+        for (unsigned int j=msfg.incoming_offsets[i]; j<msfg.incoming_offsets[i+1]; j++) {
+            unsigned int arc = msfg.incoming_arcs[j];
+            if (msfg.arc_removed[arc]) continue;
+            msfg_node_idx_t src_node = msfg.arc_sources[arc];
+            flt_type cost = ws.scores[i] + msfg.arc_costs[arc];
+            if (!ws.queued[src_node]) {
+                ws.scores[src_node] = cost;
+                queue_node(ws, src_node);
+            }
+            else ws.scores[src_node] = add_log_domain_probs(ws.scores[src_node], cost);
+        }
+
+        if (i == 0) lp = ws.scores[0];
+        clear_node(ws, i);
+    }
+
+    return lp;
+}
+
+
+flt_type
+likelihood_viterbi(const string &text,
+                   const FrozenMultiStringFactorGraph &msfg,
+                   FrozenMSFGWorkspace &ws)
+{
+    flt_type lp = MIN_FLOAT;
+    msfg_node_idx_t text_end_node = msfg.string_end_nodes.at(text);
+    ws.scores[text_end_node] = 0.0;
+    queue_node(ws, text_end_node);
+
+    while (ws.queue.size() > 0) {
+
+        msfg_node_idx_t i = next_node(ws);
+
+        for (unsigned int j=msfg.incoming_offsets[i]; j<msfg.incoming_offsets[i+1]; j++) {
+            unsigned int arc = msfg.incoming_arcs[j];
+            if (msfg.arc_removed[arc]) continue;
+            msfg_node_idx_t src_node = msfg.arc_sources[arc];
+            flt_type cost = ws.scores[i] + msfg.arc_costs[arc];
+            if (!ws.queued[src_node]) {
+                ws.scores[src_node] = cost;
+                queue_node(ws, src_node);
+            }
+            else ws.scores[src_node] = max(ws.scores[src_node], (score_type)cost);
+        }
+
+        if (i == 0) lp = ws.scores[0];
+        clear_node(ws, i);
+    }
+
+    return lp;
+}
+
+
+flt_type
+likelihood(const map<string, flt_type> &words,
+           const set<string> &selected_words,
+           const FrozenMultiStringFactorGraph &msfg,
+           FrozenMSFGWorkspace &ws,
+           bool forward_backward)
+{
+    flt_type total_lp = 0.0;
+
+    for (auto it = selected_words.cbegin(); it != selected_words.cend(); ++it)
+        if (forward_backward)
+            total_lp += words.at(*it) * likelihood_fb(*it, msfg, ws);
+        else
+            total_lp += words.at(*it) * likelihood_viterbi(*it, msfg, ws);
+
+    return total_lp;
+}
+
+
+flt_type
+backward(const FrozenMultiStringFactorGraph &msfg,
+         const string &text,
+         const vector<score_type> &fw,
+         bigram_stats_t &stats,
+         FrozenMSFGWorkspace &ws,
+         flt_type text_weight)
+{
+    msfg_node_idx_t text_end_node = msfg.string_end_nodes.at(text);
+    ws.scores[text_end_node] = 0.0;
+    queue_node(ws, text_end_node);
+
+    while (ws.queue.size() > 0) {
+
+        msfg_node_idx_t i = next_node(ws);
+        int tgt_factor = msfg.node_factors[i];
+
+        for (unsigned int j=msfg.incoming_offsets[i]; j<msfg.incoming_offsets[i+1]; j++) {
+            unsigned int arc = msfg.incoming_arcs[j];
+            if (msfg.arc_removed[arc]) continue;
+            msfg_node_idx_t src_node = msfg.arc_sources[arc];
+            if (fw[src_node] == MIN_SCORE) continue;
+            flt_type curr_cost = msfg.arc_costs[arc] + fw[src_node] - fw[i] + ws.scores[i];
+            unsigned long long key = FrozenMultiStringFactorGraph::bigram_key(msfg.node_factors[src_node], tgt_factor);
+            stats[key] += text_weight * exp(curr_cost);
+            if (!ws.queued[src_node]) {
+                ws.scores[src_node] = curr_cost;
+                queue_node(ws, src_node);
+            }
+            else ws.scores[src_node] = add_log_domain_probs(ws.scores[src_node], curr_cost);
+        }
+
+        clear_node(ws, i);
+    }
+
+    return fw.at(text_end_node);
+}
+
+
+flt_type
+forward_backward(const FrozenMultiStringFactorGraph &msfg,
+                 const map<string, flt_type> &word_freqs,
+                 bigram_stats_t &stats)
+{
+    if (msfg.node_count() == 0) return MIN_FLOAT;
+
+    vector<score_type> fw(msfg.node_count(), MIN_SCORE);
+    fw[0] = 0.0;
+
+    forward(msfg, fw);
+    FrozenMSFGWorkspace ws(msfg);
+    flt_type total_lp = 0.0;
+    for (auto it = msfg.string_end_nodes.begin(); it != msfg.string_end_nodes.end(); ++it) {
+        flt_type lp = backward(msfg, it->first, fw, stats, ws, word_freqs.at(it->first));
+        total_lp += word_freqs.at(it->first) * lp;
+    }
+
+    return total_lp;
+}
+
+
+flt_type viterbi(const FrozenMultiStringFactorGraph &msfg,
+                 const map<string, flt_type> &word_freqs,
+                 bigram_stats_t &stats)
+{
+    if (msfg.node_count() == 0) return MIN_FLOAT;
+
+    vector<score_type> fw(msfg.node_count(), MIN_SCORE);
+    vector<int> source_nodes(msfg.node_count(), -1);
+    fw[0] = 0.0;
+
+    for (unsigned int i=0; i<msfg.node_count(); i++) {
+        if (fw[i] == MIN_SCORE) continue;
+        for (unsigned int arc=msfg.outgoing_offsets[i]; arc<msfg.outgoing_offsets[i+1]; arc++) {
+            if (msfg.arc_removed[arc]) continue;
+            msfg_node_idx_t tgt_node = msfg.arc_targets[arc];
+            flt_type cost = fw[i] + msfg.arc_costs[arc];
+            if (cost > fw[tgt_node]) {
+                fw[tgt_node] = cost;
+                source_nodes[tgt_node] = i;
+            }
+        }
+    }
+
+    flt_type total_lp = 0.0;
+    for (auto it = msfg.string_end_nodes.begin(); it != msfg.string_end_nodes.end(); ++it) {
+        msfg_node_idx_t text_end_node = it->second;
+        int curr_node = text_end_node;
+        while (curr_node != 0) {
+            if (source_nodes[curr_node] < 0) throw string("Problem in backtracking Viterbi path.");
+            msfg_node_idx_t src_node = source_nodes[curr_node];
+            unsigned long long key = FrozenMultiStringFactorGraph::bigram_key(msfg.node_factors[src_node],
+                                                                             msfg.node_factors[curr_node]);
+            stats[key] += word_freqs.at(it->first);
+            curr_node = src_node;
+        }
+        total_lp += word_freqs.at(it->first) * fw.at(text_end_node);
+    }
+
+    return total_lp;
+}
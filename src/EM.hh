@@ -7,7 +7,12 @@
 
 #include "defs.hh"
 #include "StringSet.hh"
+#include "FrozenStringSet.hh"
+#include "FrozenMSFG.hh"
+#include "RadixStringSet.hh"
 #include "FactorGraph.hh"
+#include "FlatFactorGraph.hh"
+#include "TransitionTable.hh"
 #include "MSFG.hh"
 
 
@@ -30,6 +35,26 @@ flt_type viterbi(const StringSet &vocab,
                  std::map<std::string, flt_type> &stats,
                  bool utf8=false);
 
+// Factor indices instead of strings
+flt_type viterbi(const StringSet &vocab,
+                 const std::string &text,
+                 std::vector<int> &best_path,
+                 bool reverse=true,
+                 bool utf8=false,
+                 const FactorMask *mask=nullptr);
+
+flt_type viterbi(const StringSet &vocab,
+                 const std::string &text,
+                 factor_stats_t &stats,
+                 bool utf8=false);
+
+// Factors disabled in the mask are skipped, the set is not modified
+flt_type viterbi(const StringSet &vocab,
+                 const std::string &text,
+                 factor_stats_t &stats,
+                 const FactorMask &mask,
+                 bool utf8=false);
+
 // 1-GRAM model, 2-GRAM stats
 flt_type viterbi(const StringSet &vocab,
                  const std::string &text,
@@ -39,25 +64,78 @@ flt_type viterbi(const StringSet &vocab,
 class Token {
     public:
         int source;
-        flt_type cost;
-        Token(): source(-1), cost(MIN_FLOAT) {};
-        Token(int src, flt_type cst): source(src), cost(cst) {};
-        Token(const Token& orig) { this->source=orig.source; this->cost=orig.cost; };
+        int factor;
+        score_type cost;
+        Token(): source(-1), factor(-1), cost(MIN_SCORE) {};
+        Token(int src, score_type cst, int fct=-1): source(src), factor(fct), cost(cst) {};
+        Token(const Token& orig) { this->source=orig.source; this->factor=orig.factor; this->cost=orig.cost; };
+};
+
+// Buffers for segmenting one text at a time, owned by the caller
+// The buffers grow to the longest text seen and are reused for the next texts,
+// so the segmentations need no memory allocations after that
+// Each thread needs a workspace of its own
+class SegmentationWorkspace {
+    public:
+        std::vector<StringSet::Match> matches; //!< Factors found in the text
+        std::vector<Token> tokens; //!< Best token ending in each position, Viterbi
+        std::vector<std::vector<Token> > search; //!< All tokens ending in each position, forward-backward
+        std::vector<score_type> fw; //!< Forward scores
+        std::vector<score_type> bw; //!< Backward scores
+        std::vector<score_type> costs; //!< Token costs of one position for summing
+        std::vector<int> source_offsets; //!< End of the tokens starting after each position in source_tokens, backward
+        std::vector<std::pair<int, int> > source_tokens; //!< End position and index of the tokens by their source, backward
+        std::vector<std::pair<int, int> > stats_order; //!< Factor and position for sorting the statistics
+        factor_stats_t stats_buffer; //!< Copy of the statistics while merging
+        std::vector<score_type> suffix; //!< Scores from each position to the end of the text
+        std::vector<int> suffix_match; //!< Best match starting from each position, Viterbi
+        std::vector<char> prefix_reached; //!< Positions reached from the start without a factor
+        std::vector<char> suffix_reached; //!< Positions reaching the end without a factor
+        std::vector<int> factor_matches; //!< Number of matches of each factor in the statistics
+        std::vector<int> factor_match; //!< A match of each factor in the statistics
+        std::vector<int> factors; //!< Factors of a segmentation for counting the distinct ones
+        factor_stats_t removal_stats; //!< Statistics of a segmentation without a factor
+        std::string text; //!< Previous text of the incremental segmentation, cleared to start over
+        std::vector<StringSet::ScanState> scan_states; //!< Scan states of the previous text
 };
 
+// Result of segmenting a text without one of the factors
+class FactorRemoval {
+    public:
+        int factor; //!< Index of the removed factor
+        flt_type ll; //!< Likelihood of the text without the factor
+        unsigned int num_tokens; //!< Size of the statistics without the factor, 0 if no segmentation
+};
+
+// Viterbi with the buffers taken from the workspace
+flt_type viterbi(const StringSet &vocab,
+                 const std::string &text,
+                 factor_stats_t &stats,
+                 const FactorMask &mask,
+                 SegmentationWorkspace &ws,
+                 bool utf8=false);
+
 void forward(const StringSet &vocab,
              const std::string &text,
              std::vector<std::vector<Token> > &search,
-             std::vector<flt_type> &fw,
-             bool utf8=false);
+             std::vector<score_type> &fw,
+             bool utf8=false,
+             const FactorMask *mask=nullptr);
 
 void backward(const StringSet &vocab,
               const std::string &text,
               const std::vector<std::vector<Token> > &search,
-              const std::vector<flt_type> &fw,
-              std::vector<flt_type> &bw,
+              const std::vector<score_type> &fw,
+              std::vector<score_type> &bw,
               std::map<std::string, flt_type> &stats);
 
+void backward(const StringSet &vocab,
+              const std::string &text,
+              const std::vector<std::vector<Token> > &search,
+              const std::vector<score_type> &fw,
+              std::vector<score_type> &bw,
+              factor_stats_t &stats);
+
 flt_type forward_backward(const StringSet &vocab,
                           const std::string &text,
                           std::map<std::string, flt_type> &stats,
@@ -66,7 +144,72 @@ flt_type forward_backward(const StringSet &vocab,
 flt_type forward_backward(const StringSet &vocab,
                           const std::string &text,
                           std::map<std::string, flt_type> &stats,
-                          std::vector<flt_type> &post_scores,
+                          std::vector<score_type> &post_scores,
+                          bool utf8=false);
+
+flt_type forward_backward(const StringSet &vocab,
+                          const std::string &text,
+                          factor_stats_t &stats,
+                          bool utf8=false);
+
+flt_type forward_backward(const StringSet &vocab,
+                          const std::string &text,
+                          factor_stats_t &stats,
+                          std::vector<score_type> &post_scores,
+                          bool utf8=false);
+
+// Factors disabled in the mask are skipped, the set is not modified
+flt_type forward_backward(const StringSet &vocab,
+                          const std::string &text,
+                          factor_stats_t &stats,
+                          const FactorMask &mask,
+                          bool utf8=false);
+
+// Buffers are taken from the workspace
+flt_type forward_backward(const StringSet &vocab,
+                          const std::string &text,
+                          factor_stats_t &stats,
+                          const FactorMask &mask,
+                          SegmentationWorkspace &ws,
+                          bool utf8=false);
+
+// Segmentation continuing from the common prefix of the text and the previous text
+// segmented with the workspace, the matches and the forward scores of the prefix are kept
+// Same result as above, fastest when the texts come in sorted order
+// The vocabulary and the mask may not change between the texts
+flt_type viterbi_incremental(const StringSet &vocab,
+                             const std::string &text,
+                             factor_stats_t &stats,
+                             const FactorMask &mask,
+                             SegmentationWorkspace &ws,
+                             bool utf8=false);
+
+flt_type forward_backward_incremental(const StringSet &vocab,
+                                      const std::string &text,
+                                      factor_stats_t &stats,
+                                      const FactorMask &mask,
+                                      SegmentationWorkspace &ws,
+                                      bool utf8=false);
+
+// Segments the text and scores the removal of each candidate factor in the statistics
+// The scores come from the lattice of the text, a factor matching the text
+// more than once is removed with the mask and the text segmented again
+flt_type viterbi(const StringSet &vocab,
+                 const std::string &text,
+                 factor_stats_t &stats,
+                 const std::vector<bool> &candidates,
+                 std::vector<FactorRemoval> &removals,
+                 FactorMask &mask,
+                 SegmentationWorkspace &ws,
+                 bool utf8=false);
+
+flt_type forward_backward(const StringSet &vocab,
+                          const std::string &text,
+                          factor_stats_t &stats,
+                          const std::vector<bool> &candidates,
+                          std::vector<FactorRemoval> &removals,
+                          FactorMask &mask,
+                          SegmentationWorkspace &ws,
                           bool utf8=false);
 
 flt_type forward_backward(const std::map<std::string, flt_type> &vocab,
@@ -74,6 +217,129 @@ flt_type forward_backward(const std::map<std::string, flt_type> &vocab,
                           std::map<std::string, flt_type> &stats,
                           bool utf8=false);
 
+// 1-GRAM, read-only vocabulary
+flt_type viterbi(const FrozenStringSet &vocab,
+                 const std::string &text,
+                 std::vector<std::string> &best_path,
+                 bool reverse=true,
+                 bool utf8=false);
+
+flt_type viterbi(const FrozenStringSet &vocab,
+                 const std::string &text,
+                 std::map<std::string, flt_type> &stats,
+                 bool utf8=false);
+
+flt_type viterbi(const FrozenStringSet &vocab,
+                 const std::string &text,
+                 transitions_t &stats,
+                 const std::string &start_end_symbol);
+
+void forward(const FrozenStringSet &vocab,
+             const std::string &text,
+             std::vector<std::vector<Token> > &search,
+             std::vector<score_type> &fw,
+             bool utf8=false);
+
+void backward(const FrozenStringSet &vocab,
+              const std::string &text,
+              const std::vector<std::vector<Token> > &search,
+              const std::vector<score_type> &fw,
+              std::vector<score_type> &bw,
+              std::map<std::string, flt_type> &stats);
+
+flt_type forward_backward(const FrozenStringSet &vocab,
+                          const std::string &text,
+                          std::map<std::string, flt_type> &stats,
+                          bool utf8=false);
+
+flt_type forward_backward(const FrozenStringSet &vocab,
+                          const std::string &text,
+                          std::map<std::string, flt_type> &stats,
+                          std::vector<score_type> &post_scores,
+                          bool utf8=false);
+
+/** Viterbi segmentation of a long text given in parts.
+ * The prefix of the segmentation shared by all paths that can still be
+ * continued is committed after each part, and the text and tokens before
+ * it are dropped. The memory is bounded by the part length plus the longest
+ * factor as long as the paths merge, and the segmentation is the same as
+ * segmenting the whole text at once. The parts must not split letters. */
+
+class StreamingViterbi {
+public:
+
+    StreamingViterbi(bool utf8=false) : utf8(utf8) { reset(); }
+
+    /** Starts a new text */
+    void reset();
+
+    /** Adds the next part of the text
+     * \param factors = the committed factors are appended
+     */
+    void add(const FrozenStringSet &vocab,
+             const std::string &part,
+             std::vector<std::string> &factors);
+
+    /** Ends the text and starts a new one, the rest of the best path is appended to factors
+     * \return likelihood of the whole text, MIN_FLOAT if no segmentation,
+     *         the factors committed before are not taken back
+     */
+    flt_type finish(const FrozenStringSet &vocab,
+                    std::vector<std::string> &factors);
+
+    bool utf8;
+
+private:
+
+    template <class Letters>
+    void expand(const FrozenStringSet &vocab, unsigned int limit);
+    void commit(std::vector<std::string> &factors);
+    void backtrace(unsigned int end, std::vector<std::string> &factors);
+
+    std::string text; //!< Text from the last committed position
+    std::vector<Token> tokens; //!< Best token ending in each position of the text, the first is the committed position
+    unsigned int next_start; //!< Next start position to expand
+    std::vector<unsigned int> frontier; //!< Positions of the paths being continued
+    std::vector<std::string> path; //!< Factors of a backtrace in the reverse order
+};
+
+
+// 1-GRAM, path-compressed vocabulary
+flt_type viterbi(const RadixStringSet &vocab,
+                 const std::string &text,
+                 std::vector<std::string> &best_path,
+                 bool reverse=true,
+                 bool utf8=false);
+
+flt_type viterbi(const RadixStringSet &vocab,
+                 const std::string &text,
+                 std::vector<int> &best_path,
+                 bool reverse=true,
+                 bool utf8=false);
+
+flt_type viterbi(const RadixStringSet &vocab,
+                 const std::string &text,
+                 factor_stats_t &stats,
+                 bool utf8=false);
+
+void forward(const RadixStringSet &vocab,
+             const std::string &text,
+             std::vector<std::vector<Token> > &search,
+             std::vector<score_type> &fw,
+             bool utf8=false);
+
+void backward(const RadixStringSet &vocab,
+              const std::string &text,
+              const std::vector<std::vector<Token> > &search,
+              const std::vector<score_type> &fw,
+              std::vector<score_type> &bw,
+              factor_stats_t &stats);
+
+flt_type forward_backward(const RadixStringSet &vocab,
+                          const std::string &text,
+                          factor_stats_t &stats,
+                          bool utf8=false);
+
 // 2-GRAM
 
 flt_type viterbi(const transitions_t &transitions,
@@ -88,11 +354,11 @@ flt_type viterbi(const transitions_t &transitions,
 
 void forward(const transitions_t &transitions,
              FactorGraph &text,
-             std::vector<flt_type> &fw);
+             std::vector<score_type> &fw);
 
 void backward(const FactorGraph &text,
-              const std::vector<flt_type> &fw,
-              std::vector<flt_type> &bw,
+              const std::vector<score_type> &fw,
+              std::vector<score_type> &bw,
               transitions_t &stats);
 
 // Normal case
@@ -104,7 +370,7 @@ flt_type forward_backward(const transitions_t &transitions,
 flt_type forward_backward(const transitions_t &transitions,
                           FactorGraph &text,
                           transitions_t &stats,
-                          std::vector<flt_type> &post_scores);
+                          std::vector<score_type> &post_scores);
 
 // Allows blocking one factor
 flt_type forward_backward(const transitions_t &transitions,
@@ -123,6 +389,44 @@ flt_type posterior_decode(const transitions_t &transitions,
                           bool reverse=true);
 
 
+// 2-GRAM, graphs in flat arrays reused between the texts
+// The costs are looked up by the factor indices of the nodes, the graph
+// and the transition table must be built with the same vocabulary
+
+flt_type viterbi(const TransitionTable &transitions,
+                 FlatFactorGraph &text,
+                 std::vector<std::string> &best_path,
+                 bool reverse=true);
+
+flt_type viterbi(const TransitionTable &transitions,
+                 FlatFactorGraph &text,
+                 transitions_t &stats,
+                 flt_type multiplier=1.0);
+
+void forward(const TransitionTable &transitions,
+             FlatFactorGraph &text,
+             std::vector<score_type> &fw);
+
+void backward(const FlatFactorGraph &text,
+              const std::vector<score_type> &fw,
+              std::vector<score_type> &bw,
+              transitions_t &stats);
+
+flt_type forward_backward(const TransitionTable &transitions,
+                          FlatFactorGraph &text,
+                          transitions_t &stats);
+
+flt_type forward_backward(const TransitionTable &transitions,
+                          FlatFactorGraph &text,
+                          transitions_t &stats,
+                          std::vector<score_type> &post_scores);
+
+// Initialization with unigram scores, the start and end symbol must be in the vocabulary
+flt_type forward_backward(const FrozenStringSet &vocab,
+                          FlatFactorGraph &text,
+                          transitions_t &stats);
+
+
 // MultiStringFactorGraph implementations
 
 // Scores each arc in the MSFG with bigram scores
@@ -135,12 +439,12 @@ void assign_scores(std::map<std::string, flt_type> &vocab,
 
 // Basic forward pass for all strings
 void forward(const MultiStringFactorGraph &msfg,
-             std::vector<flt_type> &fw);
+             std::vector<score_type> &fw);
 
 // Forward pass for only one string
 flt_type forward(const std::string &text,
                  const MultiStringFactorGraph &msfg,
-                 std::map<msfg_node_idx_t, flt_type> &fw);
+                 std::map<msfg_node_idx_t, score_type> &fw);
 
 // Forward for selected strings, don't collect stats
 flt_type forward(const std::map<std::string, flt_type> &words,
@@ -168,7 +472,7 @@ flt_type likelihood(const std::map<std::string, flt_type> &words,
 // Backward pass for one string given forward scores
 flt_type backward(const MultiStringFactorGraph &msfg,
                   const std::string &text,
-                  const std::vector<flt_type> &fw,
+                  const std::vector<score_type> &fw,
                   transitions_t &stats,
                   flt_type text_weight = 1.0);
 
@@ -176,7 +480,7 @@ flt_type backward(const MultiStringFactorGraph &msfg,
 // Map container for forward scores
 flt_type backward(const MultiStringFactorGraph &msfg,
                   const std::string &text,
-                  const std::map<msfg_node_idx_t, flt_type> &fw,
+                  const std::map<msfg_node_idx_t, score_type> &fw,
                   transitions_t &stats,
                   flt_type text_weight = 1.0);
 
@@ -206,4 +510,70 @@ flt_type viterbi(const MultiStringFactorGraph &msfg,
                  const std::map<std::string, flt_type> &word_freqs,
                  transitions_t &stats);
 
+
+// FrozenMultiStringFactorGraph implementations
+
+// Buffers for the passes over one string in a frozen MSFG, owned by the caller
+// The buffers have an entry for each node and are cleared during each pass
+class FrozenMSFGWorkspace {
+    public:
+        FrozenMSFGWorkspace(const FrozenMultiStringFactorGraph &msfg)
+            : scores(msfg.node_count(), MIN_SCORE), queued(msfg.node_count(), 0) { }
+        std::vector<score_type> scores; //!< Score of each node reached in the pass
+        std::vector<char> queued; //!< Nodes added to the queue in the pass
+        std::vector<msfg_node_idx_t> queue; //!< Nodes to process, a heap with the last node first
+};
+
+// Scores each arc in the MSFG with bigram scores
+void assign_scores(transitions_t &transitions,
+                   FrozenMultiStringFactorGraph &msfg);
+
+// Scores each arc in the MSFG with unigram scores
+void assign_scores(std::map<std::string, flt_type> &vocab,
+                   FrozenMultiStringFactorGraph &msfg);
+
+// Updates the scores of the arcs of the changed bigrams to the current transitions
+void update_scores(const transitions_t &transitions,
+                   const transitions_t &changes,
+                   FrozenMultiStringFactorGraph &msfg);
+
+// Basic forward pass for all strings
+void forward(const FrozenMultiStringFactorGraph &msfg,
+             std::vector<score_type> &fw);
+
+// Compute likelihood of one string using Forward-backward segmentation
+flt_type likelihood_fb(const std::string &text,
+                       const FrozenMultiStringFactorGraph &msfg,
+                       FrozenMSFGWorkspace &ws);
+
+// Compute likelihood of one string using Viterbi segmentation
+flt_type likelihood_viterbi(const std::string &text,
+                            const FrozenMultiStringFactorGraph &msfg,
+                            FrozenMSFGWorkspace &ws);
+
+// Compute likelihood for given strings
+flt_type likelihood(const std::map<std::string, flt_type> &words,
+                    const std::set<std::string> &selected_words,
+                    const FrozenMultiStringFactorGraph &msfg,
+                    FrozenMSFGWorkspace &ws,
+                    bool forward_backward=true);
+
+// Backward pass for one string given forward scores
+flt_type backward(const FrozenMultiStringFactorGraph &msfg,
+                  const std::string &text,
+                  const std::vector<score_type> &fw,
+                  bigram_stats_t &stats,
+                  FrozenMSFGWorkspace &ws,
+                  flt_type text_weight = 1.0);
+
+// Forward-backward for all strings
+flt_type forward_backward(const FrozenMultiStringFactorGraph &msfg,
+                          const std::map<std::string, flt_type> &word_freqs,
+                          bigram_stats_t &stats);
+
+// Viterbi for all strings
+flt_type viterbi(const FrozenMultiStringFactorGraph &msfg,
+                 const std::map<std::string, flt_type> &word_freqs,
+                 bigram_stats_t &stats);
+
 #endif /* EM */
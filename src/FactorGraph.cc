@@ -37,6 +37,16 @@ FactorGraph::FactorGraph(const string &text,
 }
 
 
+FactorGraph::FactorGraph(const string &text,
+                         const string &start_end_symbol,
+                         const FrozenStringSet &vocab,
+                         bool utf8)
+{
+    this->utf8 = utf8;
+    set_text(text, start_end_symbol, vocab);
+}
+
+
 void
 FactorGraph::create_nodes(const string &text,
                           const map<string, flt_type> &vocab,
@@ -93,6 +103,7 @@ FactorGraph::create_nodes(const string &text,
 }
 
 
+bool match_start_sort(const StringSet::Match &i, const StringSet::Match &j) { return (i.start < j.start); }
 void
 FactorGraph::create_nodes(const string &text,
                           const StringSet &vocab,
@@ -100,6 +111,26 @@ FactorGraph::create_nodes(const string &text,
 {
     nodes.push_back(Node(0,0));
 
+    // Nodes are created in the order of the start position
+    vector<StringSet::Match> matches;
+    vocab.scan(text, matches);
+    stable_sort(matches.begin(), matches.end(), match_start_sort);
+
+    for (auto match = matches.cbegin(); match != matches.cend(); ++match) {
+        if (incoming[match->start].size() == 0) continue;
+        nodes.push_back(Node(match->start, match->end-match->start));
+        incoming[match->end].insert(match->start);
+    }
+}
+
+
+void
+FactorGraph::create_nodes(const string &text,
+                          const FrozenStringSet &vocab,
+                          vector<unordered_set<fg_node_idx_t> > &incoming)
+{
+    nodes.push_back(Node(0,0));
+
     vector<unsigned int> char_positions;
     get_character_positions(text, char_positions, utf8);
 
@@ -108,16 +139,23 @@ FactorGraph::create_nodes(const string &text,
         unsigned int start_pos = char_positions[i];
         if (incoming[start_pos].size() == 0) continue;
 
-        const StringSet::Node *node = &vocab.root_node;
-        for (unsigned int j=start_pos; j<text.length(); j++) {
+        // Letter added outside the tree
+        if (vocab.added_letter_count() > 0) {
+            unsigned int end_pos = min(char_positions[i+1], (unsigned int)text.length());
+            if (vocab.added_letter(text, start_pos, end_pos) >= 0) {
+                nodes.push_back(Node(start_pos, end_pos-start_pos));
+                incoming[end_pos].insert(start_pos);
+            }
+        }
 
-            StringSet::Arc *arc = vocab.find_arc(text[j], node);
+        int node = FrozenStringSet::root_node;
+        for (unsigned int j=start_pos; j<text.length(); j++) {
 
-            if (arc == NULL) break;
-            node = arc->target_node;
+            node = vocab.find_arc(text[j], node);
+            if (node < 0) break;
 
             // String associated with this node
-            if (arc->factor.length() > 0) {
+            if (vocab.factor_id(node) >= 0) {
                 nodes.push_back(Node(start_pos, j+1-start_pos));
                 incoming[j+1].insert(start_pos);
             }
@@ -245,6 +283,31 @@ FactorGraph::set_text(const string &text,
 }
 
 
+void
+FactorGraph::set_text(const string &text,
+                      const string &start_end_symbol,
+                      const FrozenStringSet &vocab)
+{
+    this->text.assign(text);
+    this->start_end_symbol.assign(start_end_symbol);
+    if (text.length() == 0) return;
+
+    vector<unordered_set<fg_node_idx_t> > incoming(text.size()+1); // (pos in text, source pos)
+
+    // Create all nodes
+    incoming[0].insert(0);
+    create_nodes(text, vocab, incoming);
+
+    // No possible segmentations
+    if (incoming[text.size()].size() == 0) {
+        nodes.clear();
+        return;
+    }
+
+    prune_and_create_arcs(incoming);
+}
+
+
 bool
 FactorGraph::assert_equal(const FactorGraph &other) const
 {
@@ -8,6 +8,7 @@
 
 #include "defs.hh"
 #include "StringSet.hh"
+#include "FrozenStringSet.hh"
 
 
 class FactorGraph {
@@ -55,6 +56,8 @@ public:
                 const std::set<std::string> &vocab, int maxlen, bool utf8=false);
     FactorGraph(const std::string &text, const std::string &start_end_symbol,
                 const StringSet &vocab, bool utf8=false);
+    FactorGraph(const std::string &text, const std::string &start_end_symbol,
+                const FrozenStringSet &vocab, bool utf8=false);
     ~FactorGraph();
 
     void set_text(const std::string &text, const std::string &start_end_symbol,
@@ -63,6 +66,8 @@ public:
                   const std::set<std::string> &vocab, int maxlen);
     void set_text(const std::string &text, const std::string &start_end_symbol,
                   const StringSet &vocab);
+    void set_text(const std::string &text, const std::string &start_end_symbol,
+                  const FrozenStringSet &vocab);
     void get_factor(const Node &node, std::string &nstr) const
     { if (node.len == 0) nstr.assign(start_end_symbol);
       else nstr.assign(this->text, node.start_pos, node.len); }
@@ -102,6 +107,9 @@ private:
     void create_nodes(const std::string &text,
                       const StringSet &vocab,
                       std::vector<std::unordered_set<fg_node_idx_t> > &incoming);
+    void create_nodes(const std::string &text,
+                      const FrozenStringSet &vocab,
+                      std::vector<std::unordered_set<fg_node_idx_t> > &incoming);
     void prune_and_create_arcs(std::vector<std::unordered_set<fg_node_idx_t> > &incoming);
     // Helper for enumerating paths
     void advance(std::vector<std::vector<std::string> > &paths,
@@ -0,0 +1,120 @@
+#include <algorithm>
+
+#include "FlatFactorGraph.hh"
+
+using namespace std;
+
+
+FlatFactorGraph::FlatFactorGraph(const string &text,
+                                 const string &start_end_symbol,
+                                 const FrozenStringSet &vocab,
+                                 bool utf8)
+{
+    this->utf8 = utf8;
+    set_text(text, start_end_symbol, vocab);
+}
+
+
+void
+FlatFactorGraph::reset()
+{
+    text.clear();
+    nodes.clear();
+    outgoing_offsets.clear();
+    arc_sources.clear();
+    arc_targets.clear();
+    arc_costs.clear();
+    incoming_offsets.clear();
+    incoming_arcs.clear();
+}
+
+
+void
+FlatFactorGraph::set_text(const string &text,
+                          const string &start_end_symbol,
+                          const FrozenStringSet &vocab)
+{
+    reset();
+    this->text.assign(text);
+    this->start_end_symbol.assign(start_end_symbol);
+    if (text.length() == 0) return;
+
+    // Factors from the positions reached from the start, in the order of the start position
+    matched.clear();
+    reached.assign(text.size()+1, false);
+    reached[0] = true;
+    get_character_positions(text, char_positions, utf8);
+    for (unsigned int i=0; i<char_positions.size()-1; i++) {
+
+        unsigned int start_pos = char_positions[i];
+        if (!reached[start_pos]) continue;
+
+        // Letter added outside the tree
+        if (vocab.added_letter_count() > 0) {
+            unsigned int end_pos = min(char_positions[i+1], (unsigned int)text.length());
+            int factor = vocab.added_letter(text, start_pos, end_pos);
+            if (factor >= 0) {
+                matched.push_back(Node(start_pos, end_pos-start_pos, factor));
+                reached[end_pos] = true;
+            }
+        }
+
+        int node = FrozenStringSet::root_node;
+        for (unsigned int j=start_pos; j<text.length(); j++) {
+            node = vocab.find_arc(text[j], node);
+            if (node < 0) break;
+            if (vocab.factor_id(node) >= 0) {
+                matched.push_back(Node(start_pos, j+1-start_pos, vocab.factor_id(node)));
+                reached[j+1] = true;
+            }
+        }
+    }
+
+    // No possible segmentations
+    if (!reached[text.size()]) return;
+
+    // Positions from which the end is reached, the later factors are final first
+    completed.assign(text.size()+1, false);
+    completed[text.size()] = true;
+    for (auto it = matched.crbegin(); it != matched.crend(); ++it)
+        if (completed[it->start_pos+it->len]) completed[it->start_pos] = true;
+
+    // Nodes on some path from the start to the end
+    int start_end_factor = vocab.factor_index(start_end_symbol);
+    nodes.push_back(Node(0, 0, start_end_factor));
+    for (auto it = matched.cbegin(); it != matched.cend(); ++it)
+        if (completed[it->start_pos] && completed[it->start_pos+it->len])
+            nodes.push_back(*it);
+    nodes.push_back(Node(text.size(), 0, start_end_factor));
+
+    // Nodes starting from a position are consecutive, the start node is not a target
+    first_node_at.assign(text.size()+2, nodes.size());
+    for (unsigned int i=nodes.size()-1; i>0; i--)
+        first_node_at[nodes[i].start_pos] = i;
+    for (int pos=text.size(); pos>=0; pos--)
+        if (first_node_at[pos] > first_node_at[pos+1])
+            first_node_at[pos] = first_node_at[pos+1];
+
+    // Outgoing arcs to the nodes starting from the end position
+    incoming_offsets.assign(nodes.size()+1, 0);
+    for (unsigned int i=0; i<nodes.size()-1; i++) {
+        outgoing_offsets.push_back(arc_targets.size());
+        unsigned int end_pos = nodes[i].start_pos + nodes[i].len;
+        for (unsigned int j=first_node_at[end_pos]; j<first_node_at[end_pos+1]; j++) {
+            arc_sources.push_back(i);
+            arc_targets.push_back(j);
+            incoming_offsets[j+1]++;
+        }
+    }
+    outgoing_offsets.push_back(arc_targets.size());
+    outgoing_offsets.push_back(arc_targets.size());
+    arc_costs.assign(arc_targets.size(), 0.0);
+
+    // Incoming arcs in the order of the source node
+    for (unsigned int i=0; i<nodes.size(); i++)
+        incoming_offsets[i+1] += incoming_offsets[i];
+    next_incoming.assign(incoming_offsets.begin(), incoming_offsets.end()-1);
+    incoming_arcs.resize(arc_targets.size());
+    for (unsigned int arc=0; arc<arc_targets.size(); arc++)
+        incoming_arcs[next_incoming[arc_targets[arc]]++] = arc;
+}
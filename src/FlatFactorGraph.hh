@@ -0,0 +1,81 @@
+#ifndef FLAT_FACTOR_GRAPH
+#define FLAT_FACTOR_GRAPH
+
+#include <string>
+#include <vector>
+
+#include "defs.hh"
+#include "FrozenStringSet.hh"
+
+/** Factor graph of one text in flat arrays.
+ * Nodes are ordered by the start position as in FactorGraph, the first node
+ * is the start and the last node the end of the text. The arcs are ordered
+ * by the source node and the arcs of node i are given by the offsets
+ * outgoing_offsets[i] .. outgoing_offsets[i+1]-1 to the arc arrays.
+ * The incoming arcs of node i are the arc indices incoming_arcs[incoming_offsets[i]]
+ * .. incoming_arcs[incoming_offsets[i+1]-1] in the order of the source node.
+ * Each node has the index of its factor in the vocabulary, the start and end
+ * nodes the index of the start and end symbol, -1 if not in the vocabulary.
+ * The graph is set again for each text, the arrays keep their memory. */
+
+class FlatFactorGraph {
+public:
+
+    /** Node of a factor graph. */
+    class Node {
+    public:
+        Node(int start_pos, int len, int factor)
+        : start_pos(start_pos), len(len), factor(factor) { }
+        factor_pos_t start_pos; // text indices
+        factor_len_t len;
+        int factor; //!< Factor index in the vocabulary
+    };
+
+    FlatFactorGraph(bool utf8=false) : utf8(utf8) { };
+    FlatFactorGraph(const std::string &text, const std::string &start_end_symbol,
+                    const FrozenStringSet &vocab, bool utf8=false);
+
+    /** Empties the graph, the memory is kept for the next text */
+    void reset();
+
+    /** Builds the graph of the text, no nodes if the text can not be segmented */
+    void set_text(const std::string &text, const std::string &start_end_symbol,
+                  const FrozenStringSet &vocab);
+
+    unsigned int num_arcs() const { return arc_targets.size(); }
+    void get_factor(const Node &node, std::string &nstr) const
+    { if (node.len == 0) nstr.assign(start_end_symbol);
+      else nstr.assign(this->text, node.start_pos, node.len); }
+    void get_factor(int node, std::string &nstr) const
+    { if (nodes[node].len == 0) nstr.assign(start_end_symbol);
+      else nstr.assign(this->text, nodes[node].start_pos, nodes[node].len); }
+    std::string get_factor(const Node &node) const
+    { if (node.len == 0) return start_end_symbol;
+      else return this->text.substr(node.start_pos, node.len); }
+    std::string get_factor(int node) const
+    { if (nodes[node].len == 0) return start_end_symbol;
+      else return this->text.substr(nodes[node].start_pos, nodes[node].len); }
+
+    std::string text;
+    std::string start_end_symbol;
+    std::vector<Node> nodes;
+    std::vector<unsigned int> outgoing_offsets; //!< First outgoing arc of each node, one past the last node
+    std::vector<fg_node_idx_t> arc_sources; //!< Source node of each arc
+    std::vector<fg_node_idx_t> arc_targets; //!< Target node of each arc
+    std::vector<flt_type> arc_costs; //!< Cost of each arc, set by the segmentation
+    std::vector<unsigned int> incoming_offsets; //!< First incoming arc of each node in incoming_arcs
+    std::vector<unsigned int> incoming_arcs; //!< Arc indices grouped by the target node
+    bool utf8;
+
+private:
+    // Workspace kept between the texts
+    std::vector<unsigned int> char_positions;
+    std::vector<bool> reached; //!< Positions reached from the start
+    std::vector<bool> completed; //!< Positions from which the end is reached
+    std::vector<Node> matched; //!< Factors starting from the reached positions
+    std::vector<unsigned int> first_node_at; //!< First node starting from each position or later
+    std::vector<unsigned int> next_incoming; //!< Next free slot in incoming_arcs of each node
+};
+
+
+#endif /* FLAT_FACTOR_GRAPH */
@@ -0,0 +1,444 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FrozenMSFG.hh"
+
+using namespace std;
+
+
+FrozenMultiStringFactorGraph::FrozenMultiStringFactorGraph(const string &start_end_symbol)
+    : start_end_symbol(start_end_symbol), image(nullptr), image_size(0)
+{
+    release();
+}
+
+
+FrozenMultiStringFactorGraph::FrozenMultiStringFactorGraph(const MultiStringFactorGraph &msfg)
+    : image(nullptr), image_size(0)
+{
+    build(msfg);
+}
+
+
+FrozenMultiStringFactorGraph::~FrozenMultiStringFactorGraph()
+{
+    release();
+}
+
+
+void
+FrozenMultiStringFactorGraph::build(const MultiStringFactorGraph &msfg)
+{
+    release();
+    start_end_symbol = msfg.start_end_symbol;
+    string_end_nodes = msfg.string_end_nodes;
+
+    // Factors sorted, the factors not in the factor node map are removed
+    for (auto ndit = msfg.nodes.begin(); ndit != msfg.nodes.end(); ++ndit)
+        factor_strings.push_back(ndit->factor);
+    sort(factor_strings.begin(), factor_strings.end());
+    factor_strings.erase(unique(factor_strings.begin(), factor_strings.end()), factor_strings.end());
+    factor_removed.resize(factor_strings.size());
+    num_factors = 0;
+    for (unsigned int i=0; i<factor_strings.size(); i++) {
+        factor_removed[i] = msfg.factor_node_map.find(factor_strings[i]) == msfg.factor_node_map.end();
+        if (!factor_removed[i]) num_factors++;
+    }
+
+    // Nodes grouped by the factor in the order of the node index
+    node_factor_array.resize(msfg.nodes.size());
+    factor_node_offset_array.assign(factor_strings.size()+1, 0);
+    for (unsigned int i=0; i<msfg.nodes.size(); i++) {
+        node_factor_array[i] = factor_index(msfg.nodes[i].factor);
+        factor_node_offset_array[node_factor_array[i]+1]++;
+    }
+    for (unsigned int i=0; i<factor_strings.size(); i++)
+        factor_node_offset_array[i+1] += factor_node_offset_array[i];
+    vector<unsigned int> next_node(factor_node_offset_array.begin(), factor_node_offset_array.end()-1);
+    factor_node_array.resize(msfg.nodes.size());
+    for (unsigned int i=0; i<msfg.nodes.size(); i++)
+        factor_node_array[next_node[node_factor_array[i]]++] = i;
+
+    // Outgoing arcs sorted by the target node
+    unsigned int total_arcs = 0;
+    for (auto ndit = msfg.nodes.begin(); ndit != msfg.nodes.end(); ++ndit)
+        total_arcs += ndit->outgoing.size();
+    arc_source_array.reserve(total_arcs);
+    arc_target_array.reserve(total_arcs);
+    outgoing_offset_array.clear();
+    outgoing_offset_array.reserve(msfg.nodes.size()+1);
+    vector<msfg_node_idx_t> targets;
+    for (unsigned int i=0; i<msfg.nodes.size(); i++) {
+        outgoing_offset_array.push_back(arc_target_array.size());
+        targets.clear();
+        const MultiStringFactorGraph::Node &node = msfg.nodes[i];
+        for (auto arcit = node.outgoing.begin(); arcit != node.outgoing.end(); ++arcit)
+            targets.push_back((**arcit).target_node);
+        sort(targets.begin(), targets.end());
+        for (auto tgtit = targets.begin(); tgtit != targets.end(); ++tgtit) {
+            arc_source_array.push_back(i);
+            arc_target_array.push_back(*tgtit);
+        }
+    }
+    outgoing_offset_array.push_back(arc_target_array.size());
+    arc_costs.assign(arc_target_array.size(), MIN_FLOAT);
+    arc_removed.assign(arc_target_array.size(), false);
+
+    // Incoming arcs in the order of the source node
+    incoming_offset_array.assign(msfg.nodes.size()+1, 0);
+    for (unsigned int arc=0; arc<arc_target_array.size(); arc++)
+        incoming_offset_array[arc_target_array[arc]+1]++;
+    for (unsigned int i=0; i<msfg.nodes.size(); i++)
+        incoming_offset_array[i+1] += incoming_offset_array[i];
+    vector<unsigned int> next_incoming(incoming_offset_array.begin(), incoming_offset_array.end()-1);
+    incoming_arc_array.resize(arc_target_array.size());
+    for (unsigned int arc=0; arc<arc_target_array.size(); arc++)
+        incoming_arc_array[next_incoming[arc_target_array[arc]]++] = arc;
+    use_arrays();
+}
+
+
+void
+FrozenMultiStringFactorGraph::use_arrays()
+{
+    factor_node_offsets = factor_node_offset_array.data();
+    factor_nodes = factor_node_array.data();
+    node_factors = node_factor_array.data();
+    outgoing_offsets = outgoing_offset_array.data();
+    arc_sources = arc_source_array.data();
+    arc_targets = arc_target_array.data();
+    incoming_offsets = incoming_offset_array.data();
+    incoming_arcs = incoming_arc_array.data();
+    num_nodes = node_factor_array.size();
+    num_arcs = arc_target_array.size();
+}
+
+
+void
+FrozenMultiStringFactorGraph::release()
+{
+    if (image != nullptr) munmap(image, image_size);
+    image = nullptr;
+    image_size = 0;
+    factor_strings.clear();
+    factor_removed.clear();
+    factor_node_offset_array.assign(1, 0);
+    factor_node_array.clear();
+    node_factor_array.clear();
+    outgoing_offset_array.assign(1, 0);
+    arc_source_array.clear();
+    arc_target_array.clear();
+    incoming_offset_array.assign(1, 0);
+    incoming_arc_array.clear();
+    arc_costs.clear();
+    arc_removed.clear();
+    string_end_nodes.clear();
+    num_factors = 0;
+    use_arrays();
+}
+
+
+// Layout of the binary image, the header is followed by the factor string offsets,
+// factor_node_offsets, factor_nodes, node_factors, outgoing_offsets, arc_sources,
+// arc_targets, incoming_offsets, incoming_arcs, the string offsets and end nodes
+// of the end node table, the letters of the factors, strings and start symbol,
+// and one byte per factor and per arc set if the factor or arc is removed
+struct MSFGImageHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int byte_order;
+    unsigned int num_factors;
+    unsigned int num_nodes;
+    unsigned int num_arcs;
+    unsigned int num_strings;
+    unsigned int factor_chars;
+    unsigned int string_chars;
+    unsigned int symbol_chars;
+};
+
+static const char msfg_image_magic[8] = { 'M', 'S', 'F', 'G', 'I', 'M', 'G', '\0' };
+static const unsigned int msfg_image_version = 1;
+static const unsigned int msfg_image_byte_order = 0x01020304;
+
+
+int
+FrozenMultiStringFactorGraph::write_image(const string &fname) const
+{
+    vector<unsigned int> factor_offsets(1, 0);
+    string factor_chars;
+    for (auto it = factor_strings.begin(); it != factor_strings.end(); ++it) {
+        factor_chars += *it;
+        factor_offsets.push_back(factor_chars.size());
+    }
+    vector<unsigned int> string_offsets(1, 0);
+    vector<msfg_node_idx_t> string_nodes;
+    string string_chars;
+    for (auto it = string_end_nodes.begin(); it != string_end_nodes.end(); ++it) {
+        string_chars += it->first;
+        string_offsets.push_back(string_chars.size());
+        string_nodes.push_back(it->second);
+    }
+
+    MSFGImageHeader header;
+    memcpy(header.magic, msfg_image_magic, sizeof(msfg_image_magic));
+    header.version = msfg_image_version;
+    header.byte_order = msfg_image_byte_order;
+    header.num_factors = factor_strings.size();
+    header.num_nodes = num_nodes;
+    header.num_arcs = num_arcs;
+    header.num_strings = string_nodes.size();
+    header.factor_chars = factor_chars.size();
+    header.string_chars = string_chars.size();
+    header.symbol_chars = start_end_symbol.size();
+
+    ofstream imagefile(fname.c_str(), ios_base::out | ios_base::binary | ios_base::trunc);
+    if (!imagefile) return -1;
+    imagefile.write((const char*)&header, sizeof(header));
+    imagefile.write((const char*)factor_offsets.data(), factor_offsets.size() * sizeof(unsigned int));
+    imagefile.write((const char*)factor_node_offsets, (factor_strings.size()+1) * sizeof(unsigned int));
+    imagefile.write((const char*)factor_nodes, num_nodes * sizeof(msfg_node_idx_t));
+    imagefile.write((const char*)node_factors, num_nodes * sizeof(int));
+    imagefile.write((const char*)outgoing_offsets, (num_nodes+1) * sizeof(unsigned int));
+    imagefile.write((const char*)arc_sources, num_arcs * sizeof(msfg_node_idx_t));
+    imagefile.write((const char*)arc_targets, num_arcs * sizeof(msfg_node_idx_t));
+    imagefile.write((const char*)incoming_offsets, (num_nodes+1) * sizeof(unsigned int));
+    imagefile.write((const char*)incoming_arcs, num_arcs * sizeof(unsigned int));
+    imagefile.write((const char*)string_offsets.data(), string_offsets.size() * sizeof(unsigned int));
+    imagefile.write((const char*)string_nodes.data(), string_nodes.size() * sizeof(msfg_node_idx_t));
+    imagefile.write(factor_chars.data(), factor_chars.size());
+    imagefile.write(string_chars.data(), string_chars.size());
+    imagefile.write(start_end_symbol.data(), start_end_symbol.size());
+    for (auto it = factor_removed.begin(); it != factor_removed.end(); ++it)
+        imagefile.put(*it ? 1 : 0);
+    for (auto it = arc_removed.begin(); it != arc_removed.end(); ++it)
+        imagefile.put(*it ? 1 : 0);
+    imagefile.close();
+    if (!imagefile) return -1;
+
+    return 0;
+}
+
+
+// Checks that the offsets start from 0, do not decrease and end at total
+static bool
+valid_offsets(const unsigned int *offsets, unsigned int count, unsigned int total)
+{
+    if (offsets[0] != 0 || offsets[count] != total) return false;
+    for (unsigned int i=0; i<count; i++)
+        if (offsets[i] > offsets[i+1]) return false;
+    return true;
+}
+
+
+// Checks that all the indices are below limit
+template <typename T>
+static bool
+valid_indices(const T *indices, unsigned int count, unsigned int limit)
+{
+    for (unsigned int i=0; i<count; i++)
+        if ((unsigned int)indices[i] >= limit) return false;
+    return true;
+}
+
+
+int
+FrozenMultiStringFactorGraph::open_image(const string &fname)
+{
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(MSFGImageHeader)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+
+    const MSFGImageHeader *header = (const MSFGImageHeader*)data;
+    size_t num_ints = 2 * ((size_t)header->num_factors + 1)
+        + 2 * (size_t)header->num_nodes + 2 * ((size_t)header->num_nodes + 1)
+        + 3 * (size_t)header->num_arcs + 2 * (size_t)header->num_strings + 1;
+    size_t expected_size = sizeof(MSFGImageHeader) + num_ints * sizeof(unsigned int)
+        + (size_t)header->factor_chars + header->string_chars + header->symbol_chars
+        + (size_t)header->num_factors + header->num_arcs;
+    if (memcmp(header->magic, msfg_image_magic, sizeof(msfg_image_magic)) != 0
+        || header->version != msfg_image_version
+        || header->byte_order != msfg_image_byte_order
+        || size != expected_size)
+    {
+        munmap(data, size);
+        return -1;
+    }
+
+    const unsigned int *factor_offsets = (const unsigned int*)((const char*)data + sizeof(MSFGImageHeader));
+    const unsigned int *image_factor_node_offsets = factor_offsets + header->num_factors + 1;
+    const msfg_node_idx_t *image_factor_nodes = image_factor_node_offsets + header->num_factors + 1;
+    const int *image_node_factors = (const int*)(image_factor_nodes + header->num_nodes);
+    const unsigned int *image_outgoing_offsets = (const unsigned int*)(image_node_factors + header->num_nodes);
+    const msfg_node_idx_t *image_arc_sources = image_outgoing_offsets + header->num_nodes + 1;
+    const msfg_node_idx_t *image_arc_targets = image_arc_sources + header->num_arcs;
+    const unsigned int *image_incoming_offsets = image_arc_targets + header->num_arcs;
+    const unsigned int *image_incoming_arcs = image_incoming_offsets + header->num_nodes + 1;
+    const unsigned int *string_offsets = image_incoming_arcs + header->num_arcs;
+    const msfg_node_idx_t *string_nodes = string_offsets + header->num_strings + 1;
+    const char *factor_chars = (const char*)(string_nodes + header->num_strings);
+    const char *string_chars = factor_chars + header->factor_chars;
+    const char *symbol_chars = string_chars + header->string_chars;
+    const char *removed_factors = symbol_chars + header->symbol_chars;
+    const char *removed_arcs = removed_factors + header->num_factors;
+
+    // All offsets and indices are checked before the arrays are used
+    if (!valid_offsets(factor_offsets, header->num_factors, header->factor_chars)
+        || !valid_offsets(image_factor_node_offsets, header->num_factors, header->num_nodes)
+        || !valid_indices(image_factor_nodes, header->num_nodes, header->num_nodes)
+        || !valid_indices(image_node_factors, header->num_nodes, header->num_factors)
+        || !valid_offsets(image_outgoing_offsets, header->num_nodes, header->num_arcs)
+        || !valid_indices(image_arc_sources, header->num_arcs, header->num_nodes)
+        || !valid_indices(image_arc_targets, header->num_arcs, header->num_nodes)
+        || !valid_offsets(image_incoming_offsets, header->num_nodes, header->num_arcs)
+        || !valid_indices(image_incoming_arcs, header->num_arcs, header->num_arcs)
+        || !valid_offsets(string_offsets, header->num_strings, header->string_chars)
+        || !valid_indices(string_nodes, header->num_strings, header->num_nodes))
+    {
+        munmap(data, size);
+        return -1;
+    }
+
+    release();
+    image = data;
+    image_size = size;
+    num_nodes = header->num_nodes;
+    num_arcs = header->num_arcs;
+    factor_node_offsets = image_factor_node_offsets;
+    factor_nodes = image_factor_nodes;
+    node_factors = image_node_factors;
+    outgoing_offsets = image_outgoing_offsets;
+    arc_sources = image_arc_sources;
+    arc_targets = image_arc_targets;
+    incoming_offsets = image_incoming_offsets;
+    incoming_arcs = image_incoming_arcs;
+
+    start_end_symbol.assign(symbol_chars, header->symbol_chars);
+    factor_strings.reserve(header->num_factors);
+    for (unsigned int i=0; i<header->num_factors; i++)
+        factor_strings.push_back(string(factor_chars + factor_offsets[i],
+                                        factor_offsets[i+1] - factor_offsets[i]));
+    // The strings are sorted, each one is inserted at the end
+    for (unsigned int i=0; i<header->num_strings; i++)
+        string_end_nodes.emplace_hint(string_end_nodes.end(),
+                                      string(string_chars + string_offsets[i],
+                                             string_offsets[i+1] - string_offsets[i]),
+                                      string_nodes[i]);
+
+    factor_removed.resize(factor_strings.size());
+    num_factors = 0;
+    for (unsigned int i=0; i<factor_strings.size(); i++) {
+        factor_removed[i] = removed_factors[i] != 0;
+        if (!factor_removed[i]) num_factors++;
+    }
+    arc_costs.assign(num_arcs, MIN_FLOAT);
+    arc_removed.resize(num_arcs);
+    for (unsigned int arc=0; arc<num_arcs; arc++)
+        arc_removed[arc] = removed_arcs[arc] != 0;
+
+    return 0;
+}
+
+
+bool
+FrozenMultiStringFactorGraph::is_image(const string &fname)
+{
+    ifstream imagefile(fname.c_str(), ios_base::in | ios_base::binary);
+    char magic[sizeof(msfg_image_magic)];
+    if (!imagefile.read(magic, sizeof(magic))) return false;
+    return memcmp(magic, msfg_image_magic, sizeof(msfg_image_magic)) == 0;
+}
+
+
+int
+FrozenMultiStringFactorGraph::factor_index(const string &factor) const
+{
+    auto it = lower_bound(factor_strings.begin(), factor_strings.end(), factor);
+    if (it == factor_strings.end() || *it != factor) return -1;
+    return it - factor_strings.begin();
+}
+
+
+void
+FrozenMultiStringFactorGraph::get_transitions(const bigram_stats_t &stats,
+                                              transitions_t &transitions) const
+{
+    for (auto it = stats.cbegin(); it != stats.cend(); ++it) {
+        const string &source = factor_strings[it->first >> 32];
+        const string &target = factor_strings[it->first & 0xffffffff];
+        transitions[source][target] += it->second;
+    }
+}
+
+
+void
+FrozenMultiStringFactorGraph::remove_arcs(const string &factor)
+{
+    if (factor.length() < 2) {
+        cerr << "Trying to remove factor of length 1: " << factor << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    int factor_idx = factor_index(factor);
+    if (factor_idx < 0 || factor_removed[factor_idx]) return;
+
+    for (unsigned int i=factor_node_offsets[factor_idx]; i<factor_node_offsets[factor_idx+1]; i++) {
+        msfg_node_idx_t node = factor_nodes[i];
+        for (unsigned int arc=outgoing_offsets[node]; arc<outgoing_offsets[node+1]; arc++)
+            arc_removed[arc] = true;
+        for (unsigned int j=incoming_offsets[node]; j<incoming_offsets[node+1]; j++)
+            arc_removed[incoming_arcs[j]] = true;
+    }
+
+    factor_removed[factor_idx] = true;
+    num_factors--;
+}
+
+
+void
+FrozenMultiStringFactorGraph::prune_unused(transitions_t &transitions)
+{
+    if (transitions.size() < num_factors) {
+        vector<string> to_remove;
+        cerr << "Pruning " << num_factors-transitions.size() << " unused factors from msfg." << endl;
+        for (unsigned int i=0; i<factor_strings.size(); i++)
+            if (!factor_removed[i] && transitions.find(factor_strings[i]) == transitions.end())
+                to_remove.push_back(factor_strings[i]);
+        for (auto it = to_remove.begin(); it != to_remove.end(); ++it)
+            remove_arcs(*it);
+    }
+}
+
+
+void
+FrozenMultiStringFactorGraph::collect_factors(const string &text,
+                                              set<string> &factors) const
+{
+    msfg_node_idx_t end_node = string_end_nodes.at(text);
+    set<msfg_node_idx_t> nodes_to_process; nodes_to_process.insert(end_node);
+
+    while(nodes_to_process.size() > 0) {
+
+        msfg_node_idx_t i = *(nodes_to_process.rbegin());
+
+        factors.insert(get_factor(i));
+        for (unsigned int j=incoming_offsets[i]; j<incoming_offsets[i+1]; j++)
+            if (!arc_removed[incoming_arcs[j]])
+                nodes_to_process.insert(arc_sources[incoming_arcs[j]]);
+
+        nodes_to_process.erase(i);
+    }
+}
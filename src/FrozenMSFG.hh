@@ -0,0 +1,123 @@
+#ifndef FROZEN_MSFG
+#define FROZEN_MSFG
+
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "defs.hh"
+#include "MSFG.hh"
+
+// Bigram statistics by the factor indices of a frozen graph,
+// the key is the source index in the upper and the target index in the lower 32 bits
+typedef std::unordered_map<unsigned long long, flt_type> bigram_stats_t;
+
+/** Multi string factor graph compiled to flat arrays for the EM iterations.
+ * The nodes keep the topological order and the indices of the graph they
+ * were compiled from. The factors are stored once, sorted, and each node has
+ * the index of its factor. The arcs are ordered by the source and target node,
+ * the arcs of node i are outgoing_offsets[i] .. outgoing_offsets[i+1]-1. The
+ * incoming arcs of node i are the arc indices incoming_arcs[incoming_offsets[i]]
+ * .. incoming_arcs[incoming_offsets[i+1]-1] in the order of the source node.
+ * The factors missing from the factor node map of the compiled graph are
+ * removed. No nodes or arcs are added after compiling, removed arcs are only
+ * marked. The arc costs are copied from the model by the factor indices. The node and arc arrays may be built in memory or
+ * mapped read-only from a binary image, the factors and the end nodes of the
+ * strings are read from the image to memory. */
+
+class FrozenMultiStringFactorGraph {
+public:
+
+    /** Creates an empty graph, for instance for open_image */
+    FrozenMultiStringFactorGraph(const std::string &start_end_symbol);
+    FrozenMultiStringFactorGraph(const MultiStringFactorGraph &msfg);
+    FrozenMultiStringFactorGraph(const FrozenMultiStringFactorGraph&) = delete;
+    FrozenMultiStringFactorGraph& operator=(const FrozenMultiStringFactorGraph&) = delete;
+    ~FrozenMultiStringFactorGraph();
+
+    /** Compiles the graph, replaces the current one */
+    void build(const MultiStringFactorGraph &msfg);
+
+    /** Writes the graph to a versioned binary image for open_image
+     * removed arcs and factors are stored marked and stay removed when opened
+     * \param fname = file name of the image
+     * \return 0 on success, -1 on failure
+     */
+    int write_image(const std::string &fname) const;
+
+    /** Maps a binary image written by write_image read-only
+     * the image must have been written with the same version and byte order,
+     * the offsets and node, factor and arc indices are checked to be in range
+     * \param fname = file name of the image
+     * \return 0 on success, -1 on failure
+     */
+    int open_image(const std::string &fname);
+
+    /** Checks if the file starts like a binary image */
+    static bool is_image(const std::string &fname);
+
+    unsigned int node_count() const { return num_nodes; }
+    unsigned int arc_count() const { return num_arcs; }
+    /** Returns the number of factors with arcs not removed */
+    unsigned int factor_count() const { return num_factors; }
+
+    /** Index of the factor, -1 if not in the graph */
+    int factor_index(const std::string &factor) const;
+    const std::string& get_factor(msfg_node_idx_t node) const
+    { return factor_strings[node_factors[node]]; }
+
+    static inline unsigned long long bigram_key(int source, int target)
+    { return ((unsigned long long)source << 32) | (unsigned int)target; }
+
+    /** Converts statistics by the factor indices to strings */
+    void get_transitions(const bigram_stats_t &stats,
+                         transitions_t &transitions) const;
+
+    void remove_arcs(const std::string &factor);
+    void prune_unused(transitions_t &transitions);
+    void collect_factors(const std::string &text,
+                         std::set<std::string> &factors) const;
+
+    std::string start_end_symbol;
+    std::vector<std::string> factor_strings; //!< Factors sorted
+    std::vector<bool> factor_removed; //!< Factors removed with remove_arcs
+    const unsigned int *factor_node_offsets; //!< First node of each factor in factor_nodes
+    const msfg_node_idx_t *factor_nodes; //!< Nodes grouped by the factor
+    const int *node_factors; //!< Factor index of each node
+    const unsigned int *outgoing_offsets; //!< First outgoing arc of each node, one past the last node
+    const msfg_node_idx_t *arc_sources; //!< Source node of each arc
+    const msfg_node_idx_t *arc_targets; //!< Target node of each arc
+    const unsigned int *incoming_offsets; //!< First incoming arc of each node in incoming_arcs
+    const unsigned int *incoming_arcs; //!< Arc indices grouped by the target node
+    std::vector<flt_type> arc_costs; //!< Cost of each arc set by assign_scores, MIN_FLOAT before scoring
+    std::vector<bool> arc_removed; //!< Arcs removed from the graph
+    std::map<std::string, msfg_node_idx_t> string_end_nodes;
+
+private:
+
+    /** Points the arrays to the arrays built in memory */
+    void use_arrays();
+
+    /** Unmaps a mapped image and clears the graph */
+    void release();
+
+    unsigned int num_factors; //!< Factors not removed
+    unsigned int num_nodes;
+    unsigned int num_arcs;
+
+    std::vector<unsigned int> factor_node_offset_array; //!< Storage for factor_node_offsets when built in memory
+    std::vector<msfg_node_idx_t> factor_node_array; //!< Storage for factor_nodes when built in memory
+    std::vector<int> node_factor_array; //!< Storage for node_factors when built in memory
+    std::vector<unsigned int> outgoing_offset_array; //!< Storage for outgoing_offsets when built in memory
+    std::vector<msfg_node_idx_t> arc_source_array; //!< Storage for arc_sources when built in memory
+    std::vector<msfg_node_idx_t> arc_target_array; //!< Storage for arc_targets when built in memory
+    std::vector<unsigned int> incoming_offset_array; //!< Storage for incoming_offsets when built in memory
+    std::vector<unsigned int> incoming_arc_array; //!< Storage for incoming_arcs when built in memory
+    void *image; //!< Mapped image, nullptr if built in memory
+    size_t image_size; //!< Size of the mapped image in bytes
+};
+
+
+#endif /* FROZEN_MSFG */
@@ -0,0 +1,461 @@
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FrozenStringSet.hh"
+
+using namespace std;
+
+
+FrozenStringSet::FrozenStringSet()
+    : max_factor_length(0), character_count(0), num_nodes(1), num_strings(0),
+      image(nullptr), image_size(0)
+{
+    for (int i=0; i<256; i++) codes[i] = 0;
+    for (int i=0; i<256; i++) added_first_bytes[i] = false;
+    base_array.resize(1, 0);
+    check_array.resize(1, -1);
+    factor_array.resize(1, -1);
+    use_arrays();
+}
+
+
+FrozenStringSet::FrozenStringSet(const map<string, flt_type> &vocab)
+    : image(nullptr), image_size(0)
+{
+    for (int i=0; i<256; i++) added_first_bytes[i] = false;
+    vector<pair<string, flt_type> > sorted_vocab(vocab.begin(), vocab.end());
+    build(sorted_vocab);
+}
+
+
+FrozenStringSet::FrozenStringSet(const StringSet &vocab)
+    : image(nullptr), image_size(0)
+{
+    for (int i=0; i<256; i++) added_first_bytes[i] = false;
+    vector<pair<string, flt_type> > sorted_vocab;
+    vocab.collect_factors(sorted_vocab);
+    sort(sorted_vocab.begin(), sorted_vocab.end());
+    build(sorted_vocab);
+}
+
+
+FrozenStringSet::~FrozenStringSet()
+{
+    release();
+}
+
+
+void
+FrozenStringSet::use_arrays()
+{
+    base = base_array.data();
+    check = check_array.data();
+    factors = factor_array.data();
+    costs = cost_array.data();
+    num_slots = check_array.size();
+    num_factors = cost_array.size();
+}
+
+
+void
+FrozenStringSet::release()
+{
+    if (image != nullptr) munmap(image, image_size);
+    image = nullptr;
+    image_size = 0;
+    base_array.clear();
+    check_array.clear();
+    factor_array.clear();
+    cost_array.clear();
+    added_letters.clear();
+    added_strings.clear();
+    added_costs.clear();
+    for (int i=0; i<256; i++) added_first_bytes[i] = false;
+}
+
+
+// Layout of the binary image, the header is followed by the costs
+// and the base, check and factor arrays
+struct FrozenImageHeader {
+    char magic[8];
+    unsigned int byte_order;
+    unsigned int flt_size;
+    unsigned int num_slots;
+    unsigned int num_factors;
+    unsigned int num_nodes;
+    unsigned int num_strings;
+    int max_factor_length;
+    int character_count;
+    int codes[256];
+};
+
+static const char image_magic[8] = { 'F', 'S', 'S', 'I', 'M', 'G', '0', '1' };
+static const unsigned int image_byte_order = 0x01020304;
+
+
+int
+FrozenStringSet::write_image(const string &fname) const
+{
+    FrozenImageHeader header;
+    memcpy(header.magic, image_magic, sizeof(image_magic));
+    header.byte_order = image_byte_order;
+    header.flt_size = sizeof(flt_type);
+    header.num_slots = num_slots;
+    header.num_factors = num_factors;
+    header.num_nodes = num_nodes;
+    header.num_strings = num_strings;
+    header.max_factor_length = max_factor_length;
+    header.character_count = character_count;
+    memcpy(header.codes, codes, sizeof(codes));
+
+    ofstream imagefile(fname.c_str(), ios_base::out | ios_base::binary | ios_base::trunc);
+    if (!imagefile) return -1;
+    imagefile.write((const char*)&header, sizeof(header));
+    imagefile.write((const char*)costs, num_factors * sizeof(flt_type));
+    imagefile.write((const char*)base, num_slots * sizeof(int));
+    imagefile.write((const char*)check, num_slots * sizeof(int));
+    imagefile.write((const char*)factors, num_slots * sizeof(int));
+    imagefile.close();
+    if (!imagefile) return -1;
+
+    return 0;
+}
+
+
+int
+FrozenStringSet::open_image(const string &fname)
+{
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FrozenImageHeader)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+
+    const FrozenImageHeader *header = (const FrozenImageHeader*)data;
+    size_t expected_size = sizeof(FrozenImageHeader)
+        + (size_t)header->num_factors * sizeof(flt_type)
+        + (size_t)header->num_slots * 3 * sizeof(int);
+    if (memcmp(header->magic, image_magic, sizeof(image_magic)) != 0
+        || header->byte_order != image_byte_order
+        || header->flt_size != sizeof(flt_type)
+        || header->num_slots < 257
+        || size != expected_size)
+    {
+        munmap(data, size);
+        return -1;
+    }
+
+    release();
+    image = data;
+    image_size = size;
+    num_slots = header->num_slots;
+    num_factors = header->num_factors;
+    num_nodes = header->num_nodes;
+    num_strings = header->num_strings;
+    max_factor_length = header->max_factor_length;
+    character_count = header->character_count;
+    memcpy(codes, header->codes, sizeof(codes));
+
+    const char *arrays = (const char*)data + sizeof(FrozenImageHeader);
+    costs = (const flt_type*)arrays;
+    base = (const int*)(arrays + num_factors * sizeof(flt_type));
+    check = base + num_slots;
+    factors = check + num_slots;
+
+    return 0;
+}
+
+
+bool
+FrozenStringSet::is_image(const string &fname)
+{
+    ifstream imagefile(fname.c_str(), ios_base::in | ios_base::binary);
+    char magic[sizeof(image_magic)];
+    if (!imagefile.read(magic, sizeof(magic))) return false;
+    return memcmp(magic, image_magic, sizeof(image_magic)) == 0;
+}
+
+
+void
+FrozenStringSet::get_vocab(map<string, flt_type> &vocab) const
+{
+    vocab.clear();
+
+    char letters[257] = { 0 };
+    for (int i=0; i<256; i++)
+        if (codes[i] > 0) letters[codes[i]] = (char)i;
+
+    vector<pair<int, string> > nodes_to_process;
+    nodes_to_process.push_back(make_pair((int)root_node, string()));
+    while (nodes_to_process.size() > 0) {
+        pair<int, string> curr = nodes_to_process.back();
+        nodes_to_process.pop_back();
+        if (factors[curr.first] >= 0)
+            vocab[curr.second] = costs[factors[curr.first]];
+        for (int code=1; code<=character_count; code++) {
+            int target = base[curr.first] + code;
+            if (check[target] == curr.first)
+                nodes_to_process.push_back(make_pair(target, curr.second + letters[code]));
+        }
+    }
+    for (unsigned int i=0; i<added_strings.size(); i++)
+        vocab[added_strings[i]] = added_costs[i];
+}
+
+
+bool
+FrozenStringSet::includes(const string &factor) const
+{
+    return factor_index(factor) >= 0;
+}
+
+
+int
+FrozenStringSet::factor_index(const string &factor) const
+{
+    int node = find_node(factor);
+    if (node > 0 && factors[node] >= 0) return factors[node];
+    if (factor.length() == 0 || factor.length() > 4) return -1;
+    return added_letter(factor, 0, factor.length());
+}
+
+
+flt_type
+FrozenStringSet::get_score(const string &factor) const
+{
+    int factor_idx = factor_index(factor);
+    if (factor_idx < 0) throw string("could not find factor");
+    return factor_cost(factor_idx);
+}
+
+
+int
+FrozenStringSet::add_letter(const string &letter, flt_type cost)
+{
+    if (letter.length() == 0 || letter.length() > 4) throw string("not a single letter: " + letter);
+    int factor_idx = factor_index(letter);
+    if (factor_idx >= 0) return factor_idx;
+
+    factor_idx = factor_count();
+    added_letters[letter_key(letter, 0, letter.length())] = factor_idx;
+    added_strings.push_back(letter);
+    added_costs.push_back(cost);
+    added_first_bytes[(unsigned char)letter[0]] = true;
+    max_factor_length = max(max_factor_length, (int)letter.length());
+    return factor_idx;
+}
+
+
+int
+FrozenStringSet::find_node(const string &factor) const
+{
+    int node = root_node;
+    for (unsigned int i=0; i<factor.length(); i++) {
+        node = find_arc(factor[i], node);
+        if (node < 0) return -1;
+    }
+    return node;
+}
+
+
+bool code_desc_sort(pair<unsigned char, int> i, pair<unsigned char, int> j) { return (i.second > j.second); }
+void
+FrozenStringSet::learn_codes(const vector<pair<string, flt_type> > &sorted_vocab)
+{
+    vector<pair<unsigned char, int> > charcounts;
+    for (int i=0; i<256; i++) charcounts.push_back(make_pair((unsigned char)i, 0));
+    for (auto it = sorted_vocab.cbegin(); it != sorted_vocab.cend(); ++it)
+        for (const char &chr : it->first) charcounts[(unsigned char)chr].second++;
+    stable_sort(charcounts.begin(), charcounts.end(), code_desc_sort);
+
+    for (int i=0; i<256; i++) codes[i] = 0;
+    character_count = 0;
+    for (auto it = charcounts.begin(); it != charcounts.end(); ++it) {
+        if (it->second == 0) break;
+        codes[it->first] = ++character_count;
+    }
+}
+
+
+// Range of sorted strings sharing the prefix of a node
+struct PrefixRange {
+    PrefixRange(int node, unsigned int begin, unsigned int end, unsigned int depth)
+        : node(node), begin(begin), end(end), depth(depth) { }
+    int node;
+    unsigned int begin;
+    unsigned int end;
+    unsigned int depth;
+};
+
+
+// Doubly linked list of the unused slots while placing nodes
+// Slots which have failed as the first child position too many times
+// are unlinked, they may still be used for other children
+class FreeSlots {
+public:
+    FreeSlots(vector<int> &check) : check(check), head(-1) { }
+
+    void grow(unsigned int new_size) {
+        unsigned int old_size = check.size();
+        check.resize(new_size, -1);
+        next.resize(new_size); prev.resize(new_size);
+        fails.resize(new_size, 0); listed.resize(new_size, true);
+        for (unsigned int i=old_size; i<new_size; i++) {
+            if (head == -1) {
+                head = i; next[i] = i; prev[i] = i;
+                continue;
+            }
+            int tail = prev[head];
+            next[tail] = i; prev[i] = tail;
+            next[i] = head; prev[head] = i;
+        }
+    }
+
+    void take(int slot) {
+        if (!listed[slot]) return;
+        listed[slot] = false;
+        if (next[slot] == slot) head = -1;
+        else {
+            next[prev[slot]] = next[slot];
+            prev[next[slot]] = prev[slot];
+            if (head == slot) head = next[slot];
+        }
+    }
+
+    void fail(int slot) {
+        if (++fails[slot] >= 16) take(slot);
+    }
+
+    vector<int> &check;
+    vector<int> next;
+    vector<int> prev;
+    vector<unsigned char> fails;
+    vector<bool> listed;
+    int head;
+};
+
+
+void
+FrozenStringSet::build(const vector<pair<string, flt_type> > &sorted_vocab)
+{
+    learn_codes(sorted_vocab);
+
+    max_factor_length = 0;
+    num_strings = 0;
+    vector<flt_type> &costs = cost_array;
+    vector<int> &base = base_array;
+    vector<int> &check = check_array;
+    vector<int> &factors = factor_array;
+    costs.resize(sorted_vocab.size());
+    for (unsigned int i=0; i<sorted_vocab.size(); i++)
+        costs[i] = sorted_vocab[i].second;
+    base.clear();
+    check.clear();
+    factors.clear();
+
+    FreeSlots free_slots(check);
+    free_slots.grow(1024);
+    free_slots.take(root_node);
+    check[root_node] = -2;
+    base.resize(check.size(), 0);
+    factors.resize(check.size(), -1);
+    num_nodes = 1;
+
+    deque<PrefixRange> queue;
+    queue.push_back(PrefixRange(root_node, 0, sorted_vocab.size(), 0));
+    vector<pair<int, pair<unsigned int, unsigned int> > > children;
+    int max_slot = 0;
+
+    while (queue.size() > 0) {
+        PrefixRange range = queue.front();
+        queue.pop_front();
+
+        // The shortest string of the range may end in this node
+        unsigned int i = range.begin;
+        if (i < range.end && sorted_vocab[i].first.length() == range.depth) {
+            if (range.depth > 0) {
+                factors[range.node] = i;
+                num_strings++;
+                max_factor_length = max(max_factor_length, (int)range.depth);
+            }
+            i++;
+        }
+
+        // Group the rest by the next letter
+        children.clear();
+        while (i < range.end) {
+            int code = codes[(unsigned char)sorted_vocab[i].first[range.depth]];
+            unsigned int j = i+1;
+            while (j < range.end && codes[(unsigned char)sorted_vocab[j].first[range.depth]] == code) j++;
+            children.push_back(make_pair(code, make_pair(i, j)));
+            i = j;
+        }
+        if (children.size() == 0) continue;
+        sort(children.begin(), children.end());
+
+        // Find the first offset where all children fit
+        int slot = free_slots.head;
+        int offset = 0;
+        while (true) {
+            if (slot == -1) {
+                free_slots.grow(check.size()*2);
+                slot = free_slots.head;
+            }
+            offset = slot - children[0].first;
+            if (offset >= 0) {
+                if (offset + 257 >= (int)check.size())
+                    free_slots.grow(max(check.size()*2, (size_t)offset+258));
+                bool fits = true;
+                for (unsigned int ci=1; ci<children.size(); ci++)
+                    if (check[offset + children[ci].first] != -1) { fits = false; break; }
+                if (fits) break;
+            }
+            // The list is in ascending order, wrapping around means no fit
+            int next_slot = free_slots.next[slot];
+            if (offset >= 0) free_slots.fail(slot);
+            if (next_slot <= slot || free_slots.head == -1) {
+                unsigned int old_size = check.size();
+                free_slots.grow(old_size*2);
+                next_slot = old_size;
+            }
+            slot = next_slot;
+        }
+        if (base.size() < check.size()) {
+            base.resize(check.size(), 0);
+            factors.resize(check.size(), -1);
+        }
+
+        base[range.node] = offset;
+        for (auto cit = children.begin(); cit != children.end(); ++cit) {
+            int target = offset + cit->first;
+            free_slots.take(target);
+            check[target] = range.node;
+            max_slot = max(max_slot, target);
+            queue.push_back(PrefixRange(target, cit->second.first, cit->second.second, range.depth+1));
+            num_nodes++;
+        }
+    }
+
+    // Trim, leaving space for a transition with any letter from any node
+    unsigned int size = max_slot + 257;
+    check.resize(size, -1);
+    base.resize(size, 0);
+    factors.resize(size, -1);
+    check.shrink_to_fit();
+    base.shrink_to_fit();
+    factors.shrink_to_fit();
+    use_arrays();
+}
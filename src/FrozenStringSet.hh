@@ -0,0 +1,175 @@
+#ifndef FROZEN_STRINGSET_HH
+#define FROZEN_STRINGSET_HH
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "defs.hh"
+#include "StringSet.hh"
+
+/** A read-only set of strings in a compacted double-array letter tree.
+ * Nodes are plain integer indices. The node reached from node s with a
+ * letter coded as c is base[s]+c, which is valid only if check[base[s]+c] == s.
+ * Each node may end a factor. Factors are indexed in the lexicographic
+ * order of the strings and the index is used for looking up the cost.
+ * The arrays may be built in memory or mapped read-only from a binary image,
+ * in which case the pages are shared by all processes mapping the same file.
+ * Single letters missing from the set, like out-of-vocabulary letters of the
+ * text, may be added afterwards to a side table outside the tree. They get the
+ * factor indices after the ones of the tree and are not written to an image. */
+
+class FrozenStringSet {
+public:
+
+    /** Default constructor, creates an empty set. */
+    FrozenStringSet();
+    FrozenStringSet(const std::map<std::string, flt_type> &vocab);
+    FrozenStringSet(const StringSet &vocab);
+    FrozenStringSet(const FrozenStringSet&) = delete;
+    FrozenStringSet& operator=(const FrozenStringSet&) = delete;
+    ~FrozenStringSet();
+
+    /** Writes the set to a binary image for open_image
+     * \param fname = file name of the image
+     * \return 0 on success, -1 on failure
+     */
+    int write_image(const std::string &fname) const;
+
+    /** Maps a binary image written by write_image read-only
+     * the image must have been written with the same flt_type and byte order
+     * \param fname = file name of the image
+     * \return 0 on success, -1 on failure
+     */
+    int open_image(const std::string &fname);
+
+    /** Checks if the file starts like a binary image */
+    static bool is_image(const std::string &fname);
+
+    /** Find the node reached with the given letter from the given node.
+     * \param letter = the letter to search
+     * \param node = the source node
+     * \return the target node or -1 if no such transition exists
+     */
+    inline int find_arc(char letter, int node) const
+    {
+        int code = codes[(unsigned char)letter];
+        if (code == 0) return -1;
+        int target = base[node] + code;
+        if (check[target] != node) return -1;
+        return target;
+    }
+
+    /** Factor index of a letter added with add_letter, -1 if none
+     * \param text = the text
+     * \param start = start position of the letter in the text
+     * \param end = end position of the letter in the text
+     */
+    inline int added_letter(const std::string &text, unsigned int start, unsigned int end) const
+    {
+        if (!added_first_bytes[(unsigned char)text[start]]) return -1;
+        auto it = added_letters.find(letter_key(text, start, end));
+        if (it == added_letters.end()) return -1;
+        return it->second;
+    }
+
+    /** Adds a single letter missing from the set to the side table
+     * \param letter = the letter, at most four bytes
+     * \param cost = cost of the letter
+     * \return the factor index of the letter
+     */
+    int add_letter(const std::string &letter, flt_type cost);
+
+    /** Returns the number of letters added with add_letter */
+    unsigned int added_letter_count() const { return added_costs.size(); }
+
+    /** Index of the factor ending in the node, -1 if none */
+    inline int factor_id(int node) const { return factors[node]; }
+
+    /** Cost of the factor ending in the node */
+    inline flt_type cost(int node) const { return costs[factors[node]]; }
+
+    /** Checks if the string is in the set */
+    bool includes(const std::string &factor) const;
+
+    /** Index of the factor, -1 if the string is not in the set */
+    int factor_index(const std::string &factor) const;
+
+    /** Cost of the factor by the factor index, including the added letters */
+    inline flt_type factor_cost(int factor) const
+    {
+        if (factor < (int)num_factors) return costs[factor];
+        return added_costs[factor-num_factors];
+    }
+
+    /** Returns the number of factor indices, including the added letters */
+    unsigned int factor_count() const { return num_factors + added_costs.size(); }
+
+    /** Get a score of a string in the set
+        Throws if string not in the set */
+    flt_type get_score(const std::string &factor) const;
+
+    /** Returns the number of stored strings, including the added letters */
+    unsigned int string_count() const { return num_strings + added_costs.size(); }
+
+    /** Returns the number of nodes in the tree */
+    unsigned int node_count() const { return num_nodes; }
+
+    /** Copies the factors in the set with their scores to a map */
+    void get_vocab(std::map<std::string, flt_type> &vocab) const;
+
+    static const int root_node = 0; //!< The root of the string tree
+    int max_factor_length; //!< The length of the longest factor in the set
+    int character_count; //!< Number of distinct letters
+
+private:
+
+    /** Constructs the double-array from lexicographically sorted strings */
+    void build(const std::vector<std::pair<std::string, flt_type> > &sorted_vocab);
+
+    /** Constructs the letter coding to range [1,|C|], most common letters first */
+    void learn_codes(const std::vector<std::pair<std::string, flt_type> > &sorted_vocab);
+
+    /** Walks the tree, returns the node for the string or -1 */
+    int find_node(const std::string &factor) const;
+
+    /** Points the lookup arrays to the arrays built in memory */
+    void use_arrays();
+
+    /** Unmaps a mapped image and clears the arrays built in memory and the added letters */
+    void release();
+
+    /** Key of the letter text[start..end-1] in the added letters */
+    static inline unsigned long long letter_key(const std::string &text, unsigned int start, unsigned int end)
+    {
+        unsigned long long key = end-start;
+        for (unsigned int i=start; i<end; i++)
+            key = (key << 8) | (unsigned char)text[i];
+        return key;
+    }
+
+    const int *base; //!< Offset to the child nodes
+    const int *check; //!< Parent node of each slot, -1 if unused
+    const int *factors; //!< Factor index for each node, -1 if none
+    const flt_type *costs; //!< Factor costs indexed by the factor index
+    int codes[256]; //!< Letter codes, 0 for letters not in the set
+    unsigned int num_slots;
+    unsigned int num_factors;
+    unsigned int num_nodes;
+    unsigned int num_strings;
+
+    std::vector<int> base_array; //!< Storage for base when built in memory
+    std::vector<int> check_array; //!< Storage for check when built in memory
+    std::vector<int> factor_array; //!< Storage for factors when built in memory
+    std::vector<flt_type> cost_array; //!< Storage for costs when built in memory
+    std::unordered_map<unsigned long long, int> added_letters; //!< Factor indices of the added letters by the letter key
+    std::vector<std::string> added_strings; //!< Added letters in the order of the factor index
+    std::vector<flt_type> added_costs; //!< Costs of the added letters in the order of the factor index
+    bool added_first_bytes[256]; //!< First bytes of the added letters
+    void *image; //!< Mapped image, nullptr if built in memory
+    size_t image_size; //!< Size of the mapped image in bytes
+};
+
+
+#endif /* FROZEN_STRINGSET_HH */
@@ -317,7 +317,7 @@ MultiStringFactorGraph::read(const std::string &filename)
 
     msfg_node_idx_t end_node_idx;
     string curr_string;
-    for (int i=0; i<arc_count; i++) {
+    for (int i=0; i<end_node_count; i++) {
         getline(infile, line);
         stringstream endnss(line);
         endnss >> type;
@@ -0,0 +1,202 @@
+#include <deque>
+
+#include "RadixStringSet.hh"
+
+using namespace std;
+
+
+RadixStringSet::RadixStringSet()
+    : max_factor_length(0), num_strings(0)
+{
+    nodes.resize(1);
+    nodes[0].label_start = 0;
+    nodes[0].label_length = 0;
+    nodes[0].first_child = 0;
+    nodes[0].child_count = 0;
+    nodes[0].factor = -1;
+    first_letters.resize(1, 0);
+}
+
+
+// Range of sorted strings below a node, depth is the length of the prefix
+struct RadixRange {
+    RadixRange(int node, unsigned int begin, unsigned int end, unsigned int depth)
+        : node(node), begin(begin), end(end), depth(depth) { }
+    int node;
+    unsigned int begin;
+    unsigned int end;
+    unsigned int depth;
+};
+
+
+RadixStringSet::RadixStringSet(const map<string, flt_type> &vocab)
+    : max_factor_length(0)
+{
+    vector<const string*> strings;
+    strings.reserve(vocab.size());
+    costs.reserve(vocab.size());
+    for (auto it = vocab.cbegin(); it != vocab.cend(); ++it) {
+        if (it->first.length() == 0) continue;
+        strings.push_back(&(it->first));
+        costs.push_back(it->second);
+        max_factor_length = max(max_factor_length, (int)it->first.length());
+    }
+    num_strings = strings.size();
+    factor_nodes.resize(strings.size(), 0);
+
+    Node root;
+    root.label_start = 0;
+    root.label_length = 0;
+    root.first_child = 0;
+    root.child_count = 0;
+    root.factor = -1;
+    nodes.push_back(root);
+    first_letters.push_back(0);
+
+    deque<RadixRange> queue;
+    queue.push_back(RadixRange(root_node, 0, strings.size(), 0));
+    while (queue.size() > 0) {
+        RadixRange range = queue.front();
+        queue.pop_front();
+
+        // The shortest string of the range may end in this node
+        unsigned int i = range.begin;
+        if (i < range.end && strings[i]->length() == range.depth) {
+            nodes[range.node].factor = i;
+            factor_nodes[i] = range.node;
+            i++;
+        }
+
+        // One child for each distinct letter, the edge runs over the
+        // prefix shared by all strings of the child
+        nodes[range.node].first_child = nodes.size();
+        while (i < range.end) {
+            const string &first = *strings[i];
+            char letter = first[range.depth];
+            unsigned int j = i+1;
+            while (j < range.end && (*strings[j])[range.depth] == letter) j++;
+
+            const string &last = *strings[j-1];
+            unsigned int depth = range.depth+1;
+            while (depth < first.length() && first[depth] == last[depth]) depth++;
+
+            Node child;
+            child.label_start = labels.length();
+            child.label_length = depth - range.depth;
+            child.first_child = 0;
+            child.child_count = 0;
+            child.factor = -1;
+            labels.append(first, range.depth, depth - range.depth);
+            queue.push_back(RadixRange(nodes.size(), i, j, depth));
+            nodes.push_back(child);
+            first_letters.push_back((unsigned char)letter);
+            nodes[range.node].child_count++;
+            i = j;
+        }
+    }
+}
+
+
+int
+RadixStringSet::find_node(const string &factor) const
+{
+    if (factor.length() == 0) return -1;
+    int node = root_node;
+    unsigned int pos = 0;
+    while (pos < factor.length()) {
+        node = find_edge(factor, pos, node);
+        if (node < 0) return -1;
+        pos += nodes[node].label_length;
+    }
+    return node;
+}
+
+
+bool
+RadixStringSet::includes(const string &factor) const
+{
+    int node = find_node(factor);
+    if (node < 0) return false;
+    return nodes[node].factor >= 0;
+}
+
+
+flt_type
+RadixStringSet::get_score(const string &factor) const
+{
+    int node = find_node(factor);
+    if (node < 0 || nodes[node].factor < 0) throw string("could not find factor");
+    return costs[nodes[node].factor];
+}
+
+
+int
+RadixStringSet::factor_index(const string &factor) const
+{
+    int node = find_node(factor);
+    if (node < 0 || nodes[node].factor < 0) return -1;
+    return nodes[node].factor;
+}
+
+
+void
+RadixStringSet::add(const string &factor, flt_type cost)
+{
+    int node = find_node(factor);
+    if (node < 0 || nodes[node].factor == -1) throw string("could not add factor");
+    int index = nodes[node].factor;
+    if (index < -1) index = -index-2;
+    enable(index);
+    costs[index] = cost;
+}
+
+
+void
+RadixStringSet::disable(int factor)
+{
+    Node &node = nodes[factor_nodes[factor]];
+    if (node.factor < 0) return;
+    node.factor = -node.factor-2;
+    num_strings--;
+}
+
+
+void
+RadixStringSet::enable(int factor)
+{
+    Node &node = nodes[factor_nodes[factor]];
+    if (node.factor >= 0) return;
+    node.factor = -node.factor-2;
+    num_strings++;
+}
+
+
+void
+RadixStringSet::assign_scores(const vector<flt_type> &costs)
+{
+    for (unsigned int i=0; i<factor_nodes.size(); i++) {
+        if (costs[i] == MIN_FLOAT) disable(i);
+        else {
+            enable(i);
+            this->costs[i] = costs[i];
+        }
+    }
+}
+
+
+void
+RadixStringSet::get_vocab(map<string, flt_type> &vocab) const
+{
+    vocab.clear();
+    vector<pair<int, string> > nodes_to_process;
+    nodes_to_process.push_back(make_pair((int)root_node, string()));
+    while (nodes_to_process.size() > 0) {
+        pair<int, string> curr = nodes_to_process.back();
+        nodes_to_process.pop_back();
+        const Node &node = nodes[curr.first];
+        if (node.factor >= 0)
+            vocab[curr.second] = costs[node.factor];
+        for (unsigned int i=node.first_child; i<node.first_child+node.child_count; i++)
+            nodes_to_process.push_back(make_pair((int)i, curr.second + labels.substr(nodes[i].label_start, nodes[i].label_length)));
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef RADIX_STRINGSET_HH
+#define RADIX_STRINGSET_HH
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "defs.hh"
+
+/** A set of strings in a path-compressed letter tree.
+ * Chains of nodes with a single child are collapsed to one edge with
+ * a multi-letter label, so long phrase factors take one node instead of
+ * one node per letter. A node ends exactly where a factor ends or where
+ * the strings branch. The tree layout is fixed at construction, factors
+ * may only be disabled and enabled afterwards. Factors are indexed in the
+ * lexicographic order of the strings. */
+
+class RadixStringSet {
+public:
+
+    /** Node of the tree, the edge label leads to the node from its parent */
+    class Node {
+    public:
+        unsigned int label_start; //!< Offset of the edge label in labels
+        unsigned int label_length; //!< Length of the edge label
+        unsigned int first_child; //!< Index of the first child, children are consecutive
+        unsigned int child_count; //!< Number of children
+        int factor; //!< Index of the factor, -1 if none, -(index+2) if disabled
+    };
+
+    /** Default constructor, creates an empty set. */
+    RadixStringSet();
+    RadixStringSet(const std::map<std::string, flt_type> &vocab);
+
+    /** Find the child whose edge label matches the text at the position
+     * \param text = the text to match
+     * \param pos = position of the first letter of the edge in the text
+     * \param node = the source node
+     * \return the child node or -1 if no edge matches
+     */
+    inline int find_edge(const std::string &text, unsigned int pos, int node) const
+    {
+        const Node &parent = nodes[node];
+        const unsigned char *first = first_letters.data() + parent.first_child;
+        const unsigned char *last = first + parent.child_count;
+        unsigned char letter = text[pos];
+        while (first < last) {
+            const unsigned char *middle = first + (last-first)/2;
+            if (*middle < letter) first = middle+1;
+            else last = middle;
+        }
+        if (first == first_letters.data() + parent.first_child + parent.child_count
+            || *first != letter) return -1;
+
+        int child = first - first_letters.data();
+        const Node &edge = nodes[child];
+        if (pos + edge.label_length > text.length()) return -1;
+        if (memcmp(labels.data() + edge.label_start + 1,
+                   text.data() + pos + 1, edge.label_length - 1) != 0) return -1;
+        return child;
+    }
+
+    /** Length of the edge label leading to the node */
+    inline unsigned int label_length(int node) const { return nodes[node].label_length; }
+
+    /** Index of the factor ending in the node, negative if none or disabled */
+    inline int factor_id(int node) const { return nodes[node].factor; }
+
+    /** Checks if the string is in the set */
+    bool includes(const std::string &factor) const;
+
+    /** Get a score of a string in the set
+        Throws if string not in the set */
+    flt_type get_score(const std::string &factor) const;
+
+    /** Returns the index of a factor, -1 if not in the set */
+    int factor_index(const std::string &factor) const;
+
+    /** Enables a factor stored at construction and sets its cost
+        Throws if the string was not in the initial vocabulary */
+    void add(const std::string &factor, flt_type cost);
+
+    /** Removes a factor by the index, the cost is kept */
+    void disable(int factor);
+
+    /** Adds back a removed factor by the index */
+    void enable(int factor);
+
+    /** Sets the scores by the factor index
+     * factors with the score MIN_FLOAT are removed, others are added back
+     * \param costs = new scores for all factors
+     */
+    void assign_scores(const std::vector<flt_type> &costs);
+
+    /** Copies the factors in the set with their scores to a map */
+    void get_vocab(std::map<std::string, flt_type> &vocab) const;
+
+    /** Returns the number of stored strings */
+    unsigned int string_count() const { return num_strings; }
+
+    /** Returns the number of indices in use, including removed factors */
+    unsigned int factor_count() const { return factor_nodes.size(); }
+
+    /** Returns the number of nodes in the tree */
+    unsigned int node_count() const { return nodes.size(); }
+
+    static const int root_node = 0; //!< The root of the string tree
+    int max_factor_length; //!< The length of the longest factor in the set
+    std::vector<flt_type> costs; //!< Factor costs by index
+
+private:
+
+    /** Walks the tree, returns the node ending the string or -1 */
+    int find_node(const std::string &factor) const;
+
+    std::vector<Node> nodes; //!< Nodes in BFS order, the root first
+    std::vector<unsigned char> first_letters; //!< First letter of the edge label of each node
+    std::string labels; //!< Edge labels of all nodes
+    std::vector<unsigned int> factor_nodes; //!< Node ending each factor by index
+    unsigned int num_strings;
+};
+
+
+#endif /* RADIX_STRINGSET_HH */
@@ -1,29 +1,123 @@
 #include <algorithm>
+#include <deque>
 
 #include "StringSet.hh"
 
 using namespace std;
 
 
-StringSet::StringSet(const std::map<std::string, flt_type> &vocab)
+const unsigned int StringSet::no_code;
+
+StringSet::StringSet(bool utf8)
+    : max_factor_length(0), character_count(0), utf8(utf8), num_strings(0)
 {
-    max_factor_length = 0;
-    learn_map(vocab);
-    root_node.arcs.resize(character_count, nullptr);
-    for (auto it = vocab.cbegin(); it !=vocab.cend(); ++it)
-        add(it->first, it->second);
+    if (!utf8) codemap.resize(256, no_code);
 }
 
 
-StringSet::~StringSet() {
-    clear(&root_node);
+// Range of sorted strings sharing the prefix of a node
+struct VocabRange {
+    VocabRange(int node, unsigned int begin, unsigned int end, unsigned int depth)
+        : node(node), begin(begin), end(end), depth(depth) { }
+    int node;
+    unsigned int begin;
+    unsigned int end;
+    unsigned int depth;
+};
+
+
+StringSet::StringSet(const std::map<std::string, flt_type> &vocab,
+                     bool utf8)
+    : utf8(utf8)
+{
+    max_factor_length = 0;
+
+    // Copy the letters of the sorted strings to one buffer for scanning them level by level
+    // Each string adds a node for every letter after the prefix shared
+    // with the previous string, so the arenas never reallocate
+    // Factor indices follow the order of the strings, the byte order
+    // of valid UTF-8 strings is the order of the code points
+    vector<unsigned int> offsets;
+    vector<unsigned int> letters;
+    offsets.reserve(vocab.size()+1);
+    factor_strings.reserve(vocab.size());
+    costs.reserve(vocab.size());
+    unsigned int node_count = 0;
+    unsigned int prev = 0;
+    for (auto it = vocab.cbegin(); it != vocab.cend(); ++it) {
+        if (it->first.length() == 0) continue;
+        unsigned int offset = letters.size();
+        get_letters(it->first, letters);
+        unsigned int lcp = 0;
+        if (offsets.size() > 0)
+            while (lcp < offset-prev && offset+lcp < letters.size()
+                   && letters[prev+lcp] == letters[offset+lcp]) lcp++;
+        node_count += letters.size() - offset - lcp;
+        max_factor_length = max(max_factor_length, (int)it->first.length());
+        prev = offset;
+        factor_strings.push_back(it->first);
+        costs.push_back(it->second);
+        offsets.push_back(offset);
+    }
+    offsets.push_back(letters.size());
+    num_strings = factor_strings.size();
+    learn_map(letters);
+    node_arena.reserve(node_count);
+    arc_arena.reserve(node_count);
+    factor_arcs.resize(factor_strings.size(), nullptr);
+
+    // Arc table offsets in BFS order, the root first
+    vector<unsigned int> table_offsets;
+    table_offsets.reserve(node_count+1);
+
+    deque<VocabRange> queue;
+    queue.push_back(VocabRange(-1, 0, factor_strings.size(), 0));
+    while (queue.size() > 0) {
+        VocabRange range = queue.front();
+        queue.pop_front();
+
+        unsigned int i = range.begin;
+        if (i < range.end && offsets[i+1]-offsets[i] == range.depth) {
+            factor_arcs[i] = &arc_arena[range.node];
+            i++;
+        }
+
+        // One child for each distinct letter
+        unsigned int table_size = range.node == -1 ? character_count : 0;
+        unsigned int first_arc = arc_arena.size();
+        while (i < range.end) {
+            unsigned int letter = letters[offsets[i]+range.depth];
+            unsigned int j = i+1;
+            while (j < range.end && letters[offsets[j]+range.depth] == letter) j++;
+
+            node_arena.push_back(Node());
+            if (offsets[i+1]-offsets[i] == range.depth+1)
+                arc_arena.push_back(Arc(letter, i, &node_arena.back()));
+            else
+                arc_arena.push_back(Arc(letter, -1, &node_arena.back()));
+            table_size = max(table_size, remap_letter(letter)+1);
+            queue.push_back(VocabRange(node_arena.size()-1, i, j, range.depth+1));
+            i = j;
+        }
+
+        Node &node = range.node == -1 ? root_node : node_arena[range.node];
+        table_offsets.push_back(arc_table_arena.size());
+        node.arc_count = table_size;
+        arc_table_arena.resize(arc_table_arena.size() + table_size, nullptr);
+        for (unsigned int ai=first_arc; ai<arc_arena.size(); ai++)
+            arc_table_arena[table_offsets.back() + remap_letter(arc_arena[ai].letter)] = &arc_arena[ai];
+    }
+
+    root_node.arcs = arc_table_arena.data() + table_offsets[0];
+    for (unsigned int ni=0; ni<node_arena.size(); ni++)
+        node_arena[ni].arcs = arc_table_arena.data() + table_offsets[ni+1];
+
+    update_links();
 }
 
 
-StringSet::Node*
-StringSet::insert(char letter,
-                  const string &factor,
-                  flt_type cost,
+StringSet::Arc*
+StringSet::insert(unsigned int letter,
                   StringSet::Node *node)
 {
     // Find a possible existing arc with the letter
@@ -31,58 +125,48 @@ StringSet::insert(char letter,
 
     // No existing arc: create a new arc
     if (arc == nullptr) {
-        Node *new_node = new Node();
-        unsigned int remapped = remap_char(letter); // unsigned char!
-        if (node->arcs.size() < remapped+1) node->arcs.resize(remapped+1, nullptr);
-        arc = new Arc(letter, factor, new_node, cost);
+        added_nodes.push_back(Node());
+        Node *new_node = &added_nodes.back();
+        unsigned int remapped = remap_letter(letter);
+        if (remapped == no_code) remapped = add_letter(letter);
+        if (node->arc_count < remapped+1) resize_arcs(node, remapped+1);
+        added_arcs.push_back(Arc(letter, -1, new_node));
+        arc = &added_arcs.back();
         node->arcs[remapped] = arc;
     }
 
-    // Update the existing arc if factor was set
-    else if (factor.length() > 0) {
-        if (arc->factor.length() == 0) arc->factor = factor;
-        arc->cost = cost;
-    }
-
-    // Maintain the length of the longest factor
-    if ((int)factor.length() > max_factor_length)
-        max_factor_length = factor.length();
-
-    return arc->target_node;
+    return arc;
 }
 
 
 StringSet::Arc*
-StringSet::find_arc(char letter,
-                    const StringSet::Node *node) const
+StringSet::find_arc_safe(unsigned int letter,
+                         const StringSet::Node *node) const
 {
-    unsigned char remapped = remap_char(letter);
-    if (remapped < node->arcs.size())
-        return node->arcs[remapped];
-    else
-        return nullptr;
+    return node->arcs[remap_letter(letter)];
 }
 
 
 StringSet::Arc*
-StringSet::find_arc_safe(char letter,
-                         const StringSet::Node *node) const
+StringSet::find_factor_arc(const string &factor) const
 {
-    return node->arcs[remap_char(letter)];
+    const StringSet::Node *node = &root_node;
+    StringSet::Arc *arc = nullptr;
+    unsigned int pos = 0;
+    while (pos < factor.length()) {
+        arc = step(factor, pos, node);
+        if (arc == nullptr) return nullptr;
+        node = arc->target_node;
+    }
+    return arc;
 }
 
 
 bool
 StringSet::includes(const string &factor) const
 {
-    const StringSet::Node *node = &root_node;
-    StringSet::Arc *arc = nullptr;
-    for (unsigned int i=0; i<factor.length(); i++) {
-        arc = find_arc(factor[i], node);
-        if (arc == nullptr) return false;
-        node = arc->target_node;
-    }
-    if (arc->factor.length() == 0) return false;
+    Arc *arc = find_factor_arc(factor);
+    if (arc == nullptr || arc->factor < 0) return false;
     return true;
 }
 
@@ -90,43 +174,68 @@ StringSet::includes(const string &factor) const
 flt_type
 StringSet::get_score(const string &factor) const
 {
-    const StringSet::Node *node = &root_node;
-    StringSet::Arc *arc = nullptr;
-    for (unsigned int i=0; i<factor.length(); i++) {
-        arc = find_arc(factor[i], node);
-        if (arc == nullptr) throw string("could not find factor");
-        node = arc->target_node;
-    }
-    if (arc->factor.length() == 0) throw string("could not find factor");
-    return arc->cost;
+    Arc *arc = find_factor_arc(factor);
+    if (arc == nullptr || arc->factor < 0) throw string("could not find factor");
+    return costs[arc->factor];
+}
+
+
+int
+StringSet::factor_index(const string &factor) const
+{
+    Arc *arc = find_factor_arc(factor);
+    if (arc == nullptr || arc->factor < 0) return -1;
+    return arc->factor;
 }
 
 
 void
-StringSet::add(const string &factor, flt_type cost)
+StringSet::add(const string &factor, flt_type cost, bool link)
 {
+    if (factor.length() == 0) return;
+
+    vector<unsigned int> letters;
+    get_letters(factor, letters);
+
+    unsigned int arc_count = added_arcs.size();
     Node *node = &root_node;
-    int i=0;
-    for (; i < (int)factor.length()-1; i++)
-        node = insert(factor[i], "" , 0.0, node);
-    insert(factor[i], factor, cost, node);
+    Arc *arc = nullptr;
+    for (unsigned int i=0; i<letters.size(); i++) {
+        arc = insert(letters[i], node);
+        node = arc->target_node;
+    }
+    bool new_links = (arc_count != added_arcs.size() || arc->factor == -1);
+
+    // Removed factors get back their old index
+    if (arc->factor < -1) {
+        arc->factor = -arc->factor-2;
+        num_strings++;
+    }
+    else if (arc->factor == -1) {
+        arc->factor = factor_strings.size();
+        factor_strings.push_back(factor);
+        costs.push_back(cost);
+        factor_arcs.push_back(arc);
+        num_strings++;
+    }
+    costs[arc->factor] = cost;
+    if (new_links && link) update_links();
+
+    // Maintain the length of the longest factor
+    if ((int)factor.length() > max_factor_length)
+        max_factor_length = factor.length();
 }
 
 
 flt_type
 StringSet::remove(const string &factor)
 {
-    StringSet::Node *node = &root_node;
-    StringSet::Arc *arc = nullptr;
-
-    for (unsigned int i=0; i<factor.length(); i++) {
-        arc = find_arc(factor[i], node);
-        if (arc == nullptr) throw string("could not remove factor");
-        node = arc->target_node;
-    }
-    arc->factor.clear();
-    flt_type cost = arc->cost;
-    arc->cost = 0.0;
+    Arc *arc = find_factor_arc(factor);
+    if (arc == nullptr) throw string("could not remove factor");
+    if (arc->factor < 0) return 0.0;
+    flt_type cost = costs[arc->factor];
+    arc->factor = -arc->factor-2;
+    num_strings--;
     return cost;
 }
 
@@ -134,40 +243,180 @@ StringSet::remove(const string &factor)
 void
 StringSet::assign_scores(const map<string, flt_type> &vocab)
 {
-    for (auto it = vocab.begin(); it != vocab.end(); ++it) {
-        string factor(it->first);
-        Node *node = &root_node;
-        int i=0;
-        for (; i < (int)factor.length()-1; i++)
-            node = insert(factor[i], "" , 0.0, node);
-        insert(factor[i], factor, it->second, node);
+    for (auto it = vocab.begin(); it != vocab.end(); ++it)
+        add(it->first, it->second);
+
+    for (unsigned int i=0; i<factor_arcs.size(); i++)
+        if (vocab.find(factor_strings[i]) == vocab.end())
+            disable(i);
+}
+
+
+void
+StringSet::assign_scores(const vector<flt_type> &costs)
+{
+    for (unsigned int i=0; i<factor_arcs.size(); i++) {
+        if (costs[i] == MIN_FLOAT) disable(i);
+        else {
+            enable(i);
+            this->costs[i] = costs[i];
+        }
     }
+}
+
+
+void
+StringSet::disable(int factor)
+{
+    Arc *arc = factor_arcs[factor];
+    if (arc->factor < 0) return;
+    arc->factor = -arc->factor-2;
+    num_strings--;
+}
+
+
+void
+StringSet::enable(int factor)
+{
+    Arc *arc = factor_arcs[factor];
+    if (arc->factor >= 0) return;
+    arc->factor = -arc->factor-2;
+    num_strings++;
+}
+
+
+template <bool utf8_letters>
+void
+StringSet::scan(const string &text,
+                unsigned int pos,
+                const Node *node,
+                vector<Match> &matches,
+                vector<ScanState> *states,
+                const FactorMask *mask) const
+{
+    while (pos < text.length()) {
+
+        if (states != nullptr) (*states)[pos] = ScanState(node, matches.size());
+        unsigned int letter_start = pos;
+        unsigned int letter = (unsigned char)text[pos++];
+        if (utf8_letters && letter >= 128 && !decode_utf8(text, pos, letter)) {
+            node = &root_node;
+            pos = letter_start+1;
+            continue;
+        }
 
-    vector<Arc*> arcs;
-    collect_arcs(arcs);
+        // Fall back to shorter suffixes until the letter continues one
+        Arc *arc = find_arc(letter, node);
+        while (arc == nullptr && node != &root_node) {
+            node = node->fail != nullptr ? node->fail : &root_node;
+            arc = find_arc(letter, node);
+        }
+        if (arc == nullptr) continue;
+        node = arc->target_node;
 
-    for (auto ait = arcs.begin(); ait != arcs.end(); ++ait) {
-        if (vocab.find((*ait)->factor) == vocab.end()) {
-            (*ait)->factor.clear();
-            (*ait)->cost = 0.0;
+        // All factors ending here, the longest first
+        const Arc *output = node->output;
+        while (output != nullptr) {
+            if (output->factor >= 0 && (mask == nullptr || mask->enabled(output->factor))) {
+                unsigned int length = factor_strings[output->factor].length();
+                matches.push_back(Match(pos-length, pos, output->factor, costs[output->factor]));
+            }
+            const Node *suffix = output->target_node->fail;
+            output = suffix != nullptr ? suffix->output : nullptr;
         }
     }
+    if (states != nullptr) (*states)[pos] = ScanState(node, matches.size());
+}
+
+
+void
+StringSet::scan(const string &text,
+                vector<Match> &matches,
+                const FactorMask *mask) const
+{
+    matches.clear();
+    if (utf8) scan<true>(text, 0, &root_node, matches, nullptr, mask);
+    else scan<false>(text, 0, &root_node, matches, nullptr, mask);
+}
+
+
+unsigned int
+StringSet::scan(const string &text,
+                unsigned int prefix,
+                vector<Match> &matches,
+                vector<ScanState> &states,
+                const FactorMask *mask) const
+{
+    // Back off to a letter boundary of both texts, a letter
+    // continuing over the prefix may be decoded differently
+    unsigned int pos = 0;
+    if (states.size() > 0) pos = min(prefix, (unsigned int)states.size()-1);
+    while (pos > 0 && (states[pos].node == nullptr
+                       || (utf8 && pos < text.length() && ((unsigned char)text[pos] & 192) == 128)))
+        pos--;
+
+    const Node *node = &root_node;
+    if (pos > 0) node = states[pos].node;
+    matches.erase(matches.begin() + (pos > 0 ? states[pos].num_matches : 0), matches.end());
+    states.resize(text.length()+1);
+    for (unsigned int i=pos+1; i<states.size(); i++)
+        states[i] = ScanState();
+
+    if (utf8) scan<true>(text, pos, node, matches, &states, mask);
+    else scan<false>(text, pos, node, matches, &states, mask);
+
+    return pos;
 }
 
 
 void
-StringSet::clear(Node *node)
+StringSet::update_links()
 {
-    for (auto ait = node->arcs.begin(); ait != node->arcs.end(); ++ait) {
-        if (*ait != nullptr) {
-            clear((*ait)->target_node);
-            delete (*ait)->target_node;
-            delete *ait;
+    vector<Node*> queue;
+    for (unsigned int i=0; i<root_node.arc_count; i++) {
+        Arc *arc = root_node.arcs[i];
+        if (arc == nullptr) continue;
+        arc->target_node->fail = nullptr;
+        arc->target_node->output = arc->factor != -1 ? arc : nullptr;
+        queue.push_back(arc->target_node);
+    }
+
+    for (unsigned int qi=0; qi<queue.size(); qi++) {
+        Node *node = queue[qi];
+        for (unsigned int i=0; i<node->arc_count; i++) {
+            Arc *arc = node->arcs[i];
+            if (arc == nullptr) continue;
+
+            // Longest suffix of the parent continued by the same letter
+            Node *suffix = node->fail;
+            Arc *suffix_arc = find_arc(arc->letter, suffix != nullptr ? suffix : &root_node);
+            while (suffix_arc == nullptr && suffix != nullptr) {
+                suffix = suffix->fail;
+                suffix_arc = find_arc(arc->letter, suffix != nullptr ? suffix : &root_node);
+            }
+
+            Node *target = arc->target_node;
+            target->fail = suffix_arc != nullptr ? suffix_arc->target_node : nullptr;
+            if (arc->factor != -1) target->output = arc;
+            else target->output = target->fail != nullptr ? target->fail->output : nullptr;
+            queue.push_back(target);
         }
     }
 }
 
 
+void
+StringSet::resize_arcs(Node *node, unsigned int arc_count)
+{
+    added_arc_tables.push_back(vector<Arc*>(arc_count, nullptr));
+    vector<Arc*> &arcs = added_arc_tables.back();
+    for (unsigned int i=0; i<node->arc_count; i++)
+        arcs[i] = node->arcs[i];
+    node->arcs = arcs.data();
+    node->arc_count = arc_count;
+}
+
+
 void
 StringSet::collect_arcs(vector<Arc*> &arcs)
 {
@@ -178,52 +427,122 @@ StringSet::collect_arcs(vector<Arc*> &arcs)
         Node *node = nodes_to_process.back();
         nodes_to_process.pop_back();
 
-        for (auto ait = node->arcs.begin(); ait != node->arcs.end(); ++ait) {
-            if (*ait == nullptr) continue;
-            arcs.push_back(*ait);
-            nodes_to_process.push_back((*ait)->target_node);
+        for (unsigned int i=0; i<node->arc_count; i++) {
+            Arc *arc = node->arcs[i];
+            if (arc == nullptr) continue;
+            arcs.push_back(arc);
+            nodes_to_process.push_back(arc->target_node);
         }
     }
 }
 
 
-unsigned int
-StringSet::string_count()
+void
+StringSet::collect_factors(vector<pair<string, flt_type> > &factors) const
 {
-    vector<Arc*> arcs;
-    collect_arcs(arcs);
+    for (unsigned int i=0; i<factor_arcs.size(); i++)
+        if (factor_arcs[i]->factor >= 0)
+            factors.push_back(make_pair(factor_strings[i], costs[i]));
+}
 
-    unsigned int count = 0;
-    for (auto ait = arcs.begin(); ait != arcs.end(); ++ait) {
-        if (*ait == nullptr) continue;
-        if ((*ait)->factor.length() > 0) count++;
-    }
-    return count;
+
+void
+StringSet::get_vocab(map<string, flt_type> &vocab) const
+{
+    vocab.clear();
+    for (unsigned int i=0; i<factor_arcs.size(); i++)
+        if (factor_arcs[i]->factor >= 0)
+            vocab[factor_strings[i]] = costs[i];
 }
 
 
-bool rank_desc_sort(pair<unsigned char, int> i,pair<unsigned char, int> j) { return (i.second > j.second); }
 void
-StringSet::learn_map(const map<string, flt_type> &vocab)
+StringSet::compact(vector<int> &index_map)
 {
-    for (int i=0; i<256; i++) charmap[i] = 255;
+    map<string, flt_type> vocab;
+    get_vocab(vocab);
+    StringSet compacted(vocab, utf8);
 
-    map<unsigned char, int> charcounts;
-    for (auto it = vocab.begin(); it != vocab.end(); ++it) {
-        for (const char &chr : it->first) charcounts[(unsigned char)chr]++;
-    }
+    index_map.assign(factor_strings.size(), -1);
+    for (unsigned int i=0; i<factor_arcs.size(); i++)
+        if (factor_arcs[i]->factor >= 0)
+            index_map[i] = compacted.factor_index(factor_strings[i]);
+
+    swap(compacted);
+}
+
+
+void
+StringSet::swap(StringSet &other)
+{
+    // The arenas keep their buffers when swapped, so the pointers stay valid
+    std::swap(root_node, other.root_node);
+    std::swap(max_factor_length, other.max_factor_length);
+    codemap.swap(other.codemap);
+    std::swap(character_count, other.character_count);
+    factor_strings.swap(other.factor_strings);
+    costs.swap(other.costs);
+    std::swap(utf8, other.utf8);
+    node_arena.swap(other.node_arena);
+    arc_arena.swap(other.arc_arena);
+    arc_table_arena.swap(other.arc_table_arena);
+    added_nodes.swap(other.added_nodes);
+    added_arcs.swap(other.added_arcs);
+    added_arc_tables.swap(other.added_arc_tables);
+    factor_arcs.swap(other.factor_arcs);
+    std::swap(num_strings, other.num_strings);
+}
 
-    vector<pair<unsigned char, int> > sorted_charcounts;
-    for (auto it = charcounts.begin(); it != charcounts.end(); ++it) {
-        pair<unsigned char, int> ccount = make_pair(it->first, it->second);
-        sorted_charcounts.push_back(ccount);
+
+bool rank_desc_sort(pair<unsigned int, int> i,pair<unsigned int, int> j) { return (i.second > j.second); }
+void
+StringSet::learn_map(const vector<unsigned int> &letters)
+{
+    unsigned int letter_limit = 256;
+    if (utf8)
+        for (auto it = letters.cbegin(); it != letters.cend(); ++it)
+            letter_limit = max(letter_limit, *it+1);
+    codemap.assign(letter_limit, no_code);
+
+    vector<int> lettercounts(letter_limit, 0);
+    for (auto it = letters.cbegin(); it != letters.cend(); ++it)
+        lettercounts[*it]++;
+
+    vector<pair<unsigned int, int> > sorted_lettercounts;
+    for (unsigned int i=0; i<letter_limit; i++) {
+        if (lettercounts[i] == 0) continue;
+        pair<unsigned int, int> lcount = make_pair(i, lettercounts[i]);
+        sorted_lettercounts.push_back(lcount);
     }
-    sort(sorted_charcounts.begin(), sorted_charcounts.end(), rank_desc_sort);
+    sort(sorted_lettercounts.begin(), sorted_lettercounts.end(), rank_desc_sort);
 
-    unsigned char idx = 0;
-    character_count = charcounts.size();
-    for (auto it = sorted_charcounts.begin(); it != sorted_charcounts.end(); ++it) {
-        charmap[it->first] = idx;
+    unsigned int idx = 0;
+    character_count = sorted_lettercounts.size();
+    for (auto it = sorted_lettercounts.begin(); it != sorted_lettercounts.end(); ++it) {
+        codemap[it->first] = idx;
         idx++;
     }
 }
+
+
+unsigned int
+StringSet::add_letter(unsigned int letter)
+{
+    if (letter >= codemap.size()) codemap.resize(letter+1, no_code);
+    codemap[letter] = character_count++;
+    return codemap[letter];
+}
+
+
+void
+StringSet::get_letters(const string &str,
+                       vector<unsigned int> &letters) const
+{
+    unsigned int pos = 0;
+    while (pos < str.length()) {
+        unsigned int letter = (unsigned char)str[pos++];
+        if (utf8 && letter >= 128 && !decode_utf8(str, pos, letter))
+            throw string("invalid utf-8 sequence");
+        letters.push_back(letter);
+    }
+}
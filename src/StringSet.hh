@@ -1,14 +1,43 @@
 #ifndef STRINGSET_HH
 #define STRINGSET_HH
 
+#include <deque>
+#include <map>
 #include <string>
 #include <vector>
 
 #include "defs.hh"
 
+/** Factors disabled on top of a set that is not modified.
+ * A mask is cheap to create and modify, so each thread may evaluate
+ * its own removals against one shared read-only set. */
+
+class FactorMask {
+public:
+
+    FactorMask() { }
+    FactorMask(unsigned int factor_count) : disabled(factor_count, false) { }
+
+    /** Disables a factor by the index */
+    void disable(int factor) { disabled[factor] = true; }
+
+    /** Enables a factor disabled in the mask */
+    void enable(int factor) { disabled[factor] = false; }
+
+    /** Checks if the factor is not disabled in the mask */
+    bool enabled(int factor) const { return factor >= (int)disabled.size() || !disabled[factor]; }
+
+    std::vector<bool> disabled; //!< Disabled factors by the index
+};
+
+
 /** A structure containing a set of strings in a letter-tree format.
  * Input letters and output strings are stored in arcs. Nodes are just
- * placeholders for arcs. */
+ * placeholders for arcs. Nodes and arcs live in arenas owned by the set,
+ * the tree built from a vocabulary is laid out contiguously in BFS order
+ * and everything is freed at once on destruction.
+ * The letters are bytes, or in the UTF-8 mode Unicode code points decoded
+ * from the strings, so that a multibyte character is a single arc. */
 
 class StringSet {
 public:
@@ -18,39 +47,88 @@ public:
     /** Arc of a string tree. */
     class Arc {
     public:
-        Arc(char letter, std::string factor, Node *target_node, flt_type cost=0.0)
-            : letter(letter), factor(factor), target_node(target_node), cost(cost) { }
-        char letter; //!< Letter of the factor
-        std::string factor; //!< Non-zero if factor in vocabulary
+        Arc(unsigned int letter, int factor, Node *target_node)
+            : letter(letter), factor(factor), target_node(target_node) { }
+        unsigned int letter; //!< Letter of the factor, a byte or a code point
+        int factor; //!< Index of the factor, -1 if none, -(index+2) if removed
         Node *target_node; //!< Target node
-        flt_type cost;
     };
 
     /** Node of a string tree. */
     class Node {
     public:
-        Node(int character_count = 0) { arcs.resize(character_count, nullptr); }
-        std::vector<Arc*> arcs;
+        Node() : arcs(nullptr), arc_count(0), fail(nullptr), output(nullptr) { }
+        Arc **arcs; //!< Outgoing arcs indexed by the remapped letter
+        unsigned int arc_count; //!< Size of the arc table
+        Node *fail; //!< Node of the longest proper suffix in the tree, nullptr for the root
+        Arc *output; //!< Arc ending the longest suffix with a factor index, nullptr if none
     };
 
-    /** Default constructor. */
-    StringSet() : max_factor_length(0) { };
-    StringSet(const std::map<std::string, flt_type> &vocab);
-    ~StringSet();
+    /** A factor found in a text. */
+    class Match {
+    public:
+        Match(unsigned int start, unsigned int end, int factor, flt_type cost)
+            : start(start), end(end), factor(factor), cost(cost) { }
+        unsigned int start; //!< Position of the first byte of the factor
+        unsigned int end; //!< Position after the last byte of the factor
+        int factor; //!< Index of the factor
+        flt_type cost; //!< Cost of the factor
+    };
+
+    /** State of a scan at a position of the text. */
+    class ScanState {
+    public:
+        ScanState() : node(nullptr), num_matches(0) { }
+        ScanState(const Node *node, unsigned int num_matches)
+            : node(node), num_matches(num_matches) { }
+        const Node *node; //!< Node reached, nullptr if the position is inside a letter
+        unsigned int num_matches; //!< Number of matches ending before the position
+    };
+
+    /** Default constructor.
+     * \param utf8 = use code points as letters, the strings must be valid UTF-8
+     */
+    explicit StringSet(bool utf8=false);
+    /** Bulk loads the tree in one pass over the sorted vocabulary
+     * Throws if the UTF-8 mode is used and a string is not valid UTF-8 */
+    StringSet(const std::map<std::string, flt_type> &vocab, bool utf8=false);
+    StringSet(const StringSet&) = delete;
+    StringSet& operator=(const StringSet&) = delete;
 
     /** Find an arc with the given letter from the given node.
-     * \param letter = the letter to search
+     * \param letter = the letter to search, a byte or a code point
      * \param node = the source node
      * \return the arc containing the letter or nullptr if no such arc exists
      */
-    Arc* find_arc(char letter, const Node *node) const;
+    inline Arc* find_arc(unsigned int letter, const Node *node) const
+    {
+        unsigned int code = remap_letter(letter);
+        if (code < node->arc_count)
+            return node->arcs[code];
+        else
+            return nullptr;
+    }
 
     /** Find an arc with the given letter from the given node.
      * \param letter = the letter to search
      * \param node = the source node
      * \return the arc containing the letter or NULL if no such arc exists
      */
-    Arc* find_arc_safe(char letter, const Node *node) const;
+    Arc* find_arc_safe(unsigned int letter, const Node *node) const;
+
+    /** Find the arc with the next letter of the text from the given node.
+     * In the UTF-8 mode the letter is decoded from the text while walking.
+     * \param text = the text
+     * \param pos = position of the letter, advanced past the letter
+     * \param node = the source node
+     * \return the arc containing the letter or nullptr if no such arc exists
+     */
+    inline Arc* step(const std::string &text, unsigned int &pos, const Node *node) const
+    {
+        unsigned int letter = (unsigned char)text[pos++];
+        if (utf8 && letter >= 128 && !decode_utf8(text, pos, letter)) return nullptr;
+        return find_arc(letter, node);
+    }
 
     /** Find an arc with the given letter from the given node.
      * \param letter = the letter to search
@@ -59,6 +137,33 @@ public:
      */
     void insert_arc(char letter, const Node *node) const;
 
+    /** Finds all factors in the text in one pass with the suffix links
+     * the matches are ordered by the end position and the longest comes first
+     * for the same end, that is they are ordered by the start position
+     * \param text = the text
+     * \param matches = buffer for the matches, cleared first
+     * \param mask = factors to skip in addition to the removed ones, nullptr if none
+     */
+    void scan(const std::string &text,
+              std::vector<Match> &matches,
+              const FactorMask *mask=nullptr) const;
+
+    /** Same as above continuing the scan of the previous text from the common prefix
+     * the matches and the states of the previous text are kept up to the last
+     * letter boundary within the prefix and the rest of the text is scanned
+     * \param text = the text
+     * \param prefix = length of the common prefix with the previous text, 0 to scan all
+     * \param matches = matches of the previous text, replaced by the matches of the text
+     * \param states = states of the previous text, replaced by the states of the text
+     * \param mask = the same mask as for the previous text
+     * \return the position where the scan continued
+     */
+    unsigned int scan(const std::string &text,
+                      unsigned int prefix,
+                      std::vector<Match> &matches,
+                      std::vector<ScanState> &states,
+                      const FactorMask *mask=nullptr) const;
+
     /** Checks if the string is in stringset */
     bool includes(const std::string &factor) const;
 
@@ -66,8 +171,15 @@ public:
         Throws if string not in stringset */
     flt_type get_score(const std::string &factor) const;
 
-    /** Add a new factor to the set */
-    void add(const std::string &factor, flt_type cost);
+    /** Add a new factor to the set
+     * \param link = false to leave the links for update_links after adding many factors
+     */
+    void add(const std::string &factor, flt_type cost, bool link=true);
+
+    /** Sets the suffix and output links of all nodes by a BFS from the root
+     * needed after new arcs or new factor indices, not after removals
+     */
+    void update_links();
 
     /** Remove a factor from the set
      * leaves the arc in tree, just nulls factor and cost
@@ -80,48 +192,147 @@ public:
      */
     void assign_scores(const std::map<std::string, flt_type> &vocab);
 
+    /** Sets the scores by the factor index
+     * factors with the score MIN_FLOAT are removed, others are added back
+     * \param costs = new scores for all factors
+     */
+    void assign_scores(const std::vector<flt_type> &costs);
+
+    /** Removes a factor by the index, the cost is kept */
+    void disable(int factor);
+
+    /** Adds back a removed factor by the index */
+    void enable(int factor);
+
+    /** Checks if the factor with the index is in the set */
+    bool enabled(int factor) const { return factor_arcs[factor]->factor >= 0; }
+
+    /** Returns the index of a factor, -1 if not in the set */
+    int factor_index(const std::string &factor) const;
+
     /** Returns the number of stored strings */
-    unsigned int string_count();
+    unsigned int string_count() const { return num_strings; }
+
+    /** Returns the number of indices in use, including removed factors */
+    unsigned int factor_count() const { return factor_strings.size(); }
+
+    /** Copies the factors in the set with their scores to a map */
+    void get_vocab(std::map<std::string, flt_type> &vocab) const;
+
+    /** Rebuilds the tree from the factors in the set
+     * removed factors and their arcs are dropped, the remaining nodes are
+     * laid out contiguously in BFS order and the factors are reindexed
+     * \param index_map = new index by the old index, -1 for dropped factors
+     */
+    void compact(std::vector<int> &index_map);
+
+    /** Exchanges the contents with another set */
+    void swap(StringSet &other);
+
+    /** Collects all factors and their costs in the StringSet
+     * \param factors = vector where the factors are appended
+     */
+    void collect_factors(std::vector<std::pair<std::string, flt_type> > &factors) const;
 
     Node root_node; //!< The root of the string tree
     int max_factor_length; //!< The length of the longest factor in the set
-    unsigned char charmap[256];
-    int character_count;
+    std::vector<unsigned int> codemap; //!< Dense letter codes by the letter, no_code if none
+    int character_count; //!< Number of letters with a code
+    static const unsigned int no_code = std::numeric_limits<unsigned int>::max();
+    std::vector<std::string> factor_strings; //!< Factors by index, only for output
+    std::vector<flt_type> costs; //!< Factor costs by index
 
 private:
 
     /** Insert a letter to a node (or follow an existing arc).
      * \param letter = a letter to insert to the node
-     * \param factor = a possible factor corresponding to this node (can be empty)
      * \param node = a node to which the letter is inserted
-     * \return pointer to the created or existing node
+     * \return pointer to the created or existing arc
      */
-    Node* insert(char letter, const std::string &factor, flt_type cost, Node *node);
+    Arc* insert(unsigned int letter, Node *node);
 
-    /** Destructor helper, deletes all arcs and subnodes
-     * \param node = the source node
+    /** Finds the arc ending the string, nullptr if the path is not in the tree */
+    Arc* find_factor_arc(const std::string &factor) const;
+
+    /** Scans the text from a position, the letters are decoded
+     * as in the set so the one-byte scan has no UTF-8 checks
+     * \param text = the text
+     * \param pos = position to start from
+     * \param node = node reached at the position
+     * \param matches = matches are appended here
+     * \param states = states are recorded here if not nullptr
+     * \param mask = factors to skip in addition to the removed ones, nullptr if none
      */
-    void clear(Node *node);
+    template <bool utf8_letters>
+    void scan(const std::string &text,
+              unsigned int pos,
+              const Node *node,
+              std::vector<Match> &matches,
+              std::vector<ScanState> *states,
+              const FactorMask *mask) const;
 
-    /** Pruning helper, deletes all unused arcs and subnodes
-     * \param node = the source node
-     * \return true if all arcs and subnodes of node were unused and deleted
+    /** Sets a larger arc table for a node, keeping the existing arcs
+     * \param node = the node
+     * \param arc_count = new size of the arc table
      */
-    bool prune(Node *node);
+    void resize_arcs(Node *node, unsigned int arc_count);
 
     /** Helper, collects all arcs in the StringSet
      */
     void collect_arcs(std::vector<Arc*> &arcs);
 
     /** Helper, constructs a compact letter mapping to range [0,|C|]
+     * \param letters = letters of all strings
+     */
+    void learn_map(const std::vector<unsigned int> &letters);
+
+    /** Helper, gives a code to a new letter */
+    unsigned int add_letter(unsigned int letter);
+
+    /** Helper, appends the letters of a string
+     * throws if the UTF-8 mode is used and the string is not valid UTF-8
      */
-    void learn_map(const std::map<std::string, flt_type> &vocab);
+    void get_letters(const std::string &str, std::vector<unsigned int> &letters) const;
 
-    inline unsigned char remap_char(char orig) const
+    /** Decodes the rest of a UTF-8 sequence
+     * \param text = the text
+     * \param pos = position after the lead byte, advanced past the sequence
+     * \param letter = the lead byte, set to the code point
+     * \return false if the sequence is truncated, overlong or otherwise invalid
+     */
+    static inline bool decode_utf8(const std::string &text, unsigned int &pos, unsigned int &letter)
     {
-        return charmap[(unsigned char)orig];
+        unsigned int length;
+        unsigned int min_letter;
+        if ((letter & 248) == 240) { length = 3; letter &= 7; min_letter = 0x10000; }
+        else if ((letter & 240) == 224) { length = 2; letter &= 15; min_letter = 0x800; }
+        else if ((letter & 224) == 192) { length = 1; letter &= 31; min_letter = 0x80; }
+        else return false;
+        if (pos+length > text.length()) return false;
+        for (unsigned int i=0; i<length; i++) {
+            unsigned char chr = text[pos++];
+            if ((chr & 192) != 128) return false;
+            letter = (letter << 6) | (chr & 63);
+        }
+        return (letter >= min_letter && letter <= 0x10FFFF);
     }
 
+    inline unsigned int remap_letter(unsigned int letter) const
+    {
+        return letter < codemap.size() ? codemap[letter] : no_code;
+    }
+
+    bool utf8; //!< Letters are code points instead of bytes
+
+    std::vector<Node> node_arena; //!< Bulk loaded nodes in BFS order
+    std::vector<Arc> arc_arena; //!< Bulk loaded arcs, arc i leads to node i
+    std::vector<Arc*> arc_table_arena; //!< Arc tables of the bulk loaded nodes
+    std::deque<Node> added_nodes; //!< Nodes added after the bulk load
+    std::deque<Arc> added_arcs; //!< Arcs added after the bulk load
+    std::deque<std::vector<Arc*> > added_arc_tables; //!< Arc tables grown after the bulk load
+    std::vector<Arc*> factor_arcs; //!< Arc ending each factor by index
+    unsigned int num_strings; //!< Number of factors not removed
+
 };
 
 
@@ -0,0 +1,40 @@
+#include "TransitionTable.hh"
+
+using namespace std;
+
+
+TransitionTable::TransitionTable(const transitions_t &transitions,
+                                 const FrozenStringSet &vocab,
+                                 flt_type miss_cost)
+    : miss_cost(miss_cost)
+{
+    // Number of targets for each source
+    row_offsets.assign(vocab.factor_count()+1, 0);
+    for (auto srcit = transitions.cbegin(); srcit != transitions.cend(); ++srcit) {
+        int source = vocab.factor_index(srcit->first);
+        if (source < 0) continue;
+        for (auto tgtit = srcit->second.cbegin(); tgtit != srcit->second.cend(); ++tgtit)
+            if (vocab.factor_index(tgtit->first) >= 0) row_offsets[source+1]++;
+    }
+    for (unsigned int i=0; i<vocab.factor_count(); i++)
+        row_offsets[i+1] += row_offsets[i];
+
+    // Targets sorted by the factor index within each source
+    targets.resize(row_offsets.back());
+    costs.resize(row_offsets.back());
+    vector<pair<int, flt_type> > row;
+    for (auto srcit = transitions.cbegin(); srcit != transitions.cend(); ++srcit) {
+        int source = vocab.factor_index(srcit->first);
+        if (source < 0) continue;
+        row.clear();
+        for (auto tgtit = srcit->second.cbegin(); tgtit != srcit->second.cend(); ++tgtit) {
+            int target = vocab.factor_index(tgtit->first);
+            if (target >= 0) row.push_back(make_pair(target, tgtit->second));
+        }
+        sort(row.begin(), row.end());
+        for (unsigned int i=0; i<row.size(); i++) {
+            targets[row_offsets[source]+i] = row[i].first;
+            costs[row_offsets[source]+i] = row[i].second;
+        }
+    }
+}
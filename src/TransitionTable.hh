@@ -0,0 +1,48 @@
+#ifndef TRANSITION_TABLE_HH
+#define TRANSITION_TABLE_HH
+
+#include <algorithm>
+#include <vector>
+
+#include "defs.hh"
+#include "FrozenStringSet.hh"
+
+/** Bigram costs by the factor indices of a FrozenStringSet.
+ * The targets of each source factor are stored sorted by the factor index,
+ * the targets of source s are targets[row_offsets[s]] .. targets[row_offsets[s+1]-1].
+ * Bigrams not in the table get the miss cost, also the ones with letters added
+ * to the vocabulary after building the table. The table must be built again
+ * if the vocabulary is rebuilt, as the factor indices change. */
+
+class TransitionTable {
+public:
+
+    /** Bigrams with a source or target not in the vocabulary are left out */
+    TransitionTable(const transitions_t &transitions,
+                    const FrozenStringSet &vocab,
+                    flt_type miss_cost=SMALL_LP);
+
+    /** Cost of the bigram, the miss cost if not in the table or an index is -1 */
+    inline flt_type cost(int source, int target) const
+    {
+        if (source < 0 || target < 0 || source >= (int)row_offsets.size()-1) return miss_cost;
+        const int *first = targets.data() + row_offsets[source];
+        const int *last = targets.data() + row_offsets[source+1];
+        const int *it = std::lower_bound(first, last, target);
+        if (it == last || *it != target) return miss_cost;
+        return costs[it - targets.data()];
+    }
+
+    /** Returns the number of bigrams in the table */
+    unsigned int size() const { return targets.size(); }
+
+    flt_type miss_cost; //!< Cost of the bigrams not in the table
+
+private:
+    std::vector<unsigned int> row_offsets; //!< First target of each source, one past the last source
+    std::vector<int> targets; //!< Target factor indices, sorted for each source
+    std::vector<flt_type> costs; //!< Cost of each bigram in the order of the targets
+};
+
+
+#endif /* TRANSITION_TABLE_HH */
@@ -0,0 +1,84 @@
+#include <cmath>
+
+#include "UnigramModel.hh"
+#include "Unigrams.hh"
+
+using namespace std;
+
+
+void
+UnigramModel::update_costs(flt_type min_lp)
+{
+    flt_type densum = Unigrams::get_sum(counts);
+    densum = log(densum);
+    for (unsigned int i=0; i<counts.size(); i++) {
+        if (counts[i] == MIN_FLOAT) {
+            vocab.disable(i);
+            continue;
+        }
+        flt_type cost = (log(counts[i])-densum);
+        if (cost < min_lp || std::isinf(cost) || std::isnan(cost))
+            cost = min_lp;
+        vocab.costs[i] = cost;
+        vocab.enable(i);
+    }
+}
+
+
+void
+UnigramModel::remove(int factor)
+{
+    vocab.disable(factor);
+    if (factor < (int)counts.size()) counts[factor] = MIN_FLOAT;
+}
+
+
+void
+UnigramModel::compact()
+{
+    vector<int> index_map;
+    vocab.compact(index_map);
+
+    vector<flt_type> new_counts(vocab.factor_count(), MIN_FLOAT);
+    for (unsigned int i=0; i<index_map.size() && i<counts.size(); i++)
+        if (index_map[i] >= 0) new_counts[index_map[i]] = counts[i];
+    counts.swap(new_counts);
+}
+
+
+void
+UnigramModel::assert_factors(const set<string> &factors,
+                             flt_type min_lp)
+{
+    bool added = false;
+    for (auto it = factors.cbegin(); it != factors.cend(); ++it)
+        if (!vocab.includes(*it)) {
+            vocab.add(*it, min_lp, false);
+            added = true;
+        }
+    if (added) vocab.update_links();
+}
+
+
+unsigned int
+UnigramModel::counted_size() const
+{
+    unsigned int count = 0;
+    for (auto it = counts.cbegin(); it != counts.cend(); ++it)
+        if (*it != MIN_FLOAT) count++;
+    return count;
+}
+
+
+void
+UnigramModel::get_vocab(map<string, flt_type> &vocab) const
+{
+    this->vocab.get_vocab(vocab);
+}
+
+
+void
+UnigramModel::get_counts(map<string, flt_type> &counts) const
+{
+    Unigrams::freqs_to_vocab(vocab, this->counts, counts);
+}
@@ -0,0 +1,62 @@
+#ifndef UNIGRAM_MODEL_HH
+#define UNIGRAM_MODEL_HH
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "defs.hh"
+#include "StringSet.hh"
+
+/** A unigram model kept over the EM iterations and pruning.
+ * Owns the letter tree of the factors, the costs and the expected counts,
+ * all indexed by the factor index. The tree is built once, new costs are
+ * written in place and removed factors are only disabled in the tree. */
+
+class UnigramModel {
+public:
+
+    /** Default constructor, creates an empty model. */
+    UnigramModel() { }
+    UnigramModel(const std::map<std::string, flt_type> &vocab, bool utf8=false) : vocab(vocab, utf8) { }
+
+    /** Sets the costs to the normalized log counts
+     * factors without counts are disabled
+     * \param min_lp = floor for the log probabilities
+     */
+    void update_costs(flt_type min_lp=FLOOR_LP);
+
+    /** Disables a factor and drops its counts */
+    void remove(int factor);
+
+    /** Rebuilds the tree without the disabled factors
+     * the factors are reindexed and the counts moved to the new indices
+     */
+    void compact();
+
+    /** Checks if enough factors have been disabled to make compacting worthwhile */
+    bool needs_compacting() const { return size() < vocab.factor_count()/2; }
+
+    /** Adds the given factors which are not enabled with a fixed cost */
+    void assert_factors(const std::set<std::string> &factors,
+                        flt_type min_lp);
+
+    /** Returns the number of enabled factors */
+    unsigned int size() const { return vocab.string_count(); }
+
+    /** Returns the number of factors with counts */
+    unsigned int counted_size() const;
+
+    /** Copies the enabled factors and their costs to a map */
+    void get_vocab(std::map<std::string, flt_type> &vocab) const;
+
+    /** Copies the factors with counts to a map */
+    void get_counts(std::map<std::string, flt_type> &counts) const;
+
+    StringSet vocab; //!< Factor tree, the costs are indexed by the factor index
+    std::vector<flt_type> counts; //!< Expected counts by the factor index, MIN_FLOAT if none
+};
+
+
+#endif /* UNIGRAM_MODEL_HH */
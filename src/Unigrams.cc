@@ -1,6 +1,9 @@
 #include <algorithm>
 #include <iomanip>
 #include <cmath>
+#include <functional>
+#include <thread>
+#include <unordered_map>
 
 #include "Unigrams.hh"
 #include "io.hh"
@@ -20,6 +23,14 @@ bool ascending_sort(pair<string, flt_type> i,pair<string, flt_type> j)
 }
 
 
+// Adds to the value of a factor, MIN_FLOAT marks a factor not seen yet
+static inline void accumulate(vector<flt_type> &values, int factor, flt_type value)
+{
+    if (values[factor] == MIN_FLOAT) values[factor] = 0.0;
+    values[factor] += value;
+}
+
+
 int
 Unigrams::read_vocab(string fname,
                      map<string, flt_type> &vocab,
@@ -111,6 +122,35 @@ Unigrams::read_sents(string fname,
 }
 
 
+int
+Unigrams::read_sents(string fname,
+                     vector<string> &sents,
+                     vector<flt_type> &counts)
+{
+    sents.clear();
+    counts.clear();
+    SimpleFileInput sfi(fname);
+
+    unordered_map<string, unsigned int> sent_indices;
+    int lc = 0;
+    string line;
+    while (sfi.getline(line)) {
+        trim(line, '\n');
+        auto sentiter = sent_indices.find(line);
+        if (sentiter != sent_indices.end())
+            counts[sentiter->second] += 1.0;
+        else {
+            sent_indices[line] = sents.size();
+            sents.push_back(line);
+            counts.push_back(1.0);
+        }
+        lc++;
+    }
+
+    return lc;
+}
+
+
 void
 Unigrams::sort_vocab(const map<string, flt_type> &vocab,
                      vector<pair<string, flt_type> > &sorted_vocab,
@@ -133,13 +173,23 @@ Unigrams::iterate(const map<string, flt_type> &words,
                   map<string, flt_type> &vocab,
                   unsigned int iterations)
 {
-    map<string, flt_type> freqs;
+    UnigramModel model(vocab, utf8);
+    flt_type ll = iterate(words, model, iterations);
+    model.get_vocab(vocab);
+    return ll;
+}
+
+
+flt_type
+Unigrams::iterate(const map<string, flt_type> &words,
+                  UnigramModel &model,
+                  unsigned int iterations)
+{
     flt_type ll = 0.0;
 
     for (unsigned int i=0; i<iterations; i++) {
-        ll = resegment_words(words, vocab, freqs);
-        vocab = freqs;
-        freqs_to_logprobs(vocab);
+        ll = resegment_words(words, model.vocab, model.counts);
+        model.update_costs();
     }
 
     return ll;
@@ -151,13 +201,33 @@ Unigrams::iterate(const vector<string> &sents,
                   map<string, flt_type> &vocab,
                   unsigned int iterations)
 {
-    map<string, flt_type> freqs;
+    UnigramModel model(vocab, utf8);
+    flt_type ll = iterate(sents, model, iterations);
+    model.get_vocab(vocab);
+    return ll;
+}
+
+
+flt_type
+Unigrams::iterate(const vector<string> &sents,
+                  UnigramModel &model,
+                  unsigned int iterations)
+{
+    MemoryCorpus corpus(sents);
+    return iterate(corpus, model, iterations);
+}
+
+
+flt_type
+Unigrams::iterate(Corpus &corpus,
+                  UnigramModel &model,
+                  unsigned int iterations)
+{
     flt_type ll = 0.0;
 
     for (unsigned int i=0; i<iterations; i++) {
-        ll = resegment_sents(sents, vocab, freqs);
-        vocab = freqs;
-        freqs_to_logprobs(vocab);
+        ll = resegment_sents(corpus, model.vocab, model.counts);
+        model.update_costs();
     }
 
     return ll;
@@ -170,7 +240,7 @@ Unigrams::resegment_words(const map<string, flt_type> &words,
                           map<string, flt_type> &new_freqs,
                           set<string> special_words)
 {
-    StringSet stringset_vocab(vocab);
+    StringSet stringset_vocab(vocab, utf8);
     return resegment_words(words, stringset_vocab, new_freqs, special_words);
 }
 
@@ -181,30 +251,62 @@ Unigrams::resegment_words(const map<string, flt_type> &words,
                           map<string, flt_type> &new_freqs,
                           set<string> special_words)
 {
-    new_freqs.clear();
-    flt_type ll = 0.0;
+    vector<flt_type> freqs;
+    flt_type ll = resegment_words(words, vocab, freqs, special_words);
+    freqs_to_vocab(vocab, freqs, new_freqs);
+
+    // Special symbols like <s> </s> etc. which should not be segmented
+    for (auto it = special_words.cbegin(); it != special_words.cend(); ++it) {
+        auto worditer = words.find(*it);
+        if (worditer != words.end()) new_freqs[worditer->first] += worditer->second;
+    }
 
-    for (auto worditer = words.cbegin(); worditer != words.cend(); ++worditer) {
+    return ll;
+}
 
-        // Special symbols like <s> </s> etc. which should not be segmented
-        if (special_words.size() > 0 && special_words.find(worditer->first) != special_words.end()) {
-            new_freqs[worditer->first] += worditer->second;
-            continue;
-        }
 
-        map<string, flt_type> stats;
-        flt_type curr_ll = worditer->second * segf(vocab, worditer->first, stats, this->utf8);
+flt_type
+Unigrams::resegment_words(const map<string, flt_type> &words,
+                          const StringSet &vocab,
+                          vector<flt_type> &new_freqs,
+                          const set<string> &special_words)
+{
+    new_freqs.assign(vocab.factor_count(), MIN_FLOAT);
+    flt_type ll = 0.0;
 
-        if (stats.size() == 0) {
-            cerr << "warning, no segmentation for word: " << worditer->first << endl;
-            continue;
+    // Words are segmented in batches, the statistics are summed in the word order
+    vector<const string*> batch;
+    vector<flt_type> batch_counts;
+    vector<factor_stats_t> batch_stats;
+    vector<flt_type> batch_lls;
+    auto worditer = words.cbegin();
+    while (worditer != words.cend()) {
+
+        batch.clear();
+        batch_counts.clear();
+        for (; worditer != words.cend() && batch.size() < segment_batch_size; ++worditer) {
+            // Special symbols are not segmented, caller takes care of them
+            if (special_words.size() > 0 && special_words.find(worditer->first) != special_words.end())
+                continue;
+            batch.push_back(&(worditer->first));
+            batch_counts.push_back(worditer->second);
         }
+        segment_batch(vocab, batch, batch_stats, batch_lls);
+
+        for (unsigned int i=0; i<batch.size(); i++) {
+
+            factor_stats_t &stats = batch_stats[i];
+            if (stats.size() == 0) {
+                cerr << "warning, no segmentation for word: " << *(batch[i]) << endl;
+                continue;
+            }
 
-        ll += curr_ll;
+            ll += batch_counts[i] * batch_lls[i];
 
-        // Update statistics
-        for (auto it = stats.begin(); it != stats.end(); ++it)
-            new_freqs[it->first] += worditer->second * it->second;
+            // Update statistics
+            for (auto it = stats.begin(); it != stats.end(); ++it)
+                accumulate(new_freqs, it->first, batch_counts[i] * it->second);
+        }
     }
 
     return ll;
@@ -216,7 +318,7 @@ Unigrams::resegment_sents(const vector<string> &sents,
                           const map<string, flt_type> &vocab,
                           map<string, flt_type> &new_freqs)
 {
-    StringSet stringset_vocab(vocab);
+    StringSet stringset_vocab(vocab, utf8);
     return resegment_sents(sents, stringset_vocab, new_freqs);
 }
 
@@ -226,30 +328,246 @@ Unigrams::resegment_sents(const vector<string> &sents,
                           const StringSet &vocab,
                           map<string, flt_type> &new_freqs)
 {
-    new_freqs.clear();
+    vector<flt_type> freqs;
+    flt_type ll = resegment_sents(sents, vocab, freqs);
+    freqs_to_vocab(vocab, freqs, new_freqs);
+    return ll;
+}
+
+
+flt_type
+Unigrams::resegment_sents(const vector<string> &sents,
+                          const StringSet &vocab,
+                          vector<flt_type> &new_freqs)
+{
+    MemoryCorpus corpus(sents);
+    return resegment_sents(corpus, vocab, new_freqs);
+}
+
+
+flt_type
+Unigrams::resegment_sents(Corpus &corpus,
+                          const StringSet &vocab,
+                          vector<flt_type> &new_freqs)
+{
+    new_freqs.assign(vocab.factor_count(), MIN_FLOAT);
     flt_type ll = 0.0;
 
-    for (auto sent = sents.begin(); sent != sents.end(); ++sent) {
+    // Sentences are segmented in batches, the statistics are summed in the corpus order
+    vector<const string*> batch;
+    vector<flt_type> batch_counts;
+    vector<factor_stats_t> batch_stats;
+    vector<flt_type> batch_lls;
+    corpus.rewind();
+    while (corpus.next_batch(batch, batch_counts, segment_batch_size)) {
+
+        segment_batch(vocab, batch, batch_stats, batch_lls);
 
-        map<string, flt_type> stats;
-        flt_type curr_ll = segf(vocab, *sent, stats, this->utf8);
+        for (unsigned int i=0; i<batch.size(); i++) {
 
-        if (stats.size() == 0) {
-            cerr << "warning, no segmentation for sentence: " << *sent << endl;
-            continue;
+            factor_stats_t &stats = batch_stats[i];
+            if (stats.size() == 0) {
+                cerr << "warning, no segmentation for sentence: " << *(batch[i]) << endl;
+                continue;
+            }
+
+            ll += batch_counts[i] * batch_lls[i];
+
+            // Update statistics
+            for (auto it = stats.begin(); it != stats.end(); ++it)
+                accumulate(new_freqs, it->first, batch_counts[i] * it->second);
         }
+    }
+
+    return ll;
+}
 
-        ll += curr_ll;
 
-        // Update statistics
-        for (auto it = stats.begin(); it != stats.end(); ++it)
-            new_freqs[it->first] += it->second;
+flt_type
+Unigrams::resegment_sents(const vector<string> &sents,
+                          const RadixStringSet &vocab,
+                          vector<flt_type> &new_freqs)
+{
+    MemoryCorpus corpus(sents);
+    return resegment_sents(corpus, vocab, new_freqs);
+}
+
+
+flt_type
+Unigrams::resegment_sents(Corpus &corpus,
+                          const RadixStringSet &vocab,
+                          vector<flt_type> &new_freqs)
+{
+    new_freqs.assign(vocab.factor_count(), MIN_FLOAT);
+    flt_type ll = 0.0;
+
+    // Sentences are segmented in batches, the statistics are summed in the corpus order
+    vector<const string*> batch;
+    vector<flt_type> batch_counts;
+    vector<factor_stats_t> batch_stats;
+    vector<flt_type> batch_lls;
+    corpus.rewind();
+    while (corpus.next_batch(batch, batch_counts, segment_batch_size)) {
+
+        segment_batch(vocab, batch, batch_stats, batch_lls);
+
+        for (unsigned int i=0; i<batch.size(); i++) {
+
+            factor_stats_t &stats = batch_stats[i];
+            if (stats.size() == 0) {
+                cerr << "warning, no segmentation for sentence: " << *(batch[i]) << endl;
+                continue;
+            }
+
+            ll += batch_counts[i] * batch_lls[i];
+
+            // Update statistics
+            for (auto it = stats.begin(); it != stats.end(); ++it)
+                accumulate(new_freqs, it->first, batch_counts[i] * it->second);
+        }
     }
 
     return ll;
 }
 
 
+void
+Unigrams::segment_batch(const StringSet &vocab,
+                        const vector<const string*> &texts,
+                        vector<factor_stats_t> &stats,
+                        vector<flt_type> &lls) const
+{
+    stats.resize(texts.size());
+    lls.resize(texts.size());
+    unsigned int num_threads = min(threads, (unsigned int)texts.size());
+    if (num_threads < 2) {
+        segment_range(vocab, texts, 0, texts.size(), stats, lls);
+        return;
+    }
+
+    // Each thread writes the results of its own range of texts
+    vector<thread> workers;
+    for (unsigned int t=0; t<num_threads; t++) {
+        unsigned int begin = texts.size() * t / num_threads;
+        unsigned int end = texts.size() * (t+1) / num_threads;
+        void (Unigrams::*range_func)(const StringSet&, const vector<const string*>&,
+                                     unsigned int, unsigned int,
+                                     vector<factor_stats_t>&, vector<flt_type>&) const = &Unigrams::segment_range;
+        workers.push_back(thread(range_func, this, cref(vocab), cref(texts),
+                                 begin, end, ref(stats), ref(lls)));
+    }
+    for (auto it = workers.begin(); it != workers.end(); ++it)
+        it->join();
+}
+
+
+void
+Unigrams::segment_batch(const RadixStringSet &vocab,
+                        const vector<const string*> &texts,
+                        vector<factor_stats_t> &stats,
+                        vector<flt_type> &lls) const
+{
+    stats.resize(texts.size());
+    lls.resize(texts.size());
+    unsigned int num_threads = min(threads, (unsigned int)texts.size());
+    if (num_threads < 2) {
+        segment_range(vocab, texts, 0, texts.size(), stats, lls);
+        return;
+    }
+
+    // Each thread writes the results of its own range of texts
+    vector<thread> workers;
+    for (unsigned int t=0; t<num_threads; t++) {
+        unsigned int begin = texts.size() * t / num_threads;
+        unsigned int end = texts.size() * (t+1) / num_threads;
+        void (Unigrams::*range_func)(const RadixStringSet&, const vector<const string*>&,
+                                     unsigned int, unsigned int,
+                                     vector<factor_stats_t>&, vector<flt_type>&) const = &Unigrams::segment_range;
+        workers.push_back(thread(range_func, this, cref(vocab), cref(texts),
+                                 begin, end, ref(stats), ref(lls)));
+    }
+    for (auto it = workers.begin(); it != workers.end(); ++it)
+        it->join();
+}
+
+
+void
+Unigrams::segment_range(const StringSet &vocab,
+                        const vector<const string*> &texts,
+                        unsigned int begin,
+                        unsigned int end,
+                        vector<factor_stats_t> &stats,
+                        vector<flt_type> &lls) const
+{
+    FactorMask all_enabled;
+    SegmentationWorkspace ws;
+    for (unsigned int i=begin; i<end; i++)
+        lls[i] = segf(vocab, *(texts[i]), stats[i], all_enabled, ws, this->utf8);
+}
+
+
+void
+Unigrams::segment_range(const RadixStringSet &vocab,
+                        const vector<const string*> &texts,
+                        unsigned int begin,
+                        unsigned int end,
+                        vector<factor_stats_t> &stats,
+                        vector<flt_type> &lls) const
+{
+    for (unsigned int i=begin; i<end; i++)
+        lls[i] = radix_segf(vocab, *(texts[i]), stats[i], this->utf8);
+}
+
+
+void
+Unigrams::rank_batch(const StringSet &vocab,
+                     const vector<const string*> &texts,
+                     const vector<bool> &candidate_factors,
+                     vector<factor_stats_t> &stats,
+                     vector<flt_type> &lls,
+                     vector<vector<FactorRemoval> > &hypos) const
+{
+    stats.resize(texts.size());
+    lls.resize(texts.size());
+    hypos.resize(texts.size());
+    unsigned int num_threads = min(threads, (unsigned int)texts.size());
+    if (num_threads < 2) {
+        rank_range(vocab, texts, candidate_factors, 0, texts.size(), stats, lls, hypos);
+        return;
+    }
+
+    // Each thread writes the results of its own range of texts
+    vector<thread> workers;
+    for (unsigned int t=0; t<num_threads; t++) {
+        unsigned int begin = texts.size() * t / num_threads;
+        unsigned int end = texts.size() * (t+1) / num_threads;
+        workers.push_back(thread(&Unigrams::rank_range, this, cref(vocab), cref(texts),
+                                 cref(candidate_factors), begin, end,
+                                 ref(stats), ref(lls), ref(hypos)));
+    }
+    for (auto it = workers.begin(); it != workers.end(); ++it)
+        it->join();
+}
+
+
+void
+Unigrams::rank_range(const StringSet &vocab,
+                     const vector<const string*> &texts,
+                     const vector<bool> &candidate_factors,
+                     unsigned int begin,
+                     unsigned int end,
+                     vector<factor_stats_t> &stats,
+                     vector<flt_type> &lls,
+                     vector<vector<FactorRemoval> > &hypos) const
+{
+    // The vocabulary is shared, each thread masks the removals on its own
+    FactorMask mask(vocab.factor_count());
+    SegmentationWorkspace ws;
+    for (unsigned int i=begin; i<end; i++)
+        lls[i] = rankf(vocab, *(texts[i]), stats[i], candidate_factors, hypos[i], mask, ws, this->utf8);
+}
+
+
 flt_type
 Unigrams::get_sum(const map<string, flt_type> &freqs)
 {
@@ -262,6 +580,19 @@ Unigrams::get_sum(const map<string, flt_type> &freqs)
 }
 
 
+flt_type
+Unigrams::get_sum(const vector<flt_type> &freqs)
+{
+    flt_type total = 0.0;
+    for (auto iter = freqs.cbegin(); iter != freqs.cend(); ++iter) {
+        if (*iter == MIN_FLOAT) continue;
+        if (std::isinf(*iter) || std::isnan(*iter)) continue;
+        total += *iter;
+    }
+    return total;
+}
+
+
 flt_type
 Unigrams::get_cost(const map<string, flt_type> &freqs,
                    flt_type densum)
@@ -291,6 +622,33 @@ Unigrams::freqs_to_logprobs(map<string, flt_type> &vocab,
 }
 
 
+void
+Unigrams::freqs_to_logprobs(vector<flt_type> &vocab,
+                            flt_type min_lp)
+{
+    flt_type densum = Unigrams::get_sum(vocab);
+    densum = log(densum);
+    for (auto iter = vocab.begin(); iter != vocab.end(); ++iter) {
+        if (*iter == MIN_FLOAT) continue;
+        *iter = (log(*iter)-densum);
+        if (*iter < min_lp || std::isinf(*iter) || std::isnan(*iter))
+            *iter = min_lp;
+    }
+}
+
+
+void
+Unigrams::freqs_to_vocab(const StringSet &vocab,
+                         const vector<flt_type> &freqs,
+                         map<string, flt_type> &new_vocab)
+{
+    new_vocab.clear();
+    for (unsigned int i=0; i<freqs.size(); i++)
+        if (freqs[i] != MIN_FLOAT)
+            new_vocab[vocab.factor_strings[i]] = freqs[i];
+}
+
+
 int
 Unigrams::cutoff(map<string, flt_type> &vocab,
                  flt_type limit,
@@ -322,6 +680,27 @@ Unigrams::cutoff(map<string, flt_type> &vocab,
 }
 
 
+int
+Unigrams::cutoff(UnigramModel &model,
+                 flt_type limit,
+                 const set<string> &stoplist,
+                 unsigned int min_length)
+{
+    int nremovals = 0;
+    for (unsigned int i=0; i<model.counts.size(); i++) {
+        if (model.counts[i] == MIN_FLOAT) continue;
+        const string &factor = model.vocab.factor_strings[i];
+        if (model.counts[i] <= limit
+            && get_factor_length(factor, this->utf8) >= min_length
+            && stoplist.find(factor) == stoplist.end()) {
+                model.counts[i] = MIN_FLOAT;
+                nremovals++;
+        }
+    }
+    return nremovals;
+}
+
+
 // Select n_candidates number of subwords in the vocabulary as removal candidates
 // running from the least common subword
 int
@@ -461,61 +840,88 @@ Unigrams::rank_candidates(const map<string, flt_type> &words,
                           map<string, flt_type> &new_freqs,
                           vector<pair<string, flt_type> > &removal_scores)
 {
-    new_freqs.clear();
+    UnigramModel model(vocab, utf8);
+    flt_type ll = rank_candidates(words, model, candidates, removal_scores);
+    model.get_counts(new_freqs);
+    return ll;
+}
+
+
+flt_type
+Unigrams::rank_candidates(const map<string, flt_type> &words,
+                          UnigramModel &model,
+                          const set<string> &candidates,
+                          vector<pair<string, flt_type> > &removal_scores)
+{
     removal_scores.clear();
 
-    StringSet ss_vocab(vocab);
-    map<string, flt_type> ll_diffs;
-    map<string, flt_type> token_diffs;
-    set<string> problem_hypos;
+    const StringSet &ss_vocab = model.vocab;
+    unsigned int factor_count = ss_vocab.factor_count();
+    vector<flt_type> &freqs = model.counts;
+    freqs.assign(factor_count, MIN_FLOAT);
+    vector<flt_type> ll_diffs(factor_count, MIN_FLOAT);
+    vector<flt_type> token_diffs(factor_count, 0.0);
+    vector<bool> problem_hypos(factor_count, false);
+    vector<bool> candidate_factors(factor_count, false);
+    for (auto it = candidates.cbegin(); it != candidates.cend(); ++it) {
+        int factor = ss_vocab.factor_index(*it);
+        if (factor >= 0) candidate_factors[factor] = true;
+    }
 
     flt_type curr_ll = 0.0;
     flt_type token_count = 0.0;
 
-    for (auto worditer = words.cbegin(); worditer != words.cend(); ++worditer) {
-
-        map<string, flt_type> stats;
-        flt_type orig_score = segf(ss_vocab, worditer->first, stats, this->utf8);
-
-        if (stats.size() == 0) {
-            cerr << "warning, no segmentation for word: " << worditer->first << endl;
-            continue;
+    // Words are ranked in batches, the differences are summed in the word order
+    vector<const string*> batch;
+    vector<flt_type> batch_counts;
+    vector<factor_stats_t> batch_stats;
+    vector<flt_type> batch_lls;
+    vector<vector<FactorRemoval> > batch_hypos;
+    auto worditer = words.cbegin();
+    while (worditer != words.cend()) {
+
+        batch.clear();
+        batch_counts.clear();
+        for (; worditer != words.cend() && batch.size() < segment_batch_size; ++worditer) {
+            batch.push_back(&(worditer->first));
+            batch_counts.push_back(worditer->second);
         }
+        rank_batch(ss_vocab, batch, candidate_factors, batch_stats, batch_lls, batch_hypos);
 
-        curr_ll += worditer->second * orig_score;
-        token_count += worditer->second * stats.size();
-
-        // Update statistics
-        for (auto it = stats.cbegin(); it != stats.cend(); ++it)
-            new_freqs[it->first] += worditer->second * it->second;
+        for (unsigned int i=0; i<batch.size(); i++) {
 
-        for (auto hypoiter = stats.cbegin(); hypoiter != stats.cend(); ++hypoiter) {
-
-            if (candidates.find(hypoiter->first) != candidates.end()) {
+            factor_stats_t &stats = batch_stats[i];
+            if (stats.size() == 0) {
+                cerr << "warning, no segmentation for word: " << *(batch[i]) << endl;
+                continue;
+            }
 
-                flt_type stored_value = ss_vocab.remove(hypoiter->first);
+            flt_type word_count = batch_counts[i];
+            curr_ll += word_count * batch_lls[i];
+            token_count += word_count * stats.size();
 
-                map<string, flt_type> hypo_stats;
-                flt_type hypo_score = segf(ss_vocab, worditer->first, hypo_stats, this->utf8);
+            // Update statistics
+            for (auto it = stats.cbegin(); it != stats.cend(); ++it)
+                accumulate(freqs, it->first, word_count * it->second);
 
-                if (hypo_stats.size() > 0) {
-                    ll_diffs[hypoiter->first] += worditer->second * (hypo_score-orig_score);
-                    token_diffs[hypoiter->first] += worditer->second * ((flt_type)(hypo_stats.size())-(flt_type)(stats.size()));
+            for (auto hypoiter = batch_hypos[i].cbegin(); hypoiter != batch_hypos[i].cend(); ++hypoiter) {
+                if (hypoiter->num_tokens > 0) {
+                    accumulate(ll_diffs, hypoiter->factor, word_count * (hypoiter->ll-batch_lls[i]));
+                    token_diffs[hypoiter->factor] += word_count * ((flt_type)(hypoiter->num_tokens)-(flt_type)(stats.size()));
                 }
                 else
-                    problem_hypos.insert(hypoiter->first);
-
-                ss_vocab.add(hypoiter->first, stored_value);
+                    problem_hypos[hypoiter->factor] = true;
             }
         }
     }
 
-    for (auto iter = ll_diffs.begin(); iter != ll_diffs.end(); ++iter) {
-        if (problem_hypos.find(iter->first) != problem_hypos.end()) continue;
-        flt_type renormalizer = sub_log_domain_probs(0, vocab.at(iter->first));
-        flt_type hypo_token_count = (token_count + token_diffs[iter->first]);
+    for (unsigned int i=0; i<factor_count; i++) {
+        if (ll_diffs[i] == MIN_FLOAT) continue;
+        if (problem_hypos[i]) continue;
+        flt_type renormalizer = sub_log_domain_probs(0, ss_vocab.costs[i]);
+        flt_type hypo_token_count = (token_count + token_diffs[i]);
         flt_type normalizer_ll_diff = hypo_token_count * -renormalizer;
-        pair<string, flt_type> removal_score = make_pair(iter->first, iter->second + normalizer_ll_diff);
+        pair<string, flt_type> removal_score = make_pair(ss_vocab.factor_strings[i], ll_diffs[i] + normalizer_ll_diff);
         removal_scores.push_back(removal_score);
     }
 
@@ -534,61 +940,93 @@ Unigrams::rank_candidates(std::vector<std::string> &sents,
                           map<string, flt_type> &new_freqs,
                           vector<pair<string, flt_type> > &removal_scores)
 {
-    new_freqs.clear();
-    removal_scores.clear();
+    UnigramModel model(vocab, utf8);
+    flt_type ll = rank_candidates(sents, model, candidates, removal_scores);
+    model.get_counts(new_freqs);
+    return ll;
+}
 
-    StringSet ss_vocab(vocab);
-    map<string, flt_type> ll_diffs;
-    map<string, flt_type> token_diffs;
-    set<string> problem_hypos;
 
-    flt_type curr_ll = 0.0;
-    flt_type token_count = 0.0;
+flt_type
+Unigrams::rank_candidates(std::vector<std::string> &sents,
+                          UnigramModel &model,
+                          const set<string> &candidates,
+                          vector<pair<string, flt_type> > &removal_scores)
+{
+    MemoryCorpus corpus(sents);
+    return rank_candidates(corpus, model, candidates, removal_scores);
+}
 
-    for (auto sentiter = sents.cbegin(); sentiter != sents.cend(); ++sentiter) {
 
-        map<string, flt_type> stats;
-        flt_type orig_score = segf(ss_vocab, *sentiter, stats, this->utf8);
+flt_type
+Unigrams::rank_candidates(Corpus &corpus,
+                          UnigramModel &model,
+                          const set<string> &candidates,
+                          vector<pair<string, flt_type> > &removal_scores)
+{
+    removal_scores.clear();
 
-        if (stats.size() == 0) {
-            cerr << "warning, no segmentation for sentence: " << *sentiter << endl;
-            continue;
-        }
+    const StringSet &ss_vocab = model.vocab;
+    unsigned int factor_count = ss_vocab.factor_count();
+    vector<flt_type> &freqs = model.counts;
+    freqs.assign(factor_count, MIN_FLOAT);
+    vector<flt_type> ll_diffs(factor_count, MIN_FLOAT);
+    vector<flt_type> token_diffs(factor_count, 0.0);
+    vector<bool> problem_hypos(factor_count, false);
+    vector<bool> candidate_factors(factor_count, false);
+    for (auto it = candidates.cbegin(); it != candidates.cend(); ++it) {
+        int factor = ss_vocab.factor_index(*it);
+        if (factor >= 0) candidate_factors[factor] = true;
+    }
+
+    flt_type curr_ll = 0.0;
+    flt_type token_count = 0.0;
 
-        curr_ll += orig_score;
-        token_count += stats.size();
+    // Sentences are ranked in batches, the differences are summed in the corpus order
+    vector<const string*> batch;
+    vector<flt_type> batch_counts;
+    vector<factor_stats_t> batch_stats;
+    vector<flt_type> batch_lls;
+    vector<vector<FactorRemoval> > batch_hypos;
+    corpus.rewind();
+    while (corpus.next_batch(batch, batch_counts, segment_batch_size)) {
 
-        // Update statistics
-        for (auto it = stats.cbegin(); it != stats.cend(); ++it)
-            new_freqs[it->first] += it->second;
+        rank_batch(ss_vocab, batch, candidate_factors, batch_stats, batch_lls, batch_hypos);
 
-        for (auto hypoiter = stats.cbegin(); hypoiter != stats.cend(); ++hypoiter) {
+        for (unsigned int i=0; i<batch.size(); i++) {
 
-            if (candidates.find(hypoiter->first) != candidates.end()) {
+            factor_stats_t &stats = batch_stats[i];
+            if (stats.size() == 0) {
+                cerr << "warning, no segmentation for sentence: " << *(batch[i]) << endl;
+                continue;
+            }
 
-                flt_type stored_value = ss_vocab.remove(hypoiter->first);
+            flt_type sent_count = batch_counts[i];
+            curr_ll += sent_count * batch_lls[i];
+            token_count += sent_count * stats.size();
 
-                map<string, flt_type> hypo_stats;
-                flt_type hypo_score = segf(ss_vocab, *sentiter, hypo_stats, this->utf8);
+            // Update statistics
+            for (auto it = stats.cbegin(); it != stats.cend(); ++it)
+                accumulate(freqs, it->first, sent_count * it->second);
 
-                if (hypo_stats.size() > 0) {
-                    ll_diffs[hypoiter->first] += (hypo_score-orig_score);
-                    token_diffs[hypoiter->first] += (flt_type)(hypo_stats.size())-(flt_type)(stats.size());
+            for (auto hypoiter = batch_hypos[i].cbegin(); hypoiter != batch_hypos[i].cend(); ++hypoiter) {
+                if (hypoiter->num_tokens > 0) {
+                    accumulate(ll_diffs, hypoiter->factor, sent_count * (hypoiter->ll-batch_lls[i]));
+                    token_diffs[hypoiter->factor] += sent_count * ((flt_type)(hypoiter->num_tokens)-(flt_type)(stats.size()));
                 }
                 else
-                    problem_hypos.insert(hypoiter->first);
-
-                ss_vocab.add(hypoiter->first, stored_value);
+                    problem_hypos[hypoiter->factor] = true;
             }
         }
     }
 
-    for (auto iter = ll_diffs.begin(); iter != ll_diffs.end(); ++iter) {
-        if (problem_hypos.find(iter->first) != problem_hypos.end()) continue;
-        flt_type renormalizer = sub_log_domain_probs(0, vocab.at(iter->first));
-        flt_type hypo_token_count = (token_count + token_diffs[iter->first]);
+    for (unsigned int i=0; i<factor_count; i++) {
+        if (ll_diffs[i] == MIN_FLOAT) continue;
+        if (problem_hypos[i]) continue;
+        flt_type renormalizer = sub_log_domain_probs(0, ss_vocab.costs[i]);
+        flt_type hypo_token_count = (token_count + token_diffs[i]);
         flt_type normalizer_ll_diff = hypo_token_count * -renormalizer;
-        pair<string, flt_type> removal_score = make_pair(iter->first, iter->second + normalizer_ll_diff);
+        pair<string, flt_type> removal_score = make_pair(ss_vocab.factor_strings[i], ll_diffs[i] + normalizer_ll_diff);
         removal_scores.push_back(removal_score);
     }
 
@@ -6,21 +6,38 @@
 
 #include "defs.hh"
 #include "StringSet.hh"
+#include "UnigramModel.hh"
 #include "EM.hh"
+#include "Corpus.hh"
 
 class Unigrams {
 public:
 
-    Unigrams() { this->segf = viterbi; utf8=false; }
-    Unigrams(flt_type (*segf)(const StringSet &vocab, const std::string &sentence, std::map<std::string, flt_type> &stats, bool utf8))
-        : segf(segf) { this->utf8 = utf8; }
+    Unigrams() { this->segf = viterbi; this->radix_segf = viterbi; this->rankf = viterbi; utf8=false; threads=1; }
+    // The removals are ranked with Viterbi unless set with set_ranking_method
+    Unigrams(flt_type (*segf)(const StringSet &vocab, const std::string &sentence, factor_stats_t &stats, const FactorMask &mask, SegmentationWorkspace &ws, bool utf8))
+        : segf(segf) { this->radix_segf = viterbi; this->rankf = viterbi; utf8=false; threads=1; }
 
-    void set_segmentation_method(flt_type (*segf)(const StringSet &vocab, const std::string &sentence, std::map<std::string, flt_type> &stats, bool utf8)) {
+    void set_segmentation_method(flt_type (*segf)(const StringSet &vocab, const std::string &sentence, factor_stats_t &stats, const FactorMask &mask, SegmentationWorkspace &ws, bool utf8)) {
         this->segf = segf;
     }
 
+    // Segmentation used for scoring the removals in rank_candidates,
+    // should be the same method as set with set_segmentation_method
+    void set_ranking_method(flt_type (*rankf)(const StringSet &vocab, const std::string &sentence, factor_stats_t &stats, const std::vector<bool> &candidates, std::vector<FactorRemoval> &removals, FactorMask &mask, SegmentationWorkspace &ws, bool utf8)) {
+        this->rankf = rankf;
+    }
+
+    void set_radix_segmentation_method(flt_type (*radix_segf)(const RadixStringSet &vocab, const std::string &sentence, factor_stats_t &stats, bool utf8)) {
+        this->radix_segf = radix_segf;
+    }
+
     void set_utf8(bool utf8) { this->utf8 = utf8; }
 
+    // Words and sentences are segmented in this many threads,
+    // the results do not depend on the number of threads
+    void set_threads(int threads) { this->threads = threads > 0 ? threads : 1; }
+
     static int read_vocab(std::string fname,
                           std::map<std::string, flt_type> &vocab,
                           int &maxlen,
@@ -39,6 +56,12 @@ public:
     static int read_sents(std::string fname,
                           std::vector<std::string> &sents);
 
+    // Identical sentences are read once, in the order of the first occurrence,
+    // with the number of occurrences as the count, returns the number of lines
+    static int read_sents(std::string fname,
+                          std::vector<std::string> &sents,
+                          std::vector<flt_type> &counts);
+
     static void sort_vocab(const std::map<std::string, flt_type> &vocab,
                            std::vector<std::pair<std::string, flt_type> > &sorted_vocab,
                            bool descending=true);
@@ -51,6 +74,20 @@ public:
                      std::map<std::string, flt_type> &vocab,
                      unsigned int iterations = 1);
 
+    // Updates the costs and counts of the model in place
+    flt_type iterate(const std::map<std::string, flt_type> &words,
+                     UnigramModel &model,
+                     unsigned int iterations = 1);
+
+    flt_type iterate(const std::vector<std::string> &sents,
+                     UnigramModel &model,
+                     unsigned int iterations = 1);
+
+    // The corpus is read again on each iteration
+    flt_type iterate(Corpus &corpus,
+                     UnigramModel &model,
+                     unsigned int iterations = 1);
+
     flt_type resegment_words(const std::map<std::string, flt_type> &words,
                              const std::map<std::string, flt_type> &vocab,
                              std::map<std::string, flt_type> &new_freqs,
@@ -61,6 +98,12 @@ public:
                              std::map<std::string, flt_type> &new_freqs,
                              std::set<std::string> special_words=std::set<std::string>());
 
+    // Frequencies by the factor index, MIN_FLOAT for factors not in any segmentation
+    flt_type resegment_words(const std::map<std::string, flt_type> &words,
+                             const StringSet &vocab,
+                             std::vector<flt_type> &new_freqs,
+                             const std::set<std::string> &special_words=std::set<std::string>());
+
     flt_type resegment_sents(const std::vector<std::string> &sents,
                              const std::map<std::string, flt_type> &vocab,
                              std::map<std::string, flt_type> &new_freqs);
@@ -69,14 +112,40 @@ public:
                              const StringSet &vocab,
                              std::map<std::string, flt_type> &new_freqs);
 
+    flt_type resegment_sents(const std::vector<std::string> &sents,
+                             const StringSet &vocab,
+                             std::vector<flt_type> &new_freqs);
+
+    flt_type resegment_sents(const std::vector<std::string> &sents,
+                             const RadixStringSet &vocab,
+                             std::vector<flt_type> &new_freqs);
+
+    // One pass over the corpus
+    flt_type resegment_sents(Corpus &corpus,
+                             const StringSet &vocab,
+                             std::vector<flt_type> &new_freqs);
+
+    flt_type resegment_sents(Corpus &corpus,
+                             const RadixStringSet &vocab,
+                             std::vector<flt_type> &new_freqs);
+
     static flt_type get_sum(const std::map<std::string, flt_type> &freqs);
 
+    static flt_type get_sum(const std::vector<flt_type> &freqs);
+
     static flt_type get_cost(const std::map<std::string, flt_type> &freqs,
                              flt_type densum);
 
     static void freqs_to_logprobs(std::map<std::string, flt_type> &vocab,
                                   flt_type min_lp=FLOOR_LP);
 
+    static void freqs_to_logprobs(std::vector<flt_type> &vocab,
+                                  flt_type min_lp=FLOOR_LP);
+
+    static void freqs_to_vocab(const StringSet &vocab,
+                               const std::vector<flt_type> &freqs,
+                               std::map<std::string, flt_type> &new_vocab);
+
     int cutoff(std::map<std::string, flt_type> &vocab,
                flt_type limit,
                const std::set<std::string> &stoplist,
@@ -86,6 +155,12 @@ public:
                flt_type limit,
                unsigned int min_length=2);
 
+    // Drops the counts of the factors under the limit
+    int cutoff(UnigramModel &model,
+               flt_type limit,
+               const std::set<std::string> &stoplist,
+               unsigned int min_length=2);
+
     int init_candidates(const std::map<std::string, flt_type> &vocab,
                         std::set<std::string> &candidates,
                         unsigned int n_candidates,
@@ -135,9 +210,75 @@ public:
                              std::map<std::string, flt_type> &new_freqs,
                              std::vector<std::pair<std::string, flt_type> > &removal_scores);
 
+    // Sets the counts of the model, the costs are not changed
+    // The letter tree is only read, the removals are scored from the lattice of each text
+    // The texts are ranked in threads, the scores do not depend on the number of threads
+    flt_type rank_candidates(const std::map<std::string, flt_type> &words,
+                             UnigramModel &model,
+                             const std::set<std::string> &candidates,
+                             std::vector<std::pair<std::string, flt_type> > &removal_scores);
+
+    flt_type rank_candidates(std::vector<std::string> &sents,
+                             UnigramModel &model,
+                             const std::set<std::string> &candidates,
+                             std::vector<std::pair<std::string, flt_type> > &removal_scores);
+
+    flt_type rank_candidates(Corpus &corpus,
+                             UnigramModel &model,
+                             const std::set<std::string> &candidates,
+                             std::vector<std::pair<std::string, flt_type> > &removal_scores);
+
 private:
-    flt_type (*segf)(const StringSet &vocab, const std::string &sentence, std::map<std::string, flt_type> &stats, bool utf8);
+
+    // Segments the texts, the statistics and likelihoods are stored by the text
+    void segment_batch(const StringSet &vocab,
+                       const std::vector<const std::string*> &texts,
+                       std::vector<factor_stats_t> &stats,
+                       std::vector<flt_type> &lls) const;
+
+    void segment_batch(const RadixStringSet &vocab,
+                       const std::vector<const std::string*> &texts,
+                       std::vector<factor_stats_t> &stats,
+                       std::vector<flt_type> &lls) const;
+
+    void segment_range(const StringSet &vocab,
+                       const std::vector<const std::string*> &texts,
+                       unsigned int begin,
+                       unsigned int end,
+                       std::vector<factor_stats_t> &stats,
+                       std::vector<flt_type> &lls) const;
+
+    void segment_range(const RadixStringSet &vocab,
+                       const std::vector<const std::string*> &texts,
+                       unsigned int begin,
+                       unsigned int end,
+                       std::vector<factor_stats_t> &stats,
+                       std::vector<flt_type> &lls) const;
+
+    // Segments the texts and scores the removals of the candidate factors in the segmentation
+    void rank_batch(const StringSet &vocab,
+                    const std::vector<const std::string*> &texts,
+                    const std::vector<bool> &candidate_factors,
+                    std::vector<factor_stats_t> &stats,
+                    std::vector<flt_type> &lls,
+                    std::vector<std::vector<FactorRemoval> > &hypos) const;
+
+    void rank_range(const StringSet &vocab,
+                    const std::vector<const std::string*> &texts,
+                    const std::vector<bool> &candidate_factors,
+                    unsigned int begin,
+                    unsigned int end,
+                    std::vector<factor_stats_t> &stats,
+                    std::vector<flt_type> &lls,
+                    std::vector<std::vector<FactorRemoval> > &hypos) const;
+
+    static const unsigned int segment_batch_size = 10000;
+
+    flt_type (*segf)(const StringSet &vocab, const std::string &sentence, factor_stats_t &stats, const FactorMask &mask, SegmentationWorkspace &ws, bool utf8);
+    flt_type (*radix_segf)(const RadixStringSet &vocab, const std::string &sentence, factor_stats_t &stats, bool utf8);
+    flt_type (*rankf)(const StringSet &vocab, const std::string &sentence, factor_stats_t &stats, const std::vector<bool> &candidates, std::vector<FactorRemoval> &removals, FactorMask &mask, SegmentationWorkspace &ws, bool utf8);
     bool utf8;
+    unsigned int threads;
 };
 
 bool descending_sort(std::pair<std::string, flt_type> i,std::pair<std::string, flt_type> j);
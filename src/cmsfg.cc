@@ -2,10 +2,30 @@
 
 #include "conf.hh"
 #include "Unigrams.hh"
+#include "FrozenMSFG.hh"
 
 using namespace std;
 
 
+void write_msfg(MultiStringFactorGraph &msfg,
+                const string &fname,
+                bool image)
+{
+    if (!image) {
+        msfg.write(fname);
+        return;
+    }
+
+    // The factors not in the factor node map would be frozen as removed
+    msfg.update_factor_node_map();
+    FrozenMultiStringFactorGraph frozen(msfg);
+    if (frozen.write_image(fname) < 0) {
+        cerr << "something went wrong writing msfg image" << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+
 int main(int argc, char* argv[]) {
 
     conf::Config config;
@@ -13,6 +33,7 @@ int main(int argc, char* argv[]) {
       ('h', "help", "", "", "display help")
       ('n', "no-lookahead", "", "", "don't use lookahead, uses less memory but much slower")
       ('t', "temp-graphs=INT", "arg", "0", "Write out intermediate graphs for #G mod INT == 0")
+      ('i', "image", "", "", "Write the graphs as binary images for mapping in the bigram tools")
       ('8', "utf-8", "", "", "Utf-8 character encoding in use");
     config.default_parse(argc, argv);
     if (config.arguments.size() != 3) config.print_help(stderr, 1);
@@ -22,6 +43,7 @@ int main(int argc, char* argv[]) {
     string msfg_fname = config.arguments[2];
     unsigned int temp_graph_interval = config["temp-graphs"].get_int();
     bool lookahead = !config["no-lookahead"].specified;
+    bool write_image = config["image"].specified;
     bool utf8_encoding = config["utf-8"].specified;
 
     cerr << std::boolalpha;
@@ -29,6 +51,7 @@ int main(int argc, char* argv[]) {
     cerr << "parameters, initial vocabulary: " << vocab_fname << endl;
     cerr << "parameters, msfg to write: " << msfg_fname << endl;
     cerr << "parameters, lookahead: " << lookahead << endl;
+    cerr << "parameters, write binary image: " << write_image << endl;
     if (temp_graph_interval > 0)
         cerr << "parameters, write intermediate graphs whenever #V modulo " << temp_graph_interval << " == 0" << endl;
     else
@@ -57,7 +80,7 @@ int main(int argc, char* argv[]) {
     cerr << "\t" << "wordlist size: " << words.size() << endl;
     cerr << "\t" << "maximum word length: " << word_maxlen << endl;
 
-    StringSet ss_vocab(vocab);
+    StringSet ss_vocab(vocab, utf8_encoding);
     MultiStringFactorGraph msfg(start_end_symbol);
     vocab[start_end_symbol] = 0.0;
 
@@ -75,11 +98,11 @@ int main(int argc, char* argv[]) {
             stringstream tempfname;
             tempfname << msfg_fname << "." << curr_word_idx;
             cerr << "... writing intermediate graph to file " << tempfname.str() << endl;
-            msfg.write(tempfname.str());
+            write_msfg(msfg, tempfname.str(), write_image);
         }
     }
 
-    msfg.write(msfg_fname);
+    write_msfg(msfg, msfg_fname, write_image);
 
     cerr << "factor graph strings: " << msfg.string_end_nodes.size() << endl;
     cerr << "factor graph nodes: " << msfg.nodes.size() << endl;
@@ -14,7 +14,7 @@ int main(int argc, char* argv[]) {
     conf::Config config;
     config("usage: counts [OPTION...] INPUT COUNTS1 COUNTS2\n")
       ('h', "help", "", "", "display help")
-      ('v', "vocabulary=FILE", "arg", "", "Unigram model file")
+      ('v', "vocabulary=FILE", "arg", "", "Unigram model file or a binary image from freeze-vocab")
       ('t', "transitions=FILE", "arg", "", "Bigram model file")
       ('f', "forward-backward", "", "", "Use Forward-backward segmentation instead of Viterbi")
       ('w', "weights", "", "", "Training examples are weighted")
@@ -36,8 +36,9 @@ int main(int argc, char* argv[]) {
     string trans_fname;
     int maxlen;
     map<string, flt_type> vocab;
-    StringSet *ss_vocab = NULL;
+    FrozenStringSet *fs_vocab = NULL;
     transitions_t transitions;
+    TransitionTable *trans_table = NULL;
     bool unigram = true;
     flt_type one_char_min_lp = -25.0;
     string in_fname = config.arguments[0];
@@ -49,31 +50,46 @@ int main(int argc, char* argv[]) {
 
     if (config["vocabulary"].specified) {
         vocab_fname = config["vocabulary"].get_str();
-        cerr << "Reading vocabulary " << vocab_fname << endl;
-        int retval = Unigrams::read_vocab(vocab_fname, vocab, maxlen, utf8_encoding);
-        vocab[start_end_symbol] = 0.0;
-        if (retval < 0) {
-            cerr << "something went wrong reading vocabulary" << endl;
-            exit(EXIT_FAILURE);
+        if (FrozenStringSet::is_image(vocab_fname)) {
+            cerr << "Mapping vocabulary image " << vocab_fname << endl;
+            fs_vocab = new FrozenStringSet();
+            if (fs_vocab->open_image(vocab_fname) < 0) {
+                cerr << "something went wrong mapping vocabulary image" << endl;
+                exit(EXIT_FAILURE);
+            }
+            cerr << "\t" << "size: " << fs_vocab->string_count() << endl;
+            cerr << "\t" << "maximum string length: " << fs_vocab->max_factor_length << endl;
+            // The start and end symbol goes outside the letter tree, the image stays mapped
+            fs_vocab->add_letter(start_end_symbol, 0.0);
+        }
+        else {
+            cerr << "Reading vocabulary " << vocab_fname << endl;
+            int retval = Unigrams::read_vocab(vocab_fname, vocab, maxlen, utf8_encoding);
+            vocab[start_end_symbol] = 0.0;
+            if (retval < 0) {
+                cerr << "something went wrong reading vocabulary" << endl;
+                exit(EXIT_FAILURE);
+            }
+            cerr << "\t" << "size: " << vocab.size() << endl;
+            cerr << "\t" << "maximum string length: " << maxlen << endl;
+            fs_vocab = new FrozenStringSet(vocab);
         }
-        cerr << "\t" << "size: " << vocab.size() << endl;
-        cerr << "\t" << "maximum string length: " << maxlen << endl;
-        ss_vocab = new StringSet(vocab);
     }
 
     if (config["transitions"].specified) {
         unigram = false;
-        trans_fname = config["vocabulary"].get_str();
+        trans_fname = config["transitions"].get_str();
         cerr << "Reading transitions " << trans_fname << endl;
         int retval = Bigrams::read_transitions(transitions, trans_fname);
         Bigrams::trans_to_vocab(transitions, vocab);
-        ss_vocab = new StringSet(vocab);
+        fs_vocab = new FrozenStringSet(vocab);
         if (retval < 0) {
             cerr << "something went wrong reading transitions" << endl;
             exit(EXIT_FAILURE);
         }
         cerr << "\t" << "vocabulary: " << transitions.size() << endl;
         cerr << "\t" << "transitions: " << retval << endl;
+        trans_table = new TransitionTable(transitions, *fs_vocab);
     }
 
     cerr << "Segmenting corpus" << endl;
@@ -81,6 +97,7 @@ int main(int argc, char* argv[]) {
 
     map<string, flt_type> unigram_stats;
     transitions_t trans_stats;
+    FlatFactorGraph fg;
     string line;
     int li = 1;
     while (infile.getline(line)) {
@@ -101,26 +118,26 @@ int main(int argc, char* argv[]) {
 
         for (unsigned int i=0; i<line.size(); i++) {
             string currchr {line[i]};
-            if (!ss_vocab->includes(currchr))
-                ss_vocab->add(currchr, one_char_min_lp);
+            if (!fs_vocab->includes(currchr))
+                fs_vocab->add_letter(currchr, one_char_min_lp);
         }
 
         transitions_t curr_stats;
 
         if (unigram)
             if (enable_forward_backward) {
-                FactorGraph fg(line, start_end_symbol, *ss_vocab);
-                forward_backward(vocab, fg, curr_stats);
+                fg.set_text(line, start_end_symbol, *fs_vocab);
+                forward_backward(*fs_vocab, fg, curr_stats);
             }
             else {
-                viterbi(vocab, line, curr_stats, start_end_symbol);
+                viterbi(*fs_vocab, line, curr_stats, start_end_symbol);
             }
         else {
-            FactorGraph fg(line, start_end_symbol, *ss_vocab);
+            fg.set_text(line, start_end_symbol, *fs_vocab);
             if (enable_forward_backward)
-                forward_backward(transitions, fg, curr_stats);
+                forward_backward(*trans_table, fg, curr_stats);
             else
-                viterbi(transitions, fg, curr_stats);
+                viterbi(*trans_table, fg, curr_stats);
         }
 
         Bigrams::update_trans_stats(curr_stats, curr_weight,
@@ -129,7 +146,8 @@ int main(int argc, char* argv[]) {
         li++;
     }
 
-    if (ss_vocab != NULL) delete ss_vocab;
+    if (fs_vocab != NULL) delete fs_vocab;
+    if (trans_table != NULL) delete trans_table;
 
     Unigrams::write_vocab(out_fname_1, unigram_stats, true, 10);
     Bigrams::write_transitions(trans_stats, out_fname_2, true, 10);
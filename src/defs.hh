@@ -2,6 +2,8 @@
 #define PROJECT_DEFS
 
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <limits>
 #include <map>
 #include <set>
@@ -9,16 +11,28 @@
 #include <vector>
 
 typedef double flt_type;
-typedef unsigned short int fg_node_idx_t;
+// Type of the forward and backward scores in the segmentation lattices,
+// the statistics are always summed in flt_type
+// Building with -DFLOAT_SCORES stores the scores in single precision
+#ifdef FLOAT_SCORES
+typedef float score_type;
+#else
+typedef double score_type;
+#endif
+// Node indices and positions of the graph of one text, lines may be long
+typedef unsigned int fg_node_idx_t;
 typedef unsigned int msfg_node_idx_t;
-typedef unsigned short int factor_pos_t;
+typedef unsigned int factor_pos_t;
 typedef unsigned char factor_len_t;
 
 typedef std::map<std::string, std::map<std::string, flt_type> > transitions_t;
+// Statistics for one segmentation, (factor index, value) sorted by the index
+typedef std::vector<std::pair<int, flt_type> > factor_stats_t;
 
 #define FLOOR_LP -20.0
 #define SMALL_LP -100.0
 #define MIN_FLOAT -std::numeric_limits<flt_type>::max()
+#define MIN_SCORE -std::numeric_limits<score_type>::max()
 #define MAX_LINE_LEN 8192
 static std::string start_end_symbol("*");
 
@@ -32,6 +46,75 @@ static flt_type add_log_domain_probs(flt_type a, flt_type b) {
     return b + log1p(exp(delta));
 }
 
+// Approximation of exp(x), x = k*log(2) + r with |r| <= log(2)/2 and exp(r)
+// from the Taylor series up to r^12, the relative error is below 1e-15
+// Arguments under -700 are evaluated at -700, the loop over the values
+// in fast_sum_log_domain_probs can be vectorized by the compiler
+static inline flt_type fast_exp(flt_type x) {
+    const flt_type shifter = 6755399441055744.0; // 1.5*2^52, rounds k to the low bits
+    x = x < -700.0 ? -700.0 : x;
+    flt_type k = x * 1.4426950408889634 + shifter;
+    uint64_t k_bits;
+    memcpy(&k_bits, &k, sizeof(k_bits));
+    k -= shifter;
+    flt_type r = (x - k * 6.93147180369123816490e-01) - k * 1.90821492927058770002e-10;
+    flt_type p = 1.0/479001600.0;
+    p = p * r + 1.0/39916800.0;
+    p = p * r + 1.0/3628800.0;
+    p = p * r + 1.0/362880.0;
+    p = p * r + 1.0/40320.0;
+    p = p * r + 1.0/5040.0;
+    p = p * r + 1.0/720.0;
+    p = p * r + 1.0/120.0;
+    p = p * r + 1.0/24.0;
+    p = p * r + 1.0/6.0;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+    // Unsigned arithmetic, the exponent k is negative for most arguments
+    uint64_t p_bits;
+    memcpy(&p_bits, &p, sizeof(p_bits));
+    p_bits += (k_bits - (uint64_t)0x4338000000000000) << 52;
+    memcpy(&p, &p_bits, sizeof(p));
+    return p;
+}
+
+// Return log(X_1+...+X_n) where values[i]=log(X_i)
+// The values are shifted by the maximum and their exponents summed with
+// fast_exp in four lanes, which takes one logarithm for the whole sum.
+// The results differ from the exact sums by the rounding errors and
+// the error of fast_exp.
+template <typename T>
+static flt_type fast_sum_log_domain_probs(const T *values, unsigned int count) {
+    flt_type max = values[0];
+    for (unsigned int i=1; i<count; i++)
+        max = values[i] > max ? values[i] : max;
+    flt_type sums[4] = { 0.0, 0.0, 0.0, 0.0 };
+    unsigned int i = 0;
+    for (; i+4<=count; i+=4)
+        for (unsigned int j=0; j<4; j++)
+            sums[j] += fast_exp(values[i+j] - max);
+    for (; i<count; i++)
+        sums[0] += fast_exp(values[i] - max);
+    return max + log((sums[0] + sums[1]) + (sums[2] + sums[3]));
+}
+
+// Return log(X_1+...+X_n) where values[i]=log(X_i)
+// By default the values are added one at a time with add_log_domain_probs,
+// which gives exactly the same results as adding them in a loop.
+// If FAST_LOG_SUM is defined at compile time, fast_sum_log_domain_probs is used.
+template <typename T>
+static flt_type sum_log_domain_probs(const T *values, unsigned int count) {
+#ifdef FAST_LOG_SUM
+    return fast_sum_log_domain_probs(values, count);
+#else
+    flt_type sum = values[0];
+    for (unsigned int i=1; i<count; i++)
+        sum = add_log_domain_probs(sum, values[i]);
+    return sum;
+#endif
+}
+
 // Return log(X-Y) where a=log(X) b=log(Y)
 static flt_type sub_log_domain_probs(flt_type a, flt_type b) {
     flt_type delta = b - a;
@@ -61,6 +144,24 @@ static void get_character_positions_onebyte(std::string word,
         positions.push_back(i);
 }
 
+// Letter encodings for the kernels templated over the encoding,
+// next gives the start of the letter following the one at the position
+class OneByteLetters {
+public:
+    static inline unsigned int next(const std::string &word, unsigned int pos) { return pos+1; }
+};
+
+class Utf8Letters {
+public:
+    static inline unsigned int next(const std::string &word, unsigned int pos)
+    {
+        if (!(word[pos] & 128)) return pos+1;
+        else if ((word[pos] & 240) == 240) return pos+4;
+        else if ((word[pos] & 224) == 224) return pos+3;
+        else return pos+2;
+    }
+};
+
 static void get_character_positions_utf8(const std::string &word,
                                          std::vector<unsigned int> &positions)
 {
@@ -69,12 +170,7 @@ static void get_character_positions_utf8(const std::string &word,
     unsigned int charpos=0;
 
     while (charpos<word.length()) {
-        unsigned int utfseqlen=0;
-        if (!(word[charpos] & 128)) utfseqlen = 1;
-        else if ((word[charpos] & 240) == 240) utfseqlen = 4;
-        else if ((word[charpos] & 224) == 224) utfseqlen = 3;
-        else utfseqlen = 2;
-        charpos += utfseqlen;
+        charpos = Utf8Letters::next(word, charpos);
         positions.push_back(charpos);
     }
 }
@@ -0,0 +1,39 @@
+#include "conf.hh"
+#include "FrozenMSFG.hh"
+
+using namespace std;
+
+
+int main(int argc, char* argv[]) {
+
+    conf::Config config;
+    config("usage: freeze-msfg [OPTION...] MSFG IMAGE\n")
+      ('h', "help", "", "", "display help");
+    config.default_parse(argc, argv);
+    if (config.arguments.size() != 2) config.print_help(stderr, 1);
+
+    string msfg_fname = config.arguments[0];
+    string image_fname = config.arguments[1];
+
+    cerr << "Reading msfg " << msfg_fname << endl;
+    MultiStringFactorGraph *read_msfg = new MultiStringFactorGraph(start_end_symbol);
+    read_msfg->read(msfg_fname);
+    FrozenMultiStringFactorGraph msfg(*read_msfg);
+    delete read_msfg;
+    if (msfg.node_count() == 0) {
+        cerr << "something went wrong reading msfg" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    cerr << "Writing msfg image " << image_fname << endl;
+    cerr << "\t" << "strings: " << msfg.string_end_nodes.size() << endl;
+    cerr << "\t" << "nodes: " << msfg.node_count() << endl;
+    cerr << "\t" << "arcs: " << msfg.arc_count() << endl;
+    int retval = msfg.write_image(image_fname);
+    if (retval < 0) {
+        cerr << "something went wrong writing msfg image" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,42 @@
+#include "conf.hh"
+#include "Unigrams.hh"
+
+using namespace std;
+
+
+int main(int argc, char* argv[]) {
+
+    conf::Config config;
+    config("usage: freeze-vocab [OPTION...] VOCAB IMAGE\n")
+      ('h', "help", "", "", "display help")
+      ('8', "utf-8", "", "", "Utf-8 character encoding in use");
+    config.default_parse(argc, argv);
+    if (config.arguments.size() != 2) config.print_help(stderr, 1);
+
+    bool utf8_encoding = config["utf-8"].specified;
+    string vocab_fname = config.arguments[0];
+    string image_fname = config.arguments[1];
+
+    int maxlen;
+    map<string, flt_type> vocab;
+
+    cerr << "Reading vocabulary " << vocab_fname << endl;
+    int retval = Unigrams::read_vocab(vocab_fname, vocab, maxlen, utf8_encoding);
+    if (retval < 0) {
+        cerr << "something went wrong reading vocabulary" << endl;
+        exit(EXIT_FAILURE);
+    }
+    cerr << "\t" << "size: " << vocab.size() << endl;
+    cerr << "\t" << "maximum string length: " << maxlen << endl;
+
+    FrozenStringSet fs_vocab(vocab);
+    cerr << "Writing vocabulary image " << image_fname << endl;
+    cerr << "\t" << "nodes: " << fs_vocab.node_count() << endl;
+    retval = fs_vocab.write_image(image_fname);
+    if (retval < 0) {
+        cerr << "something went wrong writing vocabulary image" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -16,6 +16,9 @@ int main(int argc, char* argv[]) {
       ('i', "iterations=INT", "arg", "5", "Number of iterations")
       ('f', "forward-backward", "", "", "Use Forward-backward segmentation instead of Viterbi")
       ('t', "temp-vocabs", "", "", "Write out vocabulary after each iteration")
+      (0, "path-compressed", "", "", "Path-compressed letter tree, less memory for long phrase factors")
+      ('b', "stream-buffer=INT", "arg", "0", "Stream the corpus from the file on each pass with a buffer of INT megabytes, DEFAULT: 0 (read all to memory)")
+      ('j', "threads=INT", "arg", "1", "Number of threads, DEFAULT: 1")
       ('8', "utf-8", "", "", "Utf-8 character encoding in use");
     config.default_parse(argc, argv);
     if (config.arguments.size() != 3) config.print_help(stderr, 1);
@@ -23,7 +26,10 @@ int main(int argc, char* argv[]) {
     int num_iterations = config["iterations"].get_int();
     bool enable_forward_backward = config["forward-backward"].specified;
     bool write_temp_vocabs = config["temp-vocabs"].specified;
+    bool path_compressed = config["path-compressed"].specified;
     bool utf8_encoding = config["utf-8"].specified;
+    int num_threads = config["threads"].get_int();
+    unsigned int stream_buffer = config["stream-buffer"].get_int();
     string training_fname = config.arguments[0];
     string vocab_in_fname = config.arguments[1];
     string vocab_out_fname = config.arguments[2];
@@ -35,13 +41,17 @@ int main(int argc, char* argv[]) {
     cerr << "parameters, use forward-backward: " << enable_forward_backward << endl;
     cerr << "parameters, number of iterations: " << num_iterations << endl;
     cerr << "parameters, write vocabulary after each iteration: " << write_temp_vocabs << endl;
+    cerr << "parameters, path-compressed letter tree: " << path_compressed << endl;
     cerr << "parameters, utf-8 encoding: " << utf8_encoding << endl;
+    cerr << "parameters, threads: " << num_threads << endl;
+    cerr << "parameters, corpus stream buffer (MB): " << stream_buffer << endl;
 
     int maxlen;
     set<string> all_chars;
     map<string, flt_type> vocab;
-    map<string, flt_type> freqs;
     vector<string> sents;
+    vector<flt_type> sent_counts;
+    Corpus *corpus = NULL;
 
     cerr << "Reading vocabulary " << vocab_in_fname << endl;
     int retval = Unigrams::read_vocab(vocab_in_fname, vocab, maxlen, utf8_encoding);
@@ -54,32 +64,76 @@ int main(int argc, char* argv[]) {
     find_short_factors(vocab, all_chars, 2, utf8_encoding);
 
     Unigrams ug;
-    if (enable_forward_backward)
+    if (enable_forward_backward) {
         ug.set_segmentation_method(forward_backward);
-    else
+        ug.set_radix_segmentation_method(forward_backward);
+    }
+    else {
         ug.set_segmentation_method(viterbi);
+        ug.set_radix_segmentation_method(viterbi);
+    }
     ug.set_utf8(utf8_encoding);
+    ug.set_threads(num_threads);
 
-    cerr << "Reading training corpus " << training_fname << endl;
-    Unigrams::read_sents(training_fname, sents);
+    if (stream_buffer > 0) {
+        // Half of the buffer for the chunk being segmented, half for the one being read
+        cerr << "Streaming training corpus " << training_fname << endl;
+        corpus = new StreamingCorpus(training_fname, (unsigned long int)stream_buffer*1024*1024/2);
+    }
+    else {
+        cerr << "Reading training corpus " << training_fname << endl;
+        int lc = Unigrams::read_sents(training_fname, sents, sent_counts);
+        cerr << "\t" << "number of sentences in corpus: " << lc << endl;
+        cerr << "\t" << "number of distinct sentences: " << sents.size() << endl;
+        corpus = new MemoryCorpus(sents, sent_counts);
+    }
 
     cerr << "iterating.." << endl;
+    if (path_compressed) {
+        RadixStringSet rs_vocab(vocab);
+        cerr << "\t" << "letter tree nodes: " << rs_vocab.node_count() << endl;
+        vector<flt_type> freqs;
+        for (int i=0; i<num_iterations; i++) {
+            flt_type cost = ug.resegment_sents(*corpus, rs_vocab, freqs);
+            cerr << "likelihood: " << cost << endl;
+            Unigrams::freqs_to_logprobs(freqs);
+            rs_vocab.assign_scores(freqs);
+            for (auto it = all_chars.cbegin(); it != all_chars.cend(); ++it)
+                if (!rs_vocab.includes(*it))
+                    rs_vocab.add(*it, one_char_min_lp);
+
+            if (write_temp_vocabs) {
+                rs_vocab.get_vocab(vocab);
+                ostringstream tempfname;
+                tempfname << vocab_out_fname << ".iter" << i+1;
+                Unigrams::write_vocab(tempfname.str(), vocab);
+            }
+        }
+        rs_vocab.get_vocab(vocab);
+        Unigrams::write_vocab(vocab_out_fname, vocab);
+        delete corpus;
+        exit(EXIT_SUCCESS);
+    }
+
+    UnigramModel model(vocab, utf8_encoding);
     for (int i=0; i<num_iterations; i++) {
-        flt_type cost = ug.resegment_sents(sents, vocab, freqs);
+        flt_type cost = ug.resegment_sents(*corpus, model.vocab, model.counts);
         cerr << "likelihood: " << cost << endl;
-        vocab = freqs;
-        Unigrams::freqs_to_logprobs(vocab);
-        assert_factors(vocab, all_chars, one_char_min_lp);
+        model.update_costs();
+        model.assert_factors(all_chars, one_char_min_lp);
 
         if (write_temp_vocabs) {
+            model.get_vocab(vocab);
             ostringstream tempfname;
             tempfname << vocab_out_fname << ".iter" << i+1;
             Unigrams::write_vocab(tempfname.str(), vocab);
         }
     }
+    model.get_vocab(vocab);
 
     Unigrams::write_vocab(vocab_out_fname, vocab);
 
+    delete corpus;
     exit(EXIT_SUCCESS);
 }
 
@@ -6,11 +6,11 @@
 using namespace std;
 
 
-void floor_values(map<string, flt_type> &vocab,
+void floor_values(vector<flt_type> &vocab,
                   flt_type floor_val)
 {
     for (auto it = vocab.begin(); it != vocab.end(); ++it)
-        if (it->second < floor_val) it->second = floor_val;
+        if (*it < floor_val) *it = floor_val;
 }
 
 
@@ -23,13 +23,17 @@ int main(int argc, char* argv[]) {
       ('h', "help", "", "", "display help")
       ('i', "iterations=INT", "arg", "5", "Number of iterations")
       ('f', "forward-backward", "", "", "Use Forward-backward segmentation instead of Viterbi")
+      ('p', "prefix", "", "", "Continue the segmentation of each word from the prefix shared with the previous word")
+      ('j', "threads=INT", "arg", "1", "Number of threads, DEFAULT: 1")
       ('8', "utf-8", "", "", "Utf-8 character encoding in use");
     config.default_parse(argc, argv);
     if (config.arguments.size() != 3) config.print_help(stderr, 1);
 
     int num_iterations = config["iterations"].get_int();
     bool enable_forward_backward = config["forward-backward"].specified;
+    bool enable_prefix = config["prefix"].specified;
     bool utf8_encoding = config["utf-8"].specified;
+    int num_threads = config["threads"].get_int();
     string wordlist_fname = config.arguments[0];
     string vocab_in_fname = config.arguments[1];
     string vocab_out_fname = config.arguments[2];
@@ -39,13 +43,14 @@ int main(int argc, char* argv[]) {
     cerr << "parameters, initial vocabulary: " << vocab_in_fname << endl;
     cerr << "parameters, final vocabulary: " << vocab_out_fname << endl;
     cerr << "parameters, use forward-backward: " << enable_forward_backward << endl;
+    cerr << "parameters, continue from shared prefix: " << enable_prefix << endl;
     cerr << "parameters, number of iterations: " << num_iterations << endl;
     cerr << "parameters, utf-8 encoding: " << utf8_encoding << endl;
+    cerr << "parameters, threads: " << num_threads << endl;
 
     int maxlen, word_maxlen;
     set<string> all_chars;
     map<string, flt_type> vocab;
-    map<string, flt_type> freqs;
     map<string, flt_type> words;
 
     cerr << "Reading vocabulary " << vocab_in_fname << endl;
@@ -58,7 +63,6 @@ int main(int argc, char* argv[]) {
     cerr << "\t" << "maximum string length: " << maxlen << endl;
     find_short_factors(vocab, all_chars, 2, utf8_encoding);
 
-    set<string> special_words;
     cerr << "Reading word list " << wordlist_fname << endl;
     retval = Unigrams::read_vocab(wordlist_fname, words, word_maxlen, utf8_encoding);
     if (retval < 0) {
@@ -70,24 +74,30 @@ int main(int argc, char* argv[]) {
     cerr << "\t" << "maximum word length: " << word_maxlen << endl;
 
     Unigrams ug;
-    if (enable_forward_backward)
+    if (enable_forward_backward && enable_prefix)
+        ug.set_segmentation_method(forward_backward_incremental);
+    else if (enable_forward_backward)
         ug.set_segmentation_method(forward_backward);
+    else if (enable_prefix)
+        ug.set_segmentation_method(viterbi_incremental);
     else
         ug.set_segmentation_method(viterbi);
     ug.set_utf8(utf8_encoding);
+    ug.set_threads(num_threads);
 
     cerr << "iterating.." << endl;
     time_t rawtime;
     time ( &rawtime );
     cerr << "start time: " << ctime (&rawtime) << endl;
+    UnigramModel model(vocab, utf8_encoding);
     for (int i=0; i<num_iterations; i++) {
-        flt_type cost = ug.resegment_words(words, vocab, freqs, special_words);
+        flt_type cost = ug.resegment_words(words, model.vocab, model.counts);
         cerr << "likelihood: " << cost << endl;
-        vocab = freqs;
-        Unigrams::freqs_to_logprobs(vocab);
-        floor_values(vocab, SMALL_LP);
-        assert_factors(vocab, all_chars, one_char_min_lp);
+        model.update_costs();
+        floor_values(model.vocab.costs, SMALL_LP);
+        model.assert_factors(all_chars, one_char_min_lp);
     }
+    model.get_vocab(vocab);
     time ( &rawtime );
     cerr << "end time: " << ctime (&rawtime) << endl;
 
@@ -17,14 +17,14 @@ void floor_values(map<string, flt_type> &vocab,
 
 
 void prune_msfg(const map<string, flt_type> &vocab,
-                MultiStringFactorGraph &msfg)
+                FrozenMultiStringFactorGraph &msfg)
 {
-    if (vocab.size() < msfg.factor_node_map.size()) {
+    if (vocab.size() < msfg.factor_count()) {
         vector<string> to_remove;
-        cerr << "Pruning " << msfg.factor_node_map.size()-vocab.size() << " unused transitions from msfg." << endl;
-        for (auto it = msfg.factor_node_map.begin(); it != msfg.factor_node_map.end(); ++it)
-            if (vocab.find(it->first) == vocab.end())
-                to_remove.push_back(it->first);
+        cerr << "Pruning " << msfg.factor_count()-vocab.size() << " unused transitions from msfg." << endl;
+        for (unsigned int i=0; i<msfg.factor_strings.size(); i++)
+            if (!msfg.factor_removed[i] && vocab.find(msfg.factor_strings[i]) == vocab.end())
+                to_remove.push_back(msfg.factor_strings[i]);
         for (auto it = to_remove.begin(); it != to_remove.end(); ++it)
             msfg.remove_arcs(*it);
         cerr << "Removed " << to_remove.size() << " subwords" << endl;
@@ -84,9 +84,21 @@ int main(int argc, char* argv[]) {
     cerr << "\t" << "wordlist size: " << words.size() << endl;
     cerr << "\t" << "maximum word length: " << word_maxlen << endl;
 
-    cerr << "Reading msfg " << msfg_fname << endl;
-    MultiStringFactorGraph msfg(start_end_symbol);
-    msfg.read(msfg_fname);
+    FrozenMultiStringFactorGraph msfg(start_end_symbol);
+    if (FrozenMultiStringFactorGraph::is_image(msfg_fname)) {
+        cerr << "Mapping msfg image " << msfg_fname << endl;
+        if (msfg.open_image(msfg_fname) < 0) {
+            cerr << "something went wrong mapping msfg image" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    else {
+        cerr << "Reading msfg " << msfg_fname << endl;
+        MultiStringFactorGraph *read_msfg = new MultiStringFactorGraph(start_end_symbol);
+        read_msfg->read(msfg_fname);
+        msfg.build(*read_msfg);
+        delete read_msfg;
+    }
 
     if (vocab.find(start_end_symbol) == vocab.end()) vocab[start_end_symbol] = log(0.5);
     prune_msfg(vocab, msfg);
@@ -11,19 +11,25 @@ int main(int argc, char* argv[]) {
     config("usage: llh [OPTION...] WORDLIST VOCABULARY\n")
       ('h', "help", "", "", "display help")
       ('f', "forward-backward", "", "", "Use Forward-backward segmentation instead of Viterbi")
+      ('p', "prefix", "", "", "Continue the segmentation of each word from the prefix shared with the previous word")
+      ('j', "threads=INT", "arg", "1", "Number of threads, DEFAULT: 1")
       ('8', "utf-8", "", "", "Utf-8 character encoding in use");
     config.default_parse(argc, argv);
     if (config.arguments.size() != 2) config.print_help(stderr, 1);
 
     bool enable_forward_backward = config["forward-backward"].specified;
+    bool enable_prefix = config["prefix"].specified;
     bool utf8_encoding = config["utf-8"].specified;
+    int num_threads = config["threads"].get_int();
     string wordlist_fname = config.arguments[0];
     string vocab_in_fname = config.arguments[1];
 
     cerr << "parameters, wordlist: " << wordlist_fname << endl;
     cerr << "parameters, vocabulary: " << vocab_in_fname << endl;
     cerr << "parameters, use forward-backward: " << enable_forward_backward << endl;
+    cerr << "parameters, continue from shared prefix: " << enable_prefix << endl;
     cerr << "parameters, utf-8 encoding: " << utf8_encoding << endl;
+    cerr << "parameters, threads: " << num_threads << endl;
 
     int maxlen, word_maxlen;
     map<string, flt_type> vocab;
@@ -49,11 +55,16 @@ int main(int argc, char* argv[]) {
     cerr << "\t" << "maximum word length: " << word_maxlen << endl;
 
     Unigrams ug;
-    if (enable_forward_backward)
+    if (enable_forward_backward && enable_prefix)
+        ug.set_segmentation_method(forward_backward_incremental);
+    else if (enable_forward_backward)
         ug.set_segmentation_method(forward_backward);
+    else if (enable_prefix)
+        ug.set_segmentation_method(viterbi_incremental);
     else
         ug.set_segmentation_method(viterbi);
     ug.set_utf8(utf8_encoding);
+    ug.set_threads(num_threads);
 
     flt_type ll = ug.resegment_words(words, vocab, freqs);
     cerr << "cost: " << ll << endl;
@@ -14,14 +14,15 @@ int main(int argc, char* argv[]) {
     string trans_fname;
     int maxlen;
     map<string, flt_type> vocab;
-    StringSet *ss_vocab = NULL;
+    FrozenStringSet *fs_vocab = NULL;
     transitions_t transitions;
+    TransitionTable *trans_table = NULL;
     bool unigram = true;
 
     conf::Config config;
     config("usage: segposts [OPTION...] INPUT SEGPROBS_OUTPUT\n")
       ('h', "help", "", "", "display help")
-      ('v', "vocabulary=FILE", "arg", "", "Unigram model file")
+      ('v', "vocabulary=FILE", "arg", "", "Unigram model file or a binary image from freeze-vocab")
       ('t', "transitions=FILE", "arg", "", "Bigram model file")
       ('8', "utf-8", "", "", "Utf-8 character encoding in use");
     config.default_parse(argc, argv);
@@ -43,48 +44,67 @@ int main(int argc, char* argv[]) {
 
     if (config["vocabulary"].specified) {
         vocab_fname = config["vocabulary"].get_str();
-        cerr << "Reading vocabulary " << vocab_fname << endl;
-        int retval = Unigrams::read_vocab(vocab_fname, vocab, maxlen, utf8_encoding);
-        if (retval < 0) {
-            cerr << "something went wrong reading vocabulary" << endl;
-            exit(EXIT_FAILURE);
+        if (FrozenStringSet::is_image(vocab_fname)) {
+            cerr << "Mapping vocabulary image " << vocab_fname << endl;
+            fs_vocab = new FrozenStringSet();
+            if (fs_vocab->open_image(vocab_fname) < 0) {
+                cerr << "something went wrong mapping vocabulary image" << endl;
+                exit(EXIT_FAILURE);
+            }
+            cerr << "\t" << "size: " << fs_vocab->string_count() << endl;
+            cerr << "\t" << "maximum string length: " << fs_vocab->max_factor_length << endl;
+        }
+        else {
+            cerr << "Reading vocabulary " << vocab_fname << endl;
+            int retval = Unigrams::read_vocab(vocab_fname, vocab, maxlen, utf8_encoding);
+            if (retval < 0) {
+                cerr << "something went wrong reading vocabulary" << endl;
+                exit(EXIT_FAILURE);
+            }
+            cerr << "\t" << "size: " << vocab.size() << endl;
+            cerr << "\t" << "maximum string length: " << maxlen << endl;
+            fs_vocab = new FrozenStringSet(vocab);
         }
-        cerr << "\t" << "size: " << vocab.size() << endl;
-        cerr << "\t" << "maximum string length: " << maxlen << endl;
-        ss_vocab = new StringSet(vocab);
     }
 
     if (config["transitions"].specified) {
         unigram = false;
-        vocab_fname = config["transitions"].get_str();
+        trans_fname = config["transitions"].get_str();
         cerr << "Reading transitions " << trans_fname << endl;
         int retval = Bigrams::read_transitions(transitions, trans_fname);
         Bigrams::trans_to_vocab(transitions, vocab);
-        ss_vocab = new StringSet(vocab);
+        fs_vocab = new FrozenStringSet(vocab);
         if (retval < 0) {
             cerr << "something went wrong reading transitions" << endl;
             exit(EXIT_FAILURE);
         }
         cerr << "\t" << "vocabulary: " << transitions.size() << endl;
         cerr << "\t" << "transitions: " << retval << endl;
+        trans_table = new TransitionTable(transitions, *fs_vocab);
     }
 
     cerr << "Segmenting corpus" << endl;
     SimpleFileInput infile(in_fname);
     SimpleFileOutput outfile(out_fname);
 
+    FlatFactorGraph fg;
     string line;
     while (infile.getline(line)) {
 
         map<string, flt_type> ug_stats;
         transitions_t bg_stats;
-        vector<flt_type> post_scores;
+        vector<score_type> post_scores;
 
         if (unigram)
-            forward_backward(*ss_vocab, line, ug_stats, post_scores, utf8_encoding);
+            forward_backward(*fs_vocab, line, ug_stats, post_scores, utf8_encoding);
         else {
-            FactorGraph fg(line, start_end_symbol, *ss_vocab);
-            forward_backward(transitions, fg, bg_stats, post_scores);
+            fg.set_text(line, start_end_symbol, *fs_vocab);
+            forward_backward(*trans_table, fg, bg_stats, post_scores);
+        }
+
+        if (post_scores.size() == 0) {
+            cerr << "warning, no segmentation for line: " << line << endl;
+            continue;
         }
 
         outfile << line << "\t";
@@ -94,6 +114,7 @@ int main(int argc, char* argv[]) {
     }
 
     outfile.close();
-    if (ss_vocab != NULL) delete ss_vocab;
+    if (fs_vocab != NULL) delete fs_vocab;
+    if (trans_table != NULL) delete trans_table;
     exit(EXIT_SUCCESS);
 }
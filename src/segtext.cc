@@ -8,22 +8,72 @@
 using namespace std;
 
 
+// Adds the letters of the text missing from the vocabulary outside the letter tree
+static void add_oov_letters(const string &text,
+                            FrozenStringSet &fs_vocab,
+                            flt_type one_char_min_lp,
+                            bool utf8)
+{
+    vector<unsigned int> char_positions;
+    get_character_positions(text, char_positions, utf8);
+    for (unsigned int i=0; i<char_positions.size()-1; i++) {
+        unsigned int start_pos = char_positions[i];
+        unsigned int end_pos = char_positions[i+1];
+        string currchr = text.substr(start_pos, end_pos-start_pos);
+        if (!fs_vocab.includes(currchr))
+            fs_vocab.add_letter(currchr, one_char_min_lp);
+    }
+}
+
+
+// Writes the factors of a line, spaces as tabs
+// num_written is the number of factors of the line written before
+static void write_factors(SimpleFileOutput &outfile,
+                          const vector<string> &factors,
+                          unsigned int num_written=0)
+{
+    for (unsigned int i=0; i<factors.size(); i++) {
+        if (factors[i] == " ")
+            outfile << "\t";
+        else {
+            if (i+num_written > 0) outfile << " ";
+            outfile << factors[i];
+        }
+    }
+}
+
+
+// Length of the text without an incomplete letter at the end
+static unsigned int complete_utf8_length(const string &text)
+{
+    unsigned int pos = 0;
+    while (pos < text.length()) {
+        unsigned int next = Utf8Letters::next(text, pos);
+        if (next > text.length()) break;
+        pos = next;
+    }
+    return pos;
+}
+
+
 int main(int argc, char* argv[]) {
 
     string vocab_fname;
     string trans_fname;
     int maxlen;
     map<string, flt_type> vocab;
-    StringSet *ss_vocab = NULL;
+    FrozenStringSet *fs_vocab = NULL;
     transitions_t transitions;
+    TransitionTable *trans_table = NULL;
     flt_type one_char_min_lp = -50.0;
     bool unigram = true;
 
     conf::Config config;
     config("usage: segtext [OPTION...] INPUT OUTPUT\n")
       ('h', "help", "", "", "display help")
-      ('v', "vocabulary=FILE", "arg", "", "Unigram model file")
+      ('v', "vocabulary=FILE", "arg", "", "Unigram model file or a binary image from freeze-vocab")
       ('t', "transitions=FILE", "arg", "", "Bigram model file")
+      ('w', "window=INT", "arg", "0", "Segment the lines in windows of INT bytes with the unigram model, the memory use does not grow with the line length, DEFAULT: 0 (whole lines)")
       ('8', "utf-8", "", "", "Utf-8 character encoding in use");
     config.default_parse(argc, argv);
     if (config.arguments.size() != 2) config.print_help(stderr, 1);
@@ -31,6 +81,7 @@ int main(int argc, char* argv[]) {
     bool utf8_encoding = config["utf-8"].specified;
     string in_fname = config.arguments[0];
     string out_fname = config.arguments[1];
+    unsigned int window = config["window"].get_int();
 
     if (!config["vocabulary"].specified && !config["transitions"].specified) {
         cerr << "Please define vocabulary or transitions" << endl;
@@ -42,17 +93,34 @@ int main(int argc, char* argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    if (window > 0 && config["transitions"].specified) {
+        cerr << "Windows are supported only with the unigram model" << endl;
+        exit(EXIT_FAILURE);
+    }
+
     if (config["vocabulary"].specified) {
         vocab_fname = config["vocabulary"].get_str();
-        cerr << "Reading vocabulary " << vocab_fname << endl;
-        int retval = Unigrams::read_vocab(vocab_fname, vocab, maxlen, utf8_encoding);
-        if (retval < 0) {
-            cerr << "something went wrong reading vocabulary" << endl;
-            exit(EXIT_FAILURE);
+        if (FrozenStringSet::is_image(vocab_fname)) {
+            cerr << "Mapping vocabulary image " << vocab_fname << endl;
+            fs_vocab = new FrozenStringSet();
+            if (fs_vocab->open_image(vocab_fname) < 0) {
+                cerr << "something went wrong mapping vocabulary image" << endl;
+                exit(EXIT_FAILURE);
+            }
+            cerr << "\t" << "size: " << fs_vocab->string_count() << endl;
+            cerr << "\t" << "maximum string length: " << fs_vocab->max_factor_length << endl;
+        }
+        else {
+            cerr << "Reading vocabulary " << vocab_fname << endl;
+            int retval = Unigrams::read_vocab(vocab_fname, vocab, maxlen, utf8_encoding);
+            if (retval < 0) {
+                cerr << "something went wrong reading vocabulary" << endl;
+                exit(EXIT_FAILURE);
+            }
+            cerr << "\t" << "size: " << vocab.size() << endl;
+            cerr << "\t" << "maximum string length: " << maxlen << endl;
+            fs_vocab = new FrozenStringSet(vocab);
         }
-        cerr << "\t" << "size: " << vocab.size() << endl;
-        cerr << "\t" << "maximum string length: " << maxlen << endl;
-        ss_vocab = new StringSet(vocab);
     }
 
     if (config["transitions"].specified) {
@@ -61,38 +129,75 @@ int main(int argc, char* argv[]) {
         cerr << "Reading transitions " << trans_fname << endl;
         int retval = Bigrams::read_transitions(transitions, trans_fname);
         Bigrams::trans_to_vocab(transitions, vocab);
-        ss_vocab = new StringSet(vocab);
+        fs_vocab = new FrozenStringSet(vocab);
         if (retval < 0) {
             cerr << "something went wrong reading transitions" << endl;
             exit(EXIT_FAILURE);
         }
         cerr << "\t" << "vocabulary size: " << transitions.size() << endl;
         cerr << "\t" << "transitions: " << retval << endl;
+        trans_table = new TransitionTable(transitions, *fs_vocab);
     }
 
     cerr << "Segmenting corpus" << endl;
     SimpleFileInput infile(in_fname);
     SimpleFileOutput outfile(out_fname);
 
-    string line;
-    while (infile.getline(line)) {
-
-        vector<unsigned int> char_positions;
-        get_character_positions(line, char_positions, utf8_encoding);
-        for (unsigned int i=0; i<char_positions.size()-1; i++) {
-            unsigned int start_pos = char_positions[i];
-            unsigned int end_pos = char_positions[i+1];
-            string currchr = line.substr(start_pos, end_pos-start_pos);
-            if (!ss_vocab->includes(currchr))
-                ss_vocab->add(currchr, one_char_min_lp);
+    if (window > 0) {
+        StreamingViterbi vit(utf8_encoding);
+        string part, text, carry;
+        vector<string> factors;
+        unsigned int num_written = 0;
+        bool line_end = false;
+        bool in_line = false;
+        while (infile.getline(part, window, line_end) || in_line) {
+
+            // The input ended in a line without a newline
+            if (!line_end && part.length() == 0) line_end = true;
+
+            // A letter split between the windows is carried to the next one
+            text.assign(carry);
+            text.append(part);
+            carry.clear();
+            if (utf8_encoding && !line_end) {
+                unsigned int len = complete_utf8_length(text);
+                carry.assign(text, len, string::npos);
+                text.resize(len);
+            }
+
+            add_oov_letters(text, *fs_vocab, one_char_min_lp, utf8_encoding);
+            factors.clear();
+            vit.add(*fs_vocab, text, factors);
+            write_factors(outfile, factors, num_written);
+            num_written += factors.size();
+            in_line = true;
+            if (!line_end) continue;
+
+            factors.clear();
+            flt_type lp = vit.finish(*fs_vocab, factors);
+            if (lp == MIN_FLOAT && num_written == 0)
+                cerr << "warning, no segmentation for line: " << text << endl;
+            else {
+                write_factors(outfile, factors, num_written);
+                outfile << "\n";
+            }
+            num_written = 0;
+            in_line = false;
         }
+    }
+
+    FlatFactorGraph fg;
+    string line;
+    while (window == 0 && infile.getline(line)) {
+
+        add_oov_letters(line, *fs_vocab, one_char_min_lp, utf8_encoding);
 
         vector<string> best_path;
         if (unigram)
-            viterbi(*ss_vocab, line, best_path, true, utf8_encoding);
+            viterbi(*fs_vocab, line, best_path, true, utf8_encoding);
         else {
-            FactorGraph fg(line, start_end_symbol, *ss_vocab);
-            viterbi(transitions, fg, best_path);
+            fg.set_text(line, start_end_symbol, *fs_vocab);
+            viterbi(*trans_table, fg, best_path);
             best_path.erase(best_path.begin());
             best_path.erase(best_path.end());
         }
@@ -102,18 +207,12 @@ int main(int argc, char* argv[]) {
             continue;
         }
 
-        for (unsigned int i=0; i<best_path.size(); i++) {
-            if (best_path[i] == " ")
-                outfile << "\t";
-            else {
-                if (i>0) outfile << " ";
-                outfile << best_path[i];
-            }
-        }
+        write_factors(outfile, best_path);
         outfile << "\n";
     }
 
     outfile.close();
-    if (ss_vocab != NULL) delete ss_vocab;
+    if (fs_vocab != NULL) delete fs_vocab;
+    if (trans_table != NULL) delete trans_table;
     exit(EXIT_SUCCESS);
 }
@@ -2,6 +2,8 @@
 
 #include "Bigrams.hh"
 #include "EM.hh"
+#include "Unigrams.hh"
+#include "io.hh"
 
 
 using namespace std;
@@ -31,6 +33,46 @@ viterbiChecks(const map<string, flt_type> &vocab,
     BOOST_CHECK_EQUAL( correct_lp, result_lp );
     for (unsigned int i=0; i<correct_path.size(); i++)
         BOOST_CHECK_EQUAL( correct_path[i], result_path[i] );
+
+    vector<int> result_ids;
+    result_lp = viterbi(ssvocab, sentence, result_ids, true, utf8);
+    BOOST_CHECK_EQUAL( correct_path.size(), result_ids.size() );
+    BOOST_CHECK_EQUAL( correct_lp, result_lp );
+    for (unsigned int i=0; i<correct_path.size(); i++)
+        BOOST_CHECK_EQUAL( correct_path[i], ssvocab.factor_strings[result_ids[i]] );
+
+    result_path.clear();
+    FrozenStringSet fsvocab(vocab);
+    result_lp = viterbi(fsvocab, sentence, result_path, true, utf8);
+    BOOST_CHECK_EQUAL( correct_path.size(), result_path.size() );
+    BOOST_CHECK_EQUAL( correct_lp, result_lp );
+    for (unsigned int i=0; i<correct_path.size(); i++)
+        BOOST_CHECK_EQUAL( correct_path[i], result_path[i] );
+
+    // Streamed in parts of one and two letters
+    vector<unsigned int> char_positions;
+    get_character_positions(sentence, char_positions, utf8);
+    StreamingViterbi svit(utf8);
+    for (unsigned int part_len=1; part_len<=2; part_len++) {
+        result_path.clear();
+        for (unsigned int i=0; i<char_positions.size()-1; i+=part_len) {
+            unsigned int end = char_positions[min(i+part_len, (unsigned int)char_positions.size()-1)];
+            svit.add(fsvocab, sentence.substr(char_positions[i], end-char_positions[i]), result_path);
+        }
+        result_lp = svit.finish(fsvocab, result_path);
+        BOOST_CHECK_EQUAL( correct_path.size(), result_path.size() );
+        BOOST_CHECK_EQUAL( correct_lp, result_lp );
+        for (unsigned int i=0; i<correct_path.size(); i++)
+            BOOST_CHECK_EQUAL( correct_path[i], result_path[i] );
+    }
+
+    result_path.clear();
+    RadixStringSet rsvocab(vocab);
+    result_lp = viterbi(rsvocab, sentence, result_path, true, utf8);
+    BOOST_CHECK_EQUAL( correct_path.size(), result_path.size() );
+    BOOST_CHECK_EQUAL( correct_lp, result_lp );
+    for (unsigned int i=0; i<correct_path.size(); i++)
+        BOOST_CHECK_EQUAL( correct_path[i], result_path[i] );
 }
 
 
@@ -185,6 +227,90 @@ BOOST_AUTO_TEST_CASE(viterbiTest8)
 }
 
 
+// Long text streamed in windows of different lengths
+BOOST_AUTO_TEST_CASE(StreamingViterbiTest1)
+{
+    map<string, flt_type> vocab;
+    vocab["k"] = -4.0; vocab["i"] = -4.0; vocab["s"] = -3.0;
+    vocab["a"] = -3.0; vocab[" "] = -1.0;
+    vocab["kis"] = -6.0; vocab["sa"] = -4.0; vocab["kissa"] = -7.0;
+    vocab["ssa"] = -5.0; vocab["kissa kissa"] = -12.0;
+    FrozenStringSet fsvocab(vocab);
+
+    string text;
+    for (int i=0; i<200; i++) text += (i % 3 == 0) ? "kissa " : "kisa kis ";
+    vector<string> correct_path;
+    flt_type correct_lp = viterbi(fsvocab, text, correct_path, true);
+
+    StreamingViterbi svit;
+    for (unsigned int window=1; window<=20; window+=3) {
+        vector<string> result_path;
+        for (unsigned int i=0; i<text.length(); i+=window)
+            svit.add(fsvocab, text.substr(i, window), result_path);
+        flt_type result_lp = svit.finish(fsvocab, result_path);
+        BOOST_CHECK_EQUAL( correct_lp, result_lp );
+        BOOST_CHECK( correct_path == result_path );
+    }
+
+    // No segmentation for an unknown letter
+    vector<string> result_path;
+    svit.add(fsvocab, "kissax", result_path);
+    BOOST_CHECK_EQUAL( MIN_FLOAT, svit.finish(fsvocab, result_path) );
+    result_path.clear();
+    BOOST_CHECK_EQUAL( MIN_FLOAT, svit.finish(fsvocab, result_path) );
+    BOOST_CHECK_EQUAL( 0, (int)result_path.size() );
+}
+
+
+// Batched sums of log domain values
+BOOST_AUTO_TEST_CASE(LogSumTest1)
+{
+    for (flt_type x = -700.0; x <= 0.0; x += 0.37)
+        BOOST_CHECK_CLOSE( exp(x), fast_exp(x), 1e-13 );
+    BOOST_CHECK_EQUAL( (flt_type)1.0, fast_exp(0.0) );
+
+    // Relative error below 1e-15 over the whole range
+    flt_type max_error = 0.0;
+    for (flt_type x = -700.0; x <= 0.0; x += 0.001)
+        max_error = max(max_error, fabs(fast_exp(x) - exp(x)) / exp(x));
+    BOOST_CHECK( max_error < 1e-15 );
+
+    vector<flt_type> values = { log(0.1), log(0.2), SMALL_LP, log(0.05), log(0.15), log(0.3), log(0.1) };
+    flt_type pairwise = values[0];
+    for (unsigned int i=1; i<values.size(); i++)
+        pairwise = add_log_domain_probs(pairwise, values[i]);
+    BOOST_CHECK_CLOSE( log(0.9), sum_log_domain_probs(&values[0], values.size()), DBL_ACCURACY );
+    BOOST_CHECK_CLOSE( pairwise, sum_log_domain_probs(&values[0], values.size()), 1e-12 );
+    BOOST_CHECK_EQUAL( values[0], sum_log_domain_probs(&values[0], 1) );
+#ifndef FAST_LOG_SUM
+    BOOST_CHECK_EQUAL( pairwise, sum_log_domain_probs(&values[0], values.size()) );
+#endif
+    BOOST_CHECK_CLOSE( pairwise, fast_sum_log_domain_probs(&values[0], values.size()), 1e-12 );
+}
+
+
+// Fast sums against the sums added one at a time
+BOOST_AUTO_TEST_CASE(LogSumTest2)
+{
+    srand(5);
+    for (int i=0; i<200; i++) {
+        vector<flt_type> values(1 + rand() % 40);
+        for (unsigned int j=0; j<values.size(); j++)
+            values[j] = -(flt_type)(rand() % 100000) / 100.0;
+        flt_type exact = values[0];
+        for (unsigned int j=1; j<values.size(); j++)
+            exact = add_log_domain_probs(exact, values[j]);
+        BOOST_CHECK_CLOSE( exact, fast_sum_log_domain_probs(&values[0], values.size()), 1e-12 );
+
+        vector<float> float_values(values.begin(), values.end());
+        flt_type float_exact = float_values[0];
+        for (unsigned int j=1; j<float_values.size(); j++)
+            float_exact = add_log_domain_probs(float_exact, float_values[j]);
+        BOOST_CHECK_CLOSE( float_exact, fast_sum_log_domain_probs(&float_values[0], float_values.size()), 1e-12 );
+    }
+}
+
+
 // Empty string
 BOOST_AUTO_TEST_CASE(ForwardBackwardTest1)
 {
@@ -357,6 +483,537 @@ BOOST_AUTO_TEST_CASE(ForwardBackwardTest9)
 }
 
 
+// Read-only vocabulary gives the same results
+BOOST_AUTO_TEST_CASE(ForwardBackwardTest10)
+{
+    map<string, flt_type> vocab;
+    vocab["a"] = log(0.25);
+    vocab["sa"] = log(0.25);
+    vocab["s"] = log(0.25);
+    vocab["ki"] = log(0.50);
+    vocab["kis"] = log(0.50);
+    vocab["kissa"] = log(0.1953125);
+    vocab["k"] = log(0.00000001);
+    string sentence("kissa");
+    StringSet ssvocab(vocab);
+    FrozenStringSet fsvocab(vocab);
+    map<string, flt_type> stats;
+    map<string, flt_type> fsstats;
+    vector<score_type> post_scores;
+    vector<score_type> fspost_scores;
+    flt_type lp = forward_backward(ssvocab, sentence, stats, post_scores);
+    flt_type fslp = forward_backward(fsvocab, sentence, fsstats, fspost_scores);
+    BOOST_CHECK_EQUAL( lp, fslp );
+    BOOST_CHECK( stats == fsstats );
+    BOOST_CHECK( post_scores == fspost_scores );
+
+    factor_stats_t idstats;
+    flt_type idlp = forward_backward(ssvocab, sentence, idstats);
+    BOOST_CHECK_EQUAL( lp, idlp );
+    BOOST_CHECK_EQUAL( stats.size(), idstats.size() );
+    for (unsigned int i=0; i<idstats.size(); i++) {
+        if (i>0) BOOST_CHECK( idstats[i-1].first < idstats[i].first );
+        BOOST_CHECK_EQUAL( stats[ssvocab.factor_strings[idstats[i].first]], idstats[i].second );
+    }
+
+    sentence.assign("kissax");
+    fslp = forward_backward(fsvocab, sentence, fsstats);
+    BOOST_CHECK_EQUAL( MIN_FLOAT, fslp );
+    BOOST_CHECK_EQUAL( 0, (int)fsstats.size() );
+}
+
+
+// Path-compressed vocabulary gives the same results for phrase factors
+BOOST_AUTO_TEST_CASE(ForwardBackwardTest11)
+{
+    map<string, flt_type> vocab;
+    vocab["_"] = log(0.1);
+    vocab["t"] = log(0.05);
+    vocab["h"] = log(0.05);
+    vocab["e"] = log(0.05);
+    vocab["f"] = log(0.05);
+    vocab["i"] = log(0.05);
+    vocab["r"] = log(0.05);
+    vocab["s"] = log(0.05);
+    vocab["_the"] = log(0.2);
+    vocab["_the_first"] = log(0.1);
+    vocab["_the_fir"] = log(0.05);
+    vocab["_first"] = log(0.1);
+    vocab["_fi"] = log(0.05);
+    vocab["st"] = log(0.05);
+    string sentence("_the_first_first_the");
+    StringSet ssvocab(vocab);
+    RadixStringSet rsvocab(vocab);
+    BOOST_CHECK( rsvocab.node_count() < 20 );
+
+    factor_stats_t stats;
+    factor_stats_t rsstats;
+    flt_type lp = forward_backward(ssvocab, sentence, stats);
+    flt_type rslp = forward_backward(rsvocab, sentence, rsstats);
+    BOOST_CHECK_EQUAL( lp, rslp );
+    BOOST_CHECK( stats == rsstats );
+
+    lp = viterbi(ssvocab, sentence, stats);
+    rslp = viterbi(rsvocab, sentence, rsstats);
+    BOOST_CHECK_EQUAL( lp, rslp );
+    BOOST_CHECK( stats == rsstats );
+
+    // Disabled factors are skipped
+    ssvocab.remove("_the_first");
+    rsvocab.disable(rsvocab.factor_index("_the_first"));
+    lp = forward_backward(ssvocab, sentence, stats);
+    rslp = forward_backward(rsvocab, sentence, rsstats);
+    BOOST_CHECK_EQUAL( lp, rslp );
+    BOOST_CHECK( stats == rsstats );
+
+    sentence.assign("_the_x");
+    rslp = forward_backward(rsvocab, sentence, rsstats);
+    BOOST_CHECK_EQUAL( MIN_FLOAT, rslp );
+    BOOST_CHECK_EQUAL( 0, (int)rsstats.size() );
+}
+
+
+// Code point letters give the same segmentations as bytes
+BOOST_AUTO_TEST_CASE(ForwardBackwardTest12)
+{
+    map<string, flt_type> vocab;
+    vocab["k"] = log(0.1);
+    vocab["\xc3\xa4"] = log(0.1);
+    vocab["y"] = log(0.1);
+    vocab["t"] = log(0.1);
+    vocab["\xc3\xb6"] = log(0.1);
+    vocab["k\xc3\xa4y"] = log(0.2);
+    vocab["t\xc3\xb6"] = log(0.1);
+    vocab["\xc3\xb6t"] = log(0.1);
+    vocab["\xe2\x82\xac"] = log(0.1);
+    string sentence("k\xc3\xa4yt\xc3\xb6t\xe2\x82\xac");
+    StringSet ssvocab(vocab);
+    StringSet cpvocab(vocab, true);
+
+    factor_stats_t stats;
+    factor_stats_t cpstats;
+    flt_type lp = forward_backward(ssvocab, sentence, stats, true);
+    flt_type cplp = forward_backward(cpvocab, sentence, cpstats, true);
+    BOOST_CHECK_EQUAL( lp, cplp );
+    BOOST_CHECK( stats == cpstats );
+
+    vector<string> best_path;
+    vector<string> cpbest_path;
+    lp = viterbi(ssvocab, sentence, best_path, true, true);
+    cplp = viterbi(cpvocab, sentence, cpbest_path, true, true);
+    BOOST_CHECK_EQUAL( lp, cplp );
+    BOOST_CHECK( best_path == cpbest_path );
+    BOOST_CHECK_EQUAL( 4, (int)cpbest_path.size() );
+
+    // Truncated character at the end
+    sentence.assign("k\xc3\xa4y\xc3");
+    cplp = forward_backward(cpvocab, sentence, cpstats, true);
+    BOOST_CHECK_EQUAL( MIN_FLOAT, cplp );
+    BOOST_CHECK_EQUAL( 0, (int)cpstats.size() );
+}
+
+
+// A mask gives the same results as removing from the set
+BOOST_AUTO_TEST_CASE(ForwardBackwardTest13)
+{
+    map<string, flt_type> vocab;
+    vocab["k"] = log(0.1);
+    vocab["i"] = log(0.1);
+    vocab["s"] = log(0.1);
+    vocab["a"] = log(0.1);
+    vocab["ki"] = log(0.2);
+    vocab["kis"] = log(0.2);
+    vocab["sa"] = log(0.2);
+    vocab["kissa"] = log(0.3);
+    string sentence("kissakissa");
+    StringSet ssvocab(vocab);
+    FactorMask mask(ssvocab.factor_count());
+    mask.disable(ssvocab.factor_index("kissa"));
+    mask.disable(ssvocab.factor_index("sa"));
+
+    factor_stats_t stats;
+    factor_stats_t maskstats;
+    flt_type masklp = forward_backward(ssvocab, sentence, maskstats, mask);
+    BOOST_CHECK( ssvocab.includes("kissa") );
+    ssvocab.remove("kissa");
+    ssvocab.remove("sa");
+    flt_type lp = forward_backward(ssvocab, sentence, stats);
+    BOOST_CHECK_EQUAL( lp, masklp );
+    BOOST_CHECK( stats == maskstats );
+
+    masklp = viterbi(ssvocab, sentence, maskstats, mask);
+    lp = viterbi(ssvocab, sentence, stats);
+    BOOST_CHECK_EQUAL( lp, masklp );
+    BOOST_CHECK( stats == maskstats );
+
+    mask.disable(ssvocab.factor_index("a"));
+    masklp = forward_backward(ssvocab, sentence, maskstats, mask);
+    BOOST_CHECK_EQUAL( MIN_FLOAT, masklp );
+}
+
+
+// A workspace reused for texts of different lengths gives the same results
+BOOST_AUTO_TEST_CASE(ForwardBackwardTest14)
+{
+    map<string, flt_type> vocab;
+    vocab["k"] = log(0.1);
+    vocab["i"] = log(0.1);
+    vocab["s"] = log(0.1);
+    vocab["a"] = log(0.1);
+    vocab["ki"] = log(0.2);
+    vocab["kis"] = log(0.2);
+    vocab["sa"] = log(0.2);
+    vocab["kissa"] = log(0.3);
+    StringSet ssvocab(vocab);
+    FactorMask all_enabled;
+    SegmentationWorkspace ws;
+
+    vector<string> sentences = { "kissakissakissa", "kissa", "xkissa", "sakis", "kissakissa" };
+    for (auto it = sentences.cbegin(); it != sentences.cend(); ++it) {
+        factor_stats_t stats;
+        factor_stats_t wsstats;
+        flt_type lp = forward_backward(ssvocab, *it, stats);
+        flt_type wslp = forward_backward(ssvocab, *it, wsstats, all_enabled, ws);
+        BOOST_CHECK_EQUAL( lp, wslp );
+        BOOST_CHECK( stats == wsstats );
+
+        lp = viterbi(ssvocab, *it, stats);
+        wslp = viterbi(ssvocab, *it, wsstats, all_enabled, ws);
+        BOOST_CHECK_EQUAL( lp, wslp );
+        BOOST_CHECK( stats == wsstats );
+    }
+}
+
+
+// Removals scored from the lattice match segmenting again without the factor
+BOOST_AUTO_TEST_CASE(ForwardBackwardTest15)
+{
+    map<string, flt_type> vocab;
+    vocab["k"] = log(0.1);
+    vocab["i"] = log(0.1);
+    vocab["s"] = log(0.1);
+    vocab["a"] = log(0.1);
+    vocab["ki"] = log(0.2);
+    vocab["kis"] = log(0.2);
+    vocab["sa"] = log(0.2);
+    vocab["ssa"] = log(0.1);
+    vocab["kissa"] = log(0.3);
+    vocab["kissakala"] = log(0.01);
+    StringSet ssvocab(vocab);
+    vector<bool> candidates(ssvocab.factor_count(), true);
+    candidates[ssvocab.factor_index("k")] = false;
+    FactorMask mask(ssvocab.factor_count());
+    SegmentationWorkspace ws;
+
+    vector<string> sentences = { "kissa", "kissakissa", "kissaki", "sakissa", "kissakala" };
+    for (auto it = sentences.cbegin(); it != sentences.cend(); ++it) {
+        for (int fb=0; fb<2; fb++) {
+            factor_stats_t stats, hypo_stats;
+            vector<FactorRemoval> removals;
+            flt_type lp = fb ? forward_backward(ssvocab, *it, stats, candidates, removals, mask, ws)
+                             : viterbi(ssvocab, *it, stats, candidates, removals, mask, ws);
+            factor_stats_t orig_stats;
+            flt_type orig_lp = fb ? forward_backward(ssvocab, *it, orig_stats) : viterbi(ssvocab, *it, orig_stats);
+            BOOST_CHECK_EQUAL( orig_lp, lp );
+            BOOST_CHECK( orig_stats == stats );
+
+            unsigned int r = 0;
+            for (auto stat = stats.cbegin(); stat != stats.cend(); ++stat) {
+                if (!candidates[stat->first]) continue;
+                BOOST_REQUIRE( r < removals.size() );
+                BOOST_CHECK_EQUAL( stat->first, removals[r].factor );
+                FactorMask removal_mask(ssvocab.factor_count());
+                removal_mask.disable(stat->first);
+                flt_type hypo_lp = fb ? forward_backward(ssvocab, *it, hypo_stats, removal_mask)
+                                      : viterbi(ssvocab, *it, hypo_stats, removal_mask);
+                BOOST_CHECK_EQUAL( hypo_stats.size(), removals[r].num_tokens );
+                if (hypo_stats.size() > 0)
+                    BOOST_CHECK_CLOSE( hypo_lp, removals[r].ll, DBL_ACCURACY );
+                r++;
+            }
+            BOOST_CHECK_EQUAL( r, removals.size() );
+        }
+    }
+}
+
+
+// Segmentation continuing from the shared prefix gives the same results
+BOOST_AUTO_TEST_CASE(ForwardBackwardTest16)
+{
+    map<string, flt_type> vocab;
+    vocab["k"] = log(0.1);
+    vocab["i"] = log(0.1);
+    vocab["s"] = log(0.1);
+    vocab["a"] = log(0.1);
+    vocab["\xc3\xa4"] = log(0.1);
+    vocab["ki"] = log(0.2);
+    vocab["kis"] = log(0.2);
+    vocab["sa"] = log(0.2);
+    vocab["ss\xc3\xa4"] = log(0.2);
+    vocab["kissa"] = log(0.3);
+    FactorMask all_enabled;
+
+    // Sorted words, a letter split by the prefix and invalid UTF-8 sequences
+    vector<string> sentences = { "kis", "kissa", "kissakissa", "kiss\xc3\xa4", "kiss\xc3\xa4" "a",
+                                 "kiss\xc3", "kiss\xc3ka", "kiss\xc3\xa4", "sa", "sakis", "" };
+    for (int utf8=0; utf8<2; utf8++) {
+        StringSet ssvocab(vocab, utf8);
+        SegmentationWorkspace ws;
+        for (unsigned int i=0; i<sentences.size(); i++) {
+            factor_stats_t stats;
+            factor_stats_t incstats;
+            flt_type lp = viterbi(ssvocab, sentences[i], stats, all_enabled, ws);
+            flt_type inclp = viterbi_incremental(ssvocab, sentences[i], incstats, all_enabled, ws);
+            BOOST_CHECK_EQUAL( lp, inclp );
+            BOOST_CHECK( stats == incstats );
+        }
+
+        SegmentationWorkspace vitws, fbws;
+        for (unsigned int i=0; i<sentences.size(); i++) {
+            factor_stats_t stats;
+            factor_stats_t incstats;
+            flt_type lp = viterbi(ssvocab, sentences[i], stats, all_enabled);
+            flt_type inclp = viterbi_incremental(ssvocab, sentences[i], incstats, all_enabled, vitws);
+            BOOST_CHECK_EQUAL( lp, inclp );
+            BOOST_CHECK( stats == incstats );
+
+            lp = forward_backward(ssvocab, sentences[i], stats, all_enabled);
+            inclp = forward_backward_incremental(ssvocab, sentences[i], incstats, all_enabled, fbws);
+            BOOST_CHECK_EQUAL( lp, inclp );
+            BOOST_CHECK( stats == incstats );
+        }
+    }
+}
+
+// Kernels of the read-only and path-compressed sets in the UTF-8 mode
+BOOST_AUTO_TEST_CASE(ForwardBackwardTest17)
+{
+    map<string, flt_type> vocab;
+    vocab["k"] = log(0.1);
+    vocab["\xc3\xa4"] = log(0.1);
+    vocab["\xe2\x82\xac"] = log(0.1);
+    vocab["k\xc3\xa4"] = log(0.2);
+    vocab["\xc3\xa4k"] = log(0.2);
+    vocab["k\xe2\x82\xac"] = log(0.05);
+    StringSet ssvocab(vocab, true);
+    RadixStringSet rsvocab(vocab);
+
+    vector<string> sentences = { "k\xc3\xa4k\xc3\xa4", "\xc3\xa4k\xe2\x82\xac", "k\xc3\xa4\xe2" };
+    for (auto it = sentences.cbegin(); it != sentences.cend(); ++it) {
+        factor_stats_t stats;
+        factor_stats_t rsstats;
+        flt_type lp = forward_backward(ssvocab, *it, stats, true);
+        flt_type rslp = forward_backward(rsvocab, *it, rsstats, true);
+        BOOST_CHECK_EQUAL( lp, rslp );
+        BOOST_CHECK( stats == rsstats );
+
+        lp = viterbi(ssvocab, *it, stats, true);
+        rslp = viterbi(rsvocab, *it, rsstats, true);
+        BOOST_CHECK_EQUAL( lp, rslp );
+        BOOST_CHECK( stats == rsstats );
+
+        map<string, flt_type> mapstats;
+        map<string, flt_type> fsstats;
+        FrozenStringSet fsvocab(vocab);
+        lp = forward_backward(vocab, *it, mapstats, true);
+        flt_type fslp = forward_backward(fsvocab, *it, fsstats, true);
+        BOOST_CHECK_EQUAL( lp, fslp );
+        BOOST_CHECK( mapstats == fsstats );
+    }
+}
+
+// Model updated in place gives the same results as the vocabulary maps
+BOOST_AUTO_TEST_CASE(UnigramModelTest1)
+{
+    map<string, flt_type> vocab;
+    vocab["a"] = log(0.25);
+    vocab["sa"] = log(0.25);
+    vocab["s"] = log(0.25);
+    vocab["ki"] = log(0.50);
+    vocab["kis"] = log(0.50);
+    vocab["kissa"] = log(0.1953125);
+    vocab["k"] = log(0.1);
+    vocab["i"] = log(0.1);
+    map<string, flt_type> words;
+    words["kissa"] = 3.0;
+    words["kiss"] = 2.0;
+    words["sika"] = 1.0;
+
+    Unigrams ug;
+    ug.set_segmentation_method(forward_backward);
+    UnigramModel model(vocab);
+    map<string, flt_type> result;
+    flt_type ll = ug.iterate(words, vocab, 2);
+    flt_type model_ll = ug.iterate(words, model, 2);
+    model.get_vocab(result);
+    BOOST_CHECK_EQUAL( ll, model_ll );
+    BOOST_CHECK( vocab == result );
+    BOOST_CHECK_EQUAL( vocab.size(), model.size() );
+
+    map<string, flt_type> freqs;
+    ll = ug.resegment_words(words, vocab, freqs);
+    model_ll = ug.resegment_words(words, model.vocab, model.counts);
+    model.get_counts(result);
+    BOOST_CHECK_EQUAL( ll, model_ll );
+    BOOST_CHECK( freqs == result );
+
+    model.remove(model.vocab.factor_index("kis"));
+    vocab.erase("kis");
+    BOOST_CHECK( !model.vocab.includes("kis") );
+    BOOST_CHECK_EQUAL( vocab.size(), model.size() );
+    BOOST_CHECK_EQUAL( vocab.size(), model.counted_size() );
+    ll = ug.iterate(words, vocab, 1);
+    model_ll = ug.iterate(words, model, 1);
+    model.get_vocab(result);
+    BOOST_CHECK_EQUAL( ll, model_ll );
+    BOOST_CHECK( vocab == result );
+
+    // Compacting drops the removed factor and keeps the counts
+    model.compact();
+    BOOST_CHECK_EQUAL( model.size(), model.vocab.factor_count() );
+    BOOST_CHECK_EQUAL( vocab.size(), model.counted_size() );
+    ll = ug.iterate(words, vocab, 1);
+    model_ll = ug.iterate(words, model, 1);
+    model.get_vocab(result);
+    BOOST_CHECK_EQUAL( ll, model_ll );
+    BOOST_CHECK( vocab == result );
+
+    // Threads do not change the results
+    vector<flt_type> thread_counts;
+    model_ll = ug.resegment_words(words, model.vocab, model.counts);
+    ug.set_threads(3);
+    flt_type thread_ll = ug.resegment_words(words, model.vocab, thread_counts);
+    BOOST_CHECK_EQUAL( model_ll, thread_ll );
+    BOOST_CHECK( model.counts == thread_counts );
+
+    set<string> candidates;
+    for (auto it = vocab.cbegin(); it != vocab.cend(); ++it)
+        if (it->first.length() > 1) candidates.insert(it->first);
+    vector<pair<string, flt_type> > removal_scores, thread_removal_scores;
+    ug.set_threads(1);
+    model_ll = ug.rank_candidates(words, model, candidates, removal_scores);
+    ug.set_threads(3);
+    thread_ll = ug.rank_candidates(words, model, candidates, thread_removal_scores);
+    BOOST_CHECK_EQUAL( model_ll, thread_ll );
+    BOOST_CHECK( removal_scores.size() > 0 );
+    BOOST_CHECK( removal_scores == thread_removal_scores );
+}
+
+
+// Corpus streamed from a file in small chunks gives the same results as the sentences in memory
+BOOST_AUTO_TEST_CASE(UnigramModelTest2)
+{
+    map<string, flt_type> vocab;
+    vocab["a"] = log(0.25);
+    vocab["sa"] = log(0.25);
+    vocab["s"] = log(0.25);
+    vocab["ki"] = log(0.50);
+    vocab["kis"] = log(0.50);
+    vocab["kissa"] = log(0.1953125);
+    vocab["k"] = log(0.1);
+    vocab["i"] = log(0.1);
+    vector<string> sents = { "kissa", "kiss", "sika", "kissakissa", "isa", "sikakissa", "kisa" };
+    vector<string> fnames = { "corpus_test.txt", "corpus_test.txt.gz" };
+
+    for (auto fname = fnames.cbegin(); fname != fnames.cend(); ++fname) {
+        SimpleFileOutput corpusf(*fname);
+        for (auto it = sents.cbegin(); it != sents.cend(); ++it)
+            corpusf << *it << "\n";
+        corpusf.close();
+
+        // Two passes over the chunks of about two sentences
+        StreamingCorpus corpus(*fname, 2*sizeof(string)+8);
+        for (int pass=0; pass<2; pass++) {
+            vector<string> read_sents;
+            vector<const string*> batch;
+            vector<flt_type> counts;
+            corpus.rewind();
+            while (corpus.next_batch(batch, counts, 3)) {
+                BOOST_CHECK( batch.size() > 0 );
+                BOOST_CHECK_EQUAL( batch.size(), counts.size() );
+                for (auto it = batch.cbegin(); it != batch.cend(); ++it)
+                    read_sents.push_back(**it);
+                for (auto it = counts.cbegin(); it != counts.cend(); ++it)
+                    BOOST_CHECK_EQUAL( 1.0, *it );
+            }
+            BOOST_CHECK( sents == read_sents );
+        }
+
+        Unigrams ug;
+        ug.set_segmentation_method(forward_backward);
+        UnigramModel model(vocab);
+        UnigramModel stream_model(vocab);
+        flt_type ll = ug.iterate(sents, model, 2);
+        flt_type stream_ll = ug.iterate(corpus, stream_model, 2);
+        BOOST_CHECK_EQUAL( ll, stream_ll );
+        BOOST_CHECK( model.counts == stream_model.counts );
+
+        set<string> candidates = { "sa", "kis", "kissa" };
+        vector<pair<string, flt_type> > removal_scores, stream_removal_scores;
+        ll = ug.rank_candidates(sents, model, candidates, removal_scores);
+        stream_ll = ug.rank_candidates(corpus, stream_model, candidates, stream_removal_scores);
+        BOOST_CHECK_EQUAL( ll, stream_ll );
+        BOOST_CHECK( removal_scores == stream_removal_scores );
+        remove(fname->c_str());
+    }
+}
+
+
+// Identical sentences read once with the counts give the same results as all the sentences
+BOOST_AUTO_TEST_CASE(UnigramModelTest3)
+{
+    map<string, flt_type> vocab;
+    vocab["a"] = log(0.25);
+    vocab["sa"] = log(0.25);
+    vocab["s"] = log(0.25);
+    vocab["ki"] = log(0.50);
+    vocab["kis"] = log(0.50);
+    vocab["kissa"] = log(0.1953125);
+    vocab["k"] = log(0.1);
+    vocab["i"] = log(0.1);
+    vector<string> sents = { "kissa", "sika", "kissa", "kissakissa", "isa", "sika", "kissa", "kisa" };
+    string fname("corpus_test.txt");
+    SimpleFileOutput corpusf(fname);
+    for (auto it = sents.cbegin(); it != sents.cend(); ++it)
+        corpusf << *it << "\n";
+    corpusf.close();
+
+    vector<string> types;
+    vector<flt_type> counts;
+    int lc = Unigrams::read_sents(fname, types, counts);
+    remove(fname.c_str());
+    BOOST_CHECK_EQUAL( 8, lc );
+    vector<string> expected_types = { "kissa", "sika", "kissakissa", "isa", "kisa" };
+    vector<flt_type> expected_counts = { 3.0, 2.0, 1.0, 1.0, 1.0 };
+    BOOST_CHECK( expected_types == types );
+    BOOST_CHECK( expected_counts == counts );
+
+    Unigrams ug;
+    ug.set_segmentation_method(forward_backward);
+    ug.set_ranking_method(forward_backward);
+    UnigramModel model(vocab);
+    UnigramModel type_model(vocab);
+    MemoryCorpus corpus(types, counts);
+    flt_type ll = ug.iterate(sents, model, 2);
+    flt_type type_ll = ug.iterate(corpus, type_model, 2);
+    BOOST_CHECK_CLOSE( ll, type_ll, 0.0001 );
+    BOOST_CHECK_EQUAL( model.counts.size(), type_model.counts.size() );
+    for (unsigned int i=0; i<model.counts.size(); i++)
+        BOOST_CHECK_CLOSE( model.counts[i], type_model.counts[i], 0.0001 );
+
+    set<string> candidates = { "sa", "kis", "kissa" };
+    vector<pair<string, flt_type> > removal_scores, type_removal_scores;
+    ll = ug.rank_candidates(sents, model, candidates, removal_scores);
+    type_ll = ug.rank_candidates(corpus, type_model, candidates, type_removal_scores);
+    BOOST_CHECK_CLOSE( ll, type_ll, 0.0001 );
+    BOOST_CHECK_EQUAL( removal_scores.size(), type_removal_scores.size() );
+    for (unsigned int i=0; i<removal_scores.size(); i++) {
+        BOOST_CHECK_EQUAL( removal_scores[i].first, type_removal_scores[i].first );
+        BOOST_CHECK_CLOSE( removal_scores[i].second, type_removal_scores[i].second, 0.0001 );
+    }
+}
+
+
 void assert_node(const FactorGraph &fg,
                  int node,
                  const std::string &nstr,
@@ -389,6 +1046,10 @@ BOOST_AUTO_TEST_CASE(FactorGraphTest1)
     StringSet ssvocab(vocab);
     FactorGraph ssfg("halojaa", start_end, ssvocab);
     BOOST_CHECK(fg.assert_equal(ssfg));
+
+    FrozenStringSet fsvocab(vocab);
+    FactorGraph fsfg("halojaa", start_end, fsvocab);
+    BOOST_CHECK(fg.assert_equal(fsfg));
 }
 
 // Testing constructor
@@ -407,6 +1068,10 @@ BOOST_AUTO_TEST_CASE(FactorGraphTest2)
     StringSet ssvocab(vocab);
     FactorGraph ssfg("halojaa", start_end, ssvocab);
     BOOST_CHECK(fg.assert_equal(ssfg));
+
+    FrozenStringSet fsvocab(vocab);
+    FactorGraph fsfg("halojaa", start_end, fsvocab);
+    BOOST_CHECK(fg.assert_equal(fsfg));
 }
 
 // Testing constructor
@@ -424,6 +1089,10 @@ BOOST_AUTO_TEST_CASE(FactorGraphTest3)
     StringSet ssvocab(vocab);
     FactorGraph ssfg("halojaa", start_end, ssvocab);
     BOOST_CHECK(fg.assert_equal(ssfg));
+
+    FrozenStringSet fsvocab(vocab);
+    FactorGraph fsfg("halojaa", start_end, fsvocab);
+    BOOST_CHECK(fg.assert_equal(fsfg));
 }
 
 
@@ -608,6 +1277,77 @@ BOOST_AUTO_TEST_CASE(FactorGraphTestRemoveArcs2)
 }
 
 
+void assert_equal_graphs(const FactorGraph &fg, const FlatFactorGraph &flat_fg)
+{
+    BOOST_REQUIRE_EQUAL( fg.nodes.size(), flat_fg.nodes.size() );
+    BOOST_CHECK_EQUAL( fg.arcs.size(), flat_fg.num_arcs() );
+    for (unsigned int i=0; i<fg.nodes.size(); i++) {
+        const FactorGraph::Node &node = fg.nodes[i];
+        BOOST_CHECK_EQUAL( node.start_pos, flat_fg.nodes[i].start_pos );
+        BOOST_CHECK_EQUAL( node.len, flat_fg.nodes[i].len );
+        BOOST_REQUIRE_EQUAL( node.outgoing.size(), flat_fg.outgoing_offsets[i+1]-flat_fg.outgoing_offsets[i] );
+        for (unsigned int j=0; j<node.outgoing.size(); j++) {
+            unsigned int arc = flat_fg.outgoing_offsets[i]+j;
+            BOOST_CHECK_EQUAL( i, flat_fg.arc_sources[arc] );
+            BOOST_CHECK_EQUAL( node.outgoing[j]->target_node, flat_fg.arc_targets[arc] );
+        }
+        BOOST_REQUIRE_EQUAL( node.incoming.size(), flat_fg.incoming_offsets[i+1]-flat_fg.incoming_offsets[i] );
+        for (unsigned int j=0; j<node.incoming.size(); j++) {
+            unsigned int arc = flat_fg.incoming_arcs[flat_fg.incoming_offsets[i]+j];
+            BOOST_CHECK_EQUAL( node.incoming[j]->source_node, flat_fg.arc_sources[arc] );
+            BOOST_CHECK_EQUAL( i, flat_fg.arc_targets[arc] );
+        }
+    }
+}
+
+
+// Flat graph has the nodes and arcs of the factor graph in the same order
+// and is set again for the next text
+BOOST_AUTO_TEST_CASE(FlatFactorGraphTest1)
+{
+    map<std::string, flt_type> vocab;
+    vocab.insert(make_pair("k", 0.0));
+    vocab.insert(make_pair("a", 0.0));
+    vocab.insert(make_pair("u", 0.0));
+    vocab.insert(make_pair("p", 0.0));
+    vocab.insert(make_pair("n", 0.0));
+    vocab.insert(make_pair("g", 0.0));
+    vocab.insert(make_pair("i", 0.0));
+    vocab.insert(make_pair("s", 0.0));
+    vocab.insert(make_pair("t", 0.0));
+    vocab.insert(make_pair("m", 0.0));
+    vocab.insert(make_pair("e", 0.0));
+    vocab.insert(make_pair("kaupun", 0.0));
+    vocab.insert(make_pair("gis", 0.0));
+    vocab.insert(make_pair("gistu", 0.0));
+    vocab.insert(make_pair("minen", 0.0));
+    vocab.insert(make_pair("kau", 0.0));
+    vocab.insert(make_pair("nn", 0.0));
+    FrozenStringSet fsvocab(vocab);
+
+    FactorGraph fg("kaupungistuminen", start_end, fsvocab);
+    FlatFactorGraph flat_fg("kaupungistuminen", start_end, fsvocab);
+    BOOST_CHECK_EQUAL(23, (int)flat_fg.nodes.size());
+    assert_equal_graphs(fg, flat_fg);
+    BOOST_CHECK_EQUAL( string("kaupun"), flat_fg.get_factor(3) );
+
+    // Dead ends are pruned
+    FactorGraph fg2("kaupunnin", start_end, fsvocab);
+    flat_fg.set_text("kaupunnin", start_end, fsvocab);
+    assert_equal_graphs(fg2, flat_fg);
+
+    // No segmentation
+    flat_fg.set_text("kaupunkix", start_end, fsvocab);
+    BOOST_CHECK_EQUAL( 0, (int)flat_fg.nodes.size() );
+    BOOST_CHECK_EQUAL( 0, (int)flat_fg.num_arcs() );
+    flat_fg.set_text("", start_end, fsvocab);
+    BOOST_CHECK_EQUAL( 0, (int)flat_fg.nodes.size() );
+
+    flat_fg.set_text("kaupungistuminen", start_end, fsvocab);
+    assert_equal_graphs(fg, flat_fg);
+}
+
+
 int transition_count(const transitions_t &transitions) {
     int count = 0;
     for (auto srcit = transitions.cbegin(); srcit != transitions.cend(); ++srcit)
@@ -1123,6 +1863,161 @@ BOOST_AUTO_TEST_CASE(TransitionForwardBackwardBlockFactor)
 }
 
 
+BOOST_AUTO_TEST_CASE(TransitionTableTest1)
+{
+    map<string, flt_type> vocab = {{"k", 0.0}, {"i", 0.0}, {"ki", 0.0}, {"s", 0.0}};
+    vocab[start_end] = 0.0;
+    FrozenStringSet fsvocab(vocab);
+
+    transitions_t transitions;
+    transitions[start_end]["k"] = log(0.5);
+    transitions[start_end]["ki"] = log(0.25);
+    transitions["k"]["i"] = log(0.5);
+    transitions["ki"]["s"] = log(0.25);
+    transitions["ki"]["sa"] = log(0.75);
+    transitions["s"][start_end] = log(0.4);
+    transitions["sa"][start_end] = log(0.6);
+
+    TransitionTable table(transitions, fsvocab);
+    BOOST_CHECK_EQUAL( 5, (int)table.size() );
+    int se = fsvocab.factor_index(start_end);
+    int k = fsvocab.factor_index("k");
+    int ki = fsvocab.factor_index("ki");
+    int i = fsvocab.factor_index("i");
+    int s = fsvocab.factor_index("s");
+    BOOST_CHECK_EQUAL( -1, fsvocab.factor_index("sa") );
+    BOOST_CHECK_EQUAL( log(0.5), table.cost(se, k) );
+    BOOST_CHECK_EQUAL( log(0.25), table.cost(se, ki) );
+    BOOST_CHECK_EQUAL( log(0.5), table.cost(k, i) );
+    BOOST_CHECK_EQUAL( log(0.25), table.cost(ki, s) );
+    BOOST_CHECK_EQUAL( log(0.4), table.cost(s, se) );
+    BOOST_CHECK_EQUAL( SMALL_LP, table.cost(se, i) );
+    BOOST_CHECK_EQUAL( SMALL_LP, table.cost(i, s) );
+    BOOST_CHECK_EQUAL( SMALL_LP, table.cost(-1, se) );
+    BOOST_CHECK_EQUAL( SMALL_LP, table.cost(ki, -1) );
+
+    // Letters added after building the table are not in it
+    int x = fsvocab.add_letter("x", log(0.1));
+    BOOST_CHECK_EQUAL( SMALL_LP, table.cost(x, se) );
+    BOOST_CHECK_EQUAL( SMALL_LP, table.cost(se, x) );
+}
+
+
+// Segmenting with a letter added to the side table equals rebuilding the vocabulary
+BOOST_AUTO_TEST_CASE(FrozenStringSetAddedLetters)
+{
+    map<string, flt_type> vocab = {{"k", log(0.2)}, {"i", log(0.1)}, {"s", log(0.1)}, {"a", log(0.1)},
+                                   {"sa", log(0.1)}, {"ki", log(0.1)}, {"kis", log(0.1)}, {"xk", log(0.1)}};
+    FrozenStringSet added(vocab);
+    added.add_letter("x", log(0.01));
+    vocab["x"] = log(0.01);
+    FrozenStringSet rebuilt(vocab);
+
+    string text("kixsaxkisx");
+    vector<string> added_path, rebuilt_path;
+    flt_type added_lp = viterbi(added, text, added_path);
+    flt_type rebuilt_lp = viterbi(rebuilt, text, rebuilt_path);
+    BOOST_CHECK_EQUAL( rebuilt_lp, added_lp );
+    BOOST_CHECK( rebuilt_path == added_path );
+
+    map<string, flt_type> added_stats, rebuilt_stats;
+    added_lp = forward_backward(added, text, added_stats);
+    rebuilt_lp = forward_backward(rebuilt, text, rebuilt_stats);
+    BOOST_CHECK_EQUAL( rebuilt_lp, added_lp );
+    BOOST_CHECK( rebuilt_stats == added_stats );
+
+    FlatFactorGraph added_fg(text, start_end, added);
+    FlatFactorGraph rebuilt_fg(text, start_end, rebuilt);
+    BOOST_REQUIRE_EQUAL( rebuilt_fg.nodes.size(), added_fg.nodes.size() );
+    for (unsigned int i=1; i<added_fg.nodes.size()-1; i++) {
+        BOOST_CHECK_EQUAL( rebuilt_fg.nodes[i].start_pos, added_fg.nodes[i].start_pos );
+        BOOST_CHECK_EQUAL( rebuilt_fg.nodes[i].len, added_fg.nodes[i].len );
+    }
+}
+
+
+void assert_close_transitions(const transitions_t &correct, const transitions_t &result)
+{
+    BOOST_REQUIRE_EQUAL( correct.size(), result.size() );
+    for (auto srcit = correct.begin(); srcit != correct.end(); ++srcit) {
+        BOOST_REQUIRE( result.find(srcit->first) != result.end() );
+        const map<string, flt_type> &targets = result.at(srcit->first);
+        BOOST_REQUIRE_EQUAL( srcit->second.size(), targets.size() );
+        for (auto tgtit = srcit->second.begin(); tgtit != srcit->second.end(); ++tgtit) {
+            BOOST_REQUIRE( targets.find(tgtit->first) != targets.end() );
+            BOOST_CHECK_CLOSE( tgtit->second, targets.at(tgtit->first), DBL_ACCURACY );
+        }
+    }
+}
+
+
+// Flat graph gives the same results as the factor graph
+BOOST_AUTO_TEST_CASE(FlatFactorGraphForwardBackward)
+{
+    map<string, flt_type> vocab = {{"k", log(0.2)}, {"i", log(0.1)}, {"s", log(0.1)}, {"a", log(0.1)},
+                                   {"sa", log(0.1)}, {"ki", log(0.1)}, {"kis", log(0.1)}, {"kissa", log(0.1)}};
+    vocab[start_end] = 0.0;
+    FrozenStringSet fsvocab(vocab);
+
+    transitions_t transitions;
+    transitions[start_end]["k"] = log(0.5);
+    transitions[start_end]["ki"] = log(0.25);
+    transitions[start_end]["kis"] = log(0.4);
+    transitions[start_end]["kissa"] = log(0.1);
+    transitions["a"][start_end] = log(0.5);
+    transitions["kissa"][start_end] = log(0.10);
+    transitions["sa"][start_end] = log(0.4);
+    transitions["ki"]["s"] = log(0.25);
+    transitions["i"]["s"] = log(0.5);
+    transitions["s"]["s"] = log(0.5);
+    transitions["s"]["sa"] = log(0.5);
+    transitions["kis"]["sa"] = log(0.4);
+    transitions["kis"]["s"] = log(0.4);
+
+    TransitionTable trans_table(transitions, fsvocab);
+    FlatFactorGraph flat_fg;
+    vector<string> sentences = { "kissa", "kissakissa", "sakki" };
+    for (auto sentence = sentences.cbegin(); sentence != sentences.cend(); ++sentence) {
+        FactorGraph fg(*sentence, start_end, fsvocab);
+        flat_fg.set_text(*sentence, start_end, fsvocab);
+
+        transitions_t stats, flat_stats;
+        vector<score_type> post_scores, flat_post_scores;
+        flt_type lp = forward_backward(transitions, fg, stats, post_scores);
+        flt_type flat_lp = forward_backward(trans_table, flat_fg, flat_stats, flat_post_scores);
+#if defined(FAST_LOG_SUM) || defined(FLOAT_SCORES)
+        // The flat graph sums the scores of the incoming arcs in one call
+        BOOST_CHECK_CLOSE( lp, flat_lp, DBL_ACCURACY );
+        assert_close_transitions(stats, flat_stats);
+        BOOST_REQUIRE_EQUAL( post_scores.size(), flat_post_scores.size() );
+        for (unsigned int i=0; i<post_scores.size(); i++)
+            BOOST_CHECK_SMALL( (flt_type)post_scores[i] - flat_post_scores[i], 1e-5 );
+#else
+        BOOST_CHECK_EQUAL( lp, flat_lp );
+        BOOST_CHECK( stats == flat_stats );
+        BOOST_CHECK( post_scores == flat_post_scores );
+#endif
+
+        stats.clear(); flat_stats.clear();
+        lp = forward_backward(vocab, fg, stats);
+        flat_lp = forward_backward(fsvocab, flat_fg, flat_stats);
+#if defined(FAST_LOG_SUM) || defined(FLOAT_SCORES)
+        BOOST_CHECK_CLOSE( lp, flat_lp, DBL_ACCURACY );
+        assert_close_transitions(stats, flat_stats);
+#else
+        BOOST_CHECK_EQUAL( lp, flat_lp );
+        BOOST_CHECK( stats == flat_stats );
+#endif
+
+        vector<string> best_path, flat_best_path;
+        lp = viterbi(transitions, fg, best_path);
+        flat_lp = viterbi(trans_table, flat_fg, flat_best_path);
+        BOOST_CHECK_EQUAL( lp, flat_lp );
+        BOOST_CHECK( best_path == flat_best_path );
+    }
+}
+
+
 // Normal scenario for one word, same data as in TransitionForwardBackwardTest7
 BOOST_AUTO_TEST_CASE(MSFGForwardBackwardTest1)
 {
@@ -1158,7 +2053,12 @@ BOOST_AUTO_TEST_CASE(MSFGForwardBackwardTest1)
     flt_type msfg_lp = forward_backward(msfg, sentence, msfg_stats);
 
     BOOST_CHECK_CLOSE( lp, msfg_lp, DBL_ACCURACY );
+#if defined(FAST_LOG_SUM) || defined(FLOAT_SCORES)
+    // The factor graph sums the scores of a node in one call
+    assert_close_transitions(stats, msfg_stats);
+#else
     BOOST_CHECK( stats == msfg_stats );
+#endif
 }
 
 
@@ -1210,7 +2110,11 @@ BOOST_AUTO_TEST_CASE(MSFGForwardBackwardTest2)
     flt_type msfg_lp = forward_backward(msfg, sentence, msfg_stats);
 
     BOOST_CHECK_CLOSE( lp, msfg_lp, DBL_ACCURACY );
+#if defined(FAST_LOG_SUM) || defined(FLOAT_SCORES)
+    assert_close_transitions(stats, msfg_stats);
+#else
     BOOST_CHECK( stats == msfg_stats );
+#endif
 }
 
 
@@ -1262,7 +2166,11 @@ BOOST_AUTO_TEST_CASE(MSFGForwardBackwardTest3)
     flt_type msfg_lp = forward_backward(msfg, word_freqs, msfg_stats);
 
     BOOST_CHECK_CLOSE( lp, msfg_lp, DBL_ACCURACY );
+#if defined(FAST_LOG_SUM) || defined(FLOAT_SCORES)
+    assert_close_transitions(stats, msfg_stats);
+#else
     BOOST_CHECK( stats == msfg_stats );
+#endif
 }
 
 
@@ -1374,3 +2282,238 @@ BOOST_AUTO_TEST_CASE(MSFGViterbiTest2)
     BOOST_CHECK_CLOSE( lp, msfg_lp, DBL_ACCURACY );
     BOOST_CHECK( stats == msfg_stats );
 }
+
+
+// Same data as in MSFGForwardBackwardTest3
+// The frozen graph gives the same results before and after removing a factor
+BOOST_AUTO_TEST_CASE(FrozenMSFGTest1)
+{
+    set<string> vocab = {"k","i","s","a","sa","ki","kis","kissa"};
+
+    transitions_t transitions;
+    transitions[start_end]["k"] = log(0.5);
+    transitions[start_end]["ki"] = log(0.25);
+    transitions[start_end]["kis"] = log(0.4);
+    transitions[start_end]["kissa"] = log(0.1);
+    transitions["a"][start_end] = log(0.5);
+    transitions["kissa"][start_end] = log(0.10);
+    transitions["sa"][start_end] = log(0.4);
+    transitions["ki"]["s"] = log(0.25);
+    transitions["k"]["i"] = log(0.5);
+    transitions["i"]["s"] = log(0.5);
+    transitions["s"]["s"] = log(0.5);
+    transitions["s"]["sa"] = log(0.5);
+    transitions["s"]["a"] = log(0.5);
+    transitions["kis"]["sa"] = log(0.4);
+    transitions["kis"]["s"] = log(0.4);
+
+    transitions["i"]["sa"] = log(0.8);
+    transitions["a"]["a"] = log(0.8);
+    transitions["ki"]["sa"] = log(0.8);
+    transitions["kis"]["a"] = log(0.8);
+    transitions["kissa"]["a"] = log(0.8);
+    transitions["sa"]["a"] = log(0.8);
+
+    map<string, flt_type> word_freqs = {{"kissa", 1.0}, {"kisa", 2.0}, {"kissaa", 3.0}};
+    MultiStringFactorGraph msfg(start_end);
+    for (auto wit = word_freqs.begin(); wit != word_freqs.end(); ++wit) {
+        FactorGraph fg(wit->first, start_end, vocab, 5);
+        msfg.add(fg);
+    }
+    msfg.update_factor_node_map();
+
+    FrozenMultiStringFactorGraph frozen(msfg);
+    BOOST_CHECK_EQUAL( msfg.nodes.size(), frozen.node_count() );
+    BOOST_CHECK_EQUAL( (int)msfg.factor_node_map.size(), (int)frozen.factor_count() );
+    BOOST_CHECK_EQUAL( 0, frozen.factor_index(start_end) );
+    BOOST_CHECK_EQUAL( -1, frozen.factor_index("kiss") );
+
+    for (int i=0; i<2; i++) {
+        assign_scores(transitions, msfg);
+        assign_scores(transitions, frozen);
+
+        transitions_t msfg_stats, frozen_stats;
+        bigram_stats_t stats;
+        flt_type msfg_lp = forward_backward(msfg, word_freqs, msfg_stats);
+        flt_type frozen_lp = forward_backward(frozen, word_freqs, stats);
+        frozen.get_transitions(stats, frozen_stats);
+        BOOST_CHECK_CLOSE( msfg_lp, frozen_lp, DBL_ACCURACY );
+        assert_close_transitions(msfg_stats, frozen_stats);
+
+        msfg_stats.clear(); frozen_stats.clear(); stats.clear();
+        msfg_lp = viterbi(msfg, word_freqs, msfg_stats);
+        frozen_lp = viterbi(frozen, word_freqs, stats);
+        frozen.get_transitions(stats, frozen_stats);
+        BOOST_CHECK_EQUAL( msfg_lp, frozen_lp );
+        BOOST_CHECK( msfg_stats == frozen_stats );
+
+        FrozenMSFGWorkspace ws(frozen);
+        for (auto wit = word_freqs.begin(); wit != word_freqs.end(); ++wit) {
+            BOOST_CHECK_CLOSE( likelihood_fb(wit->first, msfg), likelihood_fb(wit->first, frozen, ws), DBL_ACCURACY );
+            BOOST_CHECK_EQUAL( likelihood_viterbi(wit->first, msfg), likelihood_viterbi(wit->first, frozen, ws) );
+            set<string> msfg_factors, frozen_factors;
+            msfg.collect_factors(wit->first, msfg_factors);
+            frozen.collect_factors(wit->first, frozen_factors);
+            BOOST_CHECK( msfg_factors == frozen_factors );
+        }
+
+        vector<string> to_remove = {"kis"};
+        Bigrams::remove_transitions(to_remove, transitions);
+        msfg.remove_arcs("kis");
+        frozen.remove_arcs("kis");
+    }
+    BOOST_CHECK_EQUAL( (int)msfg.factor_node_map.size(), (int)frozen.factor_count() );
+}
+
+// Mapped binary image gives the same graph and likelihoods as the compiled graph
+BOOST_AUTO_TEST_CASE(FrozenMSFGTest2)
+{
+    set<string> vocab = {"k","i","s","a","sa","ki","kis","kissa"};
+
+    transitions_t transitions;
+    transitions[start_end]["k"] = log(0.5);
+    transitions[start_end]["ki"] = log(0.25);
+    transitions[start_end]["kis"] = log(0.4);
+    transitions[start_end]["kissa"] = log(0.1);
+    transitions["a"][start_end] = log(0.5);
+    transitions["kissa"][start_end] = log(0.10);
+    transitions["sa"][start_end] = log(0.4);
+    transitions["ki"]["s"] = log(0.25);
+    transitions["k"]["i"] = log(0.5);
+    transitions["i"]["s"] = log(0.5);
+    transitions["s"]["s"] = log(0.5);
+    transitions["s"]["sa"] = log(0.5);
+    transitions["s"]["a"] = log(0.5);
+    transitions["kis"]["sa"] = log(0.4);
+    transitions["kis"]["s"] = log(0.4);
+    transitions["a"]["a"] = log(0.8);
+
+    map<string, flt_type> word_freqs = {{"kissa", 1.0}, {"kisa", 2.0}, {"kissaa", 3.0}};
+    MultiStringFactorGraph msfg(start_end);
+    for (auto wit = word_freqs.begin(); wit != word_freqs.end(); ++wit) {
+        FactorGraph fg(wit->first, start_end, vocab, 5);
+        msfg.add(fg);
+    }
+    msfg.update_factor_node_map();
+
+    string fname("msfg_test_image.bin");
+    FrozenMultiStringFactorGraph frozen(msfg);
+    BOOST_CHECK_EQUAL( 0, frozen.write_image(fname) );
+    BOOST_CHECK( FrozenMultiStringFactorGraph::is_image(fname) );
+    BOOST_CHECK( !FrozenStringSet::is_image(fname) );
+
+    FrozenMultiStringFactorGraph mapped("");
+    BOOST_CHECK_EQUAL( 0, mapped.open_image(fname) );
+    BOOST_CHECK_EQUAL( start_end, mapped.start_end_symbol );
+    BOOST_CHECK_EQUAL( frozen.node_count(), mapped.node_count() );
+    BOOST_CHECK_EQUAL( frozen.arc_count(), mapped.arc_count() );
+    BOOST_CHECK_EQUAL( frozen.factor_count(), mapped.factor_count() );
+    BOOST_CHECK( frozen.factor_strings == mapped.factor_strings );
+    BOOST_CHECK( frozen.string_end_nodes == mapped.string_end_nodes );
+    for (unsigned int i=0; i<frozen.node_count(); i++) {
+        BOOST_CHECK_EQUAL( frozen.node_factors[i], mapped.node_factors[i] );
+        BOOST_CHECK_EQUAL( frozen.outgoing_offsets[i+1], mapped.outgoing_offsets[i+1] );
+        BOOST_CHECK_EQUAL( frozen.incoming_offsets[i+1], mapped.incoming_offsets[i+1] );
+    }
+    for (unsigned int arc=0; arc<frozen.arc_count(); arc++) {
+        BOOST_CHECK_EQUAL( frozen.arc_sources[arc], mapped.arc_sources[arc] );
+        BOOST_CHECK_EQUAL( frozen.arc_targets[arc], mapped.arc_targets[arc] );
+        BOOST_CHECK_EQUAL( frozen.incoming_arcs[arc], mapped.incoming_arcs[arc] );
+    }
+    remove(fname.c_str());
+
+    for (int i=0; i<2; i++) {
+        assign_scores(transitions, frozen);
+        assign_scores(transitions, mapped);
+
+        transitions_t frozen_stats, mapped_stats;
+        bigram_stats_t stats;
+        flt_type frozen_lp = forward_backward(frozen, word_freqs, stats);
+        frozen.get_transitions(stats, frozen_stats);
+        stats.clear();
+        flt_type mapped_lp = forward_backward(mapped, word_freqs, stats);
+        mapped.get_transitions(stats, mapped_stats);
+        BOOST_CHECK_EQUAL( frozen_lp, mapped_lp );
+        BOOST_CHECK( frozen_stats == mapped_stats );
+
+        frozen.remove_arcs("kis");
+        mapped.remove_arcs("kis");
+        vector<string> to_remove = {"kis"};
+        Bigrams::remove_transitions(to_remove, transitions);
+    }
+    BOOST_CHECK_EQUAL( frozen.factor_count(), mapped.factor_count() );
+
+    // Removed factors and arcs stay removed in the image
+    BOOST_CHECK_EQUAL( 0, frozen.write_image(fname) );
+    FrozenMultiStringFactorGraph pruned("");
+    BOOST_CHECK_EQUAL( 0, pruned.open_image(fname) );
+    BOOST_CHECK_EQUAL( frozen.factor_count(), pruned.factor_count() );
+    BOOST_CHECK( frozen.factor_removed == pruned.factor_removed );
+    BOOST_CHECK( frozen.arc_removed == pruned.arc_removed );
+
+    // Node factor index out of range, node_factors follows the 44 byte header,
+    // the factor string offsets, factor_node_offsets and factor_nodes
+    size_t node_factors_pos = 44 + (2*(pruned.factor_strings.size()+1) + pruned.node_count())
+        * sizeof(unsigned int);
+    int bad_factor = pruned.factor_strings.size();
+    fstream imagefile(fname.c_str(), ios_base::in | ios_base::out | ios_base::binary);
+    imagefile.seekp(node_factors_pos);
+    imagefile.write((const char*)&bad_factor, sizeof(int));
+    imagefile.close();
+    BOOST_CHECK_EQUAL( -1, pruned.open_image(fname) );
+    BOOST_CHECK_EQUAL( frozen.node_count(), pruned.node_count() );
+    remove(fname.c_str());
+
+    BOOST_CHECK( !FrozenMultiStringFactorGraph::is_image("emtest.cc") );
+    BOOST_CHECK_EQUAL( -1, mapped.open_image("no_such_image.bin") );
+}
+
+
+// Same data as in FrozenMSFGTest1
+// Ranking the candidates updates the changed arc costs and restores them
+BOOST_AUTO_TEST_CASE(FrozenMSFGTest3)
+{
+    set<string> vocab = {"k","i","s","a","sa","ki","kis","kissa"};
+
+    transitions_t transitions;
+    transitions[start_end]["k"] = log(0.5);
+    transitions[start_end]["ki"] = log(0.25);
+    transitions[start_end]["kis"] = log(0.4);
+    transitions[start_end]["kissa"] = log(0.1);
+    transitions["a"][start_end] = log(0.5);
+    transitions["kissa"][start_end] = log(0.10);
+    transitions["sa"][start_end] = log(0.4);
+    transitions["ki"]["s"] = log(0.25);
+    transitions["k"]["i"] = log(0.5);
+    transitions["i"]["s"] = log(0.5);
+    transitions["s"]["s"] = log(0.5);
+    transitions["s"]["sa"] = log(0.5);
+    transitions["s"]["a"] = log(0.5);
+    transitions["kis"]["sa"] = log(0.4);
+    transitions["kis"]["s"] = log(0.4);
+    transitions["a"]["a"] = log(0.8);
+
+    map<string, flt_type> word_freqs = {{"kissa", 1.0}, {"kisa", 2.0}, {"kissaa", 3.0}};
+    MultiStringFactorGraph msfg(start_end);
+    for (auto wit = word_freqs.begin(); wit != word_freqs.end(); ++wit) {
+        FactorGraph fg(wit->first, start_end, vocab, 5);
+        msfg.add(fg);
+    }
+    msfg.update_factor_node_map();
+    FrozenMultiStringFactorGraph frozen(msfg);
+
+    transitions_t trans_stats;
+    map<string, flt_type> unigram_stats;
+    assign_scores(transitions, msfg);
+    assign_scores(transitions, frozen);
+    Bigrams::collect_trans_stats(word_freqs, msfg, trans_stats, unigram_stats, true);
+    vector<flt_type> arc_costs = frozen.arc_costs;
+
+    map<string, flt_type> candidates = {{"kis", 0.0}, {"sa", 0.0}};
+    map<string, flt_type> frozen_candidates = candidates;
+    Bigrams::rank_candidate_subwords(word_freqs, msfg, unigram_stats, transitions, candidates);
+    Bigrams::rank_candidate_subwords(word_freqs, frozen, unigram_stats, transitions, frozen_candidates);
+    for (auto it = candidates.begin(); it != candidates.end(); ++it)
+        BOOST_CHECK_CLOSE( it->second, frozen_candidates.at(it->first), DBL_ACCURACY );
+    BOOST_CHECK( arc_costs == frozen.arc_costs );
+}
@@ -1,6 +1,8 @@
 #include <boost/test/unit_test.hpp>
 
 #include "StringSet.hh"
+#include "FrozenStringSet.hh"
+#include "RadixStringSet.hh"
 
 using namespace std;
 
@@ -152,3 +154,465 @@ BOOST_AUTO_TEST_CASE(StringSetTest5)
     BOOST_CHECK ( throws );
     BOOST_CHECK ( vocab.size() == ss.string_count() );
 }
+
+
+// Read-only set, basic lookups
+BOOST_AUTO_TEST_CASE(FrozenStringSetTest1)
+{
+    map<string, flt_type> vocab;
+    vocab["hei"] = -1.0;
+    vocab["heippa"] = -2.0;
+    vocab["heh"] = -3.0;
+    vocab["hassua"] = -4.0;
+    vocab["hassu"] = -5.0;
+    FrozenStringSet fs(vocab);
+
+    BOOST_CHECK_EQUAL ( 5, (int)fs.string_count() );
+    BOOST_CHECK_EQUAL ( 6, fs.max_factor_length );
+    BOOST_CHECK ( fs.includes("hei") );
+    BOOST_CHECK ( fs.includes("heippa") );
+    BOOST_CHECK ( fs.includes("heh") );
+    BOOST_CHECK ( fs.includes("hassua") );
+    BOOST_CHECK ( fs.includes("hassu") );
+    BOOST_CHECK ( !fs.includes("") );
+    BOOST_CHECK ( !fs.includes("h") );
+    BOOST_CHECK ( !fs.includes("he") );
+    BOOST_CHECK ( !fs.includes("heip") );
+    BOOST_CHECK ( !fs.includes("heippaa") );
+    BOOST_CHECK ( !fs.includes("x") );
+
+    BOOST_CHECK_EQUAL ( -1.0, fs.get_score("hei") );
+    BOOST_CHECK_EQUAL ( -2.0, fs.get_score("heippa") );
+    BOOST_CHECK_EQUAL ( -3.0, fs.get_score("heh") );
+    BOOST_CHECK_EQUAL ( -4.0, fs.get_score("hassua") );
+    BOOST_CHECK_EQUAL ( -5.0, fs.get_score("hassu") );
+
+    bool throws = false;
+    try {
+        fs.get_score("heip");
+    }
+    catch (string &e) {
+        throws = true;
+    }
+    BOOST_CHECK( throws );
+
+    // Factor indices follow the order of the strings
+    int node = FrozenStringSet::root_node;
+    string hassu("hassu");
+    for (unsigned int i=0; i<hassu.length(); i++)
+        node = fs.find_arc(hassu[i], node);
+    BOOST_CHECK_EQUAL ( 0, fs.factor_id(node) );
+    node = fs.find_arc('a', node);
+    BOOST_CHECK_EQUAL ( 1, fs.factor_id(node) );
+    BOOST_CHECK_EQUAL ( -4.0, fs.cost(node) );
+    BOOST_CHECK_EQUAL ( -1, fs.find_arc('a', node) );
+}
+
+// Read-only set from a StringSet, many strings
+BOOST_AUTO_TEST_CASE(FrozenStringSetTest2)
+{
+    map<string, flt_type> vocab;
+    string letters("abcdefghij");
+    srand(1);
+    for (int i=0; i<2000; i++) {
+        string word;
+        int len = 1 + rand() % 8;
+        for (int j=0; j<len; j++) word += letters[rand() % letters.size()];
+        vocab[word] = -(flt_type)(rand() % 100);
+    }
+
+    StringSet ss(vocab);
+    ss.remove(vocab.begin()->first);
+    FrozenStringSet fs(ss);
+    BOOST_CHECK_EQUAL ( vocab.size()-1, fs.string_count() );
+    BOOST_CHECK ( !fs.includes(vocab.begin()->first) );
+    for (auto it = ++vocab.begin(); it != vocab.end(); ++it) {
+        BOOST_CHECK ( fs.includes(it->first) );
+        BOOST_CHECK_EQUAL ( it->second, fs.get_score(it->first) );
+        BOOST_CHECK ( !fs.includes(it->first + "k") );
+    }
+}
+
+// Mapped binary image gives the same lookups as the set it was written from
+BOOST_AUTO_TEST_CASE(FrozenStringSetTest3)
+{
+    map<string, flt_type> vocab;
+    string letters("abcdefghij");
+    srand(3);
+    for (int i=0; i<500; i++) {
+        string word;
+        int len = 1 + rand() % 6;
+        for (int j=0; j<len; j++) word += letters[rand() % letters.size()];
+        vocab[word] = -(flt_type)(rand() % 100);
+    }
+
+    string fname("fss_test_image.bin");
+    FrozenStringSet fs(vocab);
+    BOOST_CHECK_EQUAL ( 0, fs.write_image(fname) );
+    BOOST_CHECK ( FrozenStringSet::is_image(fname) );
+
+    FrozenStringSet mapped;
+    BOOST_CHECK_EQUAL ( 0, mapped.open_image(fname) );
+    BOOST_CHECK_EQUAL ( fs.string_count(), mapped.string_count() );
+    BOOST_CHECK_EQUAL ( fs.max_factor_length, mapped.max_factor_length );
+    for (auto it = vocab.begin(); it != vocab.end(); ++it) {
+        BOOST_CHECK_EQUAL ( it->second, mapped.get_score(it->first) );
+        BOOST_CHECK ( !mapped.includes(it->first + "x") );
+    }
+
+    map<string, flt_type> result;
+    mapped.get_vocab(result);
+    BOOST_CHECK ( vocab == result );
+    remove(fname.c_str());
+
+    BOOST_CHECK ( !FrozenStringSet::is_image("sstest.cc") );
+    BOOST_CHECK_EQUAL ( -1, mapped.open_image("no_such_image.bin") );
+    BOOST_CHECK_EQUAL ( vocab.size(), mapped.string_count() );
+}
+
+// Letters added outside the tree get the indices after the tree factors
+BOOST_AUTO_TEST_CASE(FrozenStringSetTest4)
+{
+    map<string, flt_type> vocab = {{"hei", -1.0}, {"heh", -2.0}, {"ab", -3.0}};
+    string fname("fss_test_image.bin");
+    FrozenStringSet fs(vocab);
+    BOOST_CHECK_EQUAL ( 0, fs.write_image(fname) );
+
+    FrozenStringSet mapped;
+    BOOST_CHECK_EQUAL ( 0, mapped.open_image(fname) );
+    remove(fname.c_str());
+    BOOST_CHECK_EQUAL ( 3, mapped.add_letter("b", -4.0) );
+    BOOST_CHECK_EQUAL ( 4, mapped.add_letter("\xc3\xa4", -5.0) );
+    BOOST_CHECK_EQUAL ( 3, mapped.add_letter("b", -6.0) );
+    BOOST_CHECK_EQUAL ( 0, mapped.add_letter("ab", -6.0) );
+    BOOST_CHECK_EQUAL ( 5, (int)mapped.factor_count() );
+    BOOST_CHECK_EQUAL ( 5, (int)mapped.string_count() );
+    BOOST_CHECK_EQUAL ( 3, mapped.factor_index("b") );
+    BOOST_CHECK_EQUAL ( -4.0, mapped.get_score("b") );
+    BOOST_CHECK_EQUAL ( -5.0, mapped.factor_cost(4) );
+    BOOST_CHECK ( mapped.includes("\xc3\xa4") );
+    BOOST_CHECK ( !mapped.includes("\xc3") );
+    BOOST_CHECK ( !mapped.includes("a") );
+    string text("ab\xc3\xa4" "b");
+    BOOST_CHECK_EQUAL ( -1, mapped.added_letter(text, 0, 1) );
+    BOOST_CHECK_EQUAL ( 3, mapped.added_letter(text, 1, 2) );
+    BOOST_CHECK_EQUAL ( 4, mapped.added_letter(text, 2, 4) );
+    BOOST_CHECK_EQUAL ( -1, mapped.added_letter(text, 2, 3) );
+    BOOST_CHECK_EQUAL ( 3, mapped.added_letter(text, 4, 5) );
+
+    map<string, flt_type> result;
+    mapped.get_vocab(result);
+    vocab["b"] = -4.0;
+    vocab["\xc3\xa4"] = -5.0;
+    BOOST_CHECK ( vocab == result );
+}
+
+// Bulk loaded set equals the one built by adding strings one by one
+BOOST_AUTO_TEST_CASE(StringSetTest6)
+{
+    map<string, flt_type> vocab;
+    string letters("abcdefghij");
+    srand(2);
+    for (int i=0; i<2000; i++) {
+        string word;
+        int len = 1 + rand() % 8;
+        for (int j=0; j<len; j++) word += letters[rand() % letters.size()];
+        vocab[word] = -(flt_type)(rand() % 100);
+    }
+
+    StringSet ss(vocab);
+    StringSet added;
+    for (auto it = vocab.begin(); it != vocab.end(); ++it)
+        added.add(it->first, it->second);
+
+    BOOST_CHECK_EQUAL ( vocab.size(), ss.string_count() );
+    BOOST_CHECK_EQUAL ( vocab.size(), added.string_count() );
+    BOOST_CHECK_EQUAL ( added.max_factor_length, ss.max_factor_length );
+    for (auto it = vocab.begin(); it != vocab.end(); ++it) {
+        BOOST_CHECK_EQUAL ( it->second, ss.get_score(it->first) );
+        BOOST_CHECK_EQUAL ( it->second, added.get_score(it->first) );
+    }
+
+    // Strings added on top of the bulk loaded tree
+    ss.add("jjjjjjjjjjk", -1.0);
+    ss.add("ak", -2.0);
+    BOOST_CHECK_EQUAL ( -1.0, ss.get_score("jjjjjjjjjjk") );
+    BOOST_CHECK_EQUAL ( -2.0, ss.get_score("ak") );
+    BOOST_CHECK ( !ss.includes("jjjjjjjjjj") );
+    BOOST_CHECK_EQUAL ( vocab.size()+2, ss.string_count() );
+}
+
+
+// Factor indices are kept over removals and score assignments
+BOOST_AUTO_TEST_CASE(StringSetTest7)
+{
+    map<string, flt_type> vocab;
+    vocab["hei"] = -1.0;
+    vocab["heippa"] = -2.0;
+    vocab["heh"] = -3.0;
+    StringSet ss(vocab);
+
+    BOOST_CHECK_EQUAL ( 3, (int)ss.factor_count() );
+    BOOST_CHECK_EQUAL ( 0, ss.factor_index("heh") );
+    BOOST_CHECK_EQUAL ( 1, ss.factor_index("hei") );
+    BOOST_CHECK_EQUAL ( 2, ss.factor_index("heippa") );
+    BOOST_CHECK_EQUAL ( -1, ss.factor_index("heip") );
+
+    BOOST_CHECK_EQUAL ( -1.0, ss.remove("hei") );
+    BOOST_CHECK_EQUAL ( -1, ss.factor_index("hei") );
+    ss.add("hei", -4.0);
+    BOOST_CHECK_EQUAL ( 1, ss.factor_index("hei") );
+    ss.add("heip", -5.0);
+    BOOST_CHECK_EQUAL ( 3, ss.factor_index("heip") );
+    BOOST_CHECK_EQUAL ( "heip", ss.factor_strings[3] );
+
+    vector<flt_type> costs(ss.factor_count(), MIN_FLOAT);
+    costs[1] = -6.0; costs[3] = -7.0;
+    ss.assign_scores(costs);
+    BOOST_CHECK_EQUAL ( 2, (int)ss.string_count() );
+    BOOST_CHECK ( !ss.includes("heh") );
+    BOOST_CHECK ( !ss.includes("heippa") );
+    BOOST_CHECK_EQUAL ( -6.0, ss.get_score("hei") );
+    BOOST_CHECK_EQUAL ( -7.0, ss.get_score("heip") );
+
+    costs[0] = -8.0;
+    ss.assign_scores(costs);
+    BOOST_CHECK_EQUAL ( -8.0, ss.get_score("heh") );
+
+    map<string, flt_type> result;
+    ss.get_vocab(result);
+    BOOST_CHECK_EQUAL ( 3, (int)result.size() );
+    BOOST_CHECK_EQUAL ( -6.0, result["hei"] );
+}
+
+
+// Disabling by the index keeps the cost and the index
+BOOST_AUTO_TEST_CASE(StringSetTest8)
+{
+    map<string, flt_type> vocab;
+    vocab["a"] = -1.0;
+    vocab["ab"] = -2.0;
+    vocab["b"] = -3.0;
+    StringSet ss(vocab);
+
+    int factor = ss.factor_index("ab");
+    ss.disable(factor);
+    ss.disable(factor);
+    BOOST_CHECK ( !ss.enabled(factor) );
+    BOOST_CHECK ( !ss.includes("ab") );
+    BOOST_CHECK_EQUAL ( 2, (int)ss.string_count() );
+    ss.enable(factor);
+    BOOST_CHECK ( ss.enabled(factor) );
+    BOOST_CHECK_EQUAL ( -2.0, ss.get_score("ab") );
+    BOOST_CHECK_EQUAL ( 3, (int)ss.string_count() );
+
+    ss.remove("a");
+    ss.add("a", -4.0);
+    ss.add("ba", -5.0);
+    BOOST_CHECK_EQUAL ( 4, (int)ss.string_count() );
+}
+
+
+// Code points as letters, one arc per multibyte character
+BOOST_AUTO_TEST_CASE(StringSetTest9)
+{
+    map<string, flt_type> vocab;
+    vocab["\xc3\xa4"] = -1.0;
+    vocab["\xc3\xa4t"] = -2.0;
+    vocab["\xc3\xb6"] = -3.0;
+    vocab["\xe2\x82\xac"] = -4.0;
+    StringSet ss(vocab, true);
+
+    BOOST_CHECK_EQUAL ( 4, (int)ss.string_count() );
+    BOOST_CHECK_EQUAL ( 4, ss.character_count );
+    BOOST_CHECK_EQUAL ( 3, ss.max_factor_length );
+    for (auto it = vocab.begin(); it != vocab.end(); ++it)
+        BOOST_CHECK_EQUAL ( it->second, ss.get_score(it->first) );
+
+    string text("\xc3\xa4t");
+    unsigned int pos = 0;
+    StringSet::Arc *arc = ss.step(text, pos, &ss.root_node);
+    BOOST_CHECK ( arc != nullptr );
+    BOOST_CHECK_EQUAL ( 2, (int)pos );
+    BOOST_CHECK_EQUAL ( 0xe4, (int)arc->letter );
+    BOOST_CHECK_EQUAL ( 0, arc->factor );
+
+    // Partial and invalid sequences
+    BOOST_CHECK ( !ss.includes("\xc3") );
+    BOOST_CHECK ( !ss.includes("\xe2\x82") );
+    BOOST_CHECK ( !ss.includes("\xc3\x24") );
+    BOOST_CHECK ( !ss.includes("\xc0\xa4") );
+    BOOST_CHECK_THROW ( ss.add("\xa4", -5.0), string );
+
+    // New code points get new letter codes
+    ss.add("\xe2\x82\xac\xc3\xa5", -5.0);
+    ss.add("\xf0\x9f\x98\x80", -6.0);
+    BOOST_CHECK_EQUAL ( 6, ss.character_count );
+    BOOST_CHECK_EQUAL ( -5.0, ss.get_score("\xe2\x82\xac\xc3\xa5") );
+    BOOST_CHECK_EQUAL ( -6.0, ss.get_score("\xf0\x9f\x98\x80") );
+    BOOST_CHECK ( !ss.includes("\xc3\xa5") );
+}
+
+
+// Compacting drops the removed factors and reindexes the rest
+BOOST_AUTO_TEST_CASE(StringSetTest10)
+{
+    map<string, flt_type> vocab;
+    vocab["a"] = -1.0;
+    vocab["abc"] = -2.0;
+    vocab["abd"] = -3.0;
+    vocab["b"] = -4.0;
+    StringSet ss(vocab);
+    ss.remove("abc");
+    ss.remove("a");
+    ss.add("c", -5.0);
+
+    vector<int> index_map;
+    ss.compact(index_map);
+    BOOST_CHECK_EQUAL ( 3, (int)ss.factor_count() );
+    BOOST_CHECK_EQUAL ( 3, (int)ss.string_count() );
+    BOOST_CHECK_EQUAL ( 5, (int)index_map.size() );
+    BOOST_CHECK_EQUAL ( -1, index_map[0] );
+    BOOST_CHECK_EQUAL ( -1, index_map[1] );
+    BOOST_CHECK_EQUAL ( 0, index_map[2] );
+    BOOST_CHECK_EQUAL ( 1, index_map[3] );
+    BOOST_CHECK_EQUAL ( 2, index_map[4] );
+    BOOST_CHECK_EQUAL ( -3.0, ss.get_score("abd") );
+    BOOST_CHECK_EQUAL ( -5.0, ss.get_score("c") );
+    BOOST_CHECK ( !ss.includes("abc") );
+    BOOST_CHECK_EQUAL ( 3, ss.max_factor_length );
+
+    // The set is usable for adding after compacting
+    ss.add("a", -6.0);
+    BOOST_CHECK_EQUAL ( 3, ss.factor_index("a") );
+    BOOST_CHECK_EQUAL ( -6.0, ss.get_score("a") );
+
+    // Links updated once after adding many factors
+    StringSet deferred(vocab);
+    deferred.remove("abc");
+    deferred.remove("a");
+    deferred.add("c", -5.0);
+    deferred.compact(index_map);
+    deferred.add("a", -6.0, false);
+    deferred.add("bd", -7.0, false);
+    deferred.update_links();
+    ss.add("bd", -7.0);
+    vector<StringSet::Match> matches, deferred_matches;
+    ss.scan("abdcabd", matches);
+    deferred.scan("abdcabd", deferred_matches);
+    BOOST_REQUIRE_EQUAL ( matches.size(), deferred_matches.size() );
+    for (unsigned int i=0; i<matches.size(); i++) {
+        BOOST_CHECK_EQUAL ( matches[i].start, deferred_matches[i].start );
+        BOOST_CHECK_EQUAL ( matches[i].end, deferred_matches[i].end );
+        BOOST_CHECK_EQUAL ( matches[i].factor, deferred_matches[i].factor );
+    }
+}
+
+
+// All matches in one pass, ordered by the end position
+BOOST_AUTO_TEST_CASE(StringSetTest11)
+{
+    map<string, flt_type> vocab;
+    vocab["a"] = -1.0;
+    vocab["ab"] = -2.0;
+    vocab["bc"] = -3.0;
+    vocab["abcd"] = -4.0;
+    vocab["c"] = -5.0;
+    StringSet ss(vocab);
+
+    vector<StringSet::Match> matches;
+    ss.scan("xabcd", matches);
+    BOOST_CHECK_EQUAL ( 5, (int)matches.size() );
+    int starts[] = { 1, 1, 2, 3, 1 };
+    int ends[] = { 2, 3, 4, 4, 5 };
+    for (unsigned int i=0; i<matches.size(); i++) {
+        BOOST_CHECK_EQUAL ( starts[i], (int)matches[i].start );
+        BOOST_CHECK_EQUAL ( ends[i], (int)matches[i].end );
+        string factor("xabcd", matches[i].start, matches[i].end-matches[i].start);
+        BOOST_CHECK_EQUAL ( ss.factor_index(factor), matches[i].factor );
+        BOOST_CHECK_EQUAL ( ss.get_score(factor), matches[i].cost );
+    }
+
+    // Removed factors are skipped, added ones are found
+    ss.remove("bc");
+    ss.add("abc", -6.0);
+    ss.add("d", -7.0);
+    ss.scan("abcd", matches);
+    BOOST_CHECK_EQUAL ( 6, (int)matches.size() );
+    BOOST_CHECK_EQUAL ( ss.factor_index("abc"), matches[2].factor );
+    BOOST_CHECK_EQUAL ( ss.factor_index("c"), matches[3].factor );
+    BOOST_CHECK_EQUAL ( ss.factor_index("abcd"), matches[4].factor );
+    BOOST_CHECK_EQUAL ( ss.factor_index("d"), matches[5].factor );
+
+    StringSet cpss(vocab, true);
+    cpss.add("\xc3\xa4" "b", -8.0);
+    cpss.scan("\xc3\xa4" "bc\xc3", matches);
+    BOOST_CHECK_EQUAL ( 3, (int)matches.size() );
+    BOOST_CHECK_EQUAL ( 0, (int)matches[0].start );
+    BOOST_CHECK_EQUAL ( 3, (int)matches[0].end );
+    BOOST_CHECK_EQUAL ( cpss.factor_index("bc"), matches[1].factor );
+    BOOST_CHECK_EQUAL ( cpss.factor_index("c"), matches[2].factor );
+}
+
+
+// Path-compressed set, single child chains are collapsed to one node
+BOOST_AUTO_TEST_CASE(RadixStringSetTest1)
+{
+    map<string, flt_type> vocab;
+    vocab["_the_first"] = -1.0;
+    vocab["_the_fifth"] = -2.0;
+    vocab["_the"] = -3.0;
+    vocab["_a"] = -4.0;
+    vocab["x"] = -5.0;
+    RadixStringSet rs(vocab);
+
+    // root, _, the, _fi, rst, fth, a, x
+    BOOST_CHECK_EQUAL ( 8, (int)rs.node_count() );
+    BOOST_CHECK_EQUAL ( 5, (int)rs.string_count() );
+    BOOST_CHECK_EQUAL ( 10, rs.max_factor_length );
+    for (auto it = vocab.begin(); it != vocab.end(); ++it) {
+        BOOST_CHECK ( rs.includes(it->first) );
+        BOOST_CHECK_EQUAL ( it->second, rs.get_score(it->first) );
+    }
+    BOOST_CHECK ( !rs.includes("") );
+    BOOST_CHECK ( !rs.includes("_") );
+    BOOST_CHECK ( !rs.includes("_th") );
+    BOOST_CHECK ( !rs.includes("_the_fi") );
+    BOOST_CHECK ( !rs.includes("_the_firsts") );
+    BOOST_CHECK ( !rs.includes("_the_fixst") );
+    BOOST_CHECK_EQUAL ( 0, rs.factor_index("_a") );
+    BOOST_CHECK_EQUAL ( 3, rs.factor_index("_the_first") );
+
+    // Stepping over the edges
+    string text("_the_first");
+    int node = rs.find_edge(text, 0, RadixStringSet::root_node);
+    BOOST_CHECK_EQUAL ( 1, (int)rs.label_length(node) );
+    node = rs.find_edge(text, 1, node);
+    BOOST_CHECK_EQUAL ( 3, (int)rs.label_length(node) );
+    BOOST_CHECK_EQUAL ( 1, rs.factor_id(node) );
+    BOOST_CHECK_EQUAL ( -1, rs.find_edge(string("_thx"), 1, 1) );
+
+    rs.disable(3);
+    BOOST_CHECK ( !rs.includes("_the_first") );
+    BOOST_CHECK_EQUAL ( 4, (int)rs.string_count() );
+    rs.add("_the_first", -6.0);
+    BOOST_CHECK_EQUAL ( -6.0, rs.get_score("_the_first") );
+    BOOST_CHECK_EQUAL ( 5, (int)rs.string_count() );
+
+    bool throws = false;
+    try {
+        rs.add("_the_fi", -1.0);
+    }
+    catch (string &e) {
+        throws = true;
+    }
+    BOOST_CHECK ( throws );
+
+    vector<flt_type> costs(rs.factor_count(), MIN_FLOAT);
+    costs[4] = -7.0;
+    rs.assign_scores(costs);
+    map<string, flt_type> result;
+    rs.get_vocab(result);
+    BOOST_CHECK_EQUAL ( 1, (int)result.size() );
+    BOOST_CHECK_EQUAL ( -7.0, result["x"] );
+}
@@ -50,9 +50,51 @@ GZipFileInput::getline(string &line)
     }
     return false;
 }
+
+bool
+GZipFileInput::getline(string &line, unsigned int max_length, bool &line_end)
+{
+    line_end = false;
+    buffer.assign(max_length+1, '\0');
+    char *res = gzgets(gzf, &buffer[0], max_length+1);
+    if (res == NULL) {
+        line.clear();
+        return false;
+    }
+    line.assign(buffer.c_str());
+    if (line.length() > 0 && line[line.length()-1] == '\n') {
+        line.resize(line.length()-1);
+        line_end = true;
+    }
+    else if (gzeof(gzf)) line_end = true;
+    if (line_end && line.length() > 0 && line[line.length()-1] == '\r')
+        line.resize(line.length()-1);
+    return true;
+}
 #endif
 
 
+bool
+IFStreamInput::getline(string &line, unsigned int max_length, bool &line_end)
+{
+    line.clear();
+    line_end = false;
+    if (ifstr.peek() == EOF) return false;
+    buffer.assign(max_length+1, '\0');
+    ifstr.get(&buffer[0], max_length+1, '\n');
+    line.assign(buffer, 0, ifstr.gcount());
+    // No characters read before the newline sets the fail bit
+    if (ifstr.fail() && !ifstr.eof()) ifstr.clear();
+    int next = ifstr.peek();
+    if (next == '\n') {
+        ifstr.ignore();
+        line_end = true;
+    }
+    else if (next == EOF) line_end = true;
+    return true;
+}
+
+
 SimpleFileOutput::SimpleFileOutput(string filename)
 {
     if (ends_with(filename, ".gz"))
@@ -15,6 +15,8 @@ class FileInputType
 {
 public:
     virtual bool getline(std::string &line) = 0;
+    // Reads at most max_length bytes of the line, line_end is set if the rest of the line was read
+    virtual bool getline(std::string &line, unsigned int max_length, bool &line_end) = 0;
     virtual ~FileInputType() { };
 };
 
@@ -24,8 +26,10 @@ public:
     IFStreamInput(std::string filename) { ifstr.open(filename.c_str(), std::ios_base::in); };
     ~IFStreamInput() { ifstr.close(); }
     bool getline(std::string &line) { return (bool)std::getline(ifstr, line); }
+    bool getline(std::string &line, unsigned int max_length, bool &line_end);
 private:
     std::ifstream ifstr;
+    std::string buffer;
 };
 
 #ifndef NO_ZLIB
@@ -35,8 +39,10 @@ public:
     GZipFileInput(std::string filename);
     ~GZipFileInput();
     bool getline(std::string &line);
+    bool getline(std::string &line, unsigned int max_length, bool &line_end);
 private:
     gzFile gzf;
+    std::string buffer;
 };
 #endif
 
@@ -46,6 +52,8 @@ public:
     SimpleFileInput(std::string filename);
     ~SimpleFileInput();
     bool getline(std::string &line) { return infs->getline(line); }
+    bool getline(std::string &line, unsigned int max_length, bool &line_end)
+    { return infs->getline(line, max_length, line_end); }
 private:
     bool ends_with(std::string const &filename,
                    std::string const &suffix)